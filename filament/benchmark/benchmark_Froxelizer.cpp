@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "details/Allocators.h"
+#include "details/Camera.h"
+#include "details/Engine.h"
+#include "details/Froxelizer.h"
+#include "details/Scene.h"
+
+#include <filament/LightManager.h>
+#include <filament/Viewport.h>
+
+#include <utils/Allocator.h>
+#include <utils/Entity.h>
+#include <utils/EntityManager.h>
+
+#include <math/mat4.h>
+#include <math/vec4.h>
+
+#include <random>
+
+using namespace filament;
+using namespace filament::details;
+using namespace filament::math;
+using namespace utils;
+
+enum LightTypes {
+    POINT_LIGHTS,
+    SPOT_LIGHTS,
+    MIXED_LIGHTS
+};
+
+/*
+ * Generates point lights, spot lights, or half of each in front of the camera, the first entry is
+ * the directional light, which the froxelizer skips.
+ */
+static void generateLights(FScene::LightSoa& lights, size_t count, LightTypes types,
+        LightManager::Instance point, LightManager::Instance spot) {
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> rand(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> depth(1.0f, 100.0f);
+    std::uniform_real_distribution<float> radius(0.5f, 5.0f);
+
+    lights.push_back({}, {}, {}, {}, {}, {});
+    for (size_t i = 0; i < count; i++) {
+        const float z = depth(gen);
+        const float4 sphere = { rand(gen) * z, rand(gen) * z, -z, radius(gen) };
+        const float3 direction = normalize(float3{ rand(gen), rand(gen), rand(gen) } + 0.01f);
+        const bool isSpot = types == SPOT_LIGHTS || (types == MIXED_LIGHTS && (i & 1u));
+        lights.push_back(sphere, direction, isSpot ? spot : point, 1, {}, {});
+    }
+}
+
+static void BM_froxelizeLights(benchmark::State& state) {
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FEngine::DriverApi& driver = engine->getDriverApi();
+
+    Entity entities[2];
+    engine->getEntityManager().create(2, entities);
+    LightManager::Builder(LightManager::Type::POINT).build(*engine, entities[0]);
+    LightManager::Builder(LightManager::Type::SPOT)
+            .spotLightCone(0.5f, 0.7f)
+            .build(*engine, entities[1]);
+    LightManager& lcm = engine->getLightManager();
+
+    const size_t count = size_t(state.range(0));
+    FScene::LightSoa lights;
+    generateLights(lights, count, LightTypes(state.range(1)),
+            lcm.getInstance(entities[0]), lcm.getInstance(entities[1]));
+
+    // landscape, ultrawide and portrait viewports
+    const Viewport viewports[] = {
+            { 0, 0, 1920, 1080 },
+            { 0, 0, 3440, 1440 },
+            { 0, 0, 1080, 2340 },
+    };
+    const Viewport viewport = viewports[state.range(2)];
+    CameraInfo camera = {};
+    camera.projection = mat4f::perspective(60.0f,
+            float(viewport.width) / viewport.height, 0.1f, 100.0f);
+    camera.zn = 0.1f;
+    camera.zf = 100.0f;
+
+    LinearAllocatorArena arena("benchmark", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+    Froxelizer froxelizer(*engine);
+    froxelizer.setOptions(5.0f, 100.0f);
+    froxelizer.setLightCount(count);
+    size_t shadedFroxelCount = 0;
+    size_t froxelLightCount = 0;
+    {
+        PerformanceCounters pc(state);
+        size_t frame = 0;
+        for (auto _ : state) {
+            // nudge the camera, otherwise the froxelizer skips the unchanged froxelizations
+            camera.view[3].x = (frame++ & 1u) ? 1e-4f : 0.0f;
+            filament::details::ArenaScope scope(arena);
+            froxelizer.prepare(driver, scope, viewport, camera.projection, camera.zn, camera.zf);
+            froxelizer.froxelizeLights(*engine, camera, lights);
+
+            // send the froxels and records to the (no-op) driver outside of the measurements
+            state.PauseTiming();
+            // the lights of each shaded froxel drive the fragment shading cost
+            for (auto const& entry : froxelizer.getFroxelBufferUser()) {
+                const size_t lightCount = entry.pointLightCount + entry.spotLightCount;
+                shadedFroxelCount += lightCount ? 1 : 0;
+                froxelLightCount += lightCount;
+            }
+            froxelizer.commit(driver);
+            engine->flush();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+    state.counters["lights/froxel"] =
+            shadedFroxelCount ? double(froxelLightCount) / shadedFroxelCount : 0.0;
+
+    froxelizer.terminate(driver);
+    lcm.destroy(entities[0]);
+    lcm.destroy(entities[1]);
+    engine->getEntityManager().destroy(2, entities);
+    engine->shutdown();
+    delete engine;
+}
+
+static void lightArguments(benchmark::internal::Benchmark* b) {
+    for (int viewport : { 0, 1, 2 }) {
+        for (int types : { POINT_LIGHTS, SPOT_LIGHTS, MIXED_LIGHTS }) {
+            for (int count : { 256, 1024, 4096 }) {
+                b->Args({ count, types, viewport });
+            }
+        }
+    }
+}
+
+BENCHMARK(BM_froxelizeLights)
+        ->ArgNames({ "lights", "types", "viewport" })
+        ->Apply(lightArguments);
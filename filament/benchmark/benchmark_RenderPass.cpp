@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "RenderPass.h"
+
+#include <utils/JobSystem.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <string.h>
+
+using namespace filament;
+using namespace filament::details;
+using namespace utils;
+
+using Command = RenderPass::Command;
+using CommandArena = RenderPass::CommandArena;
+
+/*
+ * Generates commands similar to what a DEPTH_AND_COLOR pass produces: a third of depth commands,
+ * a third of color commands (keyed by material) and a third of SENTINEL commands.
+ */
+static std::vector<Command> generateCommands(size_t count) {
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> distance(-100.0f, 100.0f);
+    std::uniform_int_distribution<uint32_t> material(0, 1023);
+    std::uniform_int_distribution<uint32_t> priority(0, 7);
+
+    std::vector<Command> commands(count);
+    for (size_t i = 0; i < count; i++) {
+        Command& cmd = commands[i];
+        switch (i % 3) {
+            case 0: {
+                float d = distance(gen);
+                cmd.key = uint64_t(RenderPass::Pass::DEPTH);
+                cmd.key |= RenderPass::makeField(priority(gen),
+                        RenderPass::PRIORITY_MASK, RenderPass::PRIORITY_SHIFT);
+                cmd.key |= RenderPass::makeField(reinterpret_cast<uint32_t&>(d),
+                        RenderPass::DISTANCE_BITS_MASK, RenderPass::DISTANCE_BITS_SHIFT);
+                break;
+            }
+            case 1:
+                cmd.key = uint64_t(RenderPass::Pass::COLOR);
+                cmd.key |= RenderPass::makeField(priority(gen),
+                        RenderPass::PRIORITY_MASK, RenderPass::PRIORITY_SHIFT);
+                cmd.key |= RenderPass::makeMaterialSortingKey(material(gen) >> 4, material(gen));
+                break;
+            case 2:
+                cmd.key = uint64_t(RenderPass::Pass::SENTINEL);
+                break;
+        }
+    }
+    // the "eof" command
+    commands.back().key = uint64_t(RenderPass::Pass::SENTINEL);
+    return commands;
+}
+
+static void BM_sortCommands_std(benchmark::State& state) {
+    const size_t count = size_t(state.range(0));
+    std::vector<Command> const commands = generateCommands(count);
+    CommandArena arena(count);
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            state.PauseTiming();
+            arena.clear();
+            memcpy(arena.grow(count), commands.data(), count * sizeof(Command));
+            state.ResumeTiming();
+            std::sort(arena.begin(), arena.end());
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+}
+
+static void BM_sortCommands_radix(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    const size_t count = size_t(state.range(0));
+    std::vector<Command> const commands = generateCommands(count);
+    CommandArena arena(count);
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            state.PauseTiming();
+            arena.clear();
+            memcpy(arena.grow(count), commands.data(), count * sizeof(Command));
+            state.ResumeTiming();
+            RenderPass::radixSortCommands(js, arena);
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+
+    js.emancipate();
+}
+
+BENCHMARK(BM_sortCommands_std)->RangeMultiplier(8)->Range(1024, 1024 * 1024);
+BENCHMARK(BM_sortCommands_radix)->RangeMultiplier(8)->Range(1024, 1024 * 1024);
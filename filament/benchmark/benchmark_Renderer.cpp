@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include <filament/Camera.h>
+#include <filament/Engine.h>
+#include <filament/LightManager.h>
+#include <filament/RenderableManager.h>
+#include <filament/Renderer.h>
+#include <filament/Scene.h>
+#include <filament/TransformManager.h>
+#include <filament/View.h>
+#include <filament/Viewport.h>
+
+#include <utils/Entity.h>
+#include <utils/EntityManager.h>
+
+#include <math/mat4.h>
+#include <math/vec3.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace filament;
+using namespace filament::math;
+using namespace utils;
+
+/*
+ * CPU time of whole frames on the Noop backend: scene preparation, culling, lighting,
+ * froxelization and command generation, with all the renderables moving every frame.
+ */
+static void BM_renderFrame(benchmark::State& state) {
+    Engine* engine = Engine::create(Engine::Backend::NOOP);
+    SwapChain* swapChain = engine->createSwapChain(nullptr);
+    Renderer* renderer = engine->createRenderer();
+    Scene* scene = engine->createScene();
+    Camera* camera = engine->createCamera();
+    View* view = engine->createView();
+    view->setScene(scene);
+    view->setCamera(camera);
+    view->setViewport({ 0, 0, 1920, 1080 });
+    camera->setProjection(45.0, 1920.0 / 1080.0, 0.1, 100.0);
+
+    EntityManager& em = EntityManager::get();
+    TransformManager& tcm = engine->getTransformManager();
+
+    // renderables in front of the camera
+    const size_t renderableCount = size_t(state.range(0));
+    std::vector<Entity> renderables(renderableCount);
+    em.create(renderableCount, renderables.data());
+    RenderableManager::Builder(0)
+            .boundingBox({{ 0, 0, 0 }, { 0.5f, 0.5f, 0.5f }})
+            .castShadows(true)
+            .receiveShadows(true)
+            .build(*engine, renderables.data(), renderableCount);
+
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> rand(-50.0f, 50.0f);
+    std::vector<TransformManager::Instance> instances(renderableCount);
+    std::vector<float3> positions(renderableCount);
+    std::vector<mat4f> transforms(renderableCount);
+    for (size_t i = 0; i < renderableCount; i++) {
+        instances[i] = tcm.getInstance(renderables[i]);
+        positions[i] = { rand(gen), rand(gen), -std::abs(rand(gen)) - 1.0f };
+        scene->addEntity(renderables[i]);
+    }
+
+    // point lights among them
+    const size_t lightCount = size_t(state.range(1));
+    std::vector<Entity> lights(lightCount);
+    em.create(lightCount, lights.data());
+    for (size_t i = 0; i < lightCount; i++) {
+        LightManager::Builder(LightManager::Type::POINT)
+                .position({ rand(gen), rand(gen), -std::abs(rand(gen)) - 1.0f })
+                .falloff(5.0f)
+                .intensity(1000.0f)
+                .build(*engine, lights[i]);
+        scene->addEntity(lights[i]);
+    }
+
+    {
+        PerformanceCounters pc(state);
+        float t = 0;
+        for (auto _ : state) {
+            for (size_t i = 0; i < renderableCount; i++) {
+                transforms[i] = mat4f::translate(positions[i] + float3{ 0, std::sin(t), 0 });
+            }
+            tcm.setTransforms(instances.data(), transforms.data(), renderableCount);
+            if (renderer->beginFrame(swapChain)) {
+                renderer->render(view);
+                renderer->endFrame();
+            }
+            t += 0.01f;
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+
+    for (Entity e : lights) {
+        engine->destroy(e);
+    }
+    for (Entity e : renderables) {
+        engine->destroy(e);
+    }
+    em.destroy(lightCount, lights.data());
+    em.destroy(renderableCount, renderables.data());
+    engine->destroy(view);
+    engine->destroy(camera);
+    engine->destroy(scene);
+    engine->destroy(renderer);
+    engine->destroy(swapChain);
+    Engine::destroy(&engine);
+}
+
+BENCHMARK(BM_renderFrame)
+        ->ArgNames({ "renderables", "lights" })
+        ->Args({ 1000, 16 })->Args({ 10000, 16 })->Args({ 10000, 256 })
+        ->Unit(benchmark::kMicrosecond);
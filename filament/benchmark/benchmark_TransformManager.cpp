@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "details/Engine.h"
+#include "components/TransformManager.h"
+
+#include <utils/Entity.h>
+#include <utils/EntityManager.h>
+
+#include <math/mat4.h>
+#include <math/vec3.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace filament;
+using namespace filament::details;
+using namespace filament::math;
+using namespace utils;
+
+enum HierarchyShape {
+    WIDE,       // one root, all other nodes are its children
+    DEEP,       // 16 chains
+    BALANCED    // each node has 4 children
+};
+
+static void createHierarchy(FTransformManager& tcm, std::vector<Entity> const& entities,
+        HierarchyShape shape) {
+    constexpr size_t DEEP_CHAIN_COUNT = 16;
+    constexpr size_t BALANCED_CHILD_COUNT = 4;
+    for (size_t i = 0, count = entities.size(); i < count; i++) {
+        TransformManager::Instance parent;
+        if (i) {
+            switch (shape) {
+                case WIDE:
+                    parent = tcm.getInstance(entities[0]);
+                    break;
+                case DEEP:
+                    if (i >= DEEP_CHAIN_COUNT) {
+                        parent = tcm.getInstance(entities[i - DEEP_CHAIN_COUNT]);
+                    }
+                    break;
+                case BALANCED:
+                    parent = tcm.getInstance(entities[(i - 1) / BALANCED_CHILD_COUNT]);
+                    break;
+            }
+        }
+        tcm.create(entities[i], parent, {});
+    }
+}
+
+/*
+ * Animates every node of a hierarchy in a local transform transaction, which is how large
+ * hierarchies are expected to be updated every frame.
+ */
+static void BM_commitLocalTransforms(benchmark::State& state) {
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FTransformManager& tcm = engine->getTransformManager();
+    EntityManager& em = engine->getEntityManager();
+
+    const size_t count = size_t(state.range(0));
+    std::vector<Entity> entities(count);
+    em.create(count, entities.data());
+    createHierarchy(tcm, entities, HierarchyShape(state.range(1)));
+
+    {
+        PerformanceCounters pc(state);
+        float t = 0;
+        for (auto _ : state) {
+            tcm.openLocalTransformTransaction();
+            const mat4f transform = mat4f::translate(float3{ t, 0, 0 });
+            for (Entity e : entities) {
+                tcm.setTransform(tcm.getInstance(e), transform);
+            }
+            tcm.commitLocalTransformTransaction();
+            t += 1.0f;
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+
+    for (Entity e : entities) {
+        tcm.destroy(e);
+    }
+    em.destroy(count, entities.data());
+    engine->shutdown();
+    delete engine;
+}
+
+/*
+ * Same as above, with a single setTransforms() call per frame.
+ */
+static void BM_setTransforms(benchmark::State& state) {
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FTransformManager& tcm = engine->getTransformManager();
+    EntityManager& em = engine->getEntityManager();
+
+    const size_t count = size_t(state.range(0));
+    std::vector<Entity> entities(count);
+    em.create(count, entities.data());
+    createHierarchy(tcm, entities, HierarchyShape(state.range(1)));
+
+    std::vector<TransformManager::Instance> instances(count);
+    for (size_t i = 0; i < count; i++) {
+        instances[i] = tcm.getInstance(entities[i]);
+    }
+    std::vector<mat4f> transforms(count);
+
+    {
+        PerformanceCounters pc(state);
+        float t = 0;
+        for (auto _ : state) {
+            std::fill(transforms.begin(), transforms.end(), mat4f::translate(float3{ t, 0, 0 }));
+            tcm.setTransforms(instances.data(), transforms.data(), count);
+            t += 1.0f;
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+
+    for (Entity e : entities) {
+        tcm.destroy(e);
+    }
+    em.destroy(count, entities.data());
+    engine->shutdown();
+    delete engine;
+}
+
+BENCHMARK(BM_commitLocalTransforms)
+        ->ArgNames({ "nodes", "shape" })
+        ->Args({ 10000, WIDE })->Args({ 100000, WIDE })
+        ->Args({ 10000, DEEP })->Args({ 100000, DEEP })
+        ->Args({ 10000, BALANCED })->Args({ 100000, BALANCED });
+
+BENCHMARK(BM_setTransforms)
+        ->ArgNames({ "nodes", "shape" })
+        ->Args({ 10000, WIDE })->Args({ 100000, WIDE })
+        ->Args({ 10000, DEEP })->Args({ 100000, DEEP })
+        ->Args({ 10000, BALANCED })->Args({ 100000, BALANCED });
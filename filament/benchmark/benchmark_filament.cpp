@@ -22,8 +22,11 @@
 #include <filament/Box.h>
 #include <filament/Frustum.h>
 #include "details/Culler.h"
+#include "details/CullingBvh.h"
+#include "details/OcclusionCuller.h"
 
 #include <utils/Allocator.h>
+#include <utils/JobSystem.h>
 
 #include <vector>
 #include <random>
@@ -81,11 +84,17 @@ public:
     }
 };
 
-BENCHMARK_F(FilamentFixture, boxCulling)(benchmark::State& state) {
+BENCHMARK_DEFINE_F(FilamentFixture, boxCulling)(benchmark::State& state) {
+    const Culler::Isa isa = Culler::Isa(state.range(0));
+    if (!Culler::Test::isSupported(isa)) {
+        state.SkipWithError("instruction set not supported");
+        return;
+    }
+    state.SetLabel(Culler::Test::getName(isa));
     {
         PerformanceCounters pc(state);
         for (auto _ : state) {
-            Culler::Test::intersects(visibles, frustum, boxesCenter.data(), boxesExtent.data(), BATCH_SIZE);
+            Culler::Test::intersects(isa, visibles, frustum, boxesCenter.data(), boxesExtent.data(), BATCH_SIZE);
         }
         benchmark::ClobberMemory();
         pc.stop();
@@ -93,14 +102,193 @@ BENCHMARK_F(FilamentFixture, boxCulling)(benchmark::State& state) {
     }
 }
 
-BENCHMARK_F(FilamentFixture, sphereCulling)(benchmark::State& state) {
+BENCHMARK_DEFINE_F(FilamentFixture, sphereCulling)(benchmark::State& state) {
+    const Culler::Isa isa = Culler::Isa(state.range(0));
+    if (!Culler::Test::isSupported(isa)) {
+        state.SkipWithError("instruction set not supported");
+        return;
+    }
+    state.SetLabel(Culler::Test::getName(isa));
     {
         PerformanceCounters pc(state);
         for (auto _ : state) {
-            Culler::Test::intersects(visibles, frustum, spheres.data(), BATCH_SIZE);
+            Culler::Test::intersects(isa, visibles, frustum, spheres.data(), BATCH_SIZE);
         }
         benchmark::ClobberMemory();
         pc.stop();
         state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
     }
 }
+
+// one run per instruction set, see Culler::Isa
+BENCHMARK_REGISTER_F(FilamentFixture, boxCulling)->DenseRange(
+        int(Culler::Isa::GENERIC), int(Culler::Isa::AVX512));
+BENCHMARK_REGISTER_F(FilamentFixture, sphereCulling)->DenseRange(
+        int(Culler::Isa::GENERIC), int(Culler::Isa::AVX512));
+
+/*
+ * Large world: boxes scattered in a 2km cube, a small fraction of them in the frustum.
+ */
+struct World {
+    Frustum frustum;
+    std::vector<float3> centers;
+    std::vector<float3> extents;
+    std::vector<Culler::result_type> visibles;
+
+    explicit World(size_t count)
+            : frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f)),
+              centers(Culler::round(count)),
+              extents(Culler::round(count)),
+              visibles(Culler::round(count)) {
+        std::default_random_engine gen; // NOLINT
+        std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+        std::uniform_real_distribution<float> size(0.5f, 5.0f);
+        for (size_t i = 0; i < count; i++) {
+            centers[i] = { position(gen), position(gen), position(gen) };
+            extents[i] = { size(gen), size(gen), size(gen) };
+        }
+    }
+};
+
+static void BM_cullLinear(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    const size_t count = size_t(state.range(0));
+    World world(count);
+    Culler::result_type* const visibles = world.visibles.data();
+    float3 const* const centers = world.centers.data();
+    float3 const* const extents = world.extents.data();
+    Frustum const& frustum = world.frustum;
+    auto functor = [=, &frustum](uint32_t index, uint32_t c) {
+        Culler::Test::intersects(visibles + index, frustum, centers + index, extents + index, c);
+    };
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(count), std::ref(functor),
+                    jobs::CountSplitter<Culler::MODULO * Culler::MIN_LOOP_COUNT_HINT, 8>());
+            js.runAndWait(job);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+
+    js.emancipate();
+}
+
+static void BM_cullBvh(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    const size_t count = size_t(state.range(0));
+    World world(count);
+    CullingBvh bvh;
+    bvh.build(world.centers.data(), world.extents.data(), count);
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            bvh.intersects(js, world.visibles.data(), world.frustum,
+                    world.centers.data(), world.extents.data(), 0);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+
+    js.emancipate();
+}
+
+static void BM_cullBvhUpdate(benchmark::State& state) {
+    const size_t count = size_t(state.range(0));
+    World world(count);
+    CullingBvh bvh;
+    bvh.build(world.centers.data(), world.extents.data(), count);
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<size_t> index(0, count - 1);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            // move 1% of the boxes every frame
+            for (size_t i = 0; i < count / 100; i++) {
+                world.centers[index(gen)] += float3{ offset(gen), offset(gen), offset(gen) };
+            }
+            bvh.update(world.centers.data(), world.extents.data(), count);
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+}
+
+BENCHMARK(BM_cullLinear)->Arg(100000)->Arg(1000000);
+BENCHMARK(BM_cullBvh)->Arg(100000)->Arg(1000000);
+BENCHMARK(BM_cullBvhUpdate)->Arg(100000)->Arg(1000000);
+
+/*
+ * Indoor scene: walls in front of the camera and boxes behind and between them.
+ */
+static void addWalls(OcclusionCuller& culler, size_t count) {
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-40.0f, 40.0f);
+    std::uniform_real_distribution<float> depth(-80.0f, -5.0f);
+    std::uniform_real_distribution<float> size(1.0f, 8.0f);
+    culler.begin(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f));
+    for (size_t i = 0; i < count; i++) {
+        culler.addOccluder(mat4f{}, Box{
+                { position(gen), position(gen), depth(gen) },
+                { size(gen), size(gen), 0.2f } });
+    }
+}
+
+static void BM_occlusionRasterize(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    OcclusionCuller culler;
+    addWalls(culler, size_t(state.range(0)));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            culler.rasterize(js);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * state.range(0));
+
+    js.emancipate();
+}
+
+static void BM_occlusionCull(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    OcclusionCuller culler;
+    addWalls(culler, 256);
+    culler.rasterize(js);
+
+    const size_t count = size_t(state.range(0));
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-40.0f, 40.0f);
+    std::uniform_real_distribution<float> depth(-100.0f, -1.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    std::vector<float3> centers(count);
+    std::vector<float3> extents(count);
+    std::vector<Culler::result_type> visibles(count);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), depth(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+    }
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            std::fill(visibles.begin(), visibles.end(), Culler::result_type(0x3));
+            culler.cull(js, visibles.data(), centers.data(), extents.data(), count, 0, 1);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * count);
+
+    js.emancipate();
+}
+
+BENCHMARK(BM_occlusionRasterize)->Arg(64)->Arg(512);
+BENCHMARK(BM_occlusionCull)->Arg(10000)->Arg(100000);
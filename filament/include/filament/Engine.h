@@ -26,6 +26,10 @@
 #include <utils/compiler.h>
 #include <utils/EntityManager.h>
 
+namespace utils {
+class JobSystem;
+} // namespace utils
+
 namespace filament {
 
 class Camera;
@@ -166,6 +170,21 @@ public:
      *                          Setting this parameter will force filament to use the OpenGL
      *                          implementation (instead of Vulkan for instance).
      *
+     *  @param jobSystem        A JobSystem to run filament's jobs on, instead of the one the
+     *                          Engine creates by default. This lets several Engines -- e.g. in
+     *                          a server rendering many streams -- share a single thread pool
+     *                          rather than each starting one thread per core. The threads
+     *                          busy with one Engine's jobs regularly take the other Engines'
+     *                          queued jobs first, so that an Engine with a lot of work can't
+     *                          starve the others, but there is no stricter fairness.
+     *
+     *                          It must have at least one adoptable thread per thread creating
+     *                          Engines (see utils::JobSystem::Config::adoptableThreadsCount);
+     *                          Engines created on the same thread share its slot.
+     *
+     *                          The lifetime of \p jobSystem must exceed the lifetime of
+     *                          the Engine object.
+     *
      *
      * @return A pointer to the newly created Engine, or nullptr if the Engine couldn't be created.
      *
@@ -180,7 +199,8 @@ public:
      * This method is thread-safe.
      */
     static Engine* create(Backend backend = Backend::DEFAULT,
-            Platform* platform = nullptr, void* sharedGLContext = nullptr);
+            Platform* platform = nullptr, void* sharedGLContext = nullptr,
+            utils::JobSystem* jobSystem = nullptr);
 
     /**
      * Destroy the Engine instance and all associated resources.
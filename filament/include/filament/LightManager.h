@@ -98,6 +98,8 @@ class FLightManager;
  *
  * A scene can have multiple point lights.
  *
+ * Point lights are able to cast shadows, using one shadow map per face of a cube.
+ *
  * @see Builder.position(), Builder.falloff()
  *
  * Spot lights
@@ -110,6 +112,8 @@ class FLightManager;
  * spot light's influence is limited to inside the outer cone. The inner cone defines the light's
  * falloff attenuation.
  *
+ * Spot lights are able to cast shadows, which are cheaper than the shadows of point lights.
+ *
  * A physically correct spot light is a little difficult to use because changing the outer angle
  * of the cone changes the illumination levels, as the same amount of light is spread over a
  * changing volume. The coupling of illumination and the outer cone means that an artist cannot
@@ -176,7 +180,10 @@ public:
      * Control the quality / performance of the shadow map associated to this light
      */
     struct ShadowOptions {
-        /** size of the shadow map in texels. Must be a power-of-two. */
+        /** size of the shadow map in texels. Must be a power-of-two. For point and spot
+         * lights, this is the maximum size, the actual size depends on the size of the light on
+         * screen.
+         */
         uint32_t mapSize = 1024;
 
         /** constant bias in world units (e.g. meters) by which shadow are moved away from the
@@ -210,6 +217,26 @@ public:
          * use the camera far distance.
          */
         float shadowFarHint = 100.0f;
+
+        /** Number of shadow cascades of a directional light, between 1 and 4. Each cascade
+         * covers a range of distances from the camera (between the camera near plane and
+         * shadowFar) with its own mapSize x mapSize shadow map, so that the closest shadows get
+         * the most resolution.
+         */
+        uint8_t shadowCascades = 1;
+
+        /** How the distance covered by the shadow cascades is split, between 0 and 1: 0 splits
+         * it uniformly, 1 logarithmically, and values in between blend both.
+         * Ignored when cascadeSplitPositions is set.
+         */
+        float cascadeSplitLambda = 0.5f;
+
+        /** Positions of the splits between cascades, as fractions of the distance covered by
+         * the cascades, e.g. { 0.1f, 0.3f, 0.6f } for 4 cascades. The first
+         * (shadowCascades - 1) values must be increasing and between 0 and 1, exclusive,
+         * otherwise cascadeSplitLambda is used instead.
+         */
+        float cascadeSplitPositions[3] = { 0.0f, 0.0f, 0.0f };
     };
 
     //! Use Builder to construct a Light object instance
@@ -236,7 +263,9 @@ public:
          * @return This Builder, for chaining calls.
          *
          * @warning
-         * - Only a Type.DIRECTIONAL or Type.SUN light can cast shadows
+         * - Point and spot lights share a shadow atlas of a fixed size: when the visible
+         *   shadow-casting lights don't fit, the least important ones (the smallest on screen)
+         *   don't cast shadows. Their shadow maps may also be updated over several frames.
          */
         Builder& castShadows(bool enable) noexcept;
 
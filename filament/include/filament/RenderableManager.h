@@ -82,6 +82,14 @@ public:
         Builder& culling(bool enable) noexcept; // true by default
         Builder& castShadows(bool enable) noexcept; // false by default
         Builder& receiveShadows(bool enable) noexcept; // true by default
+        // A static shadow caster is rendered once in a cached shadow map, which is reused as long
+        // as the light, the casters and the shadow camera don't change. Only meaningful for
+        // shadow casters that seldom move. False by default.
+        Builder& staticShadowCaster(bool enable) noexcept;
+        // A box entirely enclosed by the Renderable's geometry, in the same space as boundingBox().
+        // When set, the Renderable hides what's behind it if the View has occlusion culling
+        // enabled. Empty by default (i.e. the Renderable is not an occluder).
+        Builder& occluder(const Box& occluderBox) noexcept;
         Builder& skinning(size_t boneCount) noexcept; // 0 by default, 255 max
         Builder& skinning(size_t boneCount, Bone const* bones) noexcept;
         Builder& skinning(size_t boneCount, filament::math::mat4f const* transforms) noexcept;
@@ -89,6 +97,16 @@ public:
         // Sets an ordering index for blended primitives that all live at the same Z value.
         Builder& blendOrder(size_t index, uint16_t order) noexcept; // 0 by default
 
+        // Makes the primitives [first, first + count) the level of detail 'level', 0 being the
+        // most detailed. Levels must be consecutive ranges covering all the primitives, there
+        // can be up to 4 of them. By default a Renderable has a single level.
+        // Each level is drawn while the Renderable's screen size, the projected diameter of its
+        // bounding box's bounding sphere divided by the viewport height, is at least
+        // 'minScreenSize', which must be decreasing with the levels. The last level is drawn
+        // below all the thresholds, its own is ignored.
+        Builder& levelOfDetail(uint8_t level, size_t first, size_t count,
+                float minScreenSize) noexcept;
+
         /**
          * Adds the Renderable component to an entity.
          *
@@ -109,6 +127,21 @@ public:
          */
         Result build(Engine& engine, utils::Entity entity);
 
+        /**
+         * Adds identical Renderable components to several entities. This is equivalent to
+         * calling build(Engine&, utils::Entity) for each of them, but the builder is only
+         * validated once, which is faster when spawning many renderables.
+         *
+         * @param engine Reference to the filament::Engine to associate these Renderables with.
+         * @param entities Array of \p count entities to add the Renderable component to.
+         * @param count Number of entities in \p entities.
+         * @return Success if the components were created successfully, Error otherwise, in which
+         *         case none of them is created.
+         *
+         * @see build(Engine&, utils::Entity)
+         */
+        Result build(Engine& engine, utils::Entity const* entities, size_t count);
+
     private:
         friend class details::FEngine;
         friend class details::FRenderPrimitive;
@@ -129,13 +162,19 @@ public:
     // destroys this component from the given entity
     void destroy(utils::Entity e) noexcept;
 
+    // destroys this component from the given entities
+    void destroy(utils::Entity const* entities, size_t count) noexcept;
+
     void setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept;
     void setLayerMask(Instance instance, uint8_t select, uint8_t values) noexcept;
     void setPriority(Instance instance, uint8_t priority) noexcept;
     void setCastShadows(Instance instance, bool enable) noexcept;
     void setReceiveShadows(Instance instance, bool enable) noexcept;
+    void setStaticShadowCaster(Instance instance, bool enable) noexcept;
+    void setOccluder(Instance instance, const Box& occluderBox) noexcept;
     bool isShadowCaster(Instance instance) const noexcept;
     bool isShadowReceiver(Instance instance) const noexcept;
+    bool isStaticShadowCaster(Instance instance) const noexcept;
 
     // Updates the bone transforms in the range [offset, offset + boneCount).
     // The bones must be pre-allocated using Builder::skinning().
@@ -143,10 +182,16 @@ public:
     void setBones(Instance instance, filament::math::mat4f const* transforms, size_t boneCount = 1, size_t offset = 0) noexcept;
 
 
+    // Changes the minimum screen size of a level of detail, see Builder::levelOfDetail()
+    void setLevelOfDetailScreenSize(Instance instance, uint8_t level, float minScreenSize) noexcept;
+
     // getters...
     const Box& getAxisAlignedBoundingBox(Instance instance) const noexcept;
 
-    // number of render primitives in this renderable
+    // number of levels of detail of this renderable
+    size_t getLevelOfDetailCount(Instance instance) const noexcept;
+
+    // number of render primitives in this renderable, across all levels of detail
     size_t getPrimitiveCount(Instance instance) const noexcept;
 
     // set/change the material of a given render primitive
@@ -345,6 +345,17 @@ public:
      * getUserTime()
      */
     void resetUserTime();
+
+    /**
+     * Returns the largest number of draw commands a single render pass of this Renderer needed
+     * so far. Shadow passes are included.
+     *
+     * The storage for draw commands grows automatically as needed and is never released, so this
+     * value is also a good estimate of the memory used by draw commands (32 bytes per command).
+     *
+     * @return The high watermark, in number of draw commands.
+     */
+    size_t getCommandsHighWatermark() const noexcept;
 };
 
 } // namespace filament
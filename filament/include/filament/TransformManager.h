@@ -124,6 +124,26 @@ public:
      */
     void setTransform(Instance ci, const filament::math::mat4f& localTransform) noexcept;
 
+    /**
+     * Sets the local transforms of several transform components at once.
+     * @param instances         Array of \p count instances of the transform components to set the
+     *                          local transform to.
+     * @param localTransforms   The local transforms (i.e. relative to the parents), the one of
+     *                          instances[i] is \p i * \p stride bytes after \p localTransforms.
+     * @param count             Number of local transforms to set.
+     * @param stride            Distance in bytes between two consecutive local transforms, which
+     *                          lets them be read from an array of structures. It must be a
+     *                          multiple of 4. By default the local transforms are tightly packed.
+     * @see setTransform()
+     *
+     * This is equivalent to calling setTransform() for each instance, but when many transforms are
+     * updated, all the world transforms are computed at once, in a single pass over the
+     * hierarchy. During a local transform transaction, this only sets the local transforms.
+     * Like setTransform(), this never changes the instances of the transform components.
+     */
+    void setTransforms(Instance const* instances, const filament::math::mat4f* localTransforms,
+            size_t count, size_t stride = sizeof(filament::math::mat4f)) noexcept;
+
     /**
      * Returns the local transform of a transform component.
      * @param ci The instance of the transform component to query the local transform from.
@@ -167,6 +187,10 @@ public:
      *
      * @note If the local transform transaction is not open, this is a no-op.
      *
+     * @note If the hierarchy changed since the last commit (components created or destroyed,
+     *       setParent() called), the components are reordered and the instances previously
+     *       returned by getInstance() become invalid.
+     *
      * @see openLocalTransformTransaction(), setTransform()
      */
     void commitLocalTransformTransaction() noexcept;
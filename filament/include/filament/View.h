@@ -465,6 +465,21 @@ public:
      */
     bool isFrontFaceWindingInverted() const noexcept;
 
+    /**
+     * Enables or disables occlusion culling. Disabled by default.
+     *
+     * When enabled, the occluders of visible Renderables (see RenderableManager::Builder::occluder())
+     * are rasterized on the CPU into a low-resolution depth buffer, and Renderables entirely
+     * hidden behind them are culled. This is useful for scenes with large occluders, such as
+     * the walls of buildings. Occlusion culling has no effect when frustum culling is disabled.
+     *
+     * @param enabled true enables occlusion culling, false disables it.
+     */
+    void setOcclusionCullingEnabled(bool enabled) noexcept;
+
+    //! Returns true if occlusion culling is enabled. See setOcclusionCullingEnabled() for more info.
+    bool isOcclusionCullingEnabled() const noexcept;
+
     // for debugging...
 
     //! debugging: allows to entirely disable frustum culling. (culling enabled by default).
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_AFFINETRANSFORM_H
+#define TNT_FILAMENT_AFFINETRANSFORM_H
+
+#include <filament/Box.h>
+
+#include <utils/compiler.h>
+
+#include <math/mat3.h>
+#include <math/mat4.h>
+#include <math/vec3.h>
+#include <math/vec4.h>
+
+namespace filament {
+
+/*
+ * An affine transform, stored as the upper 3x4 part of a mat4f -- the last row is implicitly
+ * { 0, 0, 0, 1 }. The columns are laid out like a mat4f's, without their w component, so that
+ * it takes 48 bytes instead of 64. This is used for the transforms that are read and copied
+ * for each renderable every frame.
+ *
+ * The operations below work on whole columns, so that they're vectorized by the compiler.
+ */
+struct AffineTransform {
+    filament::math::float3 columns[4];
+
+    // identity
+    constexpr AffineTransform() noexcept
+            : columns{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, 0 } } { }
+
+    // the last row of m is ignored, m must be an affine transform
+    explicit AffineTransform(filament::math::mat4f const& m) noexcept
+            : columns{ m[0].xyz, m[1].xyz, m[2].xyz, m[3].xyz } { }
+
+    filament::math::mat4f toMat4() const noexcept {
+        return filament::math::mat4f{
+                filament::math::float4{ columns[0], 0 },
+                filament::math::float4{ columns[1], 0 },
+                filament::math::float4{ columns[2], 0 },
+                filament::math::float4{ columns[3], 1 } };
+    }
+
+    filament::math::mat3f upperLeft() const noexcept {
+        return filament::math::mat3f{ columns[0], columns[1], columns[2] };
+    }
+
+    filament::math::float3 const& translation() const noexcept {
+        return columns[3];
+    }
+
+    filament::math::float3 transformPoint(filament::math::float3 const& p) const noexcept {
+        return columns[0] * p.x + columns[1] * p.y + columns[2] * p.z + columns[3];
+    }
+
+    filament::math::float3 transformVector(filament::math::float3 const& v) const noexcept {
+        return columns[0] * v.x + columns[1] * v.y + columns[2] * v.z;
+    }
+
+    friend AffineTransform operator*(
+            AffineTransform const& UTILS_RESTRICT lhs,
+            AffineTransform const& UTILS_RESTRICT rhs) noexcept {
+        AffineTransform r;
+        r.columns[0] = lhs.transformVector(rhs.columns[0]);
+        r.columns[1] = lhs.transformVector(rhs.columns[1]);
+        r.columns[2] = lhs.transformVector(rhs.columns[2]);
+        r.columns[3] = lhs.transformPoint(rhs.columns[3]);
+        return r;
+    }
+
+    friend bool operator==(AffineTransform const& lhs, AffineTransform const& rhs) noexcept {
+        return lhs.columns[0] == rhs.columns[0] && lhs.columns[1] == rhs.columns[1] &&
+               lhs.columns[2] == rhs.columns[2] && lhs.columns[3] == rhs.columns[3];
+    }
+
+    friend bool operator!=(AffineTransform const& lhs, AffineTransform const& rhs) noexcept {
+        return !(lhs == rhs);
+    }
+};
+
+static_assert(sizeof(AffineTransform) == 48, "AffineTransform must be 3x4 floats");
+
+// Same as rigidTransform(Box, mat4f), i.e. works for any affine transform, not just rigid ones.
+inline Box rigidTransform(Box const& UTILS_RESTRICT box,
+        AffineTransform const& UTILS_RESTRICT m) noexcept {
+    const filament::math::float3 c = box.center;
+    const filament::math::float3 e = box.halfExtent;
+    return {
+            m.transformPoint(c),
+            abs(m.columns[0]) * e.x + abs(m.columns[1]) * e.y + abs(m.columns[2]) * e.z };
+}
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_AFFINETRANSFORM_H
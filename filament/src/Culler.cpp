@@ -18,23 +18,39 @@
 
 #include <math/fast.h>
 
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_MSC_VER)
+#   define CULLER_HAS_X86_KERNELS 1
+#   include <immintrin.h>
+#else
+#   define CULLER_HAS_X86_KERNELS 0
+#endif
+
 using namespace filament::math;
 
 namespace filament {
 namespace details {
 
-void Culler::intersects(
-        result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
+using BoxKernel = void(*)(Culler::result_type* results, float4 const* planes,
+        float3 const* center, float3 const* extent, size_t count, size_t bit);
+
+using SphereKernel = void(*)(Culler::result_type* results, float4 const* planes,
+        float4 const* b, size_t count);
+
+// ------------------------------------------------------------------------------------------------
+// Generic kernels
+// ------------------------------------------------------------------------------------------------
+
+static void intersectsGeneric(
+        Culler::result_type* UTILS_RESTRICT results,
+        filament::math::float4 const* UTILS_RESTRICT planes,
         filament::math::float4 const* UTILS_RESTRICT b,
         size_t count) noexcept {
 
-    filament::math::float4 const * const UTILS_RESTRICT planes = frustum.mPlanes;
-
     // we use a vectorize width of 8 because, on ARMv8 it allow the compiler to write 8
     // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
     // ends-up being slower.
-    count = round(count); // capacity guaranteed to be multiple of 8
     #pragma clang loop vectorize_width(8)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
@@ -50,23 +66,20 @@ void Culler::intersects(
                               planes[j].w - sphere.w;
             visible &= fast::signbit(dot);
         }
-        results[i] = result_type(visible);
+        results[i] = Culler::result_type(visible);
     }
 }
 
-void Culler::intersects(
-        result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
+static void intersectsGeneric(
+        Culler::result_type* UTILS_RESTRICT results,
+        filament::math::float4 const* UTILS_RESTRICT planes,
         filament::math::float3 const* UTILS_RESTRICT center,
         filament::math::float3 const* UTILS_RESTRICT extent,
         size_t count, size_t bit) noexcept {
 
-    filament::math::float4 const * UTILS_RESTRICT const planes = frustum.mPlanes;
-
     // we use a vectorize width of 8 because, on ARMv8 it allows the compiler to write eight
     // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
     // ends-up being slower.
-    count = round(count); // capacity guaranteed to be multiple of 8
     #pragma clang loop vectorize_width(8)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
@@ -84,8 +97,390 @@ void Culler::intersects(
             visible &= fast::signbit(dot) << bit;
         }
 
-        results[i] |= result_type(visible);
+        results[i] |= Culler::result_type(visible);
+    }
+}
+
+#if CULLER_HAS_X86_KERNELS
+
+// ------------------------------------------------------------------------------------------------
+// x86 kernels
+//
+// These compute exactly the same dot products as the generic kernels, in the same order (no FMA),
+// so the results are bit-identical. A box or sphere is visible if all six dot products are
+// negative, which is read directly from the sign bits with movemask.
+// ------------------------------------------------------------------------------------------------
+
+#define CULLER_TARGET_AVX2      __attribute__((target("avx2")))
+#define CULLER_TARGET_AVX512    __attribute__((target("avx512f")))
+
+// OR the 8 low bits of 'mask' into 8 consecutive results, at position 'bit'
+static inline void orResults8(Culler::result_type* results, uint32_t mask, size_t bit) noexcept {
+    // spreads bit i to byte i (multiplying 8 bits would carry into the top byte)
+    uint64_t bytes = ((uint64_t(mask & 0x7Fu) * 0x0002040810204081ull) |
+                      (uint64_t(mask >> 7u) << 56u)) & 0x0101010101010101ull;
+    uint64_t r;
+    memcpy(&r, results, sizeof(r));
+    r |= bytes << bit;
+    memcpy(results, &r, sizeof(r));
+}
+
+// deinterleaves 4 float3 into x, y and z vectors
+static inline void load3x4(float3 const* p, __m128& x, __m128& y, __m128& z) noexcept {
+    float const* f = &p[0].x;
+    __m128 m0 = _mm_loadu_ps(f + 0);    // x0 y0 z0 x1
+    __m128 m1 = _mm_loadu_ps(f + 4);    // y1 z1 x2 y2
+    __m128 m2 = _mm_loadu_ps(f + 8);    // z2 x3 y3 z3
+    __m128 xy = _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(2, 1, 3, 2));    // x2 y2 x3 y3
+    __m128 yz = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(1, 0, 2, 1));    // y0 z0 y1 z1
+    x = _mm_shuffle_ps(m0, xy, _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    z = _mm_shuffle_ps(yz, m2, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+static void intersectsSse2(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (size_t i = 0; i < count; i += 8) {
+        uint32_t mask = 0;
+        for (size_t k = 0; k < 8; k += 4) {
+            __m128 cx, cy, cz, ex, ey, ez;
+            load3x4(center + i + k, cx, cy, cz);
+            load3x4(extent + i + k, ex, ey, ez);
+            __m128 visible = signMask;
+            for (size_t j = 0; j < 6; j++) {
+                const float4 p = planes[j];
+                __m128 dot = _mm_mul_ps(_mm_set1_ps(p.x), cx);
+                dot = _mm_sub_ps(dot, _mm_mul_ps(_mm_set1_ps(std::abs(p.x)), ex));
+                dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(p.y), cy));
+                dot = _mm_sub_ps(dot, _mm_mul_ps(_mm_set1_ps(std::abs(p.y)), ey));
+                dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(p.z), cz));
+                dot = _mm_sub_ps(dot, _mm_mul_ps(_mm_set1_ps(std::abs(p.z)), ez));
+                dot = _mm_add_ps(dot, _mm_set1_ps(p.w));
+                visible = _mm_and_ps(visible, dot);
+            }
+            mask |= uint32_t(_mm_movemask_ps(visible)) << k;
+        }
+        orResults8(results + i, mask, bit);
+    }
+}
+
+static void intersectsSse2(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (size_t i = 0; i < count; i += 8) {
+        uint32_t mask = 0;
+        for (size_t k = 0; k < 8; k += 4) {
+            __m128 x = _mm_loadu_ps(&b[i + k + 0].x);
+            __m128 y = _mm_loadu_ps(&b[i + k + 1].x);
+            __m128 z = _mm_loadu_ps(&b[i + k + 2].x);
+            __m128 w = _mm_loadu_ps(&b[i + k + 3].x);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            __m128 visible = signMask;
+            for (size_t j = 0; j < 6; j++) {
+                const float4 p = planes[j];
+                __m128 dot = _mm_mul_ps(_mm_set1_ps(p.x), x);
+                dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(p.y), y));
+                dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(p.z), z));
+                dot = _mm_add_ps(dot, _mm_set1_ps(p.w));
+                dot = _mm_sub_ps(dot, w);
+                visible = _mm_and_ps(visible, dot);
+            }
+            mask |= uint32_t(_mm_movemask_ps(visible)) << k;
+        }
+        memset(results + i, 0, 8);
+        orResults8(results + i, mask, 0);
+    }
+}
+
+// deinterleaves 8 float3 into x, y and z vectors
+CULLER_TARGET_AVX2 UTILS_ALWAYS_INLINE
+static inline void load3x8(float3 const* p, __m256& x, __m256& y, __m256& z) noexcept {
+    float const* f = &p[0].x;
+    // the low lanes hold items 0 to 3, the high lanes items 4 to 7
+    __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f +  0)), _mm_loadu_ps(f + 12), 1);
+    __m256 m14 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f +  4)), _mm_loadu_ps(f + 16), 1);
+    __m256 m25 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f +  8)), _mm_loadu_ps(f + 20), 1);
+    __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+    __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+    x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+CULLER_TARGET_AVX2 UTILS_ALWAYS_INLINE
+static inline uint32_t intersectsAvx2x8(__m256 const* UTILS_RESTRICT p,
+        float3 const* UTILS_RESTRICT center, float3 const* UTILS_RESTRICT extent) noexcept {
+    __m256 cx, cy, cz, ex, ey, ez;
+    load3x8(center, cx, cy, cz);
+    load3x8(extent, ex, ey, ez);
+    __m256 visible = _mm256_set1_ps(-0.0f);
+    for (size_t j = 0; j < 6; j++, p += 7) {
+        __m256 dot = _mm256_mul_ps(p[0], cx);
+        dot = _mm256_sub_ps(dot, _mm256_mul_ps(p[1], ex));
+        dot = _mm256_add_ps(dot, _mm256_mul_ps(p[2], cy));
+        dot = _mm256_sub_ps(dot, _mm256_mul_ps(p[3], ey));
+        dot = _mm256_add_ps(dot, _mm256_mul_ps(p[4], cz));
+        dot = _mm256_sub_ps(dot, _mm256_mul_ps(p[5], ez));
+        dot = _mm256_add_ps(dot, p[6]);
+        visible = _mm256_and_ps(visible, dot);
+    }
+    return uint32_t(_mm256_movemask_ps(visible));
+}
+
+CULLER_TARGET_AVX2 UTILS_ALWAYS_INLINE
+static inline void broadcastBoxPlanesAvx2(__m256* p, float4 const* planes) noexcept {
+    for (size_t j = 0; j < 6; j++, p += 7) {
+        p[0] = _mm256_set1_ps(planes[j].x);
+        p[1] = _mm256_set1_ps(std::abs(planes[j].x));
+        p[2] = _mm256_set1_ps(planes[j].y);
+        p[3] = _mm256_set1_ps(std::abs(planes[j].y));
+        p[4] = _mm256_set1_ps(planes[j].z);
+        p[5] = _mm256_set1_ps(std::abs(planes[j].z));
+        p[6] = _mm256_set1_ps(planes[j].w);
+    }
+}
+
+CULLER_TARGET_AVX2
+static void intersectsAvx2(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    __m256 p[6 * 7];
+    broadcastBoxPlanesAvx2(p, planes);
+    for (size_t i = 0; i < count; i += 8) {
+        orResults8(results + i, intersectsAvx2x8(p, center + i, extent + i), bit);
+    }
+}
+
+CULLER_TARGET_AVX2
+static void intersectsAvx2(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        float const* f = &b[i].x;
+        // the low lanes hold spheres 0 to 3, the high lanes spheres 4 to 7
+        __m256 s04 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f +  0)), _mm_loadu_ps(f + 16), 1);
+        __m256 s15 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f +  4)), _mm_loadu_ps(f + 20), 1);
+        __m256 s26 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f +  8)), _mm_loadu_ps(f + 24), 1);
+        __m256 s37 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + 12)), _mm_loadu_ps(f + 28), 1);
+        __m256 t0 = _mm256_unpacklo_ps(s04, s15);   // x0 x1 y0 y1
+        __m256 t1 = _mm256_unpacklo_ps(s26, s37);   // x2 x3 y2 y3
+        __m256 t2 = _mm256_unpackhi_ps(s04, s15);   // z0 z1 w0 w1
+        __m256 t3 = _mm256_unpackhi_ps(s26, s37);   // z2 z3 w2 w3
+        __m256 x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 w = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 visible = _mm256_set1_ps(-0.0f);
+        for (size_t j = 0; j < 6; j++) {
+            const float4 p = planes[j];
+            __m256 dot = _mm256_mul_ps(_mm256_set1_ps(p.x), x);
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(_mm256_set1_ps(p.y), y));
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(_mm256_set1_ps(p.z), z));
+            dot = _mm256_add_ps(dot, _mm256_set1_ps(p.w));
+            dot = _mm256_sub_ps(dot, w);
+            visible = _mm256_and_ps(visible, dot);
+        }
+        memset(results + i, 0, 8);
+        orResults8(results + i, uint32_t(_mm256_movemask_ps(visible)), 0);
+    }
+}
+
+// deinterleaves 16 float3 into x, y and z vectors
+CULLER_TARGET_AVX512 UTILS_ALWAYS_INLINE
+static inline void load3x16(float3 const* p, __m512& x, __m512& y, __m512& z) noexcept {
+    float const* f = &p[0].x;
+    const __m512 v0 = _mm512_loadu_ps(f +  0);
+    const __m512 v1 = _mm512_loadu_ps(f + 16);
+    const __m512 v2 = _mm512_loadu_ps(f + 32);
+    // first gather the components found in v0 and v1, then the remaining ones from v2
+    const __m512i x01 = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 0, 0, 0, 0, 0);
+    const __m512i x2  = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 17, 20, 23, 26, 29);
+    const __m512i y01 = _mm512_setr_epi32(1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 0, 0, 0, 0, 0);
+    const __m512i y2  = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 18, 21, 24, 27, 30);
+    const __m512i z01 = _mm512_setr_epi32(2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 0, 0, 0, 0, 0, 0);
+    const __m512i z2  = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 19, 22, 25, 28, 31);
+    x = _mm512_permutex2var_ps(_mm512_permutex2var_ps(v0, x01, v1), x2, v2);
+    y = _mm512_permutex2var_ps(_mm512_permutex2var_ps(v0, y01, v1), y2, v2);
+    z = _mm512_permutex2var_ps(_mm512_permutex2var_ps(v0, z01, v1), z2, v2);
+}
+
+CULLER_TARGET_AVX512
+static void intersectsAvx512(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    __m512 p[6 * 7];
+    for (size_t j = 0; j < 6; j++) {
+        p[j * 7 + 0] = _mm512_set1_ps(planes[j].x);
+        p[j * 7 + 1] = _mm512_set1_ps(std::abs(planes[j].x));
+        p[j * 7 + 2] = _mm512_set1_ps(planes[j].y);
+        p[j * 7 + 3] = _mm512_set1_ps(std::abs(planes[j].y));
+        p[j * 7 + 4] = _mm512_set1_ps(planes[j].z);
+        p[j * 7 + 5] = _mm512_set1_ps(std::abs(planes[j].z));
+        p[j * 7 + 6] = _mm512_set1_ps(planes[j].w);
+    }
+    const __m512i signMask = _mm512_set1_epi32(int32_t(0x80000000u));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 cx, cy, cz, ex, ey, ez;
+        load3x16(center + i, cx, cy, cz);
+        load3x16(extent + i, ex, ey, ez);
+        __m512 visible = _mm512_set1_ps(-0.0f);
+        for (size_t j = 0; j < 6; j++) {
+            __m512 const* q = p + j * 7;
+            __m512 dot = _mm512_mul_ps(q[0], cx);
+            dot = _mm512_sub_ps(dot, _mm512_mul_ps(q[1], ex));
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(q[2], cy));
+            dot = _mm512_sub_ps(dot, _mm512_mul_ps(q[3], ey));
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(q[4], cz));
+            dot = _mm512_sub_ps(dot, _mm512_mul_ps(q[5], ez));
+            dot = _mm512_add_ps(dot, q[6]);
+            visible = _mm512_castsi512_ps(_mm512_and_si512(
+                    _mm512_castps_si512(visible), _mm512_castps_si512(dot)));
+        }
+        const uint32_t mask = _mm512_test_epi32_mask(_mm512_castps_si512(visible), signMask);
+        orResults8(results + i, mask & 0xFFu, bit);
+        orResults8(results + i + 8, mask >> 8u, bit);
+    }
+    if (i < count) {
+        // count is a multiple of 8, there can only be 8 items left
+        intersectsAvx2(results + i, planes, center + i, extent + i, count - i, bit);
+    }
+}
+
+CULLER_TARGET_AVX512
+static void intersectsAvx512(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    const __m512i signMask = _mm512_set1_epi32(int32_t(0x80000000u));
+    // transposing each 128-bit lane leaves sphere 4*k+l in element 4*l+k, this undoes it
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        float const* f = &b[i].x;
+        const __m512 s0 = _mm512_loadu_ps(f +  0);
+        const __m512 s1 = _mm512_loadu_ps(f + 16);
+        const __m512 s2 = _mm512_loadu_ps(f + 32);
+        const __m512 s3 = _mm512_loadu_ps(f + 48);
+        const __m512 t0 = _mm512_unpacklo_ps(s0, s1);
+        const __m512 t1 = _mm512_unpacklo_ps(s2, s3);
+        const __m512 t2 = _mm512_unpackhi_ps(s0, s1);
+        const __m512 t3 = _mm512_unpackhi_ps(s2, s3);
+        const __m512 x = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m512 y = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m512 z = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m512 w = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m512 visible = _mm512_set1_ps(-0.0f);
+        for (size_t j = 0; j < 6; j++) {
+            const float4 p = planes[j];
+            __m512 dot = _mm512_mul_ps(_mm512_set1_ps(p.x), x);
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(_mm512_set1_ps(p.y), y));
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(_mm512_set1_ps(p.z), z));
+            dot = _mm512_add_ps(dot, _mm512_set1_ps(p.w));
+            dot = _mm512_sub_ps(dot, w);
+            visible = _mm512_castsi512_ps(_mm512_and_si512(
+                    _mm512_castps_si512(visible), _mm512_castps_si512(dot)));
+        }
+        visible = _mm512_permutexvar_ps(order, visible);
+        const uint32_t mask = _mm512_test_epi32_mask(_mm512_castps_si512(visible), signMask);
+        memset(results + i, 0, 16);
+        orResults8(results + i, mask & 0xFFu, 0);
+        orResults8(results + i + 8, mask >> 8u, 0);
+    }
+    if (i < count) {
+        // count is a multiple of 8, there can only be 8 items left
+        intersectsAvx2(results + i, planes, b + i, count - i);
+    }
+}
+
+#undef CULLER_TARGET_AVX2
+#undef CULLER_TARGET_AVX512
+
+#endif // CULLER_HAS_X86_KERNELS
+
+// ------------------------------------------------------------------------------------------------
+// Runtime dispatch
+// ------------------------------------------------------------------------------------------------
+
+static Culler::Isa detectIsa() noexcept {
+#if CULLER_HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return Culler::Isa::AVX512;
     }
+    if (__builtin_cpu_supports("avx2")) {
+        return Culler::Isa::AVX2;
+    }
+    return Culler::Isa::SSE2;
+#else
+    return Culler::Isa::GENERIC;
+#endif
+}
+
+struct Kernels {
+    BoxKernel box;
+    SphereKernel sphere;
+};
+
+static Kernels getKernels(Culler::Isa isa) noexcept {
+    switch (isa) {
+#if CULLER_HAS_X86_KERNELS
+        case Culler::Isa::SSE2:
+            return { intersectsSse2, intersectsSse2 };
+        case Culler::Isa::AVX2:
+            return { intersectsAvx2, intersectsAvx2 };
+        case Culler::Isa::AVX512:
+            return { intersectsAvx512, intersectsAvx512 };
+#endif
+        default:
+            return { intersectsGeneric, intersectsGeneric };
+    }
+}
+
+static Kernels const& getKernels() noexcept {
+    static const Kernels kernels = getKernels(Culler::getIsa());
+    return kernels;
+}
+
+Culler::Isa Culler::getIsa() noexcept {
+    static const Isa isa = detectIsa();
+    return isa;
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        filament::math::float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    count = round(count); // capacity guaranteed to be multiple of 8
+    getKernels().sphere(results, frustum.mPlanes, b, count);
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        filament::math::float3 const* UTILS_RESTRICT center,
+        filament::math::float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    count = round(count); // capacity guaranteed to be multiple of 8
+    getKernels().box(results, frustum.mPlanes, center, extent, count, bit);
 }
 
 /*
@@ -135,5 +530,35 @@ void Culler::Test::intersects(
     Culler::intersects(results, frustum, b, count);
 }
 
+void Culler::Test::intersects(Isa isa,
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        filament::math::float3 const* UTILS_RESTRICT c,
+        filament::math::float3 const* UTILS_RESTRICT e,
+        size_t count) noexcept {
+    getKernels(isa).box(results, frustum.mPlanes, c, e, round(count), 0);
+}
+
+void Culler::Test::intersects(Isa isa,
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        filament::math::float4 const* UTILS_RESTRICT b, size_t count) noexcept {
+    getKernels(isa).sphere(results, frustum.mPlanes, b, round(count));
+}
+
+bool Culler::Test::isSupported(Isa isa) noexcept {
+    return isa <= getIsa();
+}
+
+const char* Culler::Test::getName(Isa isa) noexcept {
+    switch (isa) {
+        case Isa::GENERIC:  return "generic";
+        case Isa::SSE2:     return "SSE2";
+        case Isa::AVX2:     return "AVX2";
+        case Isa::AVX512:   return "AVX-512";
+    }
+    return "unknown";
+}
+
 } // namespace details
 } // namespace filament
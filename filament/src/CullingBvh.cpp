@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/CullingBvh.h"
+
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
+#include <math/fast.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+using namespace filament::math;
+using namespace utils;
+
+namespace filament {
+namespace details {
+
+// leaves store (count - 1) in 3 bits
+static_assert(CullingBvh::LEAF_SIZE == 8, "LEAF_SIZE must be 8");
+
+// Largest number of boxes processed by a single culling work item
+static constexpr uint32_t MAX_WORK_ITEM_SIZE = 1024;
+
+// Number of work items collected before they're culled
+static constexpr uint32_t MAX_WORK_ITEM_COUNT = 256;
+
+// Number of boxes handed to Culler::intersects() at a time
+static constexpr uint32_t BATCH_SIZE = 64;
+
+CullingBvh::CullingBvh() noexcept = default;
+
+CullingBvh::~CullingBvh() noexcept = default;
+
+void CullingBvh::clear() noexcept {
+    std::vector<Node>().swap(mNodes);
+    std::vector<uint32_t>().swap(mIndices);
+    std::vector<uint32_t>().swap(mLeaves);
+    std::vector<float3>().swap(mCenters);
+    std::vector<float3>().swap(mExtents);
+    std::vector<uint8_t>().swap(mDirty);
+    mCount = 0;
+    mBuildArea = 0;
+    mArea = 0;
+}
+
+void CullingBvh::build(float3 const* center, float3 const* extent, size_t count) {
+    SYSTRACE_CALL();
+
+    mNodes.clear();
+    mIndices.resize(count);
+    mLeaves.resize(count);
+    mCenters.assign(center, center + count);
+    mExtents.assign(extent, extent + count);
+    mCount = count;
+    mBuildArea = 0;
+    mArea = 0;
+    if (!count) {
+        mDirty.clear();
+        return;
+    }
+
+    // median splits never produce leaves with fewer than LEAF_SIZE/2 boxes
+    mNodes.reserve(2 * ((count + LEAF_SIZE / 2 - 1) / (LEAF_SIZE / 2)));
+
+    std::iota(mIndices.begin(), mIndices.end(), 0u);
+    buildRecursive(0, uint32_t(count), center, extent);
+
+    mDirty.resize(mNodes.size());
+    for (uint32_t n = 0, c = uint32_t(mNodes.size()); n < c; n++) {
+        if (mNodes[n].skip != n + 1) {
+            mBuildArea += area(mNodes[n]);
+        }
+    }
+    mArea = mBuildArea;
+}
+
+uint32_t CullingBvh::buildRecursive(uint32_t first, uint32_t count,
+        float3 const* center, float3 const* extent) {
+    const uint32_t index = uint32_t(mNodes.size());
+    mNodes.push_back({});
+
+    uint32_t* const indices = mIndices.data() + first;
+    if (count <= LEAF_SIZE) {
+        for (uint32_t i = 0; i < count; i++) {
+            mLeaves[indices[i]] = index;
+        }
+        Node& node = mNodes[index];
+        node.skip = index + 1;
+        node.leaf = (first << 3u) | (count - 1);
+        refitLeaf(node, center, extent);
+        return index;
+    }
+
+    // split at the median of the longest axis of the centers' bounds
+    float3 cmin = std::numeric_limits<float>::max();
+    float3 cmax = std::numeric_limits<float>::lowest();
+    for (uint32_t i = 0; i < count; i++) {
+        cmin = min(cmin, center[indices[i]]);
+        cmax = max(cmax, center[indices[i]]);
+    }
+    const float3 d = cmax - cmin;
+    const size_t axis = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+    const uint32_t half = count / 2;
+    std::nth_element(indices, indices + half, indices + count,
+            [center, axis](uint32_t lhs, uint32_t rhs) {
+                return center[lhs][axis] < center[rhs][axis];
+            });
+
+    buildRecursive(first, half, center, extent);
+    const uint32_t right = buildRecursive(first + half, count - half, center, extent);
+
+    // careful: mNodes may have been reallocated
+    Node& node = mNodes[index];
+    node.min = min(mNodes[index + 1].min, mNodes[right].min);
+    node.max = max(mNodes[index + 1].max, mNodes[right].max);
+    node.skip = uint32_t(mNodes.size());
+    node.leaf = 0;
+    return index;
+}
+
+bool CullingBvh::refitLeaf(Node& node, float3 const* center, float3 const* extent) noexcept {
+    uint32_t const* const UTILS_RESTRICT indices = mIndices.data() + (node.leaf >> 3u);
+    const uint32_t count = (node.leaf & 0x7u) + 1;
+    float3 bmin = std::numeric_limits<float>::max();
+    float3 bmax = std::numeric_limits<float>::lowest();
+    for (uint32_t i = 0; i < count; i++) {
+        bmin = min(bmin, center[indices[i]] - extent[indices[i]]);
+        bmax = max(bmax, center[indices[i]] + extent[indices[i]]);
+    }
+    const bool changed = bmin != node.min || bmax != node.max;
+    node.min = bmin;
+    node.max = bmax;
+    return changed;
+}
+
+float CullingBvh::area(Node const& node) noexcept {
+    const float3 d = node.max - node.min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+void CullingBvh::update(float3 const* center, float3 const* extent, size_t count) {
+    SYSTRACE_CALL();
+
+    if (count != mCount || mNodes.empty()) {
+        build(center, extent, count);
+        return;
+    }
+
+    // Find the boxes that changed since the last update, this reads all arrays sequentially
+    uint8_t* const UTILS_RESTRICT dirty = mDirty.data();
+    std::fill(mDirty.begin(), mDirty.end(), 0);
+    uint32_t const* const UTILS_RESTRICT leaves = mLeaves.data();
+    float3* const UTILS_RESTRICT centers = mCenters.data();
+    float3* const UTILS_RESTRICT extents = mExtents.data();
+    bool changed = false;
+    for (size_t i = 0; i < count; i++) {
+        if (center[i] != centers[i] || extent[i] != extents[i]) {
+            centers[i] = center[i];
+            extents[i] = extent[i];
+            dirty[leaves[i]] = 1;
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return;
+    }
+
+    // Children are always stored after their parent, so walking the nodes backward refits
+    // bottom-up. Nodes are only recomputed when one of their boxes changed.
+    Node* const UTILS_RESTRICT nodes = mNodes.data();
+    float totalArea = mArea;
+    for (uint32_t n = uint32_t(mNodes.size()); n-- > 0;) {
+        Node& node = nodes[n];
+        if (node.skip == n + 1) {
+            dirty[n] = uint8_t(dirty[n] && refitLeaf(node, center, extent));
+        } else {
+            const uint32_t left = n + 1;
+            const uint32_t right = nodes[left].skip;
+            dirty[n] = dirty[left] | dirty[right];
+            if (dirty[n]) {
+                totalArea -= area(node);
+                node.min = min(nodes[left].min, nodes[right].min);
+                node.max = max(nodes[left].max, nodes[right].max);
+                totalArea += area(node);
+            }
+        }
+    }
+    mArea = totalArea;
+
+    if (UTILS_UNLIKELY(mArea > mBuildArea * REBUILD_RATIO)) {
+        build(center, extent, count);
+    }
+}
+
+void CullingBvh::intersects(JobSystem& js, Culler::result_type* results,
+        Frustum const& frustum, float3 const* center, float3 const* extent, size_t bit) const {
+    SYSTRACE_CALL();
+
+    if (mNodes.empty()) {
+        return;
+    }
+
+    // A run of boxes (in mIndices), either fully inside the frustum or to be tested one by one
+    struct WorkItem {
+        uint32_t first;
+        uint32_t last;
+        bool inside;
+    };
+
+    // The work items are collected on the stack and culled each time the array fills up, this
+    // keeps intersects() free of allocations and safe to call concurrently.
+    WorkItem work[MAX_WORK_ITEM_COUNT];
+    uint32_t workCount = 0;
+
+    uint32_t const* const indices = mIndices.data();
+    const Culler::result_type visibleBit = Culler::result_type(1u << bit);
+
+    // culling job (this runs on multiple threads), items never share boxes
+    auto functor = [=, &work, &frustum](uint32_t index, uint32_t count) {
+        for (uint32_t w = index, e = index + count; w < e; w++) {
+            WorkItem const& item = work[w];
+            if (item.inside) {
+                for (uint32_t i = item.first; i < item.last; i++) {
+                    results[indices[i]] |= visibleBit;
+                }
+                continue;
+            }
+            // gather the boxes, so we can use the SIMD culling code
+            for (uint32_t i = item.first; i < item.last; i += BATCH_SIZE) {
+                const uint32_t c = std::min(BATCH_SIZE, item.last - i);
+                float3 centers[BATCH_SIZE];
+                float3 extents[BATCH_SIZE];
+                Culler::result_type visibles[BATCH_SIZE] = {};
+                for (uint32_t j = 0; j < c; j++) {
+                    centers[j] = center[indices[i + j]];
+                    extents[j] = extent[indices[i + j]];
+                }
+                for (uint32_t j = c; j < Culler::round(c); j++) {
+                    centers[j] = 0;
+                    extents[j] = 0;
+                }
+                Culler::intersects(visibles, frustum, centers, extents, c, bit);
+                for (uint32_t j = 0; j < c; j++) {
+                    results[indices[i + j]] |= visibles[j];
+                }
+            }
+        }
+    };
+
+    auto flush = [&js, &functor, &workCount]() {
+        // launch the computation on multiple threads
+        auto job = jobs::parallel_for(js, nullptr, 0, workCount,
+                std::ref(functor), jobs::CountSplitter<4, 8>());
+        js.runAndWait(job);
+        workCount = 0;
+    };
+
+    auto push = [&work, &workCount, &flush](uint32_t first, uint32_t last, bool inside) {
+        if (workCount == MAX_WORK_ITEM_COUNT) {
+            flush();
+        }
+        work[workCount++] = { first, last, inside };
+    };
+
+    auto addWork = [&work, &workCount, &push](uint32_t first, uint32_t last, bool inside) {
+        if (workCount) {
+            WorkItem& prev = work[workCount - 1];
+            if (prev.inside == inside && prev.last == first &&
+                    last - prev.first <= MAX_WORK_ITEM_SIZE) {
+                prev.last = last;
+                return;
+            }
+        }
+        for (; last - first > MAX_WORK_ITEM_SIZE; first += MAX_WORK_ITEM_SIZE) {
+            push(first, first + MAX_WORK_ITEM_SIZE, inside);
+        }
+        push(first, last, inside);
+    };
+
+    // Traverse the hierarchy without a stack, following the skip links
+    Node const* const UTILS_RESTRICT nodes = mNodes.data();
+    float4 const* const UTILS_RESTRICT planes = frustum.getNormalizedPlanes();
+    for (uint32_t n = 0, c = uint32_t(mNodes.size()); n < c;) {
+        Node const& node = nodes[n];
+        const float3 nodeCenter = (node.max + node.min) * 0.5f;
+        const float3 nodeExtent = (node.max - node.min) * 0.5f;
+        bool outside = false;
+        bool inside = true;
+        for (size_t j = 0; j < 6; j++) {
+            const float d = dot(planes[j].xyz, nodeCenter) + planes[j].w;
+            const float r = dot(abs(planes[j].xyz), nodeExtent);
+            // this must match Culler::intersects(), a box is visible if dot < 0
+            outside |= !fast::signbit(d - r);
+            inside &= fast::signbit(d + r) != 0;
+        }
+
+        if (outside) {
+            n = node.skip;
+            continue;
+        }
+
+        if (inside || node.skip == n + 1) {
+            // the boxes of a subtree are contiguous, starting with its left-most leaf
+            uint32_t firstLeaf = n;
+            while (nodes[firstLeaf].skip != firstLeaf + 1) {
+                firstLeaf++;
+            }
+            Node const& lastLeaf = nodes[node.skip - 1];
+            const uint32_t first = nodes[firstLeaf].leaf >> 3u;
+            const uint32_t last = (lastLeaf.leaf >> 3u) + (lastLeaf.leaf & 0x7u) + 1;
+            addWork(first, last, inside);
+            n = node.skip;
+            continue;
+        }
+
+        n++;
+    }
+
+    if (workCount) {
+        flush();
+    }
+}
+
+} // namespace details
+} // namespace filament
@@ -69,8 +69,9 @@ namespace details {
 static std::unordered_map<Engine const*, std::unique_ptr<FEngine>> sEngines;
 static std::mutex sEnginesLock;
 
-FEngine* FEngine::create(Backend backend, Platform* platform, void* sharedGLContext) {
-    FEngine* instance = new FEngine(backend, platform, sharedGLContext);
+FEngine* FEngine::create(Backend backend, Platform* platform, void* sharedGLContext,
+        JobSystem* jobSystem) {
+    FEngine* instance = new FEngine(backend, platform, sharedGLContext, jobSystem);
 
     slog.i << "FEngine (" << sizeof(void*) * 8 << " bits) created at " << instance << " "
             << "(threading is " << (UTILS_HAS_THREADING ? "enabled)" : "disabled)") << io::endl;
@@ -122,13 +123,16 @@ static const half4 sFullScreenTriangleVertices[3] = {
 // these must be static because only a pointer is copied to the render stream
 static const uint16_t sFullScreenTriangleIndices[3] = { 0, 1, 2 };
 
-FEngine::FEngine(Backend backend, Platform* platform, void* sharedGLContext) :
+FEngine::FEngine(Backend backend, Platform* platform, void* sharedGLContext,
+        JobSystem* jobSystem) :
         mBackend(backend),
         mPlatform(platform),
         mSharedGLContext(sharedGLContext),
+        mOwnJobSystem(jobSystem ? nullptr : new JobSystem()),
+        mJobSystem(jobSystem ? *jobSystem : *mOwnJobSystem),
         mEntityManager(EntityManager::get()),
         mRenderableManager(*this),
-        mTransformManager(),
+        mTransformManager(mJobSystem),
         mLightManager(*this),
         mCameraManager(*this),
         mPerViewUib(PerViewUib::getUib()),
@@ -144,6 +148,8 @@ FEngine::FEngine(Backend backend, Platform* platform, void* sharedGLContext) :
 
     // we're assuming we're on the main thread here.
     // (it may not be the case)
+    // When the JobSystem is shared, several engines can be created on the same thread, adopt()
+    // nests in that case.
     mJobSystem.adopt();
 }
 
@@ -573,12 +579,15 @@ FCamera* FEngine::createCamera(Entity entity) noexcept {
     return mCameraManager.create(entity);
 }
 
-void FEngine::createRenderable(const RenderableManager::Builder& builder, Entity entity) {
-    mRenderableManager.create(builder, entity);
+void FEngine::createRenderables(const RenderableManager::Builder& builder,
+        Entity const* entities, size_t count) {
+    mRenderableManager.create(builder, entities, count);
     auto& tcm = mTransformManager;
-    // if this entity doesn't have a transform component, add one.
-    if (!tcm.hasComponent(entity)) {
-        tcm.create(entity, 0, mat4f());
+    // if these entities don't have a transform component, add one.
+    for (size_t i = 0; i < count; i++) {
+        if (!tcm.hasComponent(entities[i])) {
+            tcm.create(entities[i], 0, mat4f());
+        }
     }
 }
 
@@ -741,8 +750,10 @@ bool FEngine::execute() {
 
 using namespace details;
 
-Engine* Engine::create(Backend backend, Platform* platform, void* sharedGLContext) {
-    std::unique_ptr<FEngine> engine(FEngine::create(backend, platform, sharedGLContext));
+Engine* Engine::create(Backend backend, Platform* platform, void* sharedGLContext,
+        JobSystem* jobSystem) {
+    std::unique_ptr<FEngine> engine(
+            FEngine::create(backend, platform, sharedGLContext, jobSystem));
     if (UTILS_UNLIKELY(!engine)) {
         // something went wrong during the driver or engine initialization
         return nullptr;
@@ -34,6 +34,7 @@
 #include <algorithm>
 
 #include <stddef.h>
+#include <stdlib.h>
 
 using namespace filament::math;
 using namespace utils;
@@ -46,18 +47,22 @@ namespace details {
 
 /*
  * This enables froxels to be rectangular which allows us to use a but more froxel
- * with the same amount of memory in the GPU.
- * This requires backward compatibility breaking changes in the shaders.
+ * with the same amount of memory in the GPU, in particular with ultrawide or portrait viewports.
+ * The shaders handle both, using oneOverFroxelDimension and oneOverFroxelDimensionY.
  */
-static constexpr bool SUPPORTS_NON_SQUARE_FROXELS = false;
+static constexpr bool SUPPORTS_NON_SQUARE_FROXELS = true;
 
 /*
  * This changes the layout of the froxel info on the GPU such that it is more cache friendly,
  * i.e. the major axis is Z instead of X, because in a given froxel there is more chance to
  * hit another froxel at the same x,y coordinate.
- * This requires backward compatibility breaking changes in the shaders.
+ * The shaders handle both, using fParamsX and fParams.
  */
-static constexpr bool SUPPORTS_REMAPPED_FROXELS   = false;
+static constexpr bool SUPPORTS_REMAPPED_FROXELS   = true;
+
+// Below this many lights, the froxel grid uses half the z-slices and twice the froxels in x-y.
+// There are few lights along a view ray then, and the froxels' screen footprint matters more.
+constexpr size_t FEW_LIGHTS_COUNT = 32;
 
 // The Froxel buffer is set to FROXEL_BUFFER_WIDTH x n
 // With n limited by the supported texture dimension, which is guaranteed to be at least 2048
@@ -69,42 +74,72 @@ constexpr size_t FROXEL_BUFFER_WIDTH        = 1u << FROXEL_BUFFER_WIDTH_SHIFT;
 constexpr size_t FROXEL_BUFFER_WIDTH_MASK   = FROXEL_BUFFER_WIDTH - 1u;
 constexpr size_t FROXEL_BUFFER_HEIGHT       = (FROXEL_BUFFER_ENTRY_COUNT_MAX + FROXEL_BUFFER_WIDTH_MASK) / FROXEL_BUFFER_WIDTH;
 
-constexpr size_t RECORD_BUFFER_WIDTH_SHIFT  = 5u;
+constexpr size_t RECORD_BUFFER_WIDTH_SHIFT  = 8u;
 constexpr size_t RECORD_BUFFER_WIDTH        = 1u << RECORD_BUFFER_WIDTH_SHIFT;
+constexpr size_t RECORD_BUFFER_WIDTH_MASK   = RECORD_BUFFER_WIDTH - 1u;
+
+// The record buffer starts with 16K entries and doubles its height when a frame needs more,
+// up to 256K entries (512 KiB).
+constexpr size_t RECORD_BUFFER_HEIGHT_MIN       = 64;
+constexpr size_t RECORD_BUFFER_HEIGHT_MAX       = 1024;
+constexpr size_t RECORD_BUFFER_ENTRY_COUNT_MIN  = RECORD_BUFFER_WIDTH * RECORD_BUFFER_HEIGHT_MIN;
+constexpr size_t RECORD_BUFFER_ENTRY_COUNT_MAX  = RECORD_BUFFER_WIDTH * RECORD_BUFFER_HEIGHT_MAX;
 
-constexpr size_t RECORD_BUFFER_HEIGHT       = 2048;
-constexpr size_t RECORD_BUFFER_ENTRY_COUNT  = RECORD_BUFFER_WIDTH * RECORD_BUFFER_HEIGHT; // 64K
+// The spot light test works on rows of froxels, this many at a time
+constexpr size_t SPOT_LIGHT_TEST_BATCH_SIZE = 256;
+
+// Alignment of the froxels' bounding spheres arrays, enough for 8-wide vectors
+constexpr size_t BOUNDING_SPHERES_ALIGNMENT = 32;
 
 // Buffer needed for Froxelizer internal data structures (~256 KiB)
 constexpr size_t PER_FROXELDATA_ARENA_SIZE = sizeof(float4) *
                                                  (FROXEL_BUFFER_ENTRY_COUNT_MAX +
                                                   FROXEL_BUFFER_ENTRY_COUNT_MAX + 3 +
-                                                  FEngine::CONFIG_FROXEL_SLICE_COUNT / 4 + 1);
+                                                  FEngine::CONFIG_FROXEL_SLICE_COUNT / 4 + 1) +
+                                             4 * BOUNDING_SPHERES_ALIGNMENT;
 
+// Maximum number of light/froxel intersections a froxelization job can record (512 KiB), the
+// lights that don't fit are dropped.
+constexpr size_t LIGHT_HIT_COUNT_MAX_PER_JOB = 128 * 1024;
 
-// number of lights processed by one group (e.g. 32)
-static constexpr size_t LIGHT_PER_GROUP = sizeof(Froxelizer::LightGroupType) * 8;
+// froxel indices are stored in the low 16 bits of a LightHit
+static_assert(FROXEL_BUFFER_ENTRY_COUNT_MAX <= 65536,
+        "FroxelBuffer cannot be larger than 65536 entries");
 
-// number of groups (i.e. jobs) to use for froxelization (e.g. 8)
-static constexpr size_t GROUP_COUNT =
-        (CONFIG_MAX_LIGHT_COUNT + LIGHT_PER_GROUP - 1) / LIGHT_PER_GROUP;
+// set to true to run the froxelization jobs on the calling thread, for debugging
+constexpr bool SINGLE_THREADED = false;
 
+// Runs functor(i) for i in [0, count) as separate jobs and waits for all of them
+template<typename F>
+static void runJobs(JobSystem& js, size_t count, F const& functor) noexcept {
+    if (!SINGLE_THREADED) {
+        auto parent = js.createJob();
+        for (size_t i = 0; i < count; i++) {
+            js.run(jobs::createJob(js, parent, std::cref(functor), i));
+        }
+        js.runAndWait(parent);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            functor(i);
+        }
+    }
+}
 
-// record buffer cannot be larger than 65K entries because we're using uint16_t to store indices
-// so its maximum size is 128 KiB
-static_assert(RECORD_BUFFER_ENTRY_COUNT <= 65536,
-        "RecordBuffer cannot be larger than 65536 entries");
+static GPUBuffer::Element getRecordBufferElement() noexcept {
+    GPUBuffer::ElementType type = std::is_same<Froxelizer::RecordBufferType, uint8_t>::value
+                                  ? GPUBuffer::ElementType::UINT8 : GPUBuffer::ElementType::UINT16;
+    return { type, 1 };
+}
 
 Froxelizer::Froxelizer(FEngine& engine)
         : mArena("froxel", PER_FROXELDATA_ARENA_SIZE) {
 
     DriverApi& driverApi = engine.getDriverApi();
 
-    // RecordBuffer cannot be larger than 65536 entries, because indices are uint16_t
-    GPUBuffer::ElementType type = std::is_same<RecordBufferType, uint8_t>::value
-                                  ? GPUBuffer::ElementType::UINT8 : GPUBuffer::ElementType::UINT16;
-    mRecordsBuffer = GPUBuffer(driverApi, { type, 1 }, RECORD_BUFFER_WIDTH, RECORD_BUFFER_HEIGHT);
-    mFroxelBuffer  = GPUBuffer(driverApi, { GPUBuffer::ElementType::UINT16, 2 },
+    // the RecordBuffer grows in commit() when needed
+    mRecordsBuffer = GPUBuffer(driverApi, getRecordBufferElement(),
+            RECORD_BUFFER_WIDTH, RECORD_BUFFER_HEIGHT_MIN);
+    mFroxelBuffer  = GPUBuffer(driverApi, { GPUBuffer::ElementType::UINT32, 2 },
             FROXEL_BUFFER_WIDTH, FROXEL_BUFFER_HEIGHT);
 }
 
@@ -115,8 +150,9 @@ Froxelizer::~Froxelizer() {
 void Froxelizer::terminate(DriverApi& driverApi) noexcept {
     // call reset() on our LinearAllocator arenas
     mArena.reset();
+    mLastFroxelizationValid = false;
 
-    mBoundingSpheres = nullptr;
+    mBoundingSpheres = {};
     mPlanesY = nullptr;
     mPlanesX = nullptr;
     mDistancesZ = nullptr;
@@ -134,6 +170,16 @@ void Froxelizer::setOptions(float zLightNear, float zLightFar) noexcept {
 }
 
 
+void Froxelizer::setLightCount(size_t lightCount) noexcept {
+    // the grid goes back to all its z-slices only well past the threshold, so that a light count
+    // hovering around it doesn't change the layout every frame
+    const bool fewLights = lightCount <= (mFewLights ? FEW_LIGHTS_COUNT * 2 : FEW_LIGHTS_COUNT);
+    if (UTILS_UNLIKELY(mFewLights != fewLights)) {
+        mFewLights = fewLights;
+        mDirtyFlags |= VIEWPORT_CHANGED;
+    }
+}
+
 void Froxelizer::setViewport(Viewport const& viewport) noexcept {
     if (UTILS_UNLIKELY(mViewport != viewport)) {
         mViewport = viewport;
@@ -165,40 +211,40 @@ bool Froxelizer::prepare(
      * the command stream.
      */
 
-    // froxel buffer (~32 KiB)
+    // froxel buffer (~128 KiB), which is updated by whole rows
+    const size_t froxelCount = getFroxelCount();
+    const size_t froxelBufferCount =
+            (froxelCount + FROXEL_BUFFER_WIDTH_MASK) & ~FROXEL_BUFFER_WIDTH_MASK;
     mFroxelBufferUser = {
-            driverApi.allocatePod<FroxelEntry>(FROXEL_BUFFER_ENTRY_COUNT_MAX),
-            FROXEL_BUFFER_ENTRY_COUNT_MAX };
-
-    // record buffer (~64 KiB)
-    mRecordBufferUser = {
-            driverApi.allocatePod<RecordBufferType>(RECORD_BUFFER_ENTRY_COUNT),
-            RECORD_BUFFER_ENTRY_COUNT };
+            driverApi.allocatePod<FroxelEntry>(froxelBufferCount),
+            froxelBufferCount };
 
     /*
      * Temporary allocations for processing all froxel data
      */
 
-    // light records per froxel (~256 KiB)
-    mLightRecords = {
-            arena.allocate<LightRecord>(FROXEL_BUFFER_ENTRY_COUNT_MAX, CACHELINE_SIZE),
-            FROXEL_BUFFER_ENTRY_COUNT_MAX };
+    // light list of each froxel (~128 KiB)
+    mFroxelLists = {
+            arena.allocate<FroxelEntry>(froxelCount, CACHELINE_SIZE),
+            froxelCount };
 
-    // froxel thread data (~256 KiB)
-    mFroxelShardedData = {
-            arena.allocate<FroxelThreadData>(GROUP_COUNT, CACHELINE_SIZE),
-            uint32_t(GROUP_COUNT)
-    };
+    // light count of each froxel (~64 KiB)
+    mFroxelLightCounts = {
+            arena.allocate<uint32_t>(froxelCount, CACHELINE_SIZE),
+            froxelCount };
 
     assert(mFroxelBufferUser.begin());
-    assert(mRecordBufferUser.begin());
-    assert(mLightRecords.begin());
-    assert(mFroxelShardedData.begin());
+    assert(mFroxelLists.begin());
+    assert(mFroxelLightCounts.begin());
+
+    // each froxelization job counts its lights per froxel (64 KiB per job)
+    for (auto& counts : mJobLightCounts) {
+        counts.resize(froxelCount);
+    }
 
 #ifndef NDEBUG
     memset(mFroxelBufferUser.data(),    0x55, mFroxelBufferUser.sizeInBytes());
-    memset(mRecordBufferUser.data(),    0xEB, mRecordBufferUser.sizeInBytes());
-    memset(mFroxelShardedData.data(),   0xFD, mFroxelShardedData.sizeInBytes());
+    memset(mFroxelLists.data(),         0xFD, mFroxelLists.sizeInBytes());
 #endif
 
     return uniformsNeedUpdating;
@@ -206,55 +252,64 @@ bool Froxelizer::prepare(
 
 void Froxelizer::computeFroxelLayout(
         uint2* dim, uint16_t* countX, uint16_t* countY, uint16_t* countZ,
-        Viewport const& viewport) noexcept {
+        Viewport const& viewport, bool fewLights) noexcept {
 
-    if (SUPPORTS_NON_SQUARE_FROXELS == false) {
-        // calculate froxel dimension from FROXEL_BUFFER_ENTRY_COUNT_MAX and viewport
-        // - Start from the maximum number of froxels we can use in the x-y plane
-        size_t froxelSliceCount = FEngine::CONFIG_FROXEL_SLICE_COUNT;
-        size_t froxelPlaneCount = FROXEL_BUFFER_ENTRY_COUNT_MAX / froxelSliceCount;
-        // - compute the number of square froxels we need in width and height, rounded down
-        //   solving: |  froxelCountX * froxelCountY == froxelPlaneCount
-        //            |  froxelCountX / froxelCountY == width / height
-        size_t froxelCountX = size_t(std::sqrt(froxelPlaneCount * viewport.width  / viewport.height));
-        size_t froxelCountY = size_t(std::sqrt(froxelPlaneCount * viewport.height / viewport.width));
-        // - copmute the froxels dimensions, rounded up
-        size_t froxelSizeX = (viewport.width  + froxelCountX - 1) / froxelCountX;
-        size_t froxelSizeY = (viewport.height + froxelCountY - 1) / froxelCountY;
-        // - and since our froxels must be square, only keep the largest dimension
-        size_t froxelDimension = std::max(froxelSizeX, froxelSizeY);
+    const size_t width  = viewport.width;
+    const size_t height = viewport.height;
+
+    // calculate froxel dimension from FROXEL_BUFFER_ENTRY_COUNT_MAX and viewport
+    // - Start from the maximum number of froxels we can use in the x-y plane
+    const size_t froxelSliceCount = fewLights ?
+            FEngine::CONFIG_FROXEL_SLICE_COUNT / 2 : FEngine::CONFIG_FROXEL_SLICE_COUNT;
+    const size_t froxelPlaneCount = FROXEL_BUFFER_ENTRY_COUNT_MAX / froxelSliceCount;
 
-        // Here we recompute the froxel counts which may have changed a little due to the rounding
-        // and the squareness requirement of froxels
-        froxelCountX = (viewport.width  + froxelDimension - 1) / froxelDimension;
-        froxelCountY = (viewport.height + froxelDimension - 1) / froxelDimension;
+    // - compute the number of square froxels we need in width and height, rounded down
+    //   solving: |  froxelCountX * froxelCountY == froxelPlaneCount
+    //            |  froxelCountX / froxelCountY == width / height
+    size_t froxelCountX = size_t(std::sqrt(float(froxelPlaneCount) * width / height));
+    froxelCountX = clamp(froxelCountX, size_t(1), std::min(width, froxelPlaneCount));
 
-        *dim = froxelDimension;
-        *countX = uint16_t(froxelCountX);
-        *countY = uint16_t(froxelCountY);
-        *countZ = uint16_t(froxelSliceCount);
+    size_t froxelSizeX, froxelSizeY;
+    if (SUPPORTS_NON_SQUARE_FROXELS == false) {
+        size_t froxelCountY = size_t(std::sqrt(float(froxelPlaneCount) * height / width));
+        froxelCountY = clamp(froxelCountY, size_t(1), std::min(height, froxelPlaneCount));
+        // - compute the froxels dimensions, rounded up
+        froxelSizeX = (width  + froxelCountX - 1) / froxelCountX;
+        froxelSizeY = (height + froxelCountY - 1) / froxelCountY;
+        // - and since our froxels must be square, only keep the largest dimension
+        froxelSizeX = froxelSizeY = std::max(froxelSizeX, froxelSizeY);
     } else {
-        // TODO: don't hardcode this
-        *countX = uint16_t(32);
-        *countY = uint16_t(16);
-        if (viewport.height > viewport.width) {
-            std::swap(*countX, *countY);
-        }
-        *countZ = uint16_t(FEngine::CONFIG_FROXEL_SLICE_COUNT);
-         dim->x = (viewport.width  + *countX - 1) / *countX;
-         dim->y = (viewport.height + *countY - 1) / *countY;
+        // - the froxels stay close to square, but the rows use the froxels left over by the
+        //   rounding of froxelCountX, which matters with ultrawide or portrait viewports
+        const size_t froxelCountY = std::min(height, froxelPlaneCount / froxelCountX);
+        // - compute the froxels dimensions, rounded up
+        froxelSizeX = (width  + froxelCountX - 1) / froxelCountX;
+        froxelSizeY = (height + froxelCountY - 1) / froxelCountY;
     }
+
+    // Here we recompute the froxel counts which may have changed a little due to the rounding
+    // and the squareness requirement of froxels
+    *dim = uint2{ uint32_t(froxelSizeX), uint32_t(froxelSizeY) };
+    *countX = uint16_t((width  + froxelSizeX - 1) / froxelSizeX);
+    *countY = uint16_t((height + froxelSizeY - 1) / froxelSizeY);
+    *countZ = uint16_t(froxelSliceCount);
+
+    assert(*countX * *countY * *countZ <= FROXEL_BUFFER_ENTRY_COUNT_MAX);
 }
 
 UTILS_NOINLINE
 bool Froxelizer::update() noexcept {
+    // the froxels changed, the next froxelization can't be skipped
+    mLastFroxelizationValid = false;
+
     bool uniformsNeedUpdating = false;
     if (UTILS_UNLIKELY(mDirtyFlags & VIEWPORT_CHANGED)) {
         Viewport const& viewport = mViewport;
 
         uint2 froxelDimension;
         uint16_t froxelCountX, froxelCountY, froxelCountZ;
-        computeFroxelLayout(&froxelDimension, &froxelCountX, &froxelCountY, &froxelCountZ, viewport);
+        computeFroxelLayout(&froxelDimension, &froxelCountX, &froxelCountY, &froxelCountZ,
+                viewport, mFewLights);
 
         mFroxelDimension = froxelDimension;
         mClipToFroxelX = (0.5f * viewport.width)  / froxelDimension.x;
@@ -264,7 +319,7 @@ bool Froxelizer::update() noexcept {
         uniformsNeedUpdating = true;
 
 #ifndef NDEBUG
-        size_t froxelSliceCount = FEngine::CONFIG_FROXEL_SLICE_COUNT;
+        size_t froxelSliceCount = froxelCountZ;
         slog.d << "Froxel: " << viewport.width << "x" << viewport.height << " / "
                << froxelDimension.x << "x" << froxelDimension.y << io::endl
                << "Froxel: " << froxelCountX << "x" << froxelCountY << "x" << froxelSliceCount
@@ -284,7 +339,7 @@ bool Froxelizer::update() noexcept {
             // this is a LinearAllocator arena, use rewind() instead of free (which is a no op).
             mArena.rewind(mDistancesZ);
 
-            mBoundingSpheres = nullptr;
+            mBoundingSpheres = {};
             mPlanesY = nullptr;
             mPlanesX = nullptr;
             mDistancesZ = nullptr;
@@ -293,12 +348,15 @@ bool Froxelizer::update() noexcept {
         mDistancesZ      = mArena.alloc<float>(froxelCountZ + 1);
         mPlanesX         = mArena.alloc<float4>(froxelCountX + 1);
         mPlanesY         = mArena.alloc<float4>(froxelCountY + 1);
-        mBoundingSpheres = mArena.alloc<float4>(froxelCount);
+        mBoundingSpheres.x = mArena.alloc<float>(froxelCount, BOUNDING_SPHERES_ALIGNMENT);
+        mBoundingSpheres.y = mArena.alloc<float>(froxelCount, BOUNDING_SPHERES_ALIGNMENT);
+        mBoundingSpheres.z = mArena.alloc<float>(froxelCount, BOUNDING_SPHERES_ALIGNMENT);
+        mBoundingSpheres.r = mArena.alloc<float>(froxelCount, BOUNDING_SPHERES_ALIGNMENT);
 
         assert(mDistancesZ);
         assert(mPlanesX);
         assert(mPlanesY);
-        assert(mBoundingSpheres);
+        assert(mBoundingSpheres.r);
 
         mDistancesZ[0] = 0.0f;
         const float zLightNear = mZLightNear;
@@ -335,7 +393,7 @@ bool Froxelizer::update() noexcept {
         assert(mDistancesZ);
         assert(mPlanesX);
         assert(mPlanesY);
-        assert(mBoundingSpheres);
+        assert(mBoundingSpheres.r);
 
         // clip-space dimensions
         const float froxelWidthInClipSpace  = (2.0f * mFroxelDimension.x) / mViewport.width;
@@ -374,7 +432,10 @@ bool Froxelizer::update() noexcept {
         typename std::aligned_storage<sizeof(float2), alignof(float2)>::type stack[2048];
         float2* const UTILS_RESTRICT minMaxX = reinterpret_cast<float2*>(stack);
 
-        float4* const        UTILS_RESTRICT boundingSpheres = mBoundingSpheres;
+        float*  const        UTILS_RESTRICT spheresX = mBoundingSpheres.x;
+        float*  const        UTILS_RESTRICT spheresY = mBoundingSpheres.y;
+        float*  const        UTILS_RESTRICT spheresZ = mBoundingSpheres.z;
+        float*  const        UTILS_RESTRICT spheresR = mBoundingSpheres.r;
         float4  const* const UTILS_RESTRICT planesX = mPlanesX;
         float4  const* const UTILS_RESTRICT planesY = mPlanesY;
         float   const* const UTILS_RESTRICT planesZ = mDistancesZ;
@@ -437,7 +498,12 @@ bool Froxelizer::update() noexcept {
                     assert(getFroxelIndex(ix, iy, iz) == fi);
                     minp.x = minMaxX[ix][0];
                     maxp.x = minMaxX[ix][1];
-                    boundingSpheres[fi++] = { (maxp + minp) * 0.5f, length((maxp - minp) * 0.5f) };
+                    const float3 center = (maxp + minp) * 0.5f;
+                    spheresX[fi] = center.x;
+                    spheresY[fi] = center.y;
+                    spheresZ[fi] = center.z;
+                    spheresR[fi] = length((maxp - minp) * 0.5f);
+                    fi++;
                 }
             }
         }
@@ -522,38 +588,73 @@ std::pair<size_t, size_t> Froxelizer::clipToIndices(float2 const& clip) const no
 }
 
 
-void Froxelizer::commit(driver::DriverApi& driverApi) {
+bool Froxelizer::commit(driver::DriverApi& driverApi) {
+    if (mFroxelsUnchanged) {
+        // the GPU already has this frame's froxels and records
+        return false;
+    }
+
     // send data to GPU
     mFroxelBuffer.commit(driverApi, mFroxelBufferUser);
-    mRecordsBuffer.commit(driverApi, mRecordBufferUser);
+
+    // grow the record buffer if this frame's records don't fit
+    bool recordBufferReallocated = false;
+    const size_t rowCount = std::max(size_t(1),
+            (mRecordCount + RECORD_BUFFER_WIDTH_MASK) >> RECORD_BUFFER_WIDTH_SHIFT);
+    if (UTILS_UNLIKELY(rowCount > mRecordsBuffer.getHeight())) {
+        size_t height = mRecordsBuffer.getHeight();
+        while (height < rowCount) {
+            height *= 2;
+        }
+        assert(height <= RECORD_BUFFER_HEIGHT_MAX);
+        mRecordsBuffer.terminate(driverApi);
+        mRecordsBuffer = GPUBuffer(driverApi, getRecordBufferElement(), RECORD_BUFFER_WIDTH, height);
+        recordBufferReallocated = true;
+    }
+
+    // mRecords is reused by the next froxelization, possibly before the driver is done with
+    // it, so the records are copied. They're too large for the command stream.
+    const size_t entryCount = rowCount * RECORD_BUFFER_WIDTH;
+    RecordBufferType* const records = (RecordBufferType*)malloc(entryCount * sizeof(RecordBufferType));
+    std::copy_n(mRecords.data(), mRecordCount, records);
+    std::fill(records + mRecordCount, records + entryCount, 0);
+    mRecordsBuffer.commit(driverApi, records, records + entryCount,
+            [](void* buffer, size_t size, void* user) { ::free(buffer); });
+
 #ifndef NDEBUG
     mFroxelBufferUser.clear();
     mRecordBufferUser.clear();
-    mFroxelShardedData.clear();
+    mFroxelLists.clear();
+    mFroxelLightCounts.clear();
 #endif
+    return recordBufferReallocated;
 }
 
 void Froxelizer::froxelizeLights(FEngine& engine,
         CameraInfo const& UTILS_RESTRICT camera,
         const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
     // note: this is called asynchronously
-    froxelizeLoop(engine, camera, lightData);
-    froxelizeAssignRecordsCompress();
+    mFroxelsUnchanged = !updateLightInputs(engine, camera, lightData);
+    if (mFroxelsUnchanged) {
+        // the froxel and record buffers on the GPU are still valid
+        return;
+    }
+
+    froxelizeLoop(engine.getJobSystem(), camera);
+    froxelizeAssignRecordsCompress(engine.getJobSystem());
 
 #ifndef NDEBUG
     if (lightData.size()) {
         // go through every froxel
         auto const& recordBufferUser(mRecordBufferUser);
-        auto gpuFroxelEntries(mFroxelBufferUser);
-        gpuFroxelEntries.set(gpuFroxelEntries.begin(),
-                mFroxelCountX * mFroxelCountY * mFroxelCountZ);
-        for (auto const& entry : gpuFroxelEntries) {
+        for (size_t i = 0, c = getFroxelCount(); i < c; i++) {
+            FroxelEntry const& entry = mFroxelBufferUser[i];
             // go through every lights for that froxel
-            for (size_t i = 0; i < entry.pointLightCount + entry.spotLightCount; i++) {
+            for (size_t j = 0; j < entry.pointLightCount + entry.spotLightCount; j++) {
                 // get the light index
-                assert(entry.offset + i < RECORD_BUFFER_ENTRY_COUNT);
+                assert(entry.offset + j < recordBufferUser.size());
 
-                size_t lightIndex = recordBufferUser[entry.offset + i];
+                size_t lightIndex = recordBufferUser[entry.offset + j];
                 assert(lightIndex <= CONFIG_MAX_LIGHT_INDEX);
 
                 // make sure it corresponds to an existing light
@@ -564,191 +665,269 @@ void Froxelizer::froxelizeLights(FEngine& engine,
 #endif
 }
 
-void Froxelizer::froxelizeLoop(FEngine& engine,
+bool Froxelizer::updateLightInputs(FEngine& engine,
         const CameraInfo& UTILS_RESTRICT camera,
         const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
     SYSTRACE_CALL();
 
-    Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
-    memset(froxelThreadData.data(), 0, froxelThreadData.sizeInBytes());
-
     auto& lcm = engine.getLightManager();
     auto const* UTILS_RESTRICT spheres      = lightData.data<FScene::POSITION_RADIUS>();
     auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
     auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
 
-    auto process = [ this, &froxelThreadData,
-                     spheres, directions, instances, &camera, &lcm ]
-            (size_t count, size_t offset, size_t stride) {
+    const size_t lightCount = lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT;
+    std::vector<LightInputs>& inputs = mLightInputs;
+    inputs.resize(lightCount);
+    for (size_t i = 0; i < lightCount; i++) {
+        const size_t j = i + FScene::DIRECTIONAL_LIGHTS_COUNT;
+        FLightManager::Instance li = instances[j];
+        inputs[i] = {
+                .positionRadius = spheres[j],
+                .direction = directions[j],
+                .cosSqr = lcm.getCosOuterSquared(li),
+                .invSin = lcm.getSinInverse(li),
+        };
+    }
+
+    // LightInputs has no padding, so it can be compared with memcmp
+    static_assert(sizeof(LightInputs) == sizeof(float) * 9, "LightInputs must be packed");
+    const bool unchanged = mLastFroxelizationValid &&
+            !mat4f::fuzzyEqual(mLastView, camera.view) &&
+            inputs.size() == mLastLightInputs.size() &&
+            !memcmp(inputs.data(), mLastLightInputs.data(), inputs.size() * sizeof(LightInputs));
+
+    std::swap(mLightInputs, mLastLightInputs);
+    mLastView = camera.view;
+    mLastFroxelizationValid = true;
+    return !unchanged;
+}
+
+void Froxelizer::froxelizeLoop(JobSystem& js,
+        const CameraInfo& UTILS_RESTRICT camera) noexcept {
+    SYSTRACE_CALL();
+
+    LightInputs const* UTILS_RESTRICT inputs = mLastLightInputs.data();
+    const size_t lightCount = mLastLightInputs.size();
+    const size_t froxelCount = getFroxelCount();
+
+    auto process = [ this, inputs, &camera, lightCount, froxelCount ](size_t job) {
 
         const mat4f& projection = mProjection;
         const mat3f& vn = camera.view.upperLeft();
-
-        for (size_t i = offset; i < count; i += stride) {
-            const size_t j = i + FScene::DIRECTIONAL_LIGHTS_COUNT;
-            FLightManager::Instance li = instances[j];
+        std::vector<LightHit>& hits = mLightHits[job];
+        size_t hitCount = 0;
+
+        // each job processes its lights in increasing order, which keeps the light lists of
+        // the froxels in a canonical order (see froxelizeAssignRecordsCompress())
+        for (size_t i = job; i < lightCount; i += FROXELIZE_JOB_COUNT) {
+            LightInputs const& input = inputs[i];
+            const float4 position = { input.positionRadius.xyz, 1 };
             LightParams light = {
-                    .position = (camera.view * float4{ spheres[j].xyz, 1 }).xyz, // to view-space
-                    .cosSqr = lcm.getCosOuterSquared(li),   // spot only
-                    .axis = vn * directions[j],             // spot only
-                    .invSin = lcm.getSinInverse(li),        // spot only
-                    .radius = spheres[j].w,
+                    .position = (camera.view * position).xyz,  // to view-space
+                    .cosSqr = input.cosSqr,                 // spot only
+                    .axis = vn * input.direction,           // spot only
+                    .invSin = input.invSin,                 // spot only
+                    .radius = input.positionRadius.w,
             };
 
-            const size_t group = i % GROUP_COUNT;
-            const size_t bit   = i / GROUP_COUNT;
-            assert(bit < LIGHT_PER_GROUP);
-
-            FroxelThreadData& threadData = froxelThreadData[group];
             const bool isSpot = light.invSin != std::numeric_limits<float>::infinity();
-            threadData[0] |= isSpot << bit;
-            froxelizePointAndSpotLight(threadData, bit, projection, light);
+            const LightHit lightBits = (LightHit(i) << 16u) | (isSpot ? LIGHT_HIT_SPOT_BIT : 0u);
+            hitCount = froxelizePointAndSpotLight(hits, hitCount, lightBits, projection, light);
+        }
+        mLightHitCounts[job] = hitCount;
+
+        // count this job's point and spot lights of each froxel, packed as point | spot << 16
+        LightHit const* const UTILS_RESTRICT froxelHits = hits.data();
+        uint32_t* const UTILS_RESTRICT counts = mJobLightCounts[job].data();
+        std::fill_n(counts, froxelCount, 0u);
+        for (size_t i = 0; i < hitCount; i++) {
+            const LightHit hit = froxelHits[i];
+            counts[hit & 0xFFFFu] += (hit & LIGHT_HIT_SPOT_BIT) ? 0x10000u : 1u;
         }
     };
 
-    // we do 64 lights per job
-    JobSystem& js = engine.getJobSystem();
-
-    constexpr bool SINGLE_THREADED = false;
-    if (!SINGLE_THREADED) {
-        auto parent = js.createJob();
-        for (size_t i = 0; i < GROUP_COUNT; i++) {
-            js.run(jobs::createJob(js, parent, std::cref(process),
-                    lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, i, GROUP_COUNT));
-        }
-        js.runAndWait(parent);
-    } else {
-        js.runAndWait(jobs::createJob(js, nullptr, std::cref(process),
-                lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, 0, 1)
-        );
-    }
+    runJobs(js, FROXELIZE_JOB_COUNT, process);
 }
 
-void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
+void Froxelizer::froxelizeAssignRecordsCompress(JobSystem& js) noexcept {
 
     SYSTRACE_CALL();
 
-    Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
-
-    // convert froxel data from N groups of M bits to LightRecord::bitset, so we can
-    // easily compare adjacent froxels, for compaction. The conversion loops below get
-    // inlined and vectorized in release builds.
-
-    // keep these two loops separate, it helps the compiler a lot
-    LightRecord::bitset spotLights;
-    for (size_t i = 0; i < LightRecord::bitset::WORLD_COUNT; i++) {
-        using container_type = LightRecord::bitset::container_type;
-        constexpr size_t r = sizeof(container_type) / sizeof(LightGroupType);
-        container_type b = froxelThreadData[i * r][0];
-        for (size_t k = 0; k < r; k++) {
-            b |= (container_type(froxelThreadData[i * r + k][0]) << (LIGHT_PER_GROUP * k));
+    const size_t froxelCount = getFroxelCount();
+
+    // Replace each job's light counts by the sum of the previous jobs' ones, i.e. where its
+    // lights go in each froxel's list, and sum all of them into the froxels' light counts.
+    // The light counts are packed as point | spot << 16, which can't overflow.
+    uint32_t* const UTILS_RESTRICT totals = mFroxelLightCounts.data();
+    std::fill_n(totals, froxelCount, 0u);
+    for (size_t job = 0; job < FROXELIZE_JOB_COUNT; job++) {
+        uint32_t* const UTILS_RESTRICT counts = mJobLightCounts[job].data();
+        // this loop gets vectorized
+        for (size_t i = 0; i < froxelCount; i++) {
+            const uint32_t count = counts[i];
+            counts[i] = totals[i];
+            totals[i] += count;
         }
-        spotLights.getBitsAt(i) = b;
     }
 
-    // this gets very well vectorized...
-    utils::Slice<LightRecord> records(mLightRecords);
-    for (size_t j = 1, jc = FROXEL_BUFFER_ENTRY_COUNT_MAX; j < jc; j++) {
-        for (size_t i = 0; i < LightRecord::bitset::WORLD_COUNT; i++) {
-            using container_type = LightRecord::bitset::container_type;
-            constexpr size_t r = sizeof(container_type) / sizeof(LightGroupType);
-            container_type b = froxelThreadData[i * r][j];
-            for (size_t k = 0; k < r; k++) {
-                b |= (container_type(froxelThreadData[i * r + k][j]) << (LIGHT_PER_GROUP * k));
-            }
-            records[j - 1].lights.getBitsAt(i) = b;
-        }
+    // each froxel's light list follows the previous one's, point lights first
+    FroxelEntry* const UTILS_RESTRICT lists = mFroxelLists.data();
+    size_t hitCount = 0;
+    for (size_t i = 0; i < froxelCount; i++) {
+        const uint16_t pointCount = uint16_t(totals[i] & 0xFFFFu);
+        const uint16_t spotCount  = uint16_t(totals[i] >> 16u);
+        lists[i] = { uint32_t(hitCount), pointCount, spotCount };
+        hitCount += pointCount + spotCount;
+    }
+    if (mFroxelLightLists.size() < hitCount) {
+        mFroxelLightLists.resize(hitCount);
     }
 
-    uint16_t offset = 0;
+    // Scatter the lights in the lists, each job in its own slots. A job's lights are in
+    // increasing order and go after the previous jobs' ones, so that froxels lit by the same
+    // lights end up with identical lists.
+    RecordBufferType* const UTILS_RESTRICT lightLists = mFroxelLightLists.data();
+    runJobs(js, FROXELIZE_JOB_COUNT, [this, lists, lightLists](size_t job) {
+        LightHit const* const UTILS_RESTRICT hits = mLightHits[job].data();
+        uint32_t* const UTILS_RESTRICT cursors = mJobLightCounts[job].data();
+        for (size_t i = 0, c = mLightHitCounts[job]; i < c; i++) {
+            const LightHit hit = hits[i];
+            const size_t froxel = hit & 0xFFFFu;
+            const bool isSpot = (hit & LIGHT_HIT_SPOT_BIT) != 0;
+            const uint32_t cursor = cursors[froxel];
+            const size_t index = lists[froxel].offset + (isSpot ?
+                    lists[froxel].pointLightCount + (cursor >> 16u) : (cursor & 0xFFFFu));
+            cursors[froxel] = cursor + (isSpot ? 0x10000u : 1u);
+            lightLists[index] = RecordBufferType((hit & ~LIGHT_HIT_SPOT_BIT) >> 16u);
+        }
+    });
+
     FroxelEntry* const UTILS_RESTRICT froxels = mFroxelBufferUser.data();
 
     const size_t froxelCountX = mFroxelCountX;
-    auto remap = [stride = size_t(froxelCountX * mFroxelCountY)](size_t i) -> size_t {
-        if (SUPPORTS_REMAPPED_FROXELS) {
-            // TODO: with the non-square froxel change these would be mask ops instead of divide.
-            i = (i % stride) * FEngine::CONFIG_FROXEL_SLICE_COUNT + (i / stride);
-        }
-        return i;
+    const size_t froxelCountY = mFroxelCountY;
+    const size_t sliceFroxelCount = froxelCountX * froxelCountY;
+
+    auto isSameList = [lightLists](FroxelEntry const& lhs, FroxelEntry const& rhs) -> bool {
+        return lhs.pointLightCount == rhs.pointLightCount &&
+               lhs.spotLightCount == rhs.spotLightCount &&
+               std::equal(lightLists + lhs.offset,
+                       lightLists + lhs.offset + lhs.pointLightCount + lhs.spotLightCount,
+                       lightLists + rhs.offset);
     };
 
-    RecordBufferType* const UTILS_RESTRICT froxelRecords = mRecordBufferUser.data();
-
-    // how many froxel record entries were reused (for debugging)
-    UTILS_UNUSED size_t reused = 0;
+    /*
+     * The records are assigned in parallel, one z-slice per job, in two passes. The first pass
+     * finds which froxels share the records of the froxel on their left, or above them, and
+     * assigns the other ones an offset relative to their slice, in the froxel buffer. The second
+     * pass copies the records and stores the final froxels in the lists, which are then copied
+     * to the froxel buffer in its GPU layout.
+     */
 
-    for (size_t i = 0, c = getFroxelCount(); i < c;) {
-        LightRecord b = records[i];
-        if (b.lights.none()) {
-            froxels[remap(i++)].u32 = 0;
-            continue;
+    // markers of the froxels sharing records in the first pass, these are not valid offsets
+    constexpr uint32_t SAME_AS_LEFT  = 0xFFFFFFFFu;
+    constexpr uint32_t SAME_AS_ABOVE = 0xFFFFFFFEu;
+    constexpr uint32_t SLICE_DROPPED = 0xFFFFFFFFu;
+
+    uint32_t sliceRecordCounts[FEngine::CONFIG_FROXEL_SLICE_COUNT];
+    uint32_t sliceRecordOffsets[FEngine::CONFIG_FROXEL_SLICE_COUNT];
+    const size_t sliceCount = mFroxelCountZ;
+    assert(sliceCount <= FEngine::CONFIG_FROXEL_SLICE_COUNT);
+
+    runJobs(js, sliceCount, [&](size_t slice) {
+        const size_t begin = slice * sliceFroxelCount;
+        const size_t end = begin + sliceFroxelCount;
+        uint32_t recordCount = 0;
+        for (size_t i = begin; i < end; i++) {
+            FroxelEntry const& list = lists[i];
+            FroxelEntry& froxel = froxels[i];
+            froxel = { recordCount, list.pointLightCount, list.spotLightCount };
+            if (!(list.pointLightCount + list.spotLightCount)) {
+                froxel.offset = 0;
+                continue;
+            }
+            // if this froxel has the same lights as the one on its left, or the one above it,
+            // it shares its records, which saves many records (north of 10% for the one above)
+            if (i > begin && isSameList(list, lists[i - 1])) {
+                froxel.offset = SAME_AS_LEFT;
+            } else if (i >= begin + froxelCountX && isSameList(list, lists[i - froxelCountX])) {
+                froxel.offset = SAME_AS_ABOVE;
+            } else {
+                recordCount += list.pointLightCount + list.spotLightCount;
+            }
         }
+        sliceRecordCounts[slice] = recordCount;
+    });
 
-        // We have a limitation of 255 spot + 255 point lights per froxel.
-        FroxelEntry entry = {
-                .offset = offset,
-                .pointLightCount = (uint8_t)std::min(size_t(255), (b.lights & ~spotLights).count()),
-                .spotLightCount  = (uint8_t)std::min(size_t(255), (b.lights &  spotLights).count())
-        };
-        const size_t lightCount = entry.count[0] + entry.count[1];
-
-        if (UTILS_UNLIKELY(offset + lightCount >= RECORD_BUFFER_ENTRY_COUNT)) {
+    size_t recordCount = 0;
+    for (size_t slice = 0; slice < sliceCount; slice++) {
+        if (UTILS_UNLIKELY(recordCount + sliceRecordCounts[slice] > RECORD_BUFFER_ENTRY_COUNT_MAX)) {
 #ifndef NDEBUG
-            slog.d << "out of space: " << i << ", at " << offset << io::endl;
+            slog.d << "out of space: slice " << slice << ", at " << recordCount << io::endl;
 #endif
-            // note: instead of dropping froxels we could look for similar records we've already
-            // filed up.
-            do { // this compiles to memset() when remap() is identity
-                froxels[remap(i++)].u32 = 0;
-            } while(i < c);
-            goto out_of_memory;
+            // this slice's froxels are dropped, but the next slices might still fit
+            sliceRecordOffsets[slice] = SLICE_DROPPED;
+            continue;
         }
+        sliceRecordOffsets[slice] = uint32_t(recordCount);
+        recordCount += sliceRecordCounts[slice];
+    }
 
-        // iterate the bitfield
-        auto beginPoint = froxelRecords + offset;
-        auto beginSpot  = froxelRecords + offset + entry.count[0];
-        b.lights.forEachSetBit([&spotLights,
-                point = beginPoint, spot = beginSpot, beginPoint, beginSpot]
-                (size_t l) mutable {
-
-            // make sure to keep this code branch-less
-            const bool isSpot = spotLights[l];
-            auto& p = isSpot ? spot      : point;
-            auto  s = isSpot ? beginSpot : beginPoint;
-
-            const size_t word = l / LIGHT_PER_GROUP;
-            const size_t bit  = l % LIGHT_PER_GROUP;
-            l = (bit * GROUP_COUNT) | (word % GROUP_COUNT);
-
-            *p = (RecordBufferType)l;
-            // we need to "cancel" the write if we have more than 255 spot or point lights
-            // (this is a limitation of the data type used to store the light counts per froxel)
-            p += (p - s < 255) ? 1 : 0;
-        });
-
-        offset += lightCount;
+    if (UTILS_UNLIKELY(recordCount > mRecords.size())) {
+        mRecords.resize(std::min(RECORD_BUFFER_ENTRY_COUNT_MAX,
+                std::max({ recordCount, mRecords.size() * 2, RECORD_BUFFER_ENTRY_COUNT_MIN })));
+    }
 
-#ifndef NDEBUG
-        if (lightCount) { reused--; }
-#endif
-        do {
-#ifndef NDEBUG
-            if (lightCount) { reused++; }
-#endif
-            froxels[remap(i++)].u32 = entry.u32;
-            if (i >= c) break;
-
-            if (records[i].lights != b.lights && i >= froxelCountX) {
-                // if this froxel record doesn't match the previous one on its left,
-                // we re-try with the record above it, which saves many froxel records
-                // (north of 10% in practice).
-                b = records[i - froxelCountX];
-                entry.u32 = froxels[remap(i - froxelCountX)].u32;
+    RecordBufferType* const UTILS_RESTRICT records = mRecords.data();
+    runJobs(js, sliceCount, [&](size_t slice) {
+        const size_t begin = slice * sliceFroxelCount;
+        const size_t end = begin + sliceFroxelCount;
+        const uint32_t recordOffset = sliceRecordOffsets[slice];
+        for (size_t i = begin; i < end; i++) {
+            // the lists on the left and above are final already
+            FroxelEntry froxel = froxels[i];
+            if (froxel.offset == SAME_AS_LEFT) {
+                froxel = lists[i - 1];
+            } else if (froxel.offset == SAME_AS_ABOVE) {
+                froxel = lists[i - froxelCountX];
+            } else if (froxel.pointLightCount + froxel.spotLightCount) {
+                if (UTILS_UNLIKELY(recordOffset == SLICE_DROPPED)) {
+                    froxel = {};
+                } else {
+                    FroxelEntry const& list = lists[i];
+                    std::copy_n(lightLists + list.offset,
+                            list.pointLightCount + list.spotLightCount,
+                            records + recordOffset + froxel.offset);
+                    froxel.offset += recordOffset;
+                }
+            }
+            lists[i] = froxel;
+        }
+    });
+
+    if (SUPPORTS_REMAPPED_FROXELS) {
+        // the GPU layout is z-major, i.e. froxel (x, y, z) is at (x + y * countX) * countZ + z,
+        // each job writes a contiguous range of rows
+        const size_t froxelCountZ = mFroxelCountZ;
+        runJobs(js, FROXELIZE_JOB_COUNT, [=](size_t job) {
+            const size_t y0 = (froxelCountY *  job     ) / FROXELIZE_JOB_COUNT;
+            const size_t y1 = (froxelCountY * (job + 1)) / FROXELIZE_JOB_COUNT;
+            FroxelEntry* UTILS_RESTRICT out = froxels + y0 * froxelCountX * froxelCountZ;
+            for (size_t i = y0 * froxelCountX, c = y1 * froxelCountX; i < c; i++) {
+                for (size_t iz = 0; iz < froxelCountZ; iz++) {
+                    *out++ = lists[i + iz * sliceFroxelCount];
+                }
             }
-        } while(records[i].lights == b.lights);
+        });
+    } else {
+        std::copy_n(lists, froxelCount, froxels);
     }
-out_of_memory:
-    ;
+
+    // the froxel buffer is sent by whole rows
+    std::fill(froxels + froxelCount, mFroxelBufferUser.end(), FroxelEntry{});
+
+    mRecordCount = recordCount;
+    mRecordBufferUser = { mRecords.data(), recordCount };
 }
 
 static inline float2 project(mat4f const& p, float3 const& v) noexcept {
@@ -773,8 +952,35 @@ static inline float2 project(mat4f const& p, float3 const& v) noexcept {
     return float2{ x, y } * (1 / w);
 }
 
-void Froxelizer::froxelizePointAndSpotLight(
-        FroxelThreadData& froxelThread, size_t bit,
+/*
+ * Tests a row of froxels' bounding spheres against a spot light's cone, this is the same test as
+ * sphereConeIntersectionFast(), written over the SoA bounding spheres so that it vectorizes.
+ */
+static void sphereConeIntersectionFastRow(uint8_t* UTILS_RESTRICT intersects, size_t count,
+        float const* UTILS_RESTRICT spheresX, float const* UTILS_RESTRICT spheresY,
+        float const* UTILS_RESTRICT spheresZ, float const* UTILS_RESTRICT spheresR,
+        float3 const& conePosition, float3 const& coneAxis,
+        float coneSinInverse, float coneCosSquared) noexcept {
+    const float px = conePosition.x;
+    const float py = conePosition.y;
+    const float pz = conePosition.z;
+    const float ax = coneAxis.x;
+    const float ay = coneAxis.y;
+    const float az = coneAxis.z;
+    #pragma clang loop vectorize_width(8)
+    for (size_t i = 0; i < count; i++) {
+        const float k = spheresR[i] * coneSinInverse;
+        const float dx = spheresX[i] - (px - k * ax);
+        const float dy = spheresY[i] - (py - k * ay);
+        const float dz = spheresZ[i] - (pz - k * az);
+        const float e = ax * dx + ay * dy + az * dz;
+        const float dd = dx * dx + dy * dy + dz * dz;
+        intersects[i] = uint8_t((e * e >= dd * coneCosSquared) & (e > 0));
+    }
+}
+
+size_t Froxelizer::froxelizePointAndSpotLight(
+        std::vector<LightHit>& hits, size_t hitCount, LightHit lightBits,
         mat4f const& UTILS_RESTRICT p,
         const Froxelizer::LightParams& UTILS_RESTRICT light) const noexcept {
 
@@ -782,7 +988,7 @@ void Froxelizer::froxelizePointAndSpotLight(
         // This light is fully behind LightFar, it doesn't light anything
         // (we could avoid this check if we culled lights using LightFar instead of the
         // culling camera's far plane)
-        return;
+        return hitCount;
     }
 
     // the code below works with radius^2
@@ -828,11 +1034,24 @@ void Froxelizer::froxelizePointAndSpotLight(
     assert(z0 <= z1);
 #endif
 
+    // make room for every froxel of the bounding-box, so the loops below don't check for space
+    const size_t maxHitCount = (x1 - x0) * (y1 - y0 + 1) * (z1 - z0 + 1);
+    if (UTILS_UNLIKELY(hitCount + maxHitCount > hits.size())) {
+        if (UTILS_UNLIKELY(hitCount + maxHitCount > LIGHT_HIT_COUNT_MAX_PER_JOB)) {
+            // out of space, this light is dropped
+            return hitCount;
+        }
+        hits.resize(std::min(LIGHT_HIT_COUNT_MAX_PER_JOB,
+                std::max(hitCount + maxHitCount, hits.size() * 2)));
+    }
+    LightHit* const UTILS_RESTRICT froxelHits = hits.data();
+
     const size_t zcenter = findSliceZ(s.z);
     float4 const * const UTILS_RESTRICT planesX = mPlanesX;
     float4 const * const UTILS_RESTRICT planesY = mPlanesY;
     float const * const UTILS_RESTRICT planesZ = mDistancesZ;
-    float4 const * const UTILS_RESTRICT boundingSpheres = mBoundingSpheres;
+    BoundingSpheres const& spheres = mBoundingSpheres;
+    uint8_t intersects[SPOT_LIGHT_TEST_BATCH_SIZE];
     for (size_t iz = z0 ; iz <= z1; ++iz) {
         float4 cz(s);
         if (UTILS_LIKELY(iz != zcenter)) {
@@ -878,27 +1097,33 @@ void Froxelizer::froxelizePointAndSpotLight(
 
                     assert(bx < mFroxelCountX && ex <= mFroxelCountX);
 
-                    // The first entry reserved for type of light, i.e. point/spot
-                    size_t fi = getFroxelIndex(bx, iy, iz) + 1;
+                    size_t fi = getFroxelIndex(bx, iy, iz);
                     if (light.invSin != std::numeric_limits<float>::infinity()) {
                         // This is a spotlight (common case)
-                        // this loops gets vectorized (on arm64) w/ clang
-                        while (bx++ != ex) {
-                            // see if this froxel intersects the cone
-                            bool intersect = sphereConeIntersectionFast(boundingSpheres[fi - 1],
+                        // test the row against the cone first, 8 froxels at a time
+                        for (size_t n = ex - bx; n; ) {
+                            const size_t c = std::min(n, SPOT_LIGHT_TEST_BATCH_SIZE);
+                            sphereConeIntersectionFastRow(intersects, c,
+                                    spheres.x + fi, spheres.y + fi, spheres.z + fi, spheres.r + fi,
                                     light.position, light.axis, light.invSin, light.cosSqr);
-                            froxelThread[fi++] |= LightGroupType(intersect) << bit;
+                            // the hit is always written, but only kept if the froxel intersects
+                            for (size_t i = 0; i < c; i++) {
+                                froxelHits[hitCount] = lightBits | LightHit(fi + i);
+                                hitCount += intersects[i];
+                            }
+                            fi += c;
+                            n -= c;
                         }
                     } else {
-                        // this loops gets vectorized (on arm64) w/ clang
                         while (bx++ != ex) {
-                            froxelThread[fi++] |= LightGroupType(1) << bit;
+                            froxelHits[hitCount++] = lightBits | LightHit(fi++);
                         }
                     }
                 }
             }
         }
     }
+    return hitCount;
 }
 
 /*
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/LocalShadowMaps.h"
+
+#include "details/Engine.h"
+#include "details/ShadowMap.h"
+
+#include <filament/driver/DriverEnums.h>
+
+#include <utils/Systrace.h>
+
+#include <math/scalar.h>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+
+using namespace filament::math;
+using namespace utils;
+
+namespace filament {
+
+using namespace driver;
+
+namespace details {
+
+// the faces of a point light's cube, in the order the shaders expect them
+static constexpr float3 CUBE_FACE_DIRECTIONS[6] = {
+        { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+static constexpr float3 CUBE_FACE_UPS[6] = {
+        { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 } };
+
+// the budget of all the shadow maps
+static constexpr uint32_t ATLAS_DIMENSION = 2048;
+static constexpr uint32_t MIN_SHADOW_MAP_DIMENSION = 64;
+
+// number of shadow maps rendered each frame
+static constexpr size_t MAX_UPDATES_PER_FRAME = 6;
+
+// widest spot light cone a shadow map can cover
+static constexpr float MAX_SPOT_FOV = float(M_PI * 170.0 / 180.0);
+
+LocalShadowMaps::LocalShadowMaps(FEngine& engine) noexcept
+        : mClipSpaceFlipped(engine.getBackend() == Backend::VULKAN) {
+}
+
+LocalShadowMaps::~LocalShadowMaps() noexcept = default;
+
+void LocalShadowMaps::terminate(DriverApi& driver) noexcept {
+    mAtlas.terminate(driver);
+    mRecords.clear();
+}
+
+void LocalShadowMaps::release(Record& record) noexcept {
+    if (record.dimension) {
+        for (size_t f = 0; f < record.faceCount; f++) {
+            mAllocator.free(record.faces[f].tile);
+        }
+        record.dimension = 0;
+    }
+    for (Face& face : record.faces) {
+        face.rendered = false;
+    }
+}
+
+bool LocalShadowMaps::prepare(DriverApi& driver, FLightManager const& lcm,
+        FScene::LightSoa& lightData, CameraInfo const& camera,
+        Viewport const& viewport) noexcept {
+    SYSTRACE_CALL();
+
+    mFrame++;
+    mUpdates.clear();
+
+    auto const* const UTILS_RESTRICT spheres = lightData.data<FScene::POSITION_RADIUS>();
+    auto const* const UTILS_RESTRICT instances = lightData.data<FScene::LIGHT_INSTANCE>();
+    float2* const UTILS_RESTRICT shadowParams = lightData.data<FScene::SHADOW_PARAMS>();
+
+    // 1) The importance of a light is the size of its sphere of influence on screen, relative
+    // to the viewport: radius * projection[1][1] / sqrt(distance^2 - radius^2)
+    const float3 eye = camera.getPosition();
+    const float scale = std::abs(camera.projection[1][1]);
+    std::vector<Candidate>& candidates = mCandidates;
+    candidates.clear();
+    for (size_t i = FScene::DIRECTIONAL_LIGHTS_COUNT, c = lightData.size(); i < c; i++) {
+        FLightManager::Instance li = instances[i];
+        if (!lcm.isShadowCaster(li)) {
+            continue;
+        }
+        const float r = spheres[i].w;
+        const float3 d = spheres[i].xyz - eye;
+        const float h2 = dot(d, d) - r * r;
+        // the camera may be inside the light's sphere
+        const float importance = h2 > 0.0f ? std::min(1.0f, r * scale / std::sqrt(h2)) : 1.0f;
+        candidates.push_back({ lcm.getEntity(li), uint32_t(i), importance });
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+            [](Candidate const& lhs, Candidate const& rhs) {
+                return lhs.importance > rhs.importance;
+            });
+
+    // 2) the most important lights cast shadows, as long as their shadow maps fit the uniforms
+    size_t shadowMapCount = 0;
+    size_t selectedCount = 0;
+    for (Candidate const& candidate : candidates) {
+        const uint8_t faceCount = uint8_t(lcm.isPointLight(instances[candidate.index]) ? 6 : 1);
+        if (shadowMapCount + faceCount > CONFIG_MAX_LOCAL_SHADOW_MAPS) {
+            continue;
+        }
+        shadowMapCount += faceCount;
+        candidates[selectedCount++] = candidate;
+        Record& record = mRecords[candidate.entity];
+        record.frame = mFrame;
+        if (record.faceCount != faceCount) {
+            release(record);
+            record.faceCount = faceCount;
+        }
+    }
+    candidates.resize(selectedCount);
+
+    // the other lights give their shadow maps back
+    for (auto it = mRecords.begin(); it != mRecords.end();) {
+        if (it->second.frame != mFrame) {
+            release(it.value());
+            it = mRecords.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (mRecords.empty()) {
+        // the atlas is only kept while it's used
+        mAtlas.terminate(driver);
+        return false;
+    }
+
+    if (mAtlas.prepare(driver, ATLAS_DIMENSION, 1)) {
+        // the content of a new atlas is undefined
+        mAllocator.init(ATLAS_DIMENSION, MIN_SHADOW_MAP_DIMENSION);
+        for (auto it = mRecords.begin(); it != mRecords.end(); ++it) {
+            Record& record = it.value();
+            record.dimension = 0;
+            for (Face& face : record.faces) {
+                face.rendered = false;
+            }
+        }
+    }
+
+    // 3) The shadow maps are sized after the lights on screen. The requested size changes only
+    // when the light's size on screen is well out of its range, so that the shadow maps aren't
+    // reallocated (and rendered) all the time.
+    for (Candidate const& candidate : candidates) {
+        Record& record = mRecords.find(candidate.entity).value();
+        const float ideal = candidate.importance * viewport.height;
+        const uint32_t maxDimension = std::max(MIN_SHADOW_MAP_DIMENSION,
+                std::min(ATLAS_DIMENSION, lcm.getShadowMapSize(instances[candidate.index])));
+        uint32_t requested = record.requestedDimension;
+        if (!requested || ideal > requested * 1.1f || ideal < requested * 0.45f) {
+            requested = MIN_SHADOW_MAP_DIMENSION;
+            while (requested < ideal && requested < maxDimension) {
+                requested *= 2;
+            }
+        }
+        requested = std::min(requested, maxDimension);
+        if (requested != record.requestedDimension) {
+            release(record);
+            record.requestedDimension = requested;
+        }
+    }
+
+    // 4) The most important lights are allocated first, with smaller shadow maps than
+    // requested when the atlas is full. The lights that don't fit don't cast shadows.
+    for (Candidate const& candidate : candidates) {
+        Record& record = mRecords.find(candidate.entity).value();
+        for (uint32_t dim = record.requestedDimension;
+                !record.dimension && dim >= MIN_SHADOW_MAP_DIMENSION; dim /= 2) {
+            size_t f = 0;
+            for (; f < record.faceCount; f++) {
+                record.faces[f].tile = mAllocator.allocate(dim);
+                if (record.faces[f].tile.empty()) {
+                    break;
+                }
+            }
+            if (f == record.faceCount) {
+                record.dimension = dim;
+            } else {
+                while (f--) {
+                    mAllocator.free(record.faces[f].tile);
+                }
+            }
+        }
+        if (record.dimension) {
+            updateFaces(record, lcm, lightData, candidate.index);
+        }
+    }
+
+    // 5) Only a few shadow maps are rendered each frame: the ones never rendered first, then
+    // the ones whose light camera changed, then the oldest ones. Otherwise, the most important
+    // lights first.
+    auto& staleFaces = mStaleFaces;
+    staleFaces.clear();
+    for (Candidate const& candidate : candidates) {
+        Record& record = mRecords.find(candidate.entity).value();
+        if (!record.dimension) {
+            continue;
+        }
+        for (size_t f = 0; f < record.faceCount; f++) {
+            Face& face = record.faces[f];
+            uint64_t state = 2;
+            if (!face.rendered) {
+                state = 0;
+            } else if (memcmp(&face.lightFromWorld, &face.renderedLightFromWorld,
+                    sizeof(mat4f)) != 0) {
+                state = 1;
+            }
+            staleFaces.emplace_back((state << 32u) | face.renderedFrame, &face);
+        }
+    }
+    std::stable_sort(staleFaces.begin(), staleFaces.end(),
+            [](auto const& lhs, auto const& rhs) { return lhs.first < rhs.first; });
+
+    for (size_t i = 0, c = std::min(staleFaces.size(), MAX_UPDATES_PER_FRAME); i < c; i++) {
+        Face& face = *staleFaces[i].second;
+        face.rendered = true;
+        face.renderedFrame = mFrame;
+        face.renderedLightFromWorld = face.lightFromWorld;
+        Viewport const& tile = face.tile;
+        mUpdates.push_back({
+                face.camera,
+                FCamera::getFrustum(mat4{ face.camera.cullingProjection }, face.camera.view),
+                tile,
+                { tile.left + 1, tile.bottom + 1, tile.width - 2, tile.height - 2 } });
+    }
+
+    // 6) the lights whose shadow maps are all rendered are shadowed
+    size_t shadowIndex = 0;
+    for (Candidate const& candidate : candidates) {
+        Record const& record = mRecords.find(candidate.entity).value();
+        if (!record.dimension) {
+            continue;
+        }
+        bool rendered = true;
+        for (size_t f = 0; f < record.faceCount; f++) {
+            rendered &= record.faces[f].rendered;
+        }
+        if (!rendered) {
+            continue;
+        }
+        for (size_t f = 0; f < record.faceCount; f++) {
+            mShadowMatrices[shadowIndex + f] = record.faces[f].renderedLightFromWorld;
+        }
+        shadowParams[candidate.index] = float2{ float(shadowIndex), record.normalBiasScale };
+        shadowIndex += record.faceCount;
+    }
+    assert(shadowIndex <= CONFIG_MAX_LOCAL_SHADOW_MAPS);
+
+    return true;
+}
+
+void LocalShadowMaps::updateFaces(Record& record, FLightManager const& lcm,
+        FScene::LightSoa const& lightData, size_t index) noexcept {
+    FLightManager::Instance li = lightData.elementAt<FScene::LIGHT_INSTANCE>(index);
+    const float4 sphere = lightData.elementAt<FScene::POSITION_RADIUS>(index);
+    const float3 position = sphere.xyz;
+    const float zf = sphere.w;
+    const float zn = zf * 0.01f;
+
+    // the shadow maps are rendered in their tile minus its 1-texel border
+    const float dimension = record.dimension - 2.0f;
+    float tanHalfFov;
+    if (record.faceCount == 6) {
+        // the faces overlap by a texel so that the shadow maps can be filtered at their edges
+        tanHalfFov = dimension / (dimension - 2.0f);
+    } else {
+        const float halfFov = std::acos(std::sqrt(lcm.getCosOuterSquared(li)));
+        tanHalfFov = std::tan(clamp(halfFov, 0.01f, MAX_SPOT_FOV * 0.5f));
+    }
+
+    // the normal bias is scaled by the size of a texel at a distance of 1 from the light
+    record.normalBiasScale = lcm.getShadowNormalBias(li) * 2.0f * tanHalfFov / dimension;
+
+    const float t = tanHalfFov * zn;
+    const mat4f projection(mat4f::frustum(-t, t, -t, t, zn, zf));
+    for (size_t f = 0; f < record.faceCount; f++) {
+        Face& face = record.faces[f];
+        const float3 direction = record.faceCount == 6 ? CUBE_FACE_DIRECTIONS[f] :
+                lightData.elementAt<FScene::DIRECTION>(index);
+        // the up vector of a spot light must not be colinear with its direction
+        const float3 up = record.faceCount == 6 ? CUBE_FACE_UPS[f] :
+                (std::abs(direction.y) > 0.99f ? float3{ 1, 0, 0 } : float3{ 0, 1, 0 });
+        const mat4f model(mat4f::lookAt(position, position + direction, up));
+        face.camera = CameraInfo{
+                .projection         = projection,
+                .cullingProjection  = projection,
+                .model              = model,
+                .view               = FCamera::getViewMatrix(model),
+                .zn                 = zn,
+                .zf                 = zf,
+        };
+        face.lightFromWorld = ShadowMap::getTextureCoordsMapping(face.tile,
+                mAtlas.getDimension(), mClipSpaceFlipped) * projection * face.camera.view;
+    }
+}
+
+} // namespace details
+} // namespace filament
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/OcclusionCuller.h"
+
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
+#include <math/mat3.h>
+#include <math/vec2.h>
+#include <math/vec4.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <cmath>
+
+using namespace filament::math;
+using namespace utils;
+
+namespace filament {
+namespace details {
+
+static_assert(OcclusionCuller::WIDTH % OcclusionCuller::TILE_SIZE == 0,
+        "WIDTH must be a multiple of TILE_SIZE");
+static_assert(OcclusionCuller::HEIGHT % OcclusionCuller::TILE_SIZE == 0,
+        "HEIGHT must be a multiple of TILE_SIZE");
+
+static constexpr float FAR_DEPTH = std::numeric_limits<float>::infinity();
+
+// The corners of a box, bit 0, 1, 2 select the min or max of x, y, z respectively. Each face
+// is given by 3 of its corners, such that they're counter-clockwise when seen from outside.
+static constexpr uint8_t sFaces[6][3] = {
+        { 0, 4, 2 },    // -x
+        { 1, 3, 5 },    // +x
+        { 0, 1, 4 },    // -y
+        { 2, 6, 3 },    // +y
+        { 0, 2, 1 },    // -z
+        { 4, 5, 6 },    // +z
+};
+
+// Projects the corners of a box to screen space (pixels, z is the NDC depth), returns false
+// if any corner is in front of the near plane.
+static bool projectBox(float3* UTILS_RESTRICT out, mat4f const& clipFromLocal,
+        float3 const& center, float3 const& extent) noexcept {
+    const float4 c = clipFromLocal * float4{ center, 1 };
+    const float4 ex = clipFromLocal[0] * extent.x;
+    const float4 ey = clipFromLocal[1] * extent.y;
+    const float4 ez = clipFromLocal[2] * extent.z;
+    const float2 scale = float2{ OcclusionCuller::WIDTH, OcclusionCuller::HEIGHT } * 0.5f;
+    for (size_t i = 0; i < 8; i++) {
+        const float4 p = c + ((i & 1u) ? ex : -ex) + ((i & 2u) ? ey : -ey) + ((i & 4u) ? ez : -ez);
+        // this also rejects NaNs
+        if (!(p.w > 0 && p.z >= -p.w)) {
+            return false;
+        }
+        const float3 ndc = p.xyz * (1.0f / p.w);
+        out[i] = float3{ (ndc.xy + 1.0f) * scale, ndc.z };
+    }
+    return true;
+}
+
+OcclusionCuller::OcclusionCuller() noexcept = default;
+
+OcclusionCuller::~OcclusionCuller() noexcept = default;
+
+void OcclusionCuller::begin(mat4f const& clipFromWorld) noexcept {
+    mClipFromWorld = clipFromWorld;
+    mPolygons.clear();
+}
+
+void OcclusionCuller::addOccluder(mat4f const& worldTransform, Box const& box) {
+    float3 corners[8];
+    if (!projectBox(corners, mClipFromWorld * worldTransform, box.center, box.halfExtent)) {
+        return;
+    }
+
+    Polygon polygon;
+
+    // the silhouette is the convex hull of the corners (Andrew's monotone chain)
+    float2 points[8];
+    for (size_t i = 0; i < 8; i++) {
+        points[i] = corners[i].xy;
+    }
+    std::sort(points, points + 8, [](float2 const& lhs, float2 const& rhs) {
+        return lhs.x < rhs.x || (lhs.x == rhs.x && lhs.y < rhs.y);
+    });
+    auto turn = [](float2 const& o, float2 const& a, float2 const& b) {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+    };
+    float2 hull[16];
+    size_t k = 0;
+    for (size_t i = 0; i < 8; i++) {
+        while (k >= 2 && turn(hull[k - 2], hull[k - 1], points[i]) <= 0) k--;
+        hull[k++] = points[i];
+    }
+    for (size_t i = 7, t = k + 1; i-- > 0;) {
+        while (k >= t && turn(hull[k - 2], hull[k - 1], points[i]) <= 0) k--;
+        hull[k++] = points[i];
+    }
+    const size_t edgeCount = k - 1;
+    if (edgeCount < 3 || edgeCount > MAX_EDGES) {
+        return;
+    }
+
+    polygon.edgeCount = uint32_t(edgeCount);
+    polygon.xmin = polygon.ymin = std::numeric_limits<float>::max();
+    polygon.xmax = polygon.ymax = std::numeric_limits<float>::lowest();
+    for (size_t i = 0; i < edgeCount; i++) {
+        float2 const& p0 = hull[i];
+        float2 const& p1 = hull[i + 1];
+        const float a = p0.y - p1.y;
+        const float b = p1.x - p0.x;
+        // the whole pixel must be inside the edge
+        const float c = -(a * p0.x + b * p0.y) - 0.5f * (std::abs(a) + std::abs(b));
+        polygon.edges[i] = float3{ a, b, c };
+        polygon.xmin = std::min(polygon.xmin, p0.x);
+        polygon.xmax = std::max(polygon.xmax, p0.x);
+        polygon.ymin = std::min(polygon.ymin, p0.y);
+        polygon.ymax = std::max(polygon.ymax, p0.y);
+    }
+
+    // a mirroring transform flips the winding of the faces
+    const mat3f m = worldTransform.upperLeft();
+    const float winding = dot(cross(m[0], m[1]), m[2]) < 0 ? -1.0f : 1.0f;
+    size_t planeCount = 0;
+    for (auto const& face : sFaces) {
+        float3 const& p0 = corners[face[0]];
+        const float3 d1 = corners[face[1]] - p0;
+        const float3 d2 = corners[face[2]] - p0;
+        const float area = d1.x * d2.y - d2.x * d1.y;
+        // skip back faces and faces seen edge-on
+        if (area * winding <= std::numeric_limits<float>::epsilon()) {
+            continue;
+        }
+        const float dzdx = (d1.z * d2.y - d2.z * d1.y) / area;
+        const float dzdy = (d2.z * d1.x - d1.z * d2.x) / area;
+        // use the farthest depth of the plane within the pixel
+        const float c = p0.z - dzdx * p0.x - dzdy * p0.y + 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+        if (planeCount < MAX_PLANES) {
+            polygon.planes[planeCount++] = float3{ dzdx, dzdy, c };
+        }
+    }
+    if (!planeCount) {
+        return;
+    }
+    for (size_t i = planeCount; i < MAX_PLANES; i++) {
+        polygon.planes[i] = polygon.planes[0];
+    }
+
+    mPolygons.push_back(polygon);
+}
+
+void OcclusionCuller::rasterize(JobSystem& js) noexcept {
+    SYSTRACE_CALL();
+
+    mDepth.resize(WIDTH * HEIGHT);
+    mTiles.resize(TILE_COUNT_X * TILE_COUNT_Y);
+
+    // rasterization job (this runs on multiple threads), bands never share pixels or tiles
+    auto functor = [this](uint32_t index, uint32_t count) {
+        rasterizeBand(index, index + count);
+    };
+
+    auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(HEIGHT / BAND_HEIGHT),
+            std::ref(functor), jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
+}
+
+void OcclusionCuller::rasterizeBand(size_t first, size_t last) noexcept {
+    const size_t y0 = first * BAND_HEIGHT;
+    const size_t y1 = last * BAND_HEIGHT;
+    float* const UTILS_RESTRICT depth = mDepth.data();
+    std::fill(depth + y0 * WIDTH, depth + y1 * WIDTH, FAR_DEPTH);
+
+    for (Polygon const& polygon : mPolygons) {
+        // rows whose pixels' center is within the polygon's bounds
+        const float ymin = std::max(float(y0), std::ceil(polygon.ymin - 0.5f));
+        const float ymax = std::min(float(y1) - 1.0f, std::floor(polygon.ymax - 0.5f));
+        for (float y = ymin; y <= ymax; y++) {
+            const float py = y + 0.5f;
+
+            // the polygon is convex, so it covers an interval of pixel centers in each row
+            float lo = polygon.xmin;
+            float hi = polygon.xmax;
+            for (size_t i = 0; i < polygon.edgeCount; i++) {
+                float3 const& e = polygon.edges[i];
+                const float t = e.y * py + e.z;
+                if (e.x > 0) {
+                    lo = std::max(lo, -t / e.x);
+                } else if (e.x < 0) {
+                    hi = std::min(hi, -t / e.x);
+                } else if (t < 0) {
+                    hi = lo - 1.0f;
+                }
+            }
+            const float xmin = std::max(0.0f, std::ceil(lo - 0.5f));
+            const float xmax = std::min(float(WIDTH) - 1.0f, std::floor(hi - 0.5f));
+            if (!(xmin <= xmax)) {
+                continue;
+            }
+
+            float3 const p0 = polygon.planes[0];
+            float3 const p1 = polygon.planes[1];
+            float3 const p2 = polygon.planes[2];
+            const float c0 = p0.y * py + p0.z;
+            const float c1 = p1.y * py + p1.z;
+            const float c2 = p2.y * py + p2.z;
+
+            // This loop gets vectorized
+            float* const UTILS_RESTRICT row = depth + size_t(y) * WIDTH;
+            for (size_t x = size_t(xmin), e = size_t(xmax); x <= e; x++) {
+                const float px = float(x) + 0.5f;
+                const float z = std::max(p0.x * px + c0, std::max(p1.x * px + c1, p2.x * px + c2));
+                row[x] = std::min(row[x], z);
+            }
+        }
+    }
+
+    // reduce the band to the farthest depth of each tile
+    float* const UTILS_RESTRICT tiles = mTiles.data();
+    for (size_t ty = y0 / TILE_SIZE, tye = y1 / TILE_SIZE; ty < tye; ty++) {
+        float rowMax[WIDTH];
+        std::copy_n(depth + ty * TILE_SIZE * WIDTH, WIDTH, rowMax);
+        for (size_t y = 1; y < TILE_SIZE; y++) {
+            float const* const UTILS_RESTRICT row = depth + (ty * TILE_SIZE + y) * WIDTH;
+            for (size_t x = 0; x < WIDTH; x++) {
+                rowMax[x] = std::max(rowMax[x], row[x]);
+            }
+        }
+        for (size_t tx = 0; tx < TILE_COUNT_X; tx++) {
+            float z = rowMax[tx * TILE_SIZE];
+            for (size_t x = 1; x < TILE_SIZE; x++) {
+                z = std::max(z, rowMax[tx * TILE_SIZE + x]);
+            }
+            tiles[ty * TILE_COUNT_X + tx] = z;
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(float3 const& center, float3 const& extent) const noexcept {
+    float3 corners[8];
+    if (!projectBox(corners, mClipFromWorld, center, extent)) {
+        // the box crosses the near plane
+        return false;
+    }
+
+    float3 bmin = corners[0];
+    float3 bmax = corners[0];
+    for (size_t i = 1; i < 8; i++) {
+        bmin = min(bmin, corners[i]);
+        bmax = max(bmax, corners[i]);
+    }
+
+    // pixels overlapping the box's bounds
+    const float xmin = std::max(0.0f, std::floor(bmin.x));
+    const float ymin = std::max(0.0f, std::floor(bmin.y));
+    const float xmax = std::min(float(WIDTH) - 1.0f, std::floor(bmax.x));
+    const float ymax = std::min(float(HEIGHT) - 1.0f, std::floor(bmax.y));
+    if (!(xmin <= xmax && ymin <= ymax)) {
+        // the box is outside of the screen, leave it to frustum culling
+        return false;
+    }
+    const size_t x0 = size_t(xmin);
+    const size_t y0 = size_t(ymin);
+    const size_t x1 = size_t(xmax);
+    const size_t y1 = size_t(ymax);
+    const float z = bmin.z;
+
+    // the hierarchical depth buffer answers for most boxes
+    auto farthest = [](float const* UTILS_RESTRICT row, size_t first, size_t last) {
+        float z = row[first];
+        for (size_t x = first + 1; x <= last; x++) {
+            z = std::max(z, row[x]);
+        }
+        return z;
+    };
+    float const* const UTILS_RESTRICT tiles = mTiles.data();
+    bool occluded = true;
+    for (size_t ty = y0 / TILE_SIZE; occluded && ty <= y1 / TILE_SIZE; ty++) {
+        occluded = farthest(tiles + ty * TILE_COUNT_X, x0 / TILE_SIZE, x1 / TILE_SIZE) < z;
+    }
+    if (occluded) {
+        return true;
+    }
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > MAX_PIXEL_TEST_COUNT) {
+        return false;
+    }
+
+    // small boxes near the edge of an occluder are worth testing at full resolution
+    float const* const UTILS_RESTRICT depth = mDepth.data();
+    occluded = true;
+    for (size_t y = y0; occluded && y <= y1; y++) {
+        occluded = farthest(depth + y * WIDTH, x0, x1) < z;
+    }
+    return occluded;
+}
+
+void OcclusionCuller::cull(JobSystem& js, Culler::result_type* results,
+        float3 const* center, float3 const* extent,
+        size_t count, size_t testBit, size_t bit) const noexcept {
+    SYSTRACE_CALL();
+
+    if (mPolygons.empty()) {
+        return;
+    }
+
+    const Culler::result_type testMask = Culler::result_type(1u << testBit);
+    const Culler::result_type clearMask = Culler::result_type(~(1u << bit));
+
+    // culling job (this runs on multiple threads)
+    auto functor = [=](uint32_t index, uint32_t c) {
+        for (uint32_t i = index, e = index + c; i < e; i++) {
+            if ((results[i] & testMask) && isOccluded(center[i], extent[i])) {
+                results[i] &= clearMask;
+            }
+        }
+    };
+
+    auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(count),
+            std::ref(functor), jobs::CountSplitter<64, 8>());
+    js.runAndWait(job);
+}
+
+} // namespace details
+} // namespace filament
@@ -17,10 +17,12 @@
 #include "RenderPass.h"
 
 #include "details/Culler.h"
+#include "details/LocalShadowMaps.h"
 #include "details/Material.h"
 #include "details/MaterialInstance.h"
 #include "details/RenderPrimitive.h"
 #include "details/ShadowMap.h"
+#include "details/ShadowMapAtlas.h"
 #include "details/View.h"
 
 // NOTE: We only need Renderer.h here because the definition of some FRenderer methods are here
@@ -29,8 +31,12 @@
 #include <private/filament/UibGenerator.h>
 
 #include <utils/JobSystem.h>
+#include <utils/memalign.h>
+#include <utils/Panic.h>
 #include <utils/Systrace.h>
 
+#include <limits>
+
 using namespace utils;
 using namespace filament::math;
 
@@ -42,14 +48,80 @@ namespace details {
 
 RenderPass::~RenderPass() noexcept = default;
 
+RenderPass::CommandArena::CommandArena(size_t capacity) noexcept {
+    reserve(capacity);
+}
+
+RenderPass::CommandArena::~CommandArena() noexcept {
+    utils::aligned_free(mCommands);
+    utils::aligned_free(mScratch);
+}
+
+RenderPass::Command* RenderPass::CommandArena::getScratch() noexcept {
+    if (UTILS_UNLIKELY(!mScratch)) {
+        mScratch = static_cast<Command*>(
+                utils::aligned_alloc(mCapacity * sizeof(Command), CACHELINE_SIZE));
+        ASSERT_POSTCONDITION(mScratch,
+                "couldn't allocate %u commands", unsigned(mCapacity));
+    }
+    return mScratch;
+}
+
+UTILS_NOINLINE
+void RenderPass::CommandArena::reserve(size_t count) noexcept {
+    if (count > mCapacity) {
+        // grow geometrically so that a slowly growing scene doesn't reallocate every frame
+        size_t capacity = std::max(count, mCapacity + mCapacity / 2);
+        Command* const commands = static_cast<Command*>(
+                utils::aligned_alloc(capacity * sizeof(Command), CACHELINE_SIZE));
+        ASSERT_POSTCONDITION(commands,
+                "couldn't allocate %u commands", unsigned(capacity));
+        if (mSize) {
+            memcpy(commands, mCommands, mSize * sizeof(Command));
+        }
+        utils::aligned_free(mCommands);
+        mCommands = commands;
+        mCapacity = capacity;
+        // the scratch buffer is now too small, it'll be reallocated if needed
+        utils::aligned_free(mScratch);
+        mScratch = nullptr;
+    }
+}
+
+Handle<HwUniformBuffer> RenderPass::CommandArena::getInstanceUbo(
+        driver::DriverApi& driver, size_t count) noexcept {
+    // bound ranges always cover a whole ObjectUniforms block, even past the last instance
+    count += CONFIG_MAX_INSTANCES - 1;
+    if (UTILS_UNLIKELY(count > mInstanceUboCount)) {
+        // grow geometrically, like the commands
+        count = std::max(count, mInstanceUboCount + mInstanceUboCount / 2);
+        if (mInstanceUbh) {
+            driver.destroyUniformBuffer(mInstanceUbh);
+        }
+        mInstanceUbh = driver.createUniformBuffer(count * sizeof(PerRenderableUib),
+                driver::BufferUsage::DYNAMIC);
+        mInstanceUboCount = count;
+    }
+    return mInstanceUbh;
+}
+
+void RenderPass::CommandArena::terminate(driver::DriverApi& driver) noexcept {
+    if (mInstanceUbh) {
+        driver.destroyUniformBuffer(mInstanceUbh);
+        mInstanceUbh.clear();
+        mInstanceUboCount = 0;
+    }
+}
+
 UTILS_ALWAYS_INLINE // this allows the compiler to devirtualize some calls
 inline              // this removes the code from the compilation unit
 void RenderPass::render(
         FEngine& engine, JobSystem& js,
         FScene& scene, Range<uint32_t> vr,
         uint32_t commandTypeFlags, RenderFlags renderFlags,
+        Culler::result_type visibilityMask,
         const CameraInfo& camera, Viewport const& viewport,
-        GrowingSlice<Command>& commands) noexcept {
+        CommandArena& commands) noexcept {
 
     SYSTRACE_CONTEXT();
 
@@ -67,42 +139,82 @@ void RenderPass::render(
     const bool colorPass  = bool(commandTypeFlags & CommandTypeFlags::COLOR);
     const bool depthPass  = bool(commandTypeFlags & (CommandTypeFlags::DEPTH | CommandTypeFlags::SHADOW));
     growBy *= uint32_t(colorPass * 2 + depthPass);
-    Command* const curr = commands.grow(growBy);
+    // reserve room for the "eof" command as well, so that the buffer is never reallocated
+    // after the commands are generated.
+    Command* const curr = commands.grow(growBy + 1);
 
     // we extract camera position/forward outside of the loop, because these are not cheap.
     const float3 cameraPosition(camera.getPosition());
     const float3 cameraForwardVector(camera.getForwardVector());
-    auto work = [commandTypeFlags, curr, &soa, renderFlags, cameraPosition, cameraForwardVector]
-            (uint32_t startIndex, uint32_t indexCount) {
+    auto work = [commandTypeFlags, curr, &soa, renderFlags, visibilityMask,
+            cameraPosition, cameraForwardVector](uint32_t startIndex, uint32_t indexCount) {
         RenderPass::generateCommands(commandTypeFlags, curr,
-                soa, { startIndex, startIndex + indexCount }, renderFlags,
+                soa, { startIndex, startIndex + indexCount }, renderFlags, visibilityMask,
                 cameraPosition, cameraForwardVector);
     };
 
     auto jobCommandsParallel = jobs::parallel_for(js, nullptr, vr.first, (uint32_t)vr.size(),
             std::cref(work), jobs::CountSplitter<JOBS_PARALLEL_FOR_COMMANDS_COUNT, 8>());
 
-    { // scope for systrace
-        SYSTRACE_NAME("jobCommandsParallel");
-        js.runAndWait(jobCommandsParallel);
-    }
-
     // always add an "eof" command
     // "eof" command. these commands are guaranteed to be sorted last in the
     // command buffer.
-    commands.grow(1)->key = uint64_t(Pass::SENTINEL);
+    curr[growBy].key = uint64_t(Pass::SENTINEL);
+
+    // The commands are sorted, then merged into instanced draws, as soon as they're all
+    // generated, without waiting in between.
+    std::vector<uint32_t>& instances = commands.mInstances;
+    JobSystem::Job* jobSortCommands = js.createJob(nullptr,
+            [&commands, &instances](JobSystem& js, JobSystem::Job*) {
+                { // sort all commands
+                    SYSTRACE_NAME("sort commands");
+                    sortCommands(js, commands);
+                }
 
-    { // sort all commands
-        SYSTRACE_NAME("sort commands");
-        std::sort(commands.begin(), commands.end());
+                // this reuses the storage of the previous passes
+                instances.clear();
+                { // merge commands drawing the same primitive into instanced draws
+                    SYSTRACE_NAME("instance commands");
+                    instanceCommands(commands, instances);
+                }
+            });
+    js.addDependency(jobCommandsParallel, jobSortCommands);
+    jobSortCommands = js.runAndRetain(jobSortCommands);
+    js.run(jobCommandsParallel);
+
+    { // scope for systrace
+        SYSTRACE_NAME("jobCommands");
+        js.waitAndRelease(jobSortCommands);
     }
 
     // Take care not to upload data within the render pass (synchronize can commit froxel data)
     driver::DriverApi& driver = engine.getDriverApi();
+
+    // The uniforms of the instances of a draw call must be contiguous, so the scene's copy of
+    // each instance's uniforms is gathered in the arena's instance UBO.
+    Handle<HwUniformBuffer> instanceUbh;
+    if (!instances.empty()) {
+        SYSTRACE_NAME("instance uniforms");
+        instanceUbh = commands.getInstanceUbo(driver, instances.size());
+        const size_t size = instances.size() * sizeof(PerRenderableUib);
+        uint8_t* const UTILS_RESTRICT buffer = static_cast<uint8_t*>(driver.allocate(size));
+        uint8_t const* const UTILS_RESTRICT uniforms =
+                static_cast<uint8_t const*>(scene.getRenderableUniforms());
+        uint32_t const* const UTILS_RESTRICT uboSlots = soa.data<FScene::UBO_SLOT>();
+        uint32_t const* const UTILS_RESTRICT indices = instances.data();
+        for (size_t i = 0, c = instances.size(); i < c; i++) {
+            memcpy(buffer + i * sizeof(PerRenderableUib),
+                    uniforms + uboSlots[indices[i]] * sizeof(PerRenderableUib),
+                    sizeof(PerRenderableUib));
+        }
+        driver.updateUniformBuffer(instanceUbh, { buffer, size });
+    }
+
     beginRenderPass(driver, viewport, camera);
 
     // Now, execute all commands
-    RenderPass::recordDriverCommands(driver, scene, commands);
+    RenderPass::recordDriverCommands(driver, scene, instanceUbh,
+            { commands.begin(), commands.end() });
 
     endRenderPass(driver, viewport);
 
@@ -112,16 +224,208 @@ void RenderPass::render(
     engine.flush();
 }
 
+void RenderPass::sortCommands(JobSystem& js, CommandArena& commands) noexcept {
+    if (commands.size() < RADIX_SORT_MIN_COMMANDS_COUNT) {
+        std::sort(commands.begin(), commands.end());
+    } else {
+        radixSortCommands(js, commands);
+    }
+}
+
+/*
+ * Parallel LSD radix sort of the commands.
+ *
+ * Each pass sorts 8 bits of the key and is split in chunks, each chunk is processed by a job.
+ * A pass is done in two steps: first each job computes the histogram of its chunk, then the
+ * histograms are prefix-summed and each job scatters its commands to their final location.
+ *
+ * We only sort the bits that actually differ between commands, which are typically much fewer
+ * than 64, e.g.: the depth pass only has the 32 bits of distance and a few priority bits.
+ *
+ * SENTINEL commands (which include the discarded ones) are dropped during the first pass, which
+ * can significantly reduce the amount of work for the following passes.
+ */
+UTILS_NOINLINE
+void RenderPass::radixSortCommands(JobSystem& js, CommandArena& commands) noexcept {
+    constexpr uint64_t SENTINEL = uint64_t(Pass::SENTINEL);
+    constexpr uint64_t DIGIT_MASK = RADIX_SORT_BUCKET_COUNT - 1;
+
+    struct alignas(CACHELINE_SIZE) ChunkState {
+        uint32_t histogram[RADIX_SORT_BUCKET_COUNT];
+        uint64_t keysOr;
+        uint64_t keysAnd;
+    };
+
+    Command* src = commands.begin();
+    Command* dst = commands.getScratch();
+    uint32_t count = uint32_t(commands.size());
+
+    const size_t chunkCount = std::max(size_t(1), std::min({
+            RADIX_SORT_MAX_CHUNK_COUNT,
+            size_t(2) << js.getParallelSplitCount(),
+            count / RADIX_SORT_MIN_CHUNK_SIZE }));
+
+    ChunkState chunks[RADIX_SORT_MAX_CHUNK_COUNT];
+
+    auto getChunk = [chunkCount](Command* data, uint32_t count, uint32_t c) {
+        const uint32_t first = uint32_t((uint64_t(count) *  c)      / chunkCount);
+        const uint32_t last  = uint32_t((uint64_t(count) * (c + 1)) / chunkCount);
+        return Slice<Command>(data + first, data + last);
+    };
+
+    auto parallel = [&js, chunkCount](auto const& work) {
+        js.runAndWait(jobs::parallel_for(js, nullptr, 0, uint32_t(chunkCount),
+                std::cref(work), jobs::CountSplitter<1>()));
+    };
+
+    // find which bits we need to sort
+    auto analyze = [&](uint32_t first, uint32_t n) {
+        for (uint32_t c = first; c < first + n; c++) {
+            uint64_t keysOr = 0;
+            uint64_t keysAnd = SENTINEL;
+            for (Command const& command : getChunk(src, count, c)) {
+                const uint64_t key = command.key;
+                const bool sentinel = key == SENTINEL;
+                keysOr  |= sentinel ? 0 : key;
+                keysAnd &= key;
+            }
+            chunks[c].keysOr = keysOr;
+            chunks[c].keysAnd = keysAnd;
+        }
+    };
+    parallel(analyze);
+
+    uint64_t keysOr = 0;
+    uint64_t keysAnd = SENTINEL;
+    for (size_t c = 0; c < chunkCount; c++) {
+        keysOr  |= chunks[c].keysOr;
+        keysAnd &= chunks[c].keysAnd;
+    }
+    // keysAnd is always a subset of keysOr, unless all commands are SENTINELs
+    uint64_t bits = (keysAnd & ~keysOr) ? 0 : (keysOr ^ keysAnd);
+
+    // we always need at least one pass to get rid of the SENTINELs
+    size_t passCount = 0;
+    uint8_t shifts[64 / RADIX_SORT_BITS];
+    do {
+        const uint8_t shift = uint8_t(bits ? utils::ctz(bits) : 0);
+        shifts[passCount++] = shift;
+        bits &= ~(DIGIT_MASK << shift);
+    } while (bits);
+
+    for (size_t pass = 0; pass < passCount; pass++) {
+        const uint8_t shift = shifts[pass];
+        const bool dropSentinels = pass == 0;
+
+        auto histogram = [&](uint32_t first, uint32_t n) {
+            for (uint32_t c = first; c < first + n; c++) {
+                uint32_t* const UTILS_RESTRICT h = chunks[c].histogram;
+                std::fill_n(h, RADIX_SORT_BUCKET_COUNT, 0);
+                for (Command const& command : getChunk(src, count, c)) {
+                    const uint64_t key = command.key;
+                    if (UTILS_UNLIKELY(dropSentinels && key == SENTINEL)) {
+                        continue;
+                    }
+                    h[(key >> shift) & DIGIT_MASK]++;
+                }
+            }
+        };
+        parallel(histogram);
+
+        // Exclusive prefix-sum of the histograms, ordered by bucket then by chunk, this gives
+        // each chunk the offset of its first command in each bucket and keeps the sort stable.
+        uint32_t offset = 0;
+        for (size_t b = 0; b < RADIX_SORT_BUCKET_COUNT; b++) {
+            for (size_t c = 0; c < chunkCount; c++) {
+                const uint32_t n = chunks[c].histogram[b];
+                chunks[c].histogram[b] = offset;
+                offset += n;
+            }
+        }
+
+        auto scatter = [&](uint32_t first, uint32_t n) {
+            for (uint32_t c = first; c < first + n; c++) {
+                uint32_t* const UTILS_RESTRICT h = chunks[c].histogram;
+                Command* const UTILS_RESTRICT out = dst;
+                for (Command const& command : getChunk(src, count, c)) {
+                    const uint64_t key = command.key;
+                    if (UTILS_UNLIKELY(dropSentinels && key == SENTINEL)) {
+                        continue;
+                    }
+                    out[h[(key >> shift) & DIGIT_MASK]++] = command;
+                }
+            }
+        };
+        parallel(scatter);
+
+        std::swap(src, dst);
+        count = offset;
+    }
+
+    // we dropped at least the "eof" command, so there is room to add it back
+    assert(count < commands.size());
+    src[count].key = SENTINEL;
+
+    if (src == commands.begin()) {
+        commands.resize(count + 1);
+    } else {
+        commands.swapScratch(count + 1);
+    }
+}
+
+UTILS_NOINLINE
+void RenderPass::instanceCommands(CommandArena& commands,
+        std::vector<uint32_t>& instances) noexcept {
+    constexpr uint64_t SENTINEL = uint64_t(Pass::SENTINEL);
+
+    auto canMerge = [](PrimitiveInfo const& lhs, PrimitiveInfo const& rhs) {
+        return lhs.mi == rhs.mi &&
+               lhs.primitiveHandle.getId() == rhs.primitiveHandle.getId() &&
+               lhs.materialVariant.key == rhs.materialVariant.key &&
+               lhs.rasterState == rhs.rasterState &&
+               !rhs.perRenderableBones;
+    };
+
+    // commands are compacted in place, there is always a SENTINEL command at the end
+    Command* const UTILS_RESTRICT first = commands.begin();
+    Command* UTILS_RESTRICT out = first;
+    Command const* UTILS_RESTRICT c = first;
+    while (c->key != SENTINEL) {
+        Command const* UTILS_RESTRICT e = c + 1;
+        if (!c->primitive.perRenderableBones) {
+            while (e->key != SENTINEL && size_t(e - c) < CONFIG_MAX_INSTANCES &&
+                   canMerge(c->primitive, e->primitive)) {
+                ++e;
+            }
+        }
+        *out = *c;
+        if (e - c > 1) {
+            out->primitive.index = uint32_t(instances.size());
+            out->primitive.instanceCount = uint8_t(e - c);
+            for (Command const* i = c; i < e; ++i) {
+                instances.push_back(i->primitive.index);
+            }
+        }
+        ++out;
+        c = e;
+    }
+    out->key = SENTINEL;
+    commands.resize(out - first + 1);
+}
+
 UTILS_NOINLINE // no need to be inlined
 void RenderPass::recordDriverCommands(
         FEngine::DriverApi& UTILS_RESTRICT driver,  // using restrict here is very important
         FScene& UTILS_RESTRICT scene,
+        Handle<HwUniformBuffer> instanceUbh,
         Slice<Command> const& commands) noexcept {
     SYSTRACE_CALL();
 
     if (!commands.empty()) {
         Driver::PipelineState pipeline;
         Handle<HwUniformBuffer> uboHandle = scene.getRenderableUBO();
+        uint32_t const* const UTILS_RESTRICT uboSlots =
+                scene.getRenderableData().data<FScene::UBO_SLOT>();
         FMaterialInstance const* UTILS_RESTRICT mi = nullptr;
         FMaterial const* UTILS_RESTRICT ma = nullptr;
         Command const* UTILS_RESTRICT c;
@@ -142,12 +446,21 @@ void RenderPass::recordDriverCommands(
             }
 
             pipeline.program = ma->getProgram(info.materialVariant.key);
-            size_t offset = info.index * sizeof(PerRenderableUib);
             if (info.perRenderableBones) {
                 driver.bindUniformBuffer(BindingPoints::PER_RENDERABLE_BONES, info.perRenderableBones);
             }
-            driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE, uboHandle, offset, sizeof(PerRenderableUib));
-            driver.draw(pipeline, info.primitiveHandle);
+            // the bound range must be at least as large as the ObjectUniforms block
+            if (UTILS_LIKELY(info.instanceCount == 1)) {
+                size_t offset = uboSlots[info.index] * sizeof(PerRenderableUib);
+                driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE, uboHandle, offset,
+                        CONFIG_MAX_INSTANCES * sizeof(PerRenderableUib));
+                driver.draw(pipeline, info.primitiveHandle);
+            } else {
+                size_t offset = info.index * sizeof(PerRenderableUib);
+                driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE, instanceUbh, offset,
+                        CONFIG_MAX_INSTANCES * sizeof(PerRenderableUib));
+                driver.drawInstanced(pipeline, info.primitiveHandle, info.instanceCount);
+            }
         }
 
         SYSTRACE_VALUE32("commandCount", c - commands.cbegin());
@@ -206,6 +519,7 @@ void RenderPass::setupColorCommand(Command& cmdDraw, bool hasDepthPass,
 UTILS_NOINLINE
 void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const commands,
         FScene::RenderableSoa const& soa, utils::Range<uint32_t> range, RenderFlags renderFlags,
+        Culler::result_type visibilityMask,
         filament::math::float3 cameraPosition, filament::math::float3 cameraForward) noexcept {
 
     // generateCommands() writes both the draw and depth commands simultaneously such that
@@ -241,15 +555,15 @@ void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const comm
         default: // squash IDE warning -- should never happen.
         case CommandTypeFlags::COLOR:
             generateCommandsImpl<CommandTypeFlags::COLOR>(commandTypeFlags, curr,
-                    soa, range, renderFlags, cameraPosition, cameraForward);
+                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
             break;
         case CommandTypeFlags::DEPTH_AND_COLOR:
             generateCommandsImpl<CommandTypeFlags::DEPTH_AND_COLOR>(commandTypeFlags, curr,
-                    soa, range, renderFlags, cameraPosition, cameraForward);
+                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
             break;
         case CommandTypeFlags::SHADOW:
             generateCommandsImpl<CommandTypeFlags::SHADOW>(commandTypeFlags, curr,
-                    soa, range, renderFlags, cameraPosition, cameraForward);
+                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
             break;
     }
 }
@@ -260,7 +574,7 @@ UTILS_NOINLINE
 void RenderPass::generateCommandsImpl(uint32_t,
         Command* UTILS_RESTRICT curr,
         FScene::RenderableSoa const& UTILS_RESTRICT soa, utils::Range<uint32_t> range,
-        RenderFlags renderFlags,
+        RenderFlags renderFlags, Culler::result_type visibilityMask,
         float3 cameraPosition, float3 cameraForward) noexcept {
 
     // generateCommands() writes both the draw and depth commands simultaneously such that
@@ -276,9 +590,12 @@ void RenderPass::generateCommandsImpl(uint32_t,
     auto const* const UTILS_RESTRICT soaVisibility      = soa.data<FScene::VISIBILITY_STATE>();
     auto const* const UTILS_RESTRICT soaPrimitives      = soa.data<FScene::PRIMITIVES>();
     auto const* const UTILS_RESTRICT soaBonesUbh        = soa.data<FScene::BONES_UBH>();
+    auto const* const UTILS_RESTRICT soaVisibleMask     = soa.data<FScene::VISIBLE_MASK>();
 
     const bool hasShadowing = renderFlags & HAS_SHADOWING;
     const bool inverseFrontFaces = renderFlags & HAS_INVERSE_FRONT_FACES;
+    const bool skipStaticShadowCasters = renderFlags & SKIP_STATIC_SHADOW_CASTERS;
+    const bool skipDynamicShadowCasters = renderFlags & SKIP_DYNAMIC_SHADOW_CASTERS;
 
     Variant materialVariant;
     materialVariant.setDirectionalLighting(renderFlags & HAS_DIRECTIONAL_LIGHT);
@@ -328,7 +645,7 @@ void RenderPass::generateCommandsImpl(uint32_t,
         const uint32_t distanceBits = reinterpret_cast<uint32_t&>(distance);
 
         cmdColor.key = makeField(soaVisibility[i].priority, PRIORITY_MASK, PRIORITY_SHIFT);
-        cmdColor.primitive.index = (uint16_t)i;
+        cmdColor.primitive.index = i;
         cmdColor.primitive.perRenderableBones = soaBonesUbh[i];
         materialVariant.setShadowReceiver(soaVisibility[i].receiveShadows & hasShadowing);
         materialVariant.setSkinning(soaVisibility[i].skinning);
@@ -338,13 +655,20 @@ void RenderPass::generateCommandsImpl(uint32_t,
         cmdDepth.key = uint64_t(Pass::DEPTH);
         cmdDepth.key |= makeField(soaVisibility[i].priority, PRIORITY_MASK, PRIORITY_SHIFT);
         cmdDepth.key |= makeField(distanceBits, DISTANCE_BITS_MASK, DISTANCE_BITS_SHIFT);
-        cmdDepth.primitive.index = (uint16_t)i;
+        cmdDepth.primitive.index = i;
         cmdDepth.primitive.perRenderableBones = soaBonesUbh[i];
         cmdDepth.primitive.materialVariant.setSkinning(soaVisibility[i].skinning);
 
         const bool shadowCaster = soaVisibility[i].castShadows & hasShadowing;
         const bool writeDepthForShadows = shadowPass & shadowCaster;
 
+        // renderables in the range that this pass doesn't draw still need their commands,
+        // they're cancelled (e.g. shadow casters outside of the rendered shadow cascade)
+        const bool staticShadowCaster = soaVisibility[i].staticShadowCaster;
+        const bool skipped = (staticShadowCaster & skipStaticShadowCasters) |
+                             (!staticShadowCaster & skipDynamicShadowCasters);
+        const bool visible = ((soaVisibleMask[i] & visibilityMask) != 0) & !skipped;
+
         const Slice<FRenderPrimitive>& primitives = soaPrimitives[i];
 
         /*
@@ -401,6 +725,8 @@ void RenderPass::generateCommandsImpl(uint32_t,
                     // correct for TransparencyMode::DEFAULT -- i.e. cancel the command
                     key |= select(mode == TransparencyMode::DEFAULT);
 
+                    key |= select(!visible);
+
                     *curr = cmdColor;
                     curr->key = key;
                     ++curr;
@@ -435,6 +761,7 @@ void RenderPass::generateCommandsImpl(uint32_t,
                 *curr = cmdColor;
                 // handle the case where this primitive is empty / no-op
                 curr->key |= select(primitive.getPrimitiveType() == PrimitiveType::NONE);
+                curr->key |= select(!visible);
                 ++curr;
             }
 
@@ -456,7 +783,7 @@ void RenderPass::generateCommandsImpl(uint32_t,
                 bool issueDepth =
                         (rs.depthWrite & !(colorPass & (rs.alphaToCoverage | rs.hasBlending())))
                         | writeDepthForShadows;
-                curr->key |= select(!issueDepth);
+                curr->key |= select(!issueDepth | !visible);
 
                 // handle the case where this primitive is empty / no-op
                 curr->key |= select(primitive.getPrimitiveType() == PrimitiveType::NONE);
@@ -551,14 +878,14 @@ void FRenderer::ColorPass::endRenderPass(DriverApi& driver, Viewport const& view
 void FRenderer::ColorPass::renderColorPass(FEngine& engine,
         JobSystem& js, JobSystem::Job* sync,
         Handle<HwRenderTarget> const rth, FView& view, Viewport const& scaledViewport,
-        GrowingSlice<Command>& commands) noexcept {
+        CommandArena& commands) noexcept {
 
     CameraInfo const& cameraInfo = view.getCameraInfo();
     auto& soa = view.getScene()->getRenderableData();
     auto vr = view.getVisibleRenderables();
 
     // populate the RenderPrimitive array with the proper LOD
-    view.updatePrimitivesLod(engine, cameraInfo, soa, vr);
+    view.updatePrimitivesLod(engine, cameraInfo, soa, vr, FView::LOD_COLOR_PASS);
 
     DriverApi& driver = engine.getDriverApi();
     view.prepareCamera(cameraInfo, scaledViewport);
@@ -566,7 +893,10 @@ void FRenderer::ColorPass::renderColorPass(FEngine& engine,
 
     RenderPass::RenderFlags flags = 0;
     if (view.hasShadowing())               flags |= RenderPass::HAS_SHADOWING;
-    if (view.hasDirectionalLight())        flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
+    // the local shadows are only compiled in the variants with a directional light
+    if (view.hasDirectionalLight() || view.hasShadowing()) {
+        flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
+    }
     if (view.hasDynamicLighting())         flags |= RenderPass::HAS_DYNAMIC_LIGHTING;
     if (view.isFrontFaceWindingInverted()) flags |= RenderPass::HAS_INVERSE_FRONT_FACES;
 
@@ -591,56 +921,135 @@ void FRenderer::ColorPass::renderColorPass(FEngine& engine,
     ColorPass colorPass("ColorPass", js, sync, view, rth);
     driver.pushGroupMarker("Color Pass");
     colorPass.render(engine, js, *view.getScene(), vr, commandType, flags,
-            cameraInfo, scaledViewport, commands);
+            FView::getRenderableVisibilityMask(), cameraInfo, scaledViewport, commands);
     driver.popGroupMarker();
 }
 
 // ------------------------------------------------------------------------------------------------
 
 FRenderer::ShadowPass::ShadowPass(const char* name,
-        ShadowMap const& shadowMap) noexcept
-        : RenderPass(name), shadowMap(shadowMap) {
+        ShadowMapAtlas const& atlas, bool clear) noexcept
+        : RenderPass(name), atlas(atlas), clear(clear) {
 }
 
-void FRenderer::ShadowPass::beginRenderPass(driver::DriverApi& driver, Viewport const&, const CameraInfo&) noexcept {
-    shadowMap.beginRenderPass(driver);
+FRenderer::ShadowPass::ShadowPass(const char* name,
+        ShadowMapAtlas const& atlas, Viewport const& tile) noexcept
+        : RenderPass(name), atlas(atlas), clear(false), tile(tile) {
+}
+
+void FRenderer::ShadowPass::beginRenderPass(driver::DriverApi& driver, Viewport const& viewport, const CameraInfo&) noexcept {
+    if (tile.empty()) {
+        atlas.beginRenderPass(driver, clear);
+    } else {
+        atlas.beginTileRenderPass(driver, tile);
+    }
+    driver.viewport(viewport.left, viewport.bottom, viewport.width, viewport.height);
 }
 
 void FRenderer::ShadowPass::renderShadowMap(FEngine& engine, JobSystem& js,
-        FView& view, GrowingSlice<Command>& commands) noexcept {
+        FView& view, CommandArena& commands) noexcept {
+
+    RenderPass::RenderFlags flags = 0;
+    if (view.hasShadowing())               flags |= RenderPass::HAS_SHADOWING;
+    // the local shadows are only compiled in the variants with a directional light
+    if (view.hasDirectionalLight() || view.hasShadowing()) {
+        flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
+    }
+    if (view.hasDynamicLighting())         flags |= RenderPass::HAS_DYNAMIC_LIGHTING;
+    if (view.isFrontFaceWindingInverted()) flags |= RenderPass::HAS_INVERSE_FRONT_FACES;
+
+    if (view.hasDirectionalShadowing()) {
+        RenderFlags cascadeFlags = flags;
+        // the static shadow casters are only rendered when their cached shadow maps are out of
+        // date
+        if (view.hasStaticShadowMap()) {
+            if (view.isStaticShadowMapDirty()) {
+                renderCascades(engine, js, view, commands, view.getStaticShadowMapAtlas(),
+                        cascadeFlags | RenderPass::SKIP_DYNAMIC_SHADOW_CASTERS);
+            }
+            cascadeFlags |= RenderPass::SKIP_STATIC_SHADOW_CASTERS;
+        }
+
+        renderCascades(engine, js, view, commands, view.getShadowMapAtlas(), cascadeFlags);
+    }
+
+    renderLocalShadowMaps(engine, js, view, commands, flags);
+}
+
+void FRenderer::ShadowPass::renderLocalShadowMaps(FEngine& engine, JobSystem& js,
+        FView& view, CommandArena& commands, RenderFlags flags) noexcept {
 
     auto& soa = view.getScene()->getRenderableData();
     auto vr = view.getVisibleShadowCasters();
-    ShadowMap const& shadowMap = view.getShadowMap();
-    Viewport const& viewport = shadowMap.getViewport();
-    FCamera const& camera = shadowMap.getCamera();
-
-    CameraInfo cameraInfo = {
-            .projection         = mat4f{ camera.getProjectionMatrix() },
-            .cullingProjection  = mat4f{ camera.getCullingProjectionMatrix() },
-            .model              = camera.getModelMatrix(),
-            .view               = camera.getViewMatrix(),
-            .zn                 = camera.getNear(),
-            .zf                 = camera.getCullingFar(),
-    };
+    driver::DriverApi& driver = engine.getDriverApi();
+    LocalShadowMaps const& localShadowMaps = view.getLocalShadowMaps();
 
-    // populate the RenderPrimitive array with the proper LOD
-    view.updatePrimitivesLod(engine, cameraInfo, soa, vr);
+    // each shadow map clears and renders its own tile, the rest of the atlas is kept
+    for (LocalShadowMaps::Update const& update : localShadowMaps.getUpdates()) {
+        const Culler::result_type visibilityMask = view.cullLocalShadowCasters(update);
+
+        // populate the RenderPrimitive array with the proper LOD
+        view.updatePrimitivesLod(engine, update.camera, soa, vr, FView::LOD_LOCAL_SHADOW_PASS);
+
+        view.prepareCamera(update.camera, update.viewport);
+        view.commitUniforms(driver);
 
+        ShadowPass shadowPass("LocalShadowPass", localShadowMaps.getAtlas(), update.tile);
+        driver.pushGroupMarker("Local shadow map Pass");
+        shadowPass.render(engine, js, *view.getScene(), vr, CommandTypeFlags::SHADOW, flags,
+                visibilityMask, update.camera, update.viewport, commands);
+        driver.popGroupMarker();
+
+        // reset the command buffer for the next shadow map
+        commands.clear();
+    }
+}
+
+void FRenderer::ShadowPass::renderCascades(FEngine& engine, JobSystem& js,
+        FView& view, CommandArena& commands, ShadowMapAtlas const& atlas,
+        RenderFlags flags) noexcept {
+
+    auto& soa = view.getScene()->getRenderableData();
+    auto vr = view.getVisibleShadowCasters();
     driver::DriverApi& driver = engine.getDriverApi();
-    view.prepareCamera(cameraInfo, viewport);
-    view.commitUniforms(driver);
 
-    RenderPass::RenderFlags flags = 0;
-    if (view.hasShadowing())               flags |= RenderPass::HAS_SHADOWING;
-    if (view.hasDirectionalLight())        flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
-    if (view.hasDynamicLighting())         flags |= RenderPass::HAS_DYNAMIC_LIGHTING;
-    if (view.isFrontFaceWindingInverted()) flags |= RenderPass::HAS_INVERSE_FRONT_FACES;
+    // each cascade renders the shadow casters it sees, in its own tile of the atlas
+    bool clear = true;
+    for (size_t c = 0, n = view.getShadowCascadeCount(); c < n; c++) {
+        ShadowMap const& shadowMap = view.getShadowMap(c);
+        if (!shadowMap.hasVisibleShadows()) {
+            continue;
+        }
 
-    ShadowPass shadowPass("ShadowPass", shadowMap);
-    driver.pushGroupMarker("Shadow map Pass");
-    shadowPass.render(engine, js, *view.getScene(), vr, CommandTypeFlags::SHADOW, flags, cameraInfo, viewport, commands);
-    driver.popGroupMarker();
+        Viewport const& viewport = shadowMap.getViewport();
+        FCamera const& camera = shadowMap.getCamera();
+
+        CameraInfo cameraInfo = {
+                .projection         = mat4f{ camera.getProjectionMatrix() },
+                .cullingProjection  = mat4f{ camera.getCullingProjectionMatrix() },
+                .model              = camera.getModelMatrix(),
+                .view               = camera.getViewMatrix(),
+                .zn                 = camera.getNear(),
+                .zf                 = camera.getCullingFar(),
+        };
+
+        // populate the RenderPrimitive array with the proper LOD
+        view.updatePrimitivesLod(engine, cameraInfo, soa, vr,
+                FView::LodPass(FView::LOD_SHADOW_PASS + c));
+
+        view.prepareCamera(cameraInfo, viewport);
+        view.commitUniforms(driver);
+
+        ShadowPass shadowPass("ShadowPass", atlas, clear);
+        driver.pushGroupMarker("Shadow map Pass");
+        shadowPass.render(engine, js, *view.getScene(), vr, CommandTypeFlags::SHADOW, flags,
+                FView::getShadowCascadeVisibilityMask(c), cameraInfo, viewport, commands);
+        driver.popGroupMarker();
+
+        // reset the command buffer for the next cascade
+        commands.clear();
+        clear = false;
+    }
 }
 
 void FRenderer::ShadowPass::endRenderPass(DriverApi& driver, Viewport const& viewport) noexcept {
@@ -30,6 +30,8 @@
 #include <utils/compiler.h>
 #include <utils/Slice.h>
 
+#include <vector>
+
 namespace utils {
 class JobSystem;
 }
@@ -172,19 +174,21 @@ public:
         return boolish ? -1llu : 0llu;
     }
 
-    struct PrimitiveInfo { // 24 bytes
+    struct PrimitiveInfo { // 32 bytes
         FMaterialInstance const* mi = nullptr;              // 8 bytes (4)
         Handle<HwRenderPrimitive> primitiveHandle;          // 4 bytes
         Handle<HwUniformBuffer> perRenderableBones;         // 4 bytes
         Driver::RasterState rasterState;                    // 4 bytes
-        uint16_t index = 0;                                 // 2 bytes
+        // renderable index, or index of the first instance for instanced draws
+        uint32_t index = 0;                                 // 4 bytes
         Variant materialVariant;                            // 1 byte
-        uint8_t reserved = { };                             // 1 byte
+        uint8_t instanceCount = 1;                          // 1 byte
+        uint8_t reserved[6] = { };                          // 6 bytes (2)
     };
 
-    struct alignas(8) Command {     // 32 bytes
+    struct alignas(8) Command {     // 40 bytes
         CommandKey key = 0;         //  8 bytes
-        PrimitiveInfo primitive;    // 24 bytes
+        PrimitiveInfo primitive;    // 32 bytes
         bool operator < (Command const& rhs) const noexcept { return key < rhs.key; }
         // placement new declared as "throw" to avoid the compiler's null-check
         inline void* operator new (std::size_t size, void* ptr) {
@@ -195,24 +199,124 @@ public:
     static_assert(std::is_trivially_destructible<Command>::value,
             "Command isn't trivially destructible");
 
+    /*
+     * A growable buffer of Commands.
+     *
+     * Commands are sorted in place, so they must stay contiguous: when the buffer is too small
+     * it's reallocated (and its content moved). The storage is kept from one frame to the next
+     * and never shrinks, so in the steady state no allocation happens. This is also true of the
+     * renderable indices of the instanced draws and of the uniform buffer holding their uniforms.
+     */
+    class CommandArena {
+    public:
+        explicit CommandArena(size_t capacity) noexcept;
+        ~CommandArena() noexcept;
+
+        CommandArena(CommandArena const& rhs) = delete;
+        CommandArena& operator=(CommandArena const& rhs) = delete;
+
+        // Appends count uninitialized commands and returns a pointer to the first one.
+        // This can reallocate the storage, which invalidates all previously returned pointers.
+        Command* grow(size_t count) noexcept {
+            if (UTILS_UNLIKELY(mSize + count > mCapacity)) {
+                reserve(mSize + count);
+            }
+            Command* const p = mCommands + mSize;
+            mSize += count;
+            mHighWatermark = std::max(mHighWatermark, mSize);
+            return p;
+        }
+
+        void clear() noexcept { mSize = 0; }
+
+        size_t size() const noexcept { return mSize; }
+        size_t capacity() const noexcept { return mCapacity; }
+        bool empty() const noexcept { return mSize == 0; }
+
+        Command* begin() noexcept { return mCommands; }
+        Command* end() noexcept { return mCommands + mSize; }
+        Command const* begin() const noexcept { return mCommands; }
+        Command const* end() const noexcept { return mCommands + mSize; }
+
+        // largest number of commands this arena ever held
+        size_t getHighWatermark() const noexcept { return mHighWatermark; }
+
+        // Destroys the instance uniform buffer, must be called before the arena is destroyed
+        void terminate(driver::DriverApi& driver) noexcept;
+
+    private:
+        friend class RenderPass;
+
+        // Scratch storage of the same capacity, used for sorting. Allocated on first use.
+        Command* getScratch() noexcept;
+
+        void resize(size_t count) noexcept {
+            assert(count <= mCapacity);
+            mSize = count;
+        }
+
+        // Makes the scratch buffer the current buffer, holding count commands.
+        void swapScratch(size_t count) noexcept {
+            assert(count <= mCapacity);
+            std::swap(mCommands, mScratch);
+            mSize = count;
+        }
+
+        void reserve(size_t count) noexcept;
+
+        // Returns a uniform buffer with room for the uniforms of 'count' instances, it's kept
+        // between passes and only reallocated when it's too small.
+        Handle<HwUniformBuffer> getInstanceUbo(driver::DriverApi& driver, size_t count) noexcept;
+
+        Command* mCommands = nullptr;
+        Command* mScratch = nullptr;
+        std::vector<uint32_t> mInstances;   // see instanceCommands(), kept between passes
+        Handle<HwUniformBuffer> mInstanceUbh;
+        size_t mInstanceUboCount = 0;       // number of PerRenderableUib mInstanceUbh can hold
+        size_t mSize = 0;
+        size_t mCapacity = 0;
+        size_t mHighWatermark = 0;
+    };
+
+    // Sorts commands by key. Commands keyed as Pass::SENTINEL are sorted last, but only one of
+    // them is guaranteed to be kept.
+    // Large buffers are sorted with a parallel radix sort on the JobSystem.
+    static void sortCommands(utils::JobSystem& js, CommandArena& commands) noexcept;
+
+    // Radix sort used by sortCommands() for large buffers, public for benchmarking.
+    static void radixSortCommands(utils::JobSystem& js, CommandArena& commands) noexcept;
+
+    // Merges runs of adjacent sorted commands drawing the same primitive with the same material
+    // instance, variant and raster state into instanced draws of at most CONFIG_MAX_INSTANCES
+    // instances. Commands with bones are never merged. The renderable index of each instance is
+    // appended to 'instances', the index of a merged command is the position of its first
+    // instance in 'instances'.
+    static void instanceCommands(CommandArena& commands,
+            std::vector<uint32_t>& instances) noexcept;
+
 
     using RenderFlags = uint8_t;
     static constexpr RenderFlags HAS_SHADOWING           = 0x01;
     static constexpr RenderFlags HAS_DIRECTIONAL_LIGHT   = 0x02;
     static constexpr RenderFlags HAS_DYNAMIC_LIGHTING    = 0x04;
     static constexpr RenderFlags HAS_INVERSE_FRONT_FACES = 0x08;
+    // the static and dynamic shadow casters can be rendered in separate shadow maps
+    static constexpr RenderFlags SKIP_STATIC_SHADOW_CASTERS  = 0x10;
+    static constexpr RenderFlags SKIP_DYNAMIC_SHADOW_CASTERS = 0x20;
 
     explicit RenderPass(const char* name) noexcept : mName(name) { }
 
     virtual ~RenderPass() noexcept;
 
-    // appends rendering commands for the given view
+    // appends rendering commands for the given view, only the renderables whose VISIBLE_MASK
+    // has a bit of 'visibilityMask' set are drawn.
     void render(
             FEngine& engine, utils::JobSystem& js,
             FScene& scene, utils::Range<uint32_t> visibleRenderables,
             uint32_t commandTypeFlags, RenderFlags renderFlags,
+            Culler::result_type visibilityMask,
             const CameraInfo& camera, Viewport const& viewport,
-            utils::GrowingSlice<Command>& commands) noexcept;
+            CommandArena& commands) noexcept;
 
 private:
     // Called just before rendering, make sure all needed asynchronous tasks are finished.
@@ -228,8 +332,8 @@ private:
 private:
     friend class FRenderer;
 
-    // on 64-bits systems, we process batches of 4 (64 bytes) cache-lines, or 8 (32 bytes) commands
-    // on 32-bits systems, we process batches of 8 (32 bytes) cache-lines, or 8 (32 bytes) commands
+    // on 64-bits systems, we process batches of 10 (64 bytes) cache-lines, or 16 (40 bytes) commands
+    // on 32-bits systems, we process batches of 20 (32 bytes) cache-lines, or 16 (40 bytes) commands
     static constexpr size_t JOBS_PARALLEL_FOR_COMMANDS_COUNT = 16;
     static constexpr size_t JOBS_PARALLEL_FOR_COMMANDS_SIZE  =
             sizeof(Command) * JOBS_PARALLEL_FOR_COMMANDS_COUNT;
@@ -237,20 +341,31 @@ private:
     static_assert(JOBS_PARALLEL_FOR_COMMANDS_SIZE % utils::CACHELINE_SIZE == 0,
             "Size of Commands jobs must be multiple of a cache-line size");
 
+    // below this number of commands, std::sort() is faster than our radix sort
+    static constexpr size_t RADIX_SORT_MIN_COMMANDS_COUNT = 4096;
+    // we sort 8 bits per pass
+    static constexpr size_t RADIX_SORT_BITS = 8;
+    static constexpr size_t RADIX_SORT_BUCKET_COUNT = 1u << RADIX_SORT_BITS;
+    // maximum number of jobs per pass, each needs its own histogram
+    static constexpr size_t RADIX_SORT_MAX_CHUNK_COUNT = 32;
+    // minimum number of commands processed by a job
+    static constexpr size_t RADIX_SORT_MIN_CHUNK_SIZE = 2048;
+
     static inline void generateCommands(uint32_t commandTypeFlags, Command* commands,
             FScene::RenderableSoa const& soa, utils::Range<uint32_t> range, RenderFlags renderFlags,
+            Culler::result_type visibilityMask,
             filament::math::float3 cameraPosition, filament::math::float3 cameraForward) noexcept;
 
     template<uint32_t commandTypeFlags>
     static inline void generateCommandsImpl(uint32_t, Command* commands, FScene::RenderableSoa const& soa,
-            utils::Range<uint32_t> range, RenderFlags renderFlags, filament::math::float3 cameraPosition,
-            filament::math::float3 cameraForward) noexcept;
+            utils::Range<uint32_t> range, RenderFlags renderFlags, Culler::result_type visibilityMask,
+            filament::math::float3 cameraPosition, filament::math::float3 cameraForward) noexcept;
 
     static void setupColorCommand(Command& cmdDraw, bool hasDepthPass,
             FMaterialInstance const* mi) noexcept;
 
     static void recordDriverCommands(FEngine::DriverApi& driver, FScene& scene,
-            utils::Slice<Command> const& commands) noexcept;
+            Handle<HwUniformBuffer> instanceUbh, utils::Slice<Command> const& commands) noexcept;
 
     static void updateSummedPrimitiveCounts(
             FScene::RenderableSoa& renderableData, utils::Range<uint32_t> vr) noexcept;
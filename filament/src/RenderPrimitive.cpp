@@ -24,62 +24,75 @@
 namespace filament {
 namespace details {
 
-void FRenderPrimitive::init(driver::DriverApi& driver,
+void FRenderPrimitive::init(FEngine& engine,
         const RenderableManager::Builder::Entry& entry) noexcept {
 
     assert(entry.materialInstance);
 
-    mHandle = driver.createRenderPrimitive();
     mMaterialInstance = upcast(entry.materialInstance);
     mBlendOrder = entry.blendOrder;
 
+    RenderPrimitiveCache::Key geometry;
     if (entry.indices && entry.vertices) {
         FVertexBuffer* vertexBuffer = upcast(entry.vertices);
         FIndexBuffer* indexBuffer = upcast(entry.indices);
 
-        AttributeBitset enabledAttributes = vertexBuffer->getDeclaredAttributes();
-
-        auto const& ebh = vertexBuffer->getHwHandle();
-        auto const& ibh = indexBuffer->getHwHandle();
-
-        driver.setRenderPrimitiveBuffer(mHandle, ebh, ibh, (uint32_t)enabledAttributes.getValue());
-        driver.setRenderPrimitiveRange(mHandle, entry.type,
-                (uint32_t)entry.offset, (uint32_t)entry.minIndex, (uint32_t)entry.maxIndex,
-                (uint32_t)entry.count);
-
-        mPrimitiveType = entry.type;
-        mEnabledAttributes = enabledAttributes;
+        geometry.vertexBuffer = vertexBuffer->getHwHandle();
+        geometry.indexBuffer = indexBuffer->getHwHandle();
+        geometry.enabledAttributes = vertexBuffer->getDeclaredAttributes().getValue();
+        geometry.type = uint32_t(entry.type);
+        geometry.offset = uint32_t(entry.offset);
+        geometry.minIndex = uint32_t(entry.minIndex);
+        geometry.maxIndex = uint32_t(entry.maxIndex);
+        geometry.count = uint32_t(entry.count);
     }
+    setGeometry(engine, geometry);
 }
 
 void FRenderPrimitive::terminate(FEngine& engine) {
     FEngine::DriverApi& driver = engine.getDriverApi();
-    driver.destroyRenderPrimitive(mHandle);
+    engine.getRenderableManager().getRenderPrimitiveCache().release(driver, mGeometry);
+    mHandle.clear();
 }
 
 void FRenderPrimitive::set(FEngine& engine, RenderableManager::PrimitiveType type,
         FVertexBuffer* vertices, FIndexBuffer* indices, size_t offset,
         size_t minIndex, size_t maxIndex, size_t count) noexcept {
-    AttributeBitset enabledAttributes = vertices->getDeclaredAttributes();
-    auto const& ebh = vertices->getHwHandle();
-    auto const& ibh = indices->getHwHandle();
-
-    FEngine::DriverApi& driver = engine.getDriverApi();
-
-    driver.setRenderPrimitiveBuffer(mHandle, ebh, ibh, (uint32_t)enabledAttributes.getValue());
-    driver.setRenderPrimitiveRange(mHandle, type,
-            (uint32_t)offset, (uint32_t)minIndex, (uint32_t)maxIndex, (uint32_t)count);
-
-    mPrimitiveType = type;
-    mEnabledAttributes = enabledAttributes;
+    RenderPrimitiveCache::Key geometry;
+    geometry.vertexBuffer = vertices->getHwHandle();
+    geometry.indexBuffer = indices->getHwHandle();
+    geometry.enabledAttributes = vertices->getDeclaredAttributes().getValue();
+    geometry.type = uint32_t(type);
+    geometry.offset = uint32_t(offset);
+    geometry.minIndex = uint32_t(minIndex);
+    geometry.maxIndex = uint32_t(maxIndex);
+    geometry.count = uint32_t(count);
+    setGeometry(engine, geometry);
 }
 
 void FRenderPrimitive::set(FEngine& engine, RenderableManager::PrimitiveType type, size_t offset,
         size_t minIndex, size_t maxIndex, size_t count) noexcept {
+    RenderPrimitiveCache::Key geometry = mGeometry;
+    geometry.type = uint32_t(type);
+    geometry.offset = uint32_t(offset);
+    geometry.minIndex = uint32_t(minIndex);
+    geometry.maxIndex = uint32_t(maxIndex);
+    geometry.count = uint32_t(count);
+    setGeometry(engine, geometry);
+}
+
+void FRenderPrimitive::setGeometry(FEngine& engine,
+        RenderPrimitiveCache::Key const& geometry) noexcept {
+    // the handle may be shared with other render primitives, so we never modify it, instead we
+    // switch to the one matching the new geometry.
     FEngine::DriverApi& driver = engine.getDriverApi();
-    driver.setRenderPrimitiveRange(mHandle, type,
-            (uint32_t)offset, (uint32_t)minIndex, (uint32_t)maxIndex, (uint32_t)count);
-    mPrimitiveType = type;
+    RenderPrimitiveCache& cache = engine.getRenderableManager().getRenderPrimitiveCache();
+    Handle<HwRenderPrimitive> handle = cache.acquire(driver, geometry);
+    if (mHandle) {
+        cache.release(driver, mGeometry);
+    }
+    mHandle = handle;
+    mGeometry = geometry;
 }
 
 } // namespace details
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/RenderPrimitiveCache.h"
+
+#include "driver/DriverApi.h"
+
+namespace filament {
+
+using namespace driver;
+
+namespace details {
+
+// the whole key is hashed, it can't have padding
+static_assert(sizeof(RenderPrimitiveCache::Key) == 8 * sizeof(uint32_t),
+        "RenderPrimitiveCache::Key has unexpected size");
+
+RenderPrimitiveCache::RenderPrimitiveCache() noexcept = default;
+
+RenderPrimitiveCache::~RenderPrimitiveCache() noexcept {
+    assert(mEntries.empty());
+}
+
+bool RenderPrimitiveCache::KeyEqualFn::operator()(Key const& lhs, Key const& rhs) const noexcept {
+    return lhs.vertexBuffer.getId() == rhs.vertexBuffer.getId() &&
+           lhs.indexBuffer.getId() == rhs.indexBuffer.getId() &&
+           lhs.enabledAttributes == rhs.enabledAttributes &&
+           lhs.type == rhs.type &&
+           lhs.offset == rhs.offset &&
+           lhs.minIndex == rhs.minIndex &&
+           lhs.maxIndex == rhs.maxIndex &&
+           lhs.count == rhs.count;
+}
+
+Handle<HwRenderPrimitive> RenderPrimitiveCache::acquire(DriverApi& driver, Key const& key) {
+    auto pos = mEntries.find(key);
+    if (pos != mEntries.end()) {
+        pos.value().refs++;
+        return pos->second.handle;
+    }
+
+    Handle<HwRenderPrimitive> handle = driver.createRenderPrimitive();
+    if (key.vertexBuffer) {
+        driver.setRenderPrimitiveBuffer(handle,
+                key.vertexBuffer, key.indexBuffer, key.enabledAttributes);
+    }
+    if (PrimitiveType(key.type) != PrimitiveType::NONE) {
+        driver.setRenderPrimitiveRange(handle, PrimitiveType(key.type),
+                key.offset, key.minIndex, key.maxIndex, key.count);
+    }
+    mEntries.insert({ key, { handle, 1 }});
+    return handle;
+}
+
+void RenderPrimitiveCache::release(DriverApi& driver, Key const& key) noexcept {
+    auto pos = mEntries.find(key);
+    assert(pos != mEntries.end());
+    if (pos != mEntries.end() && --pos.value().refs == 0) {
+        driver.destroyRenderPrimitive(pos->second.handle);
+        mEntries.erase(pos);
+    }
+}
+
+} // namespace details
+} // namespace filament
@@ -54,7 +54,8 @@ FRenderer::FRenderer(FEngine& engine) :
         mFrameInfoManager(engine),
         mIsRGB16FSupported(false),
         mIsRGB8Supported(false),
-        mPerRenderPassArena(engine.getPerRenderPassAllocator())
+        mPerRenderPassArena(engine.getPerRenderPassAllocator()),
+        mCommands(CONFIG_PER_FRAME_COMMANDS_SIZE / sizeof(Command))
 {
 }
 
@@ -73,10 +74,10 @@ FRenderer::~FRenderer() noexcept {
     // There shouldn't be any resource left when we get here, but if there is, make sure
     // to free what we can (it would probably mean something when wrong).
 #ifndef NDEBUG
-    size_t wm = getCommandsHighWatermark();
+    size_t wm = getCommandsHighWatermark() * sizeof(Command);
     size_t wmpct = wm / (CONFIG_PER_FRAME_COMMANDS_SIZE / 100);
     slog.d << "Renderer: Commands High watermark "
-    << wm / 1024 << " KiB (" << wmpct << "%), "
+    << wm / 1024 << " KiB (" << wmpct << "% of initial size), "
     << wm / sizeof(Command) << " commands, " << sizeof(Command) << " bytes/command"
     << io::endl;
 #endif
@@ -87,6 +88,7 @@ void FRenderer::terminate(FEngine& engine) {
     // shut down threads if we created any.
     DriverApi& driver = engine.getDriverApi();
     driver.destroyRenderTarget(mRenderTarget);
+    mCommands.terminate(driver);
 
     // before we can destroy this Renderer's resources, we must make sure
     // that all pending commands have been executed (as they could reference data in this
@@ -186,13 +188,11 @@ void FRenderer::renderJob(ArenaScope& arena, FView& view) {
             [&engine, &view](JobSystem&, JobSystem::Job*) { view.froxelize(engine); }));
 
     /*
-     * Allocate command buffer.
+     * Command buffer, grows as needed.
      */
 
-    const size_t commandsSize = FEngine::CONFIG_PER_FRAME_COMMANDS_SIZE;
-    const size_t commandsCount = commandsSize / sizeof(Command);
-    GrowingSlice<Command> commands(
-            arena.allocate<Command>(commandsCount, CACHELINE_SIZE), commandsCount);
+    CommandArena& commands = mCommands;
+    commands.clear();
 
     /*
      * Shadow pass
@@ -200,7 +200,6 @@ void FRenderer::renderJob(ArenaScope& arena, FView& view) {
 
     if (view.hasShadowing()) {
         ShadowPass::renderShadowMap(engine, js, view, commands);
-        recordHighWatermark(commands); // for debugging
         // reset the command buffer
         commands.clear();
     }
@@ -315,9 +314,6 @@ void FRenderer::renderJob(ArenaScope& arena, FView& view) {
 
         driver.popGroupMarker();
     }
-
-    // for debugging
-    recordHighWatermark(commands);
 }
 
 void FRenderer::mirrorFrame(FSwapChain* dstSwapChain, Viewport const& dstViewport,
@@ -551,4 +547,8 @@ void Renderer::resetUserTime() {
     upcast(this)->resetUserTime();
 }
 
+size_t Renderer::getCommandsHighWatermark() const noexcept {
+    return upcast(this)->getCommandsHighWatermark();
+}
+
 } // namespace filament
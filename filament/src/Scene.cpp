@@ -26,12 +26,19 @@
 #include "details/IndirectLight.h"
 #include "details/Skybox.h"
 
+#include "driver/GPUBuffer.h"
+
 #include <utils/compiler.h>
 #include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
 #include <utils/Range.h>
+#include <utils/Systrace.h>
 #include <utils/Zip2Iterator.h>
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <numeric>
 
 using namespace filament::math;
 using namespace utils;
@@ -44,43 +51,456 @@ namespace details {
 FScene::FScene(FEngine& engine) :
         mEngine(engine),
         mIndirectLight(engine.getDefaultIndirectLight()) {
+    engine.getEntityManager().registerListener(&mDestroyedEntities);
+}
+
+FScene::~FScene() noexcept {
+    mEngine.getEntityManager().unregisterListener(&mDestroyedEntities);
 }
 
-FScene::~FScene() noexcept = default;
 
+// Number of lights processed together by prepareLights()
+static constexpr uint32_t LIGHT_CHUNK_SIZE = 256;
 
-void FScene::prepare(const filament::math::mat4f& worldOriginTransform) {
-    // TODO: can we skip this in most cases? Since we rely on indices staying the same,
-    //       we could only skip, if nothing changed in the RCM.
+void FScene::prepare(const filament::math::mat4f& worldOriginTransform,
+        JobSystem::Job* renderablesReady, JobSystem::Job* lightsReady) {
+    SYSTRACE_CALL();
+
+    FEngine& engine = mEngine;
+    JobSystem& js = engine.getJobSystem();
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    FLightManager& lcm = engine.getLightManager();
+
+    // the renderables' uniforms changed in this call are tagged with this version
+    mVersion++;
+
+    // Gather the entities that changed since the last time. If we can't know which did,
+    // everything is recomputed.
+    bool refreshAll = false;
+    for (size_t i = 0; i < 4; i++) {
+        refreshAll |= worldOriginTransform[i] != mWorldOriginTransform[i];
+    }
+    mWorldOriginTransform = worldOriginTransform;
+
+    std::vector<Entity>& dirty = mDirtyEntities;
+    auto addDirty = [&dirty](Entity e) { dirty.push_back(e); };
+    refreshAll |= !mDestroyedEntities.retrieve(dirty);
+    refreshAll |= !tcm.getChangeLog().read(mTransformCursor, addDirty);
+    refreshAll |= !rcm.getChangeLog().read(mRenderableCursor, addDirty);
+    refreshAll |= !lcm.getChangeLog().read(mLightCursor, addDirty);
+
+    if (UTILS_UNLIKELY(refreshAll)) {
+        updateAllEntities(js);
+        updateRenderables(js, nullptr, mRenderableCache.size());
+        mStaticShadowCastersVersion = mVersion;
+    } else if (!dirty.empty()) {
+        if (UTILS_UNLIKELY(!mSlotsValid)) {
+            rebuildSlots();
+        }
+        // the same entity can be listed many times, updateEntity() doesn't mind
+        for (Entity e : dirty) {
+            updateEntity(e);
+        }
+        std::vector<uint32_t>& slots = mDirtySlots;
+        slots.clear();
+        for (Entity e : dirty) {
+            auto pos = mRenderableSlots.find(e);
+            if (pos != mRenderableSlots.end()) {
+                slots.push_back(pos->second);
+            }
+        }
+        // a slot can't be updated by more than one job
+        std::sort(slots.begin(), slots.end());
+        slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+        updateRenderables(js, slots.data(), slots.size());
+    }
+    dirty.clear();
+
+    // The renderables and the lights are prepared concurrently, and the culling hierarchy is
+    // updated as soon as the renderables are ready, without waiting in between.
+    JobSystem::Job* renderablesJob = js.createJob(nullptr,
+            [this](JobSystem& js, JobSystem::Job*) { prepareRenderables(js); });
+    JobSystem::Job* cullingBvhJob = js.createJob(nullptr,
+            [this](JobSystem&, JobSystem::Job*) { updateCullingBvh(); });
+    JobSystem::Job* lightsJob = js.createJob(nullptr,
+            [this](JobSystem& js, JobSystem::Job*) { prepareLights(js); });
+    JobSystem::Job* doneJob = js.createJob();
+    js.addDependency(renderablesJob, cullingBvhJob);
+    js.addDependency(cullingBvhJob, doneJob);
+    js.addDependency(lightsJob, doneJob);
+    // the caller's jobs start without waiting for the rest of the scene
+    if (renderablesReady) {
+        js.addDependency(cullingBvhJob, renderablesReady);
+        js.run(renderablesReady);
+    }
+    if (lightsReady) {
+        js.addDependency(lightsJob, lightsReady);
+        js.run(lightsReady);
+    }
+    js.run(cullingBvhJob);
+    js.run(lightsJob);
+    js.run(renderablesJob);
+    js.runAndWait(doneJob);
+}
+
+void FScene::updateCullingBvh() {
+    SYSTRACE_CALL();
+
+    auto const& sceneData = mRenderableData;
+
+    // Large scenes are culled hierarchically. Renderables keep their slot, so as long as the set
+    // of renderables doesn't change, the hierarchy only needs a refit.
+    if (sceneData.size() >= CullingBvh::MIN_BOX_COUNT) {
+        mCullingBvh.update(sceneData.data<WORLD_AABB_CENTER>(),
+                sceneData.data<WORLD_AABB_EXTENT>(), sceneData.size());
+    } else if (!mCullingBvh.empty()) {
+        mCullingBvh.clear();
+    }
+}
+
+void FScene::updateAllEntities(JobSystem& js) {
+    SYSTRACE_CALL();
 
     FEngine& engine = mEngine;
     EntityManager& em = engine.getEntityManager();
     FRenderableManager& rcm = engine.getRenderableManager();
     FTransformManager& tcm = engine.getTransformManager();
     FLightManager& lcm = engine.getLightManager();
-    // go through the list of entities, and gather the data of those that are renderables
-    auto& sceneData = mRenderableData;
-    auto& lightData = mLightData;
-    auto const& entities = mEntities;
 
+    enum : uint8_t { RENDERABLE = 0x1, LIGHT = 0x2 };
+
+    // NOTE: we can't know in advance how many entities are renderable or lights because
+    // the corresponding component can be added after the entity is added to the scene.
+    std::vector<Entity>& entities = mEntityList;
+    std::vector<uint8_t>& flags = mEntityFlags;
+    entities.assign(mEntities.begin(), mEntities.end());
+    flags.resize(entities.size());
+
+    // find what each entity is (this runs on multiple threads)
+    Entity const* const UTILS_RESTRICT list = entities.data();
+    uint8_t* const UTILS_RESTRICT kinds = flags.data();
+    auto functor = [&em, &rcm, &tcm, &lcm, list, kinds](uint32_t index, uint32_t count) {
+        for (uint32_t i = index, e = index + count; i < e; i++) {
+            const Entity entity = list[i];
+            uint8_t kind = 0;
+            // getInstance() always returns null if the entity is the Null entity
+            // so we don't need to check for that, but we need to check it's alive
+            if (em.isAlive(entity)) {
+                // don't even draw this object if it doesn't have a transform (which shouldn't
+                // happen because one is always created when creating a Renderable component).
+                if (rcm.getInstance(entity) && tcm.getInstance(entity)) {
+                    kind |= RENDERABLE;
+                }
+                if (lcm.getInstance(entity)) {
+                    kind |= LIGHT;
+                }
+            }
+            kinds[i] = kind;
+        }
+    };
+    auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(entities.size()),
+            std::ref(functor), jobs::CountSplitter<1024, 8>());
+    js.runAndWait(job);
+
+    mRenderableEntities.clear();
+    mLightEntities.clear();
+    for (size_t i = 0, c = entities.size(); i < c; i++) {
+        if (kinds[i] & RENDERABLE) {
+            mRenderableEntities.push_back(list[i]);
+        }
+        if (kinds[i] & LIGHT) {
+            mLightEntities.push_back(list[i]);
+        }
+    }
+
+    // the slot maps are rebuilt on demand, the next full update may come before they're needed
+    mSlotsValid = false;
+
+    // All the renderables are recomputed by the caller. The previous data is kept, so that
+    // uniforms that didn't change don't need to be uploaded again.
+    mRenderableCache.resize(mRenderableEntities.size());
+    mSlotVersions.resize(mRenderableEntities.size(), mVersion);
+    mRenderableUniforms.resize(mRenderableEntities.size() * sizeof(PerRenderableUib));
+}
+
+void FScene::rebuildSlots() noexcept {
+    mRenderableSlots.clear();
+    mRenderableSlots.reserve(mRenderableEntities.size());
+    for (size_t i = 0, c = mRenderableEntities.size(); i < c; i++) {
+        mRenderableSlots[mRenderableEntities[i]] = uint32_t(i);
+    }
+    mLightSlots.clear();
+    mLightSlots.reserve(mLightEntities.size());
+    for (size_t i = 0, c = mLightEntities.size(); i < c; i++) {
+        mLightSlots[mLightEntities[i]] = uint32_t(i);
+    }
+    mSlotsValid = true;
+}
+
+void FScene::updateEntity(Entity e) noexcept {
+    FEngine& engine = mEngine;
+    EntityManager& em = engine.getEntityManager();
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    FLightManager& lcm = engine.getLightManager();
+    auto& cache = mRenderableCache;
+
+    // getInstance() always returns null if the entity is the Null entity
+    // so we don't need to check for that, but we need to check it's alive
+    const bool inScene = em.isAlive(e) && mEntities.find(e) != mEntities.end();
+    const bool isRenderable = inScene && rcm.getInstance(e) && tcm.getInstance(e);
+    const bool isLight = inScene && lcm.getInstance(e);
+
+    // the last entry takes the place of the one we're removing
+    auto remove = [](std::vector<Entity>& entities,
+            tsl::robin_map<Entity, uint32_t>& slots, uint32_t slot) {
+        const uint32_t last = uint32_t(entities.size() - 1);
+        if (slot != last) {
+            const Entity moved = entities[last];
+            entities[slot] = moved;
+            slots[moved] = slot;
+        }
+        entities.pop_back();
+    };
+
+    auto pos = mRenderableSlots.find(e);
+    if (isRenderable) {
+        if (pos == mRenderableSlots.end()) {
+            // the data is computed by updateRenderables()
+            mRenderableSlots[e] = uint32_t(cache.size());
+            mRenderableEntities.push_back(e);
+            mSlotVersions.push_back(mVersion);
+            mRenderableUniforms.resize(mRenderableUniforms.size() + sizeof(PerRenderableUib));
+            cache.push_back();
+        }
+    } else if (pos != mRenderableSlots.end()) {
+        const uint32_t slot = pos->second;
+        if (cache.elementAt<VISIBILITY_STATE>(slot).staticShadowCaster) {
+            mStaticShadowCastersVersion = mVersion;
+        }
+        mRenderableSlots.erase(pos);
+        const size_t last = cache.size() - 1;
+        cache.swap(slot, last);
+        cache.pop_back();
+        if (slot != last) {
+            memcpy(mRenderableUniforms.data() + slot * sizeof(PerRenderableUib),
+                    mRenderableUniforms.data() + last * sizeof(PerRenderableUib),
+                    sizeof(PerRenderableUib));
+        }
+        mRenderableUniforms.resize(last * sizeof(PerRenderableUib));
+        // the uniforms of the renderable moved to this slot must be uploaded
+        mSlotVersions[slot] = mVersion;
+        mSlotVersions.pop_back();
+        mLastChangeVersion = mVersion;
+        remove(mRenderableEntities, mRenderableSlots, slot);
+    }
+
+    auto lpos = mLightSlots.find(e);
+    if (isLight) {
+        if (lpos == mLightSlots.end()) {
+            mLightSlots[e] = uint32_t(mLightEntities.size());
+            mLightEntities.push_back(e);
+        }
+    } else if (lpos != mLightSlots.end()) {
+        const uint32_t slot = lpos->second;
+        mLightSlots.erase(lpos);
+        remove(mLightEntities, mLightSlots, slot);
+    }
+}
+
+void FScene::updateRenderables(JobSystem& js, uint32_t const* slots, size_t count) {
+    SYSTRACE_CALL();
+
+    FEngine& engine = mEngine;
+    FRenderableManager const& rcm = engine.getRenderableManager();
+    FTransformManager const& tcm = engine.getTransformManager();
+    auto& cache = mRenderableCache;
+
+    const AffineTransform worldOriginTransform{ mWorldOriginTransform };
+    Entity const* const UTILS_RESTRICT entities = mRenderableEntities.data();
+    auto* const UTILS_RESTRICT instances = cache.data<RENDERABLE_INSTANCE>();
+    AffineTransform* const UTILS_RESTRICT worldTransforms = cache.data<WORLD_TRANSFORM>();
+    auto* const UTILS_RESTRICT visibility = cache.data<VISIBILITY_STATE>();
+    auto* const UTILS_RESTRICT bones = cache.data<BONES_UBH>();
+    float3* const UTILS_RESTRICT centers = cache.data<WORLD_AABB_CENTER>();
+    uint8_t* const UTILS_RESTRICT layers = cache.data<LAYERS>();
+    float3* const UTILS_RESTRICT extents = cache.data<WORLD_AABB_EXTENT>();
+    uint64_t* const UTILS_RESTRICT versions = mSlotVersions.data();
+    void* const uniforms = mRenderableUniforms.data();
+    const uint64_t version = mVersion;
+    std::atomic<bool> uniformsChanged{ false };
+    std::atomic<bool> staticShadowCastersChanged{ false };
+
+    // each slot is written by a single job (this runs on multiple threads)
+    auto functor = [&](uint32_t index, uint32_t count) {
+        bool changed = false;
+        bool staticCasterChanged = false;
+        for (uint32_t i = index, e = index + count; i < e; i++) {
+            const uint32_t slot = slots ? slots[i] : i;
+            const Entity entity = entities[slot];
+            const auto ri = rcm.getInstance(entity);
+            const auto ti = tcm.getInstance(entity);
+
+            // get the world transform
+            const AffineTransform worldTransform =
+                    worldOriginTransform * AffineTransform{ tcm.getWorldTransform(ti) };
+
+            // compute the world AABB so we can perform culling
+            const Box worldAABB = rigidTransform(rcm.getAABB(ri), worldTransform);
+
+            // the uniforms only depend on the world transform, they're computed here once for
+            // all the views and passes
+            if (memcmp(&worldTransforms[slot], &worldTransform, sizeof(AffineTransform)) != 0) {
+                versions[slot] = version;
+            }
+            if (versions[slot] == version) {
+                writeRenderableUniforms(uniforms, slot * sizeof(PerRenderableUib),
+                        worldTransform);
+                changed = true;
+            }
+
+            // the slot is only updated if something changed, which invalidates the cached
+            // shadow maps if the renderable is, or was, a static shadow caster
+            const auto v = rcm.getVisibility(ri);
+            staticCasterChanged |= v.staticShadowCaster | visibility[slot].staticShadowCaster;
+
+            instances[slot]         = ri;
+            worldTransforms[slot]   = worldTransform;
+            visibility[slot]        = v;
+            bones[slot]             = rcm.getBonesUbh(ri);
+            centers[slot]           = worldAABB.center;
+            layers[slot]            = rcm.getLayerMask(ri);
+            extents[slot]           = worldAABB.halfExtent;
+        }
+        if (changed) {
+            uniformsChanged.store(true, std::memory_order_relaxed);
+        }
+        if (staticCasterChanged) {
+            staticShadowCastersChanged.store(true, std::memory_order_relaxed);
+        }
+    };
+    auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(count),
+            std::ref(functor), jobs::CountSplitter<128, 8>());
+    js.runAndWait(job);
+
+    if (uniformsChanged.load(std::memory_order_relaxed)) {
+        mLastChangeVersion = version;
+    }
+    if (staticShadowCastersChanged.load(std::memory_order_relaxed)) {
+        mStaticShadowCastersVersion = version;
+    }
+}
+
+void FScene::prepareRenderables(JobSystem& js) {
+    SYSTRACE_CALL();
 
-    // NOTE: we can't know in advance how many entities are renderable or lights because the corresponding
-    // component can be added after the entity is added to the scene.
+    auto& sceneData = mRenderableData;
+    auto const& cache = mRenderableCache;
 
-    size_t renderableDataCapacity = entities.size();
+    const size_t renderableCount = cache.size();
+    size_t renderableDataCapacity = renderableCount;
     // we need the capacity to be multiple of 16 for SIMD loops
     renderableDataCapacity = (renderableDataCapacity + 0xF) & ~0xF;
     // we need 1 extra entry at the end for the summed primitive count
     renderableDataCapacity = renderableDataCapacity + 1;
 
-    sceneData.clear();
     if (sceneData.capacity() < renderableDataCapacity) {
+        // don't bother preserving last frame's data
+        sceneData.clear();
         sceneData.setCapacity(renderableDataCapacity);
     }
+    // all elements are overwritten below, this only constructs the new ones
+    sceneData.resize(renderableCount);
+
+    // Copy the renderables in the per-frame data, which the View reorders as it sees fit
+    // (this runs on multiple threads)
+    auto functor = [&sceneData, &cache](uint32_t index, uint32_t count) {
+        std::copy_n(cache.data<RENDERABLE_INSTANCE>() + index, count,
+                sceneData.data<RENDERABLE_INSTANCE>() + index);
+        std::copy_n(cache.data<WORLD_TRANSFORM>() + index, count,
+                sceneData.data<WORLD_TRANSFORM>() + index);
+        std::copy_n(cache.data<VISIBILITY_STATE>() + index, count,
+                sceneData.data<VISIBILITY_STATE>() + index);
+        std::copy_n(cache.data<BONES_UBH>() + index, count,
+                sceneData.data<BONES_UBH>() + index);
+        std::iota(sceneData.data<UBO_SLOT>() + index,
+                sceneData.data<UBO_SLOT>() + index + count, index);
+        std::copy_n(cache.data<WORLD_AABB_CENTER>() + index, count,
+                sceneData.data<WORLD_AABB_CENTER>() + index);
+        std::fill_n(sceneData.data<VISIBLE_MASK>() + index, count, 0);
+        std::copy_n(cache.data<LAYERS>() + index, count,
+                sceneData.data<LAYERS>() + index);
+        std::copy_n(cache.data<WORLD_AABB_EXTENT>() + index, count,
+                sceneData.data<WORLD_AABB_EXTENT>() + index);
+        std::fill_n(sceneData.data<PRIMITIVES>() + index, count, Slice<FRenderPrimitive>{});
+        std::fill_n(sceneData.data<SUMMED_PRIMITIVE_COUNT>() + index, count, 0);
+    };
+    auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(renderableCount),
+            std::ref(functor), jobs::CountSplitter<4096, 8>());
+    js.runAndWait(job);
+}
+
+void FScene::prepareLights(JobSystem& js) {
+    SYSTRACE_CALL();
+
+    FEngine& engine = mEngine;
+    FTransformManager const& tcm = engine.getTransformManager();
+    FLightManager const& lcm = engine.getLightManager();
+    auto& lightData = mLightData;
+
+    const mat4f worldOriginTransform = mWorldOriginTransform;
+    const uint32_t lightCount = uint32_t(mLightEntities.size());
+    const uint32_t chunkCount = (lightCount + LIGHT_CHUNK_SIZE - 1) / LIGHT_CHUNK_SIZE;
+    mLightInstances.resize(lightCount);
+    mLightChunks.resize(chunkCount);
+    Entity const* const UTILS_RESTRICT entities = mLightEntities.data();
+    FLightManager::Instance* const UTILS_RESTRICT instances = mLightInstances.data();
+    LightChunk* const UTILS_RESTRICT chunks = mLightChunks.data();
+
+    // 1) count the positional lights and find the brightest directional light of each chunk
+    // (this runs on multiple threads)
+    auto count = [&lcm, entities, instances, chunks, lightCount](uint32_t index, uint32_t n) {
+        for (uint32_t c = index, ce = index + n; c < ce; c++) {
+            LightChunk chunk{ 0, ~0u, 0.0f };
+            for (uint32_t i = c * LIGHT_CHUNK_SIZE,
+                    e = std::min(i + LIGHT_CHUNK_SIZE, lightCount); i < e; i++) {
+                const auto li = lcm.getInstance(entities[i]);
+                instances[i] = li;
+                if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
+                    if (lcm.getIntensity(li) >= chunk.intensity) {
+                        chunk.directional = i;
+                        chunk.intensity = lcm.getIntensity(li);
+                    }
+                } else {
+                    chunk.offset++;
+                }
+            }
+            chunks[c] = chunk;
+        }
+    };
+    auto job = jobs::parallel_for(js, nullptr, 0, chunkCount,
+            std::ref(count), jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
+
+    // 2) the positional lights of each chunk are stored after the ones of the previous chunks
+    uint32_t positionalCount = 0;
+    uint32_t directional = ~0u;
+    float maxIntensity = 0;
+    for (uint32_t c = 0; c < chunkCount; c++) {
+        const uint32_t n = chunks[c].offset;
+        chunks[c].offset = positionalCount;
+        positionalCount += n;
+        // find the dominant directional light
+        if (chunks[c].directional != ~0u && chunks[c].intensity >= maxIntensity) {
+            directional = chunks[c].directional;
+            maxIntensity = chunks[c].intensity;
+        }
+    }
 
     // The light data list will always contain at least one entry for the
     // dominating directional light, even if there are no entities.
-    size_t lightDataCapacity = std::max<size_t>(1, entities.size());
+    size_t lightDataCapacity = DIRECTIONAL_LIGHTS_COUNT + positionalCount;
     // we need the capacity to be multiple of 16 for SIMD loops
     lightDataCapacity = (lightDataCapacity + 0xF) & ~0xF;
 
@@ -89,59 +509,43 @@ void FScene::prepare(const filament::math::mat4f& worldOriginTransform) {
         lightData.setCapacity(lightDataCapacity);
     }
     // the first entries are reserved for the directional lights (currently only one)
-    lightData.resize(DIRECTIONAL_LIGHTS_COUNT);
-
-
-    // find the max intensity directional light index in our local array
-    float maxIntensity = 0;
-
-    for (Entity e : entities) {
-        if (!em.isAlive(e))
-            continue;
-
-        // getInstance() always returns null if the entity is the Null entity
-        // so we don't need to check for that, but we need to check it's alive
-        auto ri = rcm.getInstance(e);
-        auto li = lcm.getInstance(e);
-        if (!ri & !li)
-            continue;
-
-        // get the world transform
-        auto ti = tcm.getInstance(e);
-        const mat4f worldTransform = worldOriginTransform * tcm.getWorldTransform(ti);
-
-        // don't even draw this object if it doesn't have a transform (which shouldn't happen
-        // because one is always created when creating a Renderable component).
-        if (ri && ti) {
-            // compute the world AABB so we can perform culling
-            const Box worldAABB = rigidTransform(rcm.getAABB(ri), worldTransform);
-
-            // we know there is enough space in the array
-            sceneData.push_back_unsafe(
-                    ri,
-                    worldTransform,
-                    rcm.getVisibility(ri),
-                    rcm.getBonesUbh(ri),
-                    worldAABB.center,
-                    0,
-                    rcm.getLayerMask(ri),
-                    worldAABB.halfExtent,
-                    {}, {});
-        }
+    lightData.resize(DIRECTIONAL_LIGHTS_COUNT + positionalCount);
+
+    // the directional light's shadows don't use the shadow params
+    lightData.elementAt<FScene::SHADOW_PARAMS>(0) = float2{ -1.0f, 0.0f };
+
+    // we don't store the directional lights, because we only have a single one
+    if (directional != ~0u) {
+        const auto li = instances[directional];
+        const mat4f worldTransform = worldOriginTransform *
+                tcm.getWorldTransform(tcm.getInstance(entities[directional]));
+        float3 d = lcm.getLocalDirection(li);
+        // using the inverse-transpose handles non-uniform scaling
+        d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
+        lightData.elementAt<FScene::POSITION_RADIUS>(0) = float4{ 0, 0, 0, std::numeric_limits<float>::infinity() };
+        lightData.elementAt<FScene::DIRECTION>(0)       = d;
+        lightData.elementAt<FScene::LIGHT_INSTANCE>(0)  = li;
+    }
 
-        if (li) {
-            // find the dominant directional light
-            if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
-                // we don't store the directional lights, because we only have a single one
-                if (lcm.getIntensity(li) >= maxIntensity) {
-                    float3 d = lcm.getLocalDirection(li);
-                    // using the inverse-transpose handles non-uniform scaling
-                    d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
-                    lightData.elementAt<FScene::POSITION_RADIUS>(0) = float4{ 0, 0, 0, std::numeric_limits<float>::infinity() };
-                    lightData.elementAt<FScene::DIRECTION>(0)       = d;
-                    lightData.elementAt<FScene::LIGHT_INSTANCE>(0)  = li;
+    // 3) store the positional lights, each chunk writes its own range
+    // (this runs on multiple threads)
+    float4* const UTILS_RESTRICT spheres = lightData.data<POSITION_RADIUS>() + DIRECTIONAL_LIGHTS_COUNT;
+    float3* const UTILS_RESTRICT directions = lightData.data<DIRECTION>() + DIRECTIONAL_LIGHTS_COUNT;
+    auto* const UTILS_RESTRICT lights = lightData.data<LIGHT_INSTANCE>() + DIRECTIONAL_LIGHTS_COUNT;
+    float2* const UTILS_RESTRICT shadows = lightData.data<SHADOW_PARAMS>() + DIRECTIONAL_LIGHTS_COUNT;
+    auto store = [&tcm, &lcm, worldOriginTransform, entities, instances, chunks, lightCount,
+            spheres, directions, lights, shadows](uint32_t index, uint32_t n) {
+        for (uint32_t c = index, ce = index + n; c < ce; c++) {
+            uint32_t j = chunks[c].offset;
+            for (uint32_t i = c * LIGHT_CHUNK_SIZE,
+                    e = std::min(i + LIGHT_CHUNK_SIZE, lightCount); i < e; i++) {
+                const auto li = instances[i];
+                if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
+                    continue;
                 }
-            } else {
+                // get the world transform
+                auto ti = tcm.getInstance(entities[i]);
+                const mat4f worldTransform = worldOriginTransform * tcm.getWorldTransform(ti);
                 const float4 p = worldTransform * float4{ lcm.getLocalPosition(li), 1 };
                 float3 d = 0;
                 if (!lcm.isPointLight(li) || lcm.isIESLight(li)) {
@@ -149,11 +553,17 @@ void FScene::prepare(const filament::math::mat4f& worldOriginTransform) {
                     // using the inverse-transpose handles non-uniform scaling
                     d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
                 }
-                lightData.push_back_unsafe(
-                        float4{ p.xyz, lcm.getRadius(li) }, d, li, {}, {});
+                spheres[j] = float4{ p.xyz, lcm.getRadius(li) };
+                directions[j] = d;
+                lights[j] = li;
+                shadows[j] = float2{ -1.0f, 0.0f }; // set by the view if the light is shadowed
+                j++;
             }
         }
-    }
+    };
+    job = jobs::parallel_for(js, nullptr, 0, chunkCount,
+            std::ref(store), jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
 
     // some elements past the end of the array will be accessed by SIMD code, we need to make
     // sure the data is valid enough as not to produce errors such as divide-by-zero
@@ -163,43 +573,97 @@ void FScene::prepare(const filament::math::mat4f& worldOriginTransform) {
     }
 }
 
-void FScene::updateUBOs(utils::Range<uint32_t> visibleRenderables, Handle<HwUniformBuffer> renderableUbh) noexcept {
+void FScene::DestroyedEntities::onEntitiesDestroyed(size_t n, Entity const* entities) noexcept {
+    std::lock_guard<Mutex> lock(mLock);
+    mEntities.insert(mEntities.end(), entities, entities + n);
+}
+
+void FScene::DestroyedEntities::onAllEntitiesDestroyed() noexcept {
+    std::lock_guard<Mutex> lock(mLock);
+    mEntities.clear();
+    mAllDestroyed = true;
+}
+
+bool FScene::DestroyedEntities::retrieve(std::vector<Entity>& entities) noexcept {
+    std::lock_guard<Mutex> lock(mLock);
+    entities.insert(entities.end(), mEntities.begin(), mEntities.end());
+    mEntities.clear();
+    const bool allDestroyed = mAllDestroyed;
+    mAllDestroyed = false;
+    return !allDestroyed;
+}
+
+void FScene::writeRenderableUniforms(void* buffer, size_t offset,
+        AffineTransform const& model) noexcept {
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, worldFromModelMatrix),
+            model.toMat4());
+
+    // Using the inverse-transpose handles non-uniform scaling, but DOESN'T guarantee that
+    // the transformed normals will have unit-length, therefore they need to be normalized
+    // in the shader (that's already the case anyways, since normalization is needed after
+    // interpolation).
+    //
+    // We pre-scale normals by the inverse of the largest scale factor to avoid
+    // large post-transform magnitudes in the shader, especially in the fragment shader, where
+    // we use medium precision.
+    //
+    // Note: if the model matrix is known to be a rigid-transform, we could just use it directly.
+
+    mat3f m = transpose(inverse(model.upperLeft()));
+    m *= mat3f(1.0f / std::sqrt(max(float3{length2(m[0]), length2(m[1]), length2(m[2])})));
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, worldFromModelNormalMatrix), m);
+}
+
+uint64_t FScene::updateUBOs(Handle<HwUniformBuffer> renderableUbh, uint64_t version) noexcept {
+    SYSTRACE_CALL();
+
+    // uniforms past this number of unchanged slots are uploaded in a separate range
+    constexpr uint32_t MAX_UNCHANGED_SLOTS_IN_RANGE = 16;
+    // with more ranges than this, a single range covering all of them is uploaded instead
+    constexpr size_t MAX_RANGE_COUNT = 32;
+
+    mRenderableViewUbh = renderableUbh;
+    if (version >= mLastChangeVersion) {
+        // nothing changed, what's in the UBO is up-to-date
+        return mVersion;
+    }
+
+    // find the ranges of slots whose uniforms changed since 'version'
+    Range<uint32_t> ranges[MAX_RANGE_COUNT];
+    size_t rangeCount = 0;
+    uint64_t const* const UTILS_RESTRICT versions = mSlotVersions.data();
+    for (uint32_t i = 0, c = uint32_t(mSlotVersions.size()); i < c; i++) {
+        if (versions[i] > version) {
+            if (rangeCount && i - ranges[rangeCount - 1].last <= MAX_UNCHANGED_SLOTS_IN_RANGE) {
+                ranges[rangeCount - 1].last = i + 1;
+            } else if (rangeCount < MAX_RANGE_COUNT) {
+                ranges[rangeCount++] = { i, i + 1 };
+            } else {
+                // too many ranges, upload everything in between
+                ranges[0].last = i + 1;
+                rangeCount = 1;
+            }
+        }
+    }
+
     FEngine::DriverApi& driver = mEngine.getDriverApi();
-    const size_t size = visibleRenderables.size() * sizeof(PerRenderableUib);
+    uint8_t const* const UTILS_RESTRICT uniforms = mRenderableUniforms.data();
+    for (size_t r = 0; r < rangeCount; r++) {
+        Range<uint32_t> const range = ranges[r];
+        const size_t size = range.size() * sizeof(PerRenderableUib);
 
-    // allocate space into the command stream directly
-    void* const buffer = driver.allocate(size);
+        // allocate space into the command stream directly
+        void* const buffer = driver.allocate(size);
+        memcpy(buffer, uniforms + range.first * sizeof(PerRenderableUib), size);
 
-    auto& sceneData = mRenderableData;
-    for (uint32_t i : visibleRenderables) {
-        mat4f const& model = sceneData.elementAt<WORLD_TRANSFORM>(i);
-        const size_t offset = i * sizeof(PerRenderableUib);
-
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, worldFromModelMatrix),
-                model);
-
-        // Using the inverse-transpose handles non-uniform scaling, but DOESN'T guarantee that
-        // the transformed normals will have unit-length, therefore they need to be normalized
-        // in the shader (that's already the case anyways, since normalization is needed after
-        // interpolation).
-        //
-        // We pre-scale normals by the inverse of the largest scale factor to avoid
-        // large post-transform magnitudes in the shader, especially in the fragment shader, where
-        // we use medium precision.
-        //
-        // Note: if the model matrix is known to be a rigid-transform, we could just use it directly.
-
-        mat3f m = transpose(inverse(model.upperLeft()));
-        m *= mat3f(1.0f / std::sqrt(max(float3{length2(m[0]), length2(m[1]), length2(m[2])})));
-
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, worldFromModelNormalMatrix), m);
+        driver.updateUniformBufferRange(renderableUbh, { buffer, size },
+                uint32_t(range.first * sizeof(PerRenderableUib)));
     }
 
-    // TODO: handle static objects separately
-    mRenderableViewUbh = renderableUbh;
-    driver.updateUniformBuffer(renderableUbh, { buffer, size });
+    return mVersion;
 }
 
 void FScene::terminate(FEngine& engine) {
@@ -207,14 +671,14 @@ void FScene::terminate(FEngine& engine) {
     mRenderableViewUbh.clear();
 }
 
-void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootArena, Handle<HwUniformBuffer> lightUbh) noexcept {
+void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootArena, GPUBuffer& lightBuffer) noexcept {
     FEngine::DriverApi& driver = mEngine.getDriverApi();
     FLightManager& lcm = mEngine.getLightManager();
     FScene::LightSoa& lightData = getLightData();
 
     /*
      * Here we copy our lights data into the GPU buffer, some lights might be left out if there
-     * are more than the GPU buffer allows (i.e. 256).
+     * are more than the GPU buffer allows (i.e. CONFIG_MAX_LIGHT_COUNT).
      *
      * We always sort lights by distance to the camera plane so that:
      * - we can build light trees
@@ -245,20 +709,30 @@ void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootAren
     float2* const zrange = lightData.data<FScene::SCREEN_SPACE_Z_RANGE>();
     computeLightRanges(zrange, camera, spheres + DIRECTIONAL_LIGHTS_COUNT, positionalLightCount);
 
-    LightsUib* const lp = driver.allocatePod<LightsUib>(positionalLightCount);
+    if (!positionalLightCount) {
+        return;
+    }
+
+    // the light buffer is updated by whole rows, the lights past the last one are zeroed
+    const size_t gpuLightCount = (positionalLightCount + LIGHT_PER_ROW - 1) & ~(LIGHT_PER_ROW - 1);
+    assert(gpuLightCount * LIGHT_TEXELS_PER_LIGHT <= LIGHT_BUFFER_WIDTH * lightBuffer.getHeight());
+    LightsUib* const lp = driver.allocatePod<LightsUib>(gpuLightCount);
+    memset(lp + positionalLightCount, 0, (gpuLightCount - positionalLightCount) * sizeof(LightsUib));
 
     auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
     auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
+    auto const* UTILS_RESTRICT shadows      = lightData.data<FScene::SHADOW_PARAMS>();
     for (size_t i = DIRECTIONAL_LIGHTS_COUNT, c = lightData.size(); i < c; ++i) {
         const size_t gpuIndex = i - DIRECTIONAL_LIGHTS_COUNT;
         auto li = instances[i];
         lp[gpuIndex].positionFalloff      = { spheres[i].xyz, lcm.getSquaredFalloffInv(li) };
         lp[gpuIndex].colorIntensity       = { lcm.getColor(li), lcm.getIntensity(li) };
         lp[gpuIndex].directionIES         = { directions[i], 0 };
-        lp[gpuIndex].spotScaleOffset.xy   = { lcm.getSpotParams(li).scaleOffset };
+        lp[gpuIndex].spotScaleOffset      = {
+                lcm.getSpotParams(li).scaleOffset, shadows[i].x, shadows[i].y };
     }
 
-    driver.updateUniformBuffer(lightUbh, { lp, positionalLightCount * sizeof(LightsUib) });
+    lightBuffer.commit(driver, lp, lp + gpuLightCount);
 }
 
 // These methods need to exist so clang honors the __restrict__ keyword, which in turn
@@ -315,10 +789,12 @@ void FScene::computeLightRanges(
 
 void FScene::addEntity(Entity entity) {
     mEntities.insert(entity);
+    mDirtyEntities.push_back(entity);
 }
 
 void FScene::remove(Entity entity) {
     mEntities.erase(entity);
+    mDirtyEntities.push_back(entity);
 }
 
 size_t FScene::getRenderableCount() const noexcept {
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/ShadowAtlasAllocator.h"
+
+#include <utils/algorithm.h>
+#include <utils/compiler.h>
+
+#include <assert.h>
+
+namespace filament {
+namespace details {
+
+static constexpr size_t INVALID_NODE = size_t(-1);
+
+static inline uint8_t log2i(uint32_t x) noexcept {
+    return uint8_t(31u - utils::clz(x));
+}
+
+// the x and y coordinates of a node are interleaved in its index within its level
+static inline uint32_t mortonCompact(size_t i) noexcept {
+    uint32_t r = 0;
+    for (uint32_t bit = 0; i; bit++, i >>= 2u) {
+        r |= uint32_t(i & 1u) << bit;
+    }
+    return r;
+}
+
+static inline size_t mortonInterleave(uint32_t x, uint32_t y) noexcept {
+    size_t r = 0;
+    for (uint32_t bit = 0; x | y; bit += 2, x >>= 1u, y >>= 1u) {
+        r |= size_t(x & 1u) << bit;
+        r |= size_t(y & 1u) << (bit + 1);
+    }
+    return r;
+}
+
+ShadowAtlasAllocator::ShadowAtlasAllocator() noexcept = default;
+
+ShadowAtlasAllocator::~ShadowAtlasAllocator() noexcept = default;
+
+void ShadowAtlasAllocator::init(uint32_t dimension, uint32_t minTileDimension) noexcept {
+    assert(dimension && !(dimension & (dimension - 1)));
+    assert(minTileDimension && !(minTileDimension & (minTileDimension - 1)));
+    assert(minTileDimension <= dimension);
+    mDimension = dimension;
+    mMaxLevel = log2i(dimension) - log2i(minTileDimension);
+    mNodes.assign(getLevelOffset(mMaxLevel + 1u), State::FREE);
+}
+
+Viewport ShadowAtlasAllocator::allocate(uint32_t tileDimension) noexcept {
+    assert(tileDimension && !(tileDimension & (tileDimension - 1)));
+    if (UTILS_UNLIKELY(mNodes.empty() || tileDimension > mDimension ||
+            tileDimension < getMinTileDimension())) {
+        return {};
+    }
+    const size_t level = log2i(mDimension) - log2i(tileDimension);
+    const size_t node = allocate(0, 0, level);
+    if (node == INVALID_NODE) {
+        return {};
+    }
+    return getTile(node, level);
+}
+
+size_t ShadowAtlasAllocator::allocate(size_t node, size_t level, size_t targetLevel) noexcept {
+    State& state = mNodes[node];
+    if (level == targetLevel) {
+        if (state != State::FREE) {
+            return INVALID_NODE;
+        }
+        state = State::ALLOCATED;
+        return node;
+    }
+
+    if (state == State::ALLOCATED) {
+        return INVALID_NODE;
+    }
+
+    const size_t firstChild = node * 4 + 1;
+    if (state == State::SPLIT) {
+        // look in the partially used tiles first, to keep the free ones whole
+        for (size_t i = 0; i < 4; i++) {
+            if (mNodes[firstChild + i] == State::SPLIT) {
+                size_t result = allocate(firstChild + i, level + 1, targetLevel);
+                if (result != INVALID_NODE) {
+                    return result;
+                }
+            }
+        }
+        for (size_t i = 0; i < 4; i++) {
+            if (mNodes[firstChild + i] == State::FREE) {
+                return allocate(firstChild + i, level + 1, targetLevel);
+            }
+        }
+        return INVALID_NODE;
+    }
+
+    // the children of a free node are always free
+    state = State::SPLIT;
+    return allocate(firstChild, level + 1, targetLevel);
+}
+
+void ShadowAtlasAllocator::free(Viewport const& tile) noexcept {
+    assert(tile.width && tile.width == tile.height);
+    assert(tile.width <= mDimension && tile.width >= getMinTileDimension());
+
+    const size_t level = log2i(mDimension) - log2i(tile.width);
+    const uint32_t x = uint32_t(tile.left) / tile.width;
+    const uint32_t y = uint32_t(tile.bottom) / tile.width;
+    size_t node = getLevelOffset(level) + mortonInterleave(x, y);
+    assert(node < mNodes.size());
+    assert(mNodes[node] == State::ALLOCATED);
+    mNodes[node] = State::FREE;
+
+    // merge the tile with its siblings, as long as they're all free
+    while (node) {
+        const size_t parent = (node - 1) / 4;
+        const size_t firstChild = parent * 4 + 1;
+        for (size_t i = 0; i < 4; i++) {
+            if (mNodes[firstChild + i] != State::FREE) {
+                return;
+            }
+        }
+        mNodes[parent] = State::FREE;
+        node = parent;
+    }
+}
+
+Viewport ShadowAtlasAllocator::getTile(size_t node, size_t level) const noexcept {
+    const size_t index = node - getLevelOffset(level);
+    const uint32_t dimension = mDimension >> level;
+    const uint32_t x = mortonCompact(index);
+    const uint32_t y = mortonCompact(index >> 1u);
+    return { int32_t(x * dimension), int32_t(y * dimension), dimension, dimension };
+}
+
+} // namespace details
+} // namespace filament
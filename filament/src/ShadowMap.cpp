@@ -22,8 +22,6 @@
 #include "details/ShadowMap.h"
 #include "details/Scene.h"
 
-#include <private/filament/SibGenerator.h>
-
 #include <filament/driver/DriverEnums.h>
 
 #include <limits>
@@ -62,88 +60,52 @@ ShadowMap::~ShadowMap() {
     mEngine.destroy(mDebugCamera->getEntity());
 }
 
-void ShadowMap::prepare(DriverApi& driver, SamplerBuffer& sb) noexcept {
-    assert(mShadowMapDimension);
-
-    uint32_t dim = mShadowMapDimension;
-    uint32_t currentDimension = mViewport.width + 2;
-    if (currentDimension == dim) {
-        // nothing to do here.
-        assert(mShadowMapHandle);
-        return;
-    }
-
-    // destroy the current rendertarget and texture
-    if (mShadowMapRenderTarget) {
-        driver.destroyRenderTarget(mShadowMapRenderTarget);
-    }
-    if (mShadowMapHandle) {
-        driver.destroyTexture(mShadowMapHandle);
-    }
-
-    // allocate new ones...
-    // we set a viewport with a 1-texel border for when we index outside of the texture
-    // DON'T CHANGE this unless computeLightSpaceMatrix() is updated too.
-    // see: computeLightSpaceMatrix()
-    mViewport = { 1, 1, dim - 2, dim - 2 };
-
-    mShadowMapHandle = driver.createTexture(
-            Driver::SamplerType::SAMPLER_2D, 1, Driver::TextureFormat::DEPTH16, 1, dim, dim, 1,
-            TextureUsage::DEPTH_ATTACHMENT);
-
-    mShadowMapRenderTarget = driver.createRenderTarget(
-            TargetBufferFlags::SHADOW, dim, dim, 1, Driver::TextureFormat::DEPTH16,
-            {}, { mShadowMapHandle }, {});
-
-    SamplerParams s;
-    s.filterMag = SamplerMagFilter::LINEAR;
-    s.filterMin = SamplerMinFilter::LINEAR;
-    s.compareFunc = SamplerCompareFunc::LE;
-    s.compareMode = SamplerCompareMode::COMPARE_TO_TEXTURE;
-    s.depthStencil = true;
-    sb.setSampler(PerViewSib::SHADOW_MAP, { mShadowMapHandle, s });
-}
-
-void ShadowMap::terminate(DriverApi& driverApi) noexcept {
-    if (mShadowMapRenderTarget) {
-        driverApi.destroyRenderTarget(mShadowMapRenderTarget);
-    }
-    if (mShadowMapHandle) {
-        driverApi.destroyTexture(mShadowMapHandle);
+void ShadowMap::computeCascadeSplits(float* splits, size_t cascadeCount, float zn, float zf,
+        FLightManager::ShadowParams const& params) noexcept {
+    assert(cascadeCount >= 1 && cascadeCount <= CONFIG_MAX_SHADOW_CASCADES);
+    splits[0] = zn;
+    splits[cascadeCount] = zf;
+    // explicit positions are either all set or all zero (see FLightManager::create())
+    const bool explicitSplits = params.cascadeSplitPositions[0] > 0.0f;
+    const float lambda = params.cascadeSplitLambda;
+    for (size_t i = 1; i < cascadeCount; i++) {
+        if (explicitSplits) {
+            splits[i] = zn + (zf - zn) * params.cascadeSplitPositions[i - 1];
+        } else {
+            // "practical split scheme", a blend of the uniform and logarithmic splits. The
+            // logarithmic split needs a positive near plane, which ortho cameras may not have.
+            const float t = float(i) / float(cascadeCount);
+            const float uniform = zn + (zf - zn) * t;
+            const float logarithmic = zn > 0.0f ? zn * std::pow(zf / zn, t) : uniform;
+            splits[i] = uniform + (logarithmic - uniform) * lambda;
+        }
     }
 }
 
-void ShadowMap::beginRenderPass(DriverApi& driver) const noexcept {
-    RenderPassParams params = {};
-    params.clear = TargetBufferFlags::SHADOW;
-    params.discardStart = TargetBufferFlags::DEPTH;
-    params.discardEnd = TargetBufferFlags::COLOR_AND_STENCIL;
-    params.clearDepth = 1.0;
-    params.width = params.height = mShadowMapDimension;
-    // Disable scissor and viewport to avoid bugs in some drivers where the GPU memory is reloaded
-    // needlessly.
-    params.clear |= RenderPassParams::IGNORE_SCISSOR | RenderPassParams::IGNORE_VIEWPORT;
-    driver.beginRenderPass(mShadowMapRenderTarget, params);
-
-    driver.viewport(mViewport.left, mViewport.bottom,
-            mViewport.width, mViewport.height);
-}
-
 void ShadowMap::update(
-        const FScene::LightSoa& lightData, size_t index, FScene const* scene,
-        details::CameraInfo const& camera, uint8_t visibleLayers) noexcept {
+        const FScene::LightSoa& lightData, size_t index,
+        Aabb const& wsShadowCastersVolume, Aabb const& wsShadowReceiversVolume,
+        details::CameraInfo const& camera, float2 zRange,
+        Viewport const& tile, uint32_t atlasDimension) noexcept {
     // this is the hard part here, find a good frustum for our camera
 
     auto& lcm = mEngine.getLightManager();
 
     FLightManager::Instance li = lightData.elementAt<FScene::LIGHT_INSTANCE>(index);
-    mShadowMapDimension = std::max(1u, lcm.getShadowMapSize(li));
+
+    // we set a viewport with a 1-texel border for when we index outside of the shadow map
+    // DON'T CHANGE this unless getTextureCoordsMapping() is updated too.
+    assert(tile.width == tile.height && tile.width > 2);
+    mTile = tile;
+    mViewport = { tile.left + 1, tile.bottom + 1, tile.width - 2, tile.height - 2 };
+    mShadowMapDimension = tile.width;
+    mAtlasDimension = atlasDimension;
 
     FLightManager::ShadowParams params = lcm.getShadowParams(li);
     mat4f projection(camera.cullingProjection);
-    if (params.shadowFar > 0.0f) {
-        float n = camera.zn;
-        float f = params.shadowFar;
+    if (zRange.x != camera.zn || zRange.y != camera.zf) {
+        float n = zRange.x;
+        float f = zRange.y;
         if (std::abs(projection[2].w) <= std::numeric_limits<float>::epsilon()) {
             // perspective projection
             projection[2].z =     (f + n) / (n - f);
@@ -159,10 +121,10 @@ void ShadowMap::update(
             .projection = projection,
             .model = camera.model,
             .view = camera.view,
-            .zn = camera.zn,
-            .zf = camera.zf,
-            .dzn = std::max(0.0f, params.shadowNearHint - camera.zn),
-            .dzf = std::max(0.0f, camera.zf - params.shadowFarHint),
+            .zn = zRange.x,
+            .zf = zRange.y,
+            .dzn = std::max(0.0f, params.shadowNearHint - zRange.x),
+            .dzf = std::max(0.0f, zRange.y - params.shadowFarHint),
             .frustum = Frustum(projection * camera.view),
             .worldOrigin = camera.worldOrigin
     };
@@ -182,8 +144,8 @@ void ShadowMap::update(
         case Type::SUN:
         case Type::DIRECTIONAL:
             computeShadowCameraDirectional(
-                    lightData.elementAt<FScene::DIRECTION>(index), scene, cameraInfo,
-                    visibleLayers);
+                    lightData.elementAt<FScene::DIRECTION>(index),
+                    wsShadowCastersVolume, wsShadowReceiversVolume, cameraInfo);
             break;
         case Type::FOCUSED_SPOT:
         case Type::SPOT:
@@ -194,12 +156,10 @@ void ShadowMap::update(
 }
 
 void ShadowMap::computeShadowCameraDirectional(
-        filament::math::float3 const& dir, FScene const* scene, CameraInfo const& camera,
-        uint8_t visibleLayers) noexcept {
+        filament::math::float3 const& dir,
+        Aabb const& wsShadowCastersVolume, Aabb const& wsShadowReceiversVolume,
+        CameraInfo const& camera) noexcept {
 
-    // scene bounds in world space
-    Aabb wsShadowCastersVolume, wsShadowReceiversVolume;
-    scene->computeBounds(wsShadowCastersVolume, wsShadowReceiversVolume, visibleLayers);
     if (wsShadowCastersVolume.isEmpty() || wsShadowReceiversVolume.isEmpty()) {
         mHasVisibleShadows = false;
         return;
@@ -333,8 +293,8 @@ void ShadowMap::computeShadowCameraDirectional(
 
         // For directional lights, we further constraint the light frustum to the
         // intersection of the shadow casters & receivers in light-space.
-        // However, since this relies on the 1-texel shadow map border, this wouldn't directly
-        // work if we were storing several shadow maps in a single texture.
+        // This relies on the 1-texel shadow map border, which is why each tile of the shadow
+        // map atlas has its own.
         if (mEngine.debug.shadowmap.focus_shadowcasters) {
             intersectWithShadowCasters(lsLightFrustum, WLMpMv, wsShadowCastersVolume);
         }
@@ -379,7 +339,12 @@ void ShadowMap::computeShadowCameraDirectional(
         // Final shadowmap texture transform
         const mat4f St = mat4f(MbMt * S);
 
-        mTexelSizeWs = texelSizeWorldSpace(St, float3{ 0.5f });
+        // the size of a texel at the center of the tile
+        const float3 tileCenter{
+                (mTile.left + mTile.width * 0.5f) / mAtlasDimension,
+                (mTile.bottom + mTile.height * 0.5f) / mAtlasDimension,
+                0.5f };
+        mTexelSizeWs = texelSizeWorldSpace(St, tileCenter);
         mLightSpace = St;
         mSceneRange = (zfar - znear);
         mCamera->setCustomProjection(mat4(S), znear, zfar);
@@ -464,10 +429,15 @@ mat4f ShadowMap::applyLISPSM(CameraInfo const& camera, float dzn, float dzf, mat
 
 
 mat4f ShadowMap::getTextureCoordsMapping() const noexcept {
+    return getTextureCoordsMapping(mTile, mAtlasDimension, mClipSpaceFlipped);
+}
+
+mat4f ShadowMap::getTextureCoordsMapping(Viewport const& tile,
+        uint32_t atlasDimension, bool clipSpaceFlipped) noexcept {
     // Computes St the transform to use in the shader to access the shadow map texture
     // i.e. it transform a world-space vertex to a texture coordinate in the shadow-map
     // remapping from NDC to texture coordinates (i.e. [-1,1] -> [0, 1])
-    const mat4f Mt(mClipSpaceFlipped ? mat4f::row_major_init{
+    const mat4f Mt(clipSpaceFlipped ? mat4f::row_major_init{
             0.5f,   0,    0,  0.5f,
               0, -0.5f,   0,  0.5f,
               0,    0,  0.5f, 0.5f,
@@ -479,12 +449,12 @@ mat4f ShadowMap::getTextureCoordsMapping() const noexcept {
               0,    0,    0,    1
     });
 
-    // apply the 1-texel border viewport transform
-    const float o = 1.0f / mShadowMapDimension;
-    const float s = 1.0f - 2.0f * o;
+    // apply the viewport transform, i.e. the tile in the atlas minus its 1-texel border
+    const float s = float(tile.width - 2) / atlasDimension;
+    const float2 o = float2{ float(tile.left + 1), float(tile.bottom + 1) } / atlasDimension;
     const mat4f Mb(mat4f::row_major_init{
-             s, 0, 0, o,
-             0, s, 0, o,
+             s, 0, 0, o.x,
+             0, s, 0, o.y,
              0, 0, 1, 0,
              0, 0, 0, 1
     });
@@ -808,7 +778,7 @@ float ShadowMap::texelSizeWorldSpace(const filament::math::mat4f& lightSpaceMatr
     // this version works only for orthographic projections
     const mat3f shadowmapToWorldMatrix(inverse(lightSpaceMatrix.upperLeft()));
     const float3 texelSizeWs = shadowmapToWorldMatrix * float3{ 1, 1, 0 };
-    const float s = length(texelSizeWs) / mShadowMapDimension;
+    const float s = length(texelSizeWs) / mAtlasDimension;
     return s;
 }
 
@@ -817,7 +787,7 @@ float ShadowMap::texelSizeWorldSpace(const filament::math::mat4f& lightSpaceMatr
     // therefore we need to specify which texel we want to back-project.
     const mat4f shadowmapToWorldMatrix(inverse(lightSpaceMatrix));
     const float3 p0 = mat4f::project(shadowmapToWorldMatrix, str);
-    const float3 p1 = mat4f::project(shadowmapToWorldMatrix, str + float3{ 1, 1, 0 } / mShadowMapDimension);
+    const float3 p1 = mat4f::project(shadowmapToWorldMatrix, str + float3{ 1, 1, 0 } / mAtlasDimension);
     const float s = length(p1 - p0);
     return s;
 }
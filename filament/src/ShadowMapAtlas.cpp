@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/ShadowMapAtlas.h"
+
+#include "driver/DriverApi.h"
+
+#include <filament/driver/DriverEnums.h>
+
+namespace filament {
+
+using namespace driver;
+
+namespace details {
+
+ShadowMapAtlas::ShadowMapAtlas() noexcept = default;
+
+ShadowMapAtlas::~ShadowMapAtlas() noexcept {
+    assert(!mTexture);
+}
+
+void ShadowMapAtlas::terminate(DriverApi& driver) noexcept {
+    if (mRenderTarget) {
+        driver.destroyRenderTarget(mRenderTarget);
+        mRenderTarget.clear();
+    }
+    if (mTexture) {
+        driver.destroyTexture(mTexture);
+        mTexture.clear();
+    }
+    mDimension = 0;
+}
+
+bool ShadowMapAtlas::prepare(DriverApi& driver,
+        uint32_t tileDimension, size_t tileCount) noexcept {
+    assert(tileDimension && tileCount);
+
+    // smallest square grid holding all the tiles
+    uint32_t columns = 1;
+    while (columns * columns < tileCount) {
+        columns++;
+    }
+
+    const uint32_t dim = columns * tileDimension;
+    if (dim == mDimension && tileDimension == mTileDimension) {
+        // nothing to do here.
+        assert(mTexture);
+        return false;
+    }
+
+    // destroy the current rendertarget and texture
+    terminate(driver);
+
+    mDimension = dim;
+    mTileDimension = tileDimension;
+    mColumns = columns;
+
+    mTexture = driver.createTexture(
+            Driver::SamplerType::SAMPLER_2D, 1, Driver::TextureFormat::DEPTH16, 1, dim, dim, 1,
+            TextureUsage::DEPTH_ATTACHMENT);
+
+    mRenderTarget = driver.createRenderTarget(
+            TargetBufferFlags::SHADOW, dim, dim, 1, Driver::TextureFormat::DEPTH16,
+            {}, { mTexture }, {});
+    return true;
+}
+
+SamplerParams ShadowMapAtlas::getSamplerParams() noexcept {
+    SamplerParams s;
+    s.filterMag = SamplerMagFilter::LINEAR;
+    s.filterMin = SamplerMinFilter::LINEAR;
+    s.compareFunc = SamplerCompareFunc::LE;
+    s.compareMode = SamplerCompareMode::COMPARE_TO_TEXTURE;
+    s.depthStencil = true;
+    return s;
+}
+
+Viewport ShadowMapAtlas::getTile(size_t index) const noexcept {
+    assert(index < mColumns * mColumns);
+    const uint32_t column = uint32_t(index % mColumns);
+    const uint32_t row = uint32_t(index / mColumns);
+    return { int32_t(column * mTileDimension), int32_t(row * mTileDimension),
+             mTileDimension, mTileDimension };
+}
+
+void ShadowMapAtlas::beginRenderPass(DriverApi& driver, bool clear) const noexcept {
+    RenderPassParams params = {};
+    if (clear) {
+        params.clear = TargetBufferFlags::SHADOW;
+        params.discardStart = TargetBufferFlags::DEPTH;
+    }
+    params.discardEnd = TargetBufferFlags::COLOR_AND_STENCIL;
+    params.clearDepth = 1.0;
+    params.width = params.height = mDimension;
+    // Disable scissor and viewport to avoid bugs in some drivers where the GPU memory is reloaded
+    // needlessly.
+    params.clear |= RenderPassParams::IGNORE_SCISSOR | RenderPassParams::IGNORE_VIEWPORT;
+    driver.beginRenderPass(mRenderTarget, params);
+}
+
+void ShadowMapAtlas::beginTileRenderPass(DriverApi& driver, Viewport const& tile) const noexcept {
+    assert(tile.left >= 0 && tile.bottom >= 0);
+    assert(tile.left + tile.width <= mDimension && tile.bottom + tile.height <= mDimension);
+    RenderPassParams params = {};
+    params.clear = TargetBufferFlags::SHADOW | RenderPassParams::CLEAR_RENDER_AREA;
+    params.discardEnd = TargetBufferFlags::COLOR_AND_STENCIL;
+    params.clearDepth = 1.0;
+    params.left = tile.left;
+    params.bottom = tile.bottom;
+    params.width = tile.width;
+    params.height = tile.height;
+    driver.beginRenderPass(mRenderTarget, params);
+}
+
+} // namespace details
+} // namespace filament
@@ -39,8 +39,11 @@
 #include <math/scalar.h>
 #include <math/fast.h>
 
+#include <limits>
 #include <memory>
 
+#include <string.h>
+
 using namespace filament::math;
 using namespace utils;
 
@@ -55,18 +58,42 @@ static constexpr size_t VISIBLE_RENDERABLE_BIT = 0u;
 static constexpr size_t VISIBLE_SHADOW_CASTER_BIT = 1u;
 static constexpr uint8_t VISIBLE_RENDERABLE = 1u << VISIBLE_RENDERABLE_BIT;
 static constexpr uint8_t VISIBLE_SHADOW_CASTER = 1u << VISIBLE_SHADOW_CASTER_BIT;
+
+// cleared by occlusion culling, only used before the visibility masks are computed
+static constexpr size_t VISIBLE_UNOCCLUDED_BIT = 2u;
+static constexpr uint8_t VISIBLE_UNOCCLUDED = 1u << VISIBLE_UNOCCLUDED_BIT;
 static constexpr uint8_t VISIBLE_ALL = VISIBLE_RENDERABLE | VISIBLE_SHADOW_CASTER;
 
+// set along with VISIBLE_SHADOW_CASTER, one bit per shadow cascade the caster is visible in
+static constexpr size_t VISIBLE_SHADOW_CASCADE_BIT = 3u;
+static constexpr uint8_t VISIBLE_SHADOW_CASCADES =
+        ((1u << CONFIG_MAX_SHADOW_CASCADES) - 1u) << VISIBLE_SHADOW_CASCADE_BIT;
+static_assert(VISIBLE_SHADOW_CASCADE_BIT + CONFIG_MAX_SHADOW_CASCADES <=
+        sizeof(Culler::result_type) * 8, "Shadow cascades don't fit in VISIBLE_MASK");
+
+// set by the renderer before rendering each shadow map of a point or spot light
+static constexpr size_t VISIBLE_LOCAL_SHADOW_CASTER_BIT =
+        VISIBLE_SHADOW_CASCADE_BIT + CONFIG_MAX_SHADOW_CASCADES;
+static constexpr uint8_t VISIBLE_LOCAL_SHADOW_CASTER = 1u << VISIBLE_LOCAL_SHADOW_CASTER_BIT;
+static_assert(VISIBLE_LOCAL_SHADOW_CASTER_BIT < sizeof(Culler::result_type) * 8,
+        "Local shadow casters don't fit in VISIBLE_MASK");
+
 FView::FView(FEngine& engine)
     : mFroxelizer(engine),
+      mLightBuffer(engine.getDriverApi(), { GPUBuffer::ElementType::FLOAT, 4 },
+              LIGHT_BUFFER_WIDTH, CONFIG_MAX_LIGHT_COUNT * LIGHT_TEXELS_PER_LIGHT / LIGHT_BUFFER_WIDTH),
       mPerViewUb(engine.getPerViewUib()),
       mPerViewSb(engine.getPerViewSib()),
-      mDirectionalShadowMap(engine) {
+      mLocalShadowMaps(engine) {
     DriverApi& driver = engine.getDriverApi();
 
+    // the first shadow cascade always exists, the others are allocated when needed
+    mShadowMaps[0].reset(new ShadowMap(engine));
+
     // set-up samplers
     mPerViewSb.setBuffer(PerViewSib::RECORDS, mFroxelizer.getRecordBuffer());
     mPerViewSb.setBuffer(PerViewSib::FROXELS, mFroxelizer.getFroxelBuffer());
+    mPerViewSb.setBuffer(PerViewSib::LIGHTS, mLightBuffer);
     if (engine.getDFG()->isValid()) {
         TextureSampler sampler(TextureSampler::MagFilter::LINEAR);
         mPerViewSb.setSampler(PerViewSib::IBL_DFG_LUT,
@@ -77,7 +104,6 @@ FView::FView(FEngine& engine)
 
     // allocate ubos
     mPerViewUbh = driver.createUniformBuffer(mPerViewUb.getSize(), driver::BufferUsage::DYNAMIC);
-    mLightUbh = driver.createUniformBuffer(CONFIG_MAX_LIGHT_COUNT * sizeof(LightsUib), driver::BufferUsage::DYNAMIC);
 
     mIsDynamicResolutionSupported = driver.isFrameTimeSupported();
 }
@@ -88,10 +114,12 @@ void FView::terminate(FEngine& engine) {
     // Here we would cleanly free resources we've allocated or we own (currently none).
     DriverApi& driver = engine.getDriverApi();
     driver.destroyUniformBuffer(mPerViewUbh);
-    driver.destroyUniformBuffer(mLightUbh);
+    mLightBuffer.terminate(driver);
     driver.destroySamplerBuffer(mPerViewSbh);
     driver.destroyUniformBuffer(mRenderableUbh);
-    mDirectionalShadowMap.terminate(driver);
+    mShadowMapAtlas.terminate(driver);
+    mStaticShadowMap.atlas.terminate(driver);
+    mLocalShadowMaps.terminate(driver);
     mFroxelizer.terminate(driver);
 }
 
@@ -287,34 +315,219 @@ void FView::prepareShadowing(FEngine& engine, driver::DriverApi& driver,
 
     // dominant directional light is always as index 0
     FLightManager::Instance directionalLight = lightData.elementAt<FScene::LIGHT_INSTANCE>(0);
-    mHasShadowing = mShadowingEnabled && directionalLight && lcm.isShadowCaster(directionalLight);
-    if (UTILS_UNLIKELY(mHasShadowing)) {
-        // compute the frustum for this light
-        ShadowMap& shadowMap = mDirectionalShadowMap;
-        shadowMap.update(lightData, 0, scene, mViewingCameraInfo, mVisibleLayers);
-        if (shadowMap.hasVisibleShadows()) {
-            // Cull shadow casters
-            Frustum const& frustum = shadowMap.getCamera().getFrustum();
-            FView::prepareVisibleShadowCasters(engine.getJobSystem(), frustum, renderableData);
+    mHasDirectionalShadowing =
+            mShadowingEnabled && directionalLight && lcm.isShadowCaster(directionalLight);
+    mStaticShadowMap.enabled = false;
+    mStaticShadowMap.dirty = false;
+    if (UTILS_UNLIKELY(mHasDirectionalShadowing)) {
+        FLightManager::ShadowParams const& params = lcm.getShadowParams(directionalLight);
+        const size_t cascadeCount = params.cascadeCount;
+        mShadowCascadeCount = uint8_t(cascadeCount);
+
+        // allocates shadowmap driver resources, each cascade gets its own tile
+        const uint32_t tileDimension = std::max(4u, lcm.getShadowMapSize(directionalLight));
+        mShadowMapAtlas.prepare(driver, tileDimension, cascadeCount);
+        getUs().setSampler(PerViewSib::SHADOW_MAP,
+                mShadowMapAtlas.getTexture(), ShadowMapAtlas::getSamplerParams());
+
+        // scene bounds in world space, they're the same for all cascades
+        Aabb wsShadowCastersVolume, wsShadowReceiversVolume;
+        scene->computeBounds(wsShadowCastersVolume, wsShadowReceiversVolume, mVisibleLayers);
+
+        // split the camera frustum between the cascades
+        CameraInfo const& camera = mViewingCameraInfo;
+        float splits[CONFIG_MAX_SHADOW_CASCADES + 1];
+        ShadowMap::computeCascadeSplits(splits, cascadeCount, camera.zn,
+                params.shadowFar > 0.0f ? params.shadowFar : camera.zf, params);
+
+        // compute the frustum of each cascade
+        mHasDirectionalShadowing = false;
+        for (size_t c = 0; c < cascadeCount; c++) {
+            if (UTILS_UNLIKELY(!mShadowMaps[c])) {
+                mShadowMaps[c].reset(new ShadowMap(engine));
+            }
+            ShadowMap& shadowMap = *mShadowMaps[c];
+            shadowMap.update(lightData, 0, wsShadowCastersVolume, wsShadowReceiversVolume,
+                    camera, { splits[c], splits[c + 1] },
+                    mShadowMapAtlas.getTile(c), mShadowMapAtlas.getDimension());
+            mHasDirectionalShadowing |= shadowMap.hasVisibleShadows();
+        }
 
-            // allocates shadowmap driver resources
-            shadowMap.prepare(driver, getUs());
+        if (mHasDirectionalShadowing) {
+            // Cull shadow casters
+            prepareVisibleShadowCasters(engine.getJobSystem(), renderableData,
+                    scene->getCullingBvh());
 
-            mat4f const& lightFromWorldMatrix = shadowMap.getLightSpaceMatrix();
-            u.setUniform(offsetof(PerViewUib, lightFromWorldMatrix), lightFromWorldMatrix);
+            prepareStaticShadowMap(driver, renderableData, tileDimension);
 
-            // the 2x bias is needed in opengl because the depth maps to -1/1. It may not be
-            // needed with other APIs, but at least it won't worsen the acnee there.
-            const float sceneRange = shadowMap.getSceneRange();
-            const float texelSizeWorldSpace = shadowMap.getTexelSizeWorldSpace();
+            // The constant bias is folded in the matrices since it depends on each cascade's
+            // depth range. The 2x bias is needed in opengl because the depth maps to -1/1.
+            // It may not be needed with other APIs, but at least it won't worsen the acnee there.
             const float constantBias = lcm.getShadowConstantBias(directionalLight);
             const float normalBias = lcm.getShadowNormalBias(directionalLight);
+            mat4f lightFromWorldMatrix[CONFIG_MAX_SHADOW_CASCADES];
+            float4 cascadeSplits{ std::numeric_limits<float>::max() };
+            float4 cascadeTexelSizes{ 0.0f };
+            for (size_t c = 0; c < cascadeCount; c++) {
+                // fragments beyond the last split use the last cascade
+                if (c < cascadeCount - 1) {
+                    cascadeSplits[c] = splits[c + 1];
+                }
+                ShadowMap const& shadowMap = *mShadowMaps[c];
+                if (shadowMap.hasVisibleShadows()) {
+                    lightFromWorldMatrix[c] = shadowMap.getLightSpaceMatrix();
+                    lightFromWorldMatrix[c][3].z -= 2 * constantBias / shadowMap.getSceneRange();
+                    cascadeTexelSizes[c] = shadowMap.getTexelSizeWorldSpace();
+                }
+            }
+            u.setUniformArray(offsetof(PerViewUib, lightFromWorldMatrix),
+                    lightFromWorldMatrix, CONFIG_MAX_SHADOW_CASCADES);
+            u.setUniform(offsetof(PerViewUib, cascadeSplits), cascadeSplits);
+            u.setUniform(offsetof(PerViewUib, cascadeTexelSizes), cascadeTexelSizes);
             u.setUniform(offsetof(PerViewUib, shadowBias),
-                    float3{ 2 * constantBias / sceneRange, normalBias * texelSizeWorldSpace, 0 });
+                    float3{ mStaticShadowMap.enabled ? 1.0f : 0.0f, normalBias, 1.0f });
         }
     }
 }
 
+void FView::prepareStaticShadowMap(driver::DriverApi& driver,
+        FScene::RenderableSoa const& renderableData, uint32_t tileDimension) noexcept {
+    StaticShadowMap& cache = mStaticShadowMap;
+    FScene const* const scene = mScene;
+    const size_t cascadeCount = mShadowCascadeCount;
+    const uint8_t visibleLayers = mVisibleLayers;
+
+    auto const* UTILS_RESTRICT visibility = renderableData.data<FScene::VISIBILITY_STATE>();
+    auto const* UTILS_RESTRICT layers = renderableData.data<FScene::LAYERS>();
+    bool hasStaticShadowCasters = false;
+    for (size_t i = 0, c = renderableData.size(); i < c; i++) {
+        hasStaticShadowCasters |= visibility[i].castShadows &
+                visibility[i].staticShadowCaster & bool(layers[i] & visibleLayers);
+    }
+
+    cache.enabled = hasStaticShadowCasters;
+    cache.dirty = false;
+    if (!hasStaticShadowCasters) {
+        // the shaders don't sample the cached shadow maps, but the sampler must stay valid
+        cache.atlas.terminate(driver);
+        getUs().setSampler(PerViewSib::STATIC_SHADOW_MAP,
+                mShadowMapAtlas.getTexture(), ShadowMapAtlas::getSamplerParams());
+        return;
+    }
+
+    // the cached shadow maps are re-rendered when any of the cascades' light camera, or any of
+    // the static shadow casters changed
+    mat4f lightFromWorld[CONFIG_MAX_SHADOW_CASCADES];
+    for (size_t c = 0; c < cascadeCount; c++) {
+        ShadowMap const& shadowMap = *mShadowMaps[c];
+        if (shadowMap.hasVisibleShadows()) {
+            lightFromWorld[c] = shadowMap.getLightSpaceMatrix();
+        }
+    }
+    bool dirty = cache.atlas.prepare(driver, tileDimension, cascadeCount);
+    dirty |= cache.scene != scene;
+    dirty |= cache.version != scene->getStaticShadowCastersVersion();
+    dirty |= cache.visibleLayers != visibleLayers;
+    dirty |= cache.cascadeCount != cascadeCount;
+    dirty |= memcmp(cache.lightFromWorld, lightFromWorld, sizeof(lightFromWorld)) != 0;
+
+    if (dirty) {
+        // the renderer renders them this frame
+        std::copy_n(lightFromWorld, CONFIG_MAX_SHADOW_CASCADES, cache.lightFromWorld);
+        cache.scene = scene;
+        cache.version = scene->getStaticShadowCastersVersion();
+        cache.visibleLayers = visibleLayers;
+        cache.cascadeCount = uint8_t(cascadeCount);
+        cache.dirty = true;
+    }
+
+    getUs().setSampler(PerViewSib::STATIC_SHADOW_MAP,
+            cache.atlas.getTexture(), ShadowMapAtlas::getSamplerParams());
+}
+
+void FView::prepareLocalShadowing(FEngine& engine, driver::DriverApi& driver,
+        FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData,
+        Viewport const& viewport) noexcept {
+    SYSTRACE_CALL();
+
+    LocalShadowMaps& localShadowMaps = mLocalShadowMaps;
+    bool hasLocalShadowing = false;
+    if (mShadowingEnabled) {
+        hasLocalShadowing = localShadowMaps.prepare(driver, engine.getLightManager(), lightData,
+                mViewingCameraInfo, viewport);
+    } else {
+        localShadowMaps.terminate(driver);
+    }
+
+    mHasShadowing = mHasDirectionalShadowing || hasLocalShadowing;
+    if (!mHasShadowing) {
+        return;
+    }
+
+    // the shaders sample all the shadow maps, the samplers must stay valid even when unused
+    UniformBuffer& u = getUb();
+    SamplerBuffer& s = getUs();
+    if (!hasLocalShadowing) {
+        s.setSampler(PerViewSib::LOCAL_SHADOW_MAP,
+                mShadowMapAtlas.getTexture(), ShadowMapAtlas::getSamplerParams());
+        return;
+    }
+    const auto localShadowMap = localShadowMaps.getAtlas().getTexture();
+    s.setSampler(PerViewSib::LOCAL_SHADOW_MAP, localShadowMap, ShadowMapAtlas::getSamplerParams());
+    if (!mHasDirectionalShadowing) {
+        s.setSampler(PerViewSib::SHADOW_MAP, localShadowMap, ShadowMapAtlas::getSamplerParams());
+        s.setSampler(PerViewSib::STATIC_SHADOW_MAP,
+                localShadowMap, ShadowMapAtlas::getSamplerParams());
+        // no directional shadows, nor cached ones
+        u.setUniform(offsetof(PerViewUib, shadowBias), float3{ 0.0f });
+    }
+    u.setUniformArray(offsetof(PerViewUib, localShadowMatrices),
+            localShadowMaps.getShadowMatrices(), CONFIG_MAX_LOCAL_SHADOW_MAPS);
+
+    // Cull the shadow casters of the shadow maps rendered this frame. The renderer culls them
+    // again for each shadow map, among the visible shadow casters only.
+    auto const& updates = localShadowMaps.getUpdates();
+    if (updates.empty()) {
+        return;
+    }
+    JobSystem& js = engine.getJobSystem();
+    CullingBvh const& bvh = mScene->getCullingBvh();
+    // the culling results are or'ed in blocks, the array is padded like the SoA
+    const size_t count = (renderableData.size() + 0xF) & ~0xF;
+    std::vector<Culler::result_type>& casters = mLocalShadowCasters;
+    casters.assign(count, 0);
+    for (LocalShadowMaps::Update const& update : updates) {
+        FView::cullRenderables(js, renderableData, bvh, update.frustum, casters.data(), 0);
+    }
+
+    Culler::result_type* const UTILS_RESTRICT visibleMask =
+            renderableData.data<FScene::VISIBLE_MASK>();
+    Culler::result_type const* const UTILS_RESTRICT results = casters.data();
+    for (size_t i = 0; i < count; i++) {
+        visibleMask[i] |= results[i] ? VISIBLE_SHADOW_CASTER : Culler::result_type(0);
+    }
+}
+
+Culler::result_type FView::cullLocalShadowCasters(
+        LocalShadowMaps::Update const& update) noexcept {
+    FScene::RenderableSoa& renderableData = mScene->getRenderableData();
+    Range const& range = mVisibleShadowCasters;
+
+    // the culler updates its results by blocks of 8, which the SoA's padding accommodates
+    const size_t first = range.first & ~7u;
+    const size_t last = (range.last + 7u) & ~7u;
+    Culler::result_type* const UTILS_RESTRICT visibleMask =
+            renderableData.data<FScene::VISIBLE_MASK>() + first;
+    for (size_t i = 0, c = last - first; i < c; i++) {
+        visibleMask[i] &= ~VISIBLE_LOCAL_SHADOW_CASTER;
+    }
+    Culler::intersects(visibleMask, update.frustum,
+            renderableData.data<FScene::WORLD_AABB_CENTER>() + first,
+            renderableData.data<FScene::WORLD_AABB_EXTENT>() + first,
+            last - first, VISIBLE_LOCAL_SHADOW_CASTER_BIT);
+    return VISIBLE_LOCAL_SHADOW_CASTER;
+}
+
 void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaScope& arena,
         Viewport const& viewport) noexcept {
     SYSTRACE_CALL();
@@ -323,9 +536,10 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
     const CameraInfo& camera = mViewingCameraInfo;
     FScene* const scene = mScene;
 
-    scene->prepareDynamicLights(camera, arena, mLightUbh);
+    scene->prepareDynamicLights(camera, arena, mLightBuffer);
 
-    // here the array of visible lights has been shrunk to CONFIG_MAX_LIGHT_COUNT
+    // here the array of visible lights has been shrunk to CONFIG_MAX_LIGHT_COUNT, i.e. the size
+    // of mLightBuffer
     auto const& lightData = scene->getLightData();
 
     // trace the number of visible lights
@@ -382,6 +596,10 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
         }
         u.setUniform(offsetof(PerViewUib, sun), sun);
     } else {
+        // The directional light's variant is also used by the local shadows, make sure it
+        // doesn't contribute
+        u.setUniform(offsetof(PerViewUib, lightColorIntensity), float4{ 0.0f });
+
         // Disable the sun if there's no directional light
         float4 sun{ 0.0f, 0.0f, 0.0f, -1.0f };
         u.setUniform(offsetof(PerViewUib, sun), sun);
@@ -391,6 +609,7 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
     mHasDynamicLighting = scene->getLightData().size() > FScene::DIRECTIONAL_LIGHTS_COUNT;
     if (mHasDynamicLighting) {
         Froxelizer& froxelizer = mFroxelizer;
+        froxelizer.setLightCount(scene->getLightData().size() - FScene::DIRECTIONAL_LIGHTS_COUNT);
         if (froxelizer.prepare(driver, arena, viewport, camera.projection, camera.zn, camera.zf)) {
             froxelizer.updateUniforms(u); // update our uniform buffer if needed
         }
@@ -456,44 +675,74 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
             mCullingCamera->getCullingProjectionMatrix(),
             FCamera::getViewMatrix(worldOriginScene * mCullingCamera->getModelMatrix()));
 
-    /*
-     * Gather all information needed to render this scene. Apply the world origin to all
-     * objects in the scene.
-     */
-    scene->prepare(worldOriginScene);
+    Range merged;
+    FScene::RenderableSoa& renderableData = scene->getRenderableData();
 
     /*
-     * Light culling: runs in parallel with Renderable culling (below)
+     * Light culling: runs in parallel with Renderable culling (below), as soon as the scene's
+     * lights are ready
      */
 
-    auto prepareVisibleLightsJob = js.runAndRetain(js.createJob(nullptr,
+    auto prepareVisibleLightsJob = js.retain(js.createJob(nullptr,
             [&frustum = mCullingFrustum, &engine, scene](JobSystem& js, JobSystem::Job*) {
                 FView::prepareVisibleLights(
                         engine.getLightManager(), js, frustum, scene->getLightData());
             }));
 
-    Range merged;
-    FScene::RenderableSoa& renderableData = scene->getRenderableData();
+    /*
+     * Culling: as soon as the scene's renderables are ready we perform our camera-culling
+     * (this will set the VISIBLE_RENDERABLE bit)
+     *
+     * Occlusion culling: then we hide the visible renderables that are behind occluders
+     * (this will clear the VISIBLE_UNOCCLUDED bit)
+     */
+
+    auto prepareVisibleRenderablesJob = js.retain(js.createJob(nullptr,
+            [this, &engine, &renderableData, scene, &worldOriginScene]
+                    (JobSystem& js, JobSystem::Job*) {
+                Slice<Culler::result_type> cullingMask =
+                        renderableData.slice<FScene::VISIBLE_MASK>();
+                std::uninitialized_fill(cullingMask.begin(), cullingMask.end(),
+                        VISIBLE_UNOCCLUDED);
+
+                prepareVisibleRenderables(js, mCullingFrustum, renderableData,
+                        scene->getCullingBvh());
+
+                if (isOcclusionCullingEnabled() && isFrustumCullingEnabled()) {
+                    const mat4f clipFromWorld =
+                            mat4f{ mCullingCamera->getCullingProjectionMatrix() } *
+                            FCamera::getViewMatrix(
+                                    worldOriginScene * mCullingCamera->getModelMatrix());
+                    prepareOcclusionCulling(engine, js, clipFromWorld, renderableData);
+                }
+            }));
+
+    /*
+     * Gather all information needed to render this scene. Apply the world origin to all
+     * objects in the scene. The culling jobs above are chained to it.
+     */
+    scene->prepare(worldOriginScene, prepareVisibleRenderablesJob, prepareVisibleLightsJob);
 
     { // all the operations in this scope must happen sequentially
 
+        js.waitAndRelease(prepareVisibleRenderablesJob);
         Slice<Culler::result_type> cullingMask = renderableData.slice<FScene::VISIBLE_MASK>();
-        std::uninitialized_fill(cullingMask.begin(), cullingMask.end(), 0);
 
         /*
-         * Culling: as soon as possible we perform our camera-culling
-         * (this will set the VISIBLE_RENDERABLE bit)
+         * Shadowing: compute the shadow cameras and cull shadow casters
+         * (this will set the VISIBLE_SHADOW_CASTER bit and the bits of the cascades)
          */
 
-        prepareVisibleRenderables(js, mCullingFrustum, renderableData);
-
+        prepareShadowing(engine, driver, renderableData, scene->getLightData());
 
         /*
-         * Shadowing: compute the shadow camera and cull shadow casters
-         * (this will set the VISIBLE_SHADOW_CASTER bit)
+         * Local shadowing: pick the shadow maps of the point and spot lights, and cull their
+         * shadow casters (this will set the VISIBLE_SHADOW_CASTER bit).
+         * Relies on prepareVisibleLights()
          */
 
-        prepareShadowing(engine, driver, renderableData, scene->getLightData());
+        js.waitAndRelease(prepareVisibleLightsJob);
+        prepareLocalShadowing(engine, driver, renderableData, scene->getLightData(), viewport);
 
         /*
          * partition the array of renderable w.r.t their visibility:
@@ -522,19 +771,21 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
         mVisibleShadowCasters = Range{ uint32_t(beginCasters - beginRenderables), iEnd };
         merged = Range{ 0, iEnd };
 
-        // update those UBOs
-        const size_t size = merged.size() * sizeof(PerRenderableUib);
+        // update those UBOs, only the uniforms that changed since last time are uploaded
+        const size_t uboCount = scene->getRenderableUboCount();
+        const size_t size = uboCount * sizeof(PerRenderableUib);
         if (mRenderableUBOSize < size) {
             // allocate 1/3 extra, with a minimum of 16 objects
-            const size_t count = std::max(size_t(16u), (4u * merged.size() + 2u) / 3u);
+            const size_t count = std::max(size_t(16u), (4u * uboCount + 2u) / 3u);
             mRenderableUBOSize = uint32_t(count * sizeof(PerRenderableUib));
             driver.destroyUniformBuffer(mRenderableUbh);
             mRenderableUbh = driver.createUniformBuffer(mRenderableUBOSize,
-                    driver::BufferUsage::STREAM);
+                    driver::BufferUsage::DYNAMIC);
+            mRenderableUboVersion = 0;
         } else {
             // TODO: should we shrink the underlying UBO at some point?
         }
-        scene->updateUBOs(merged, mRenderableUbh);
+        mRenderableUboVersion = scene->updateUBOs(mRenderableUbh, mRenderableUboVersion);
     }
 
     /*
@@ -543,7 +794,6 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
      * Relies on FScene::prepare() and prepareVisibleLights()
      */
 
-    js.waitAndRelease(prepareVisibleLightsJob);
     prepareLighting(engine, driver, arena, viewport);
 
     /*
@@ -575,10 +825,14 @@ void FView::computeVisibilityMasks(
         Culler::result_type mask = visibleMask[i];
         FRenderableManager::Visibility v = visibility[i];
         bool inVisibleLayer = layers[i] & visibleLayers;
-        bool visRenderables   = (!v.culling || (mask & VISIBLE_RENDERABLE))    && inVisibleLayer;
+        bool unoccluded       = mask & VISIBLE_UNOCCLUDED;
+        bool visRenderables   = (!v.culling || ((mask & VISIBLE_RENDERABLE) && unoccluded)) && inVisibleLayer;
         bool visShadowCasters = (!v.culling || (mask & VISIBLE_SHADOW_CASTER)) && inVisibleLayer && v.castShadows;
+        // renderables that aren't culled are in all the cascades
+        Culler::result_type cascades = v.culling ? (mask & VISIBLE_SHADOW_CASCADES) : VISIBLE_SHADOW_CASCADES;
         visibleMask[i] = Culler::result_type(visRenderables) |
-                         Culler::result_type(visShadowCasters << 1);
+                         Culler::result_type(visShadowCasters << 1) |
+                         Culler::result_type(visShadowCasters ? cascades : 0);
     }
 }
 
@@ -587,8 +841,9 @@ UTILS_NOINLINE
         FScene::RenderableSoa::iterator begin,
         FScene::RenderableSoa::iterator end,
         uint8_t mask) noexcept {
+    // the shadow cascade bits don't matter here
     return std::partition(begin, end, [mask](auto it) {
-        return it.template get<FScene::VISIBLE_MASK>() == mask;
+        return (it.template get<FScene::VISIBLE_MASK>() & VISIBLE_ALL) == mask;
     });
 }
 
@@ -643,35 +898,123 @@ void FView::commitUniforms(driver::DriverApi& driver) const noexcept {
 
 void FView::commitFroxels(driver::DriverApi& driverApi) const noexcept {
     if (mHasDynamicLighting) {
-        mFroxelizer.commit(driverApi);
+        if (UTILS_UNLIKELY(mFroxelizer.commit(driverApi))) {
+            // the record buffer grew, point the sampler at the new one
+            mPerViewSb.setBuffer(PerViewSib::RECORDS, mFroxelizer.getRecordBuffer());
+            driverApi.updateSamplerBuffer(mPerViewSbh, SamplerBuffer(mPerViewSb));
+            mPerViewSb.clean();
+        }
     }
 }
 
 UTILS_NOINLINE
 void FView::prepareVisibleRenderables(JobSystem& js,
-        Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept {
+        Frustum const& frustum, FScene::RenderableSoa& renderableData,
+        CullingBvh const& bvh) const noexcept {
     SYSTRACE_CALL();
     if (UTILS_LIKELY(isFrustumCullingEnabled())) {
-        FView::cullRenderables(js, renderableData, frustum, VISIBLE_RENDERABLE_BIT);
+        FView::cullRenderables(js, renderableData, bvh, frustum,
+                renderableData.data<FScene::VISIBLE_MASK>(), VISIBLE_RENDERABLE_BIT);
     } else {
         std::uninitialized_fill(renderableData.begin<FScene::VISIBLE_MASK>(),
-                  renderableData.end<FScene::VISIBLE_MASK>(), VISIBLE_RENDERABLE);
+                  renderableData.end<FScene::VISIBLE_MASK>(), VISIBLE_RENDERABLE | VISIBLE_UNOCCLUDED);
     }
 }
 
+UTILS_NOINLINE
+void FView::prepareOcclusionCulling(FEngine& engine, JobSystem& js,
+        mat4f const& clipFromWorld, FScene::RenderableSoa& renderableData) noexcept {
+    SYSTRACE_CALL();
+
+    FRenderableManager const& rcm = engine.getRenderableManager();
+    auto const* UTILS_RESTRICT instances   = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* UTILS_RESTRICT transforms  = renderableData.data<FScene::WORLD_TRANSFORM>();
+    auto const* UTILS_RESTRICT visibility  = renderableData.data<FScene::VISIBILITY_STATE>();
+    auto      * UTILS_RESTRICT visibleMask = renderableData.data<FScene::VISIBLE_MASK>();
+
+    // only the visible occluders can hide something
+    OcclusionCuller& culler = mOcclusionCuller;
+    culler.begin(clipFromWorld);
+    for (size_t i = 0, c = renderableData.size(); i < c; i++) {
+        if (UTILS_UNLIKELY(visibility[i].occluder) && (visibleMask[i] & VISIBLE_RENDERABLE)) {
+            culler.addOccluder(transforms[i].toMat4(), rcm.getOccluder(instances[i]));
+        }
+    }
+    if (culler.empty()) {
+        return;
+    }
+
+    culler.rasterize(js);
+    culler.cull(js, visibleMask,
+            renderableData.data<FScene::WORLD_AABB_CENTER>(),
+            renderableData.data<FScene::WORLD_AABB_EXTENT>(),
+            renderableData.size(), VISIBLE_RENDERABLE_BIT, VISIBLE_UNOCCLUDED_BIT);
+}
+
 UTILS_NOINLINE
 void FView::prepareVisibleShadowCasters(JobSystem& js,
-        Frustum const& lightFrustum, FScene::RenderableSoa& renderableData) noexcept {
+        FScene::RenderableSoa& renderableData, CullingBvh const& bvh) noexcept {
     SYSTRACE_CALL();
-    FView::cullRenderables(js, renderableData, lightFrustum, VISIBLE_SHADOW_CASTER_BIT);
+
+    const size_t cascadeCount = mShadowCascadeCount;
+    // the culling results are or'ed in blocks, the arrays are padded like the SoA
+    const size_t count = (renderableData.size() + 0xF) & ~0xF;
+
+    // Each cascade culls its shadow casters concurrently, in its own array since the cullers
+    // update their results array by blocks.
+    JobSystem::Job* parent = js.createJob();
+    for (size_t c = 0; c < cascadeCount; c++) {
+        std::vector<Culler::result_type>& casters = mShadowCascadeCasters[c];
+        casters.assign(count, 0);
+        ShadowMap const& shadowMap = *mShadowMaps[c];
+        if (!shadowMap.hasVisibleShadows()) {
+            continue;
+        }
+        JobSystem::Job* job = js.createJob(parent,
+                [&renderableData, &bvh, &shadowMap, results = casters.data()]
+                        (JobSystem& js, JobSystem::Job*) {
+                    Frustum const& frustum = shadowMap.getCamera().getFrustum();
+                    FView::cullRenderables(js, renderableData, bvh, frustum, results, 0);
+                });
+        js.run(job);
+    }
+    js.runAndWait(parent);
+
+    // merge the cascades in the SoA
+    Culler::result_type* const UTILS_RESTRICT visibleMask =
+            renderableData.data<FScene::VISIBLE_MASK>();
+    for (size_t c = 0; c < cascadeCount; c++) {
+        Culler::result_type const* const UTILS_RESTRICT casters =
+                mShadowCascadeCasters[c].data();
+        const Culler::result_type bits = Culler::result_type(
+                VISIBLE_SHADOW_CASTER | (1u << (VISIBLE_SHADOW_CASCADE_BIT + c)));
+        for (size_t i = 0; i < count; i++) {
+            visibleMask[i] |= casters[i] ? bits : Culler::result_type(0);
+        }
+    }
+}
+
+Culler::result_type FView::getRenderableVisibilityMask() noexcept {
+    return VISIBLE_RENDERABLE;
+}
+
+Culler::result_type FView::getShadowCascadeVisibilityMask(size_t cascade) noexcept {
+    assert(cascade < CONFIG_MAX_SHADOW_CASCADES);
+    return Culler::result_type(1u << (VISIBLE_SHADOW_CASCADE_BIT + cascade));
 }
 
 void FView::cullRenderables(JobSystem& js,
-        FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit) noexcept {
+        FScene::RenderableSoa const& renderableData, CullingBvh const& bvh,
+        Frustum const& frustum, Culler::result_type* visibleArray, size_t bit) noexcept {
 
     float3 const* worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
     float3 const* worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
-    uint8_t     * visibleArray    = renderableData.data<FScene::VISIBLE_MASK>();
+    if (!bvh.empty()) {
+        // the hierarchy was updated with this data, it sets the same bits as the loop below
+        assert(bvh.size() == renderableData.size());
+        bvh.intersects(js, visibleArray, frustum, worldAABBCenter, worldAABBExtent, bit);
+        return;
+    }
 
     // culling job (this runs on multiple threads)
     auto functor = [&frustum, worldAABBCenter, worldAABBExtent, visibleArray, bit]
@@ -746,13 +1089,61 @@ void FView::prepareVisibleLights(FLightManager const& lcm, utils::JobSystem&,
     lightData.resize(visibleLightCount);
 }
 
-void FView::updatePrimitivesLod(FEngine& engine, const CameraInfo&,
-        FScene::RenderableSoa& renderableData, Range visible) noexcept {
+void FView::updatePrimitivesLod(FEngine& engine, const CameraInfo& camera,
+        FScene::RenderableSoa& renderableData, Range visible, LodPass pass) noexcept {
+    SYSTRACE_CALL();
+
     FRenderableManager const& rcm = engine.getRenderableManager();
-    for (uint32_t index : visible) {
-        uint8_t level = 0; // TODO: pick the proper level of detail
-        auto ri = renderableData.elementAt<FScene::RENDERABLE_INSTANCE>(index);
-        renderableData.elementAt<FScene::PRIMITIVES>(index) = rcm.getRenderPrimitives(ri, level);
+
+    std::vector<uint8_t>& levels = mPrimitivesLod[pass];
+    if (levels.size() < mScene->getRenderableUboCount()) {
+        levels.resize(mScene->getRenderableUboCount(), 0);
+    }
+
+    // The screen size is the projected diameter of the bounding sphere divided by the viewport
+    // height, i.e.: radius * projection[1][1] / w, where w is the clip-space w of its center.
+    const mat4f clipFromWorld(camera.projection * camera.view);
+    const float4 wFromWorld{
+            clipFromWorld[0].w, clipFromWorld[1].w, clipFromWorld[2].w, clipFromWorld[3].w };
+    const float scale = std::abs(camera.projection[1][1]);
+    // spheres behind or crossing the camera plane are as big as can be
+    constexpr float MIN_W = 1e-6f;
+
+    auto const* const UTILS_RESTRICT instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    uint32_t const* const UTILS_RESTRICT slots = renderableData.data<FScene::UBO_SLOT>();
+    float3 const* const UTILS_RESTRICT centers = renderableData.data<FScene::WORLD_AABB_CENTER>();
+    float3 const* const UTILS_RESTRICT extents = renderableData.data<FScene::WORLD_AABB_EXTENT>();
+    Slice<FRenderPrimitive>* const UTILS_RESTRICT primitives =
+            renderableData.data<FScene::PRIMITIVES>();
+    uint8_t* const UTILS_RESTRICT lods = levels.data();
+
+    // Screen sizes are computed for a batch of renderables at a time, in a loop that can be
+    // vectorized, then the level of each renderable is picked.
+    constexpr uint32_t BATCH_SIZE = 64;
+    float screenSizes[BATCH_SIZE];
+    for (uint32_t first = visible.first; first < visible.last; first += BATCH_SIZE) {
+        const uint32_t count = std::min(visible.last - first, BATCH_SIZE);
+
+        for (uint32_t i = 0; i < count; i++) {
+            float3 const c = centers[first + i];
+            float3 const e = extents[first + i];
+            const float w = wFromWorld.x * c.x + wFromWorld.y * c.y + wFromWorld.z * c.z +
+                            wFromWorld.w;
+            screenSizes[i] = scale * std::sqrt(dot(e, e)) / std::max(w, MIN_W);
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t index = first + i;
+            auto ri = instances[index];
+            uint8_t level = 0;
+            FRenderableManager::LevelsOfDetail const* const lod = rcm.getLevelsOfDetail(ri);
+            if (UTILS_UNLIKELY(lod)) {
+                uint8_t& current = lods[slots[index]];
+                level = FRenderableManager::selectLevelOfDetail(*lod, screenSizes[i], current);
+                current = level;
+            }
+            primitives[index] = rcm.getRenderPrimitives(ri, level);
+        }
     }
 }
 
@@ -803,6 +1194,14 @@ void View::setClearTargets(bool color, bool depth, bool stencil) noexcept {
     return upcast(this)->setClearTargets(color, depth, stencil);
 }
 
+void View::setOcclusionCullingEnabled(bool enabled) noexcept {
+    upcast(this)->setOcclusionCullingEnabled(enabled);
+}
+
+bool View::isOcclusionCullingEnabled() const noexcept {
+    return upcast(this)->isOcclusionCullingEnabled();
+}
+
 void View::setFrustumCullingEnabled(bool culling) noexcept {
     upcast(this)->setFrustumCullingEnabled(culling);
 }
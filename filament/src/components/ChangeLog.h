@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_COMPONENTS_CHANGELOG_H
+#define TNT_FILAMENT_COMPONENTS_CHANGELOG_H
+
+#include <utils/compiler.h>
+#include <utils/Entity.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+/*
+ * A log of the entities whose component changed, so that consumers (e.g. FScene) only need to
+ * process what changed since they last looked.
+ *
+ * Each reader keeps its own Cursor. The log has a bounded size, when it's full the oldest
+ * entries are dropped; a reader that falls behind (or a new reader) is told to start over by
+ * read() returning false. invalidate() does the same for all readers, it's used when a change
+ * affects too many entities to be worth recording them individually.
+ *
+ * The same entity can appear multiple times.
+ */
+class UTILS_PRIVATE ChangeLog {
+public:
+    using Cursor = uint64_t;
+
+    // maximum number of entries kept in the log
+    static constexpr size_t CAPACITY = 65536;
+
+    void record(utils::Entity e) noexcept {
+        if (UTILS_UNLIKELY(mEntities.size() >= CAPACITY)) {
+            // drop the oldest half, readers that haven't read them yet will have to start over
+            mEntities.erase(mEntities.begin(), mEntities.begin() + CAPACITY / 2);
+            mBase += CAPACITY / 2;
+        }
+        mEntities.push_back(e);
+    }
+
+    void invalidate() noexcept {
+        mBase += mEntities.size() + 1;
+        mEntities.clear();
+    }
+
+    // Calls f(Entity) for each entity recorded since 'cursor' and moves 'cursor' to the end of
+    // the log. Returns false if some entries were lost, in which case f() isn't called.
+    template<typename F>
+    bool read(Cursor& cursor, F f) const {
+        const Cursor end = mBase + mEntities.size();
+        if (UTILS_UNLIKELY(cursor < mBase)) {
+            cursor = end;
+            return false;
+        }
+        for (size_t i = size_t(cursor - mBase), c = mEntities.size(); i < c; i++) {
+            f(mEntities[i]);
+        }
+        cursor = end;
+        return true;
+    }
+
+private:
+    std::vector<utils::Entity> mEntities;
+    // position of mEntities[0] in the log, starts at 1 so that new readers (with a cursor
+    // of 0) always start over.
+    Cursor mBase = 1;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_COMPONENTS_CHANGELOG_H
@@ -157,6 +157,7 @@ void FLightManager::create(const FLightManager::Builder& builder, utils::Entity
     }
     Instance i = manager.addComponent(entity);
     assert(i);
+    mChangeLog.record(entity);
 
     if (i) {
         // This needs to happen before we call the set() methods below
@@ -173,6 +174,22 @@ void FLightManager::create(const FLightManager::Builder& builder, utils::Entity
         shadowParams.shadowFar = std::max(builder->mShadowOptions.shadowFar, 0.0f);
         shadowParams.shadowNearHint = std::max(builder->mShadowOptions.shadowNearHint, 0.0f);
         shadowParams.shadowFarHint = std::max(builder->mShadowOptions.shadowFarHint, 0.0f);
+        shadowParams.cascadeCount = uint8_t(clamp(size_t(builder->mShadowOptions.shadowCascades),
+                size_t(1), CONFIG_MAX_SHADOW_CASCADES));
+        shadowParams.cascadeSplitLambda =
+                clamp(builder->mShadowOptions.cascadeSplitLambda, 0.0f, 1.0f);
+
+        // the explicit split positions are only used if they're all valid
+        float const* const positions = builder->mShadowOptions.cascadeSplitPositions;
+        bool validPositions = true;
+        for (size_t c = 1; c < shadowParams.cascadeCount; c++) {
+            const float previous = c > 1 ? positions[c - 2] : 0.0f;
+            validPositions &= positions[c - 1] > previous && positions[c - 1] < 1.0f;
+        }
+        for (size_t c = 1; c < CONFIG_MAX_SHADOW_CASCADES; c++) {
+            shadowParams.cascadeSplitPositions[c - 1] =
+                    (validPositions && c < shadowParams.cascadeCount) ? positions[c - 1] : 0.0f;
+        }
 
         // set default values by calling the setters
         setLocalPosition(i, builder->mPosition);
@@ -197,6 +214,7 @@ void FLightManager::destroy(utils::Entity e) noexcept {
     Instance i = getInstance(e);
     if (i) {
         auto& manager = mManager;
+        mChangeLog.record(e);
         manager.removeComponent(e);
     }
 }
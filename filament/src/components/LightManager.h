@@ -19,8 +19,11 @@
 
 #include "upcast.h"
 
+#include "components/ChangeLog.h"
+
 #include "driver/DriverApiForward.h"
 
+#include <filament/EngineEnums.h>
 #include <filament/LightManager.h>
 
 #include <utils/Entity.h>
@@ -53,6 +56,10 @@ public:
         return mManager.getInstance(e);
     }
 
+    utils::Entity getEntity(Instance i) const noexcept {
+        return mManager.getEntity(i);
+    }
+
     void create(const FLightManager::Builder& builder, utils::Entity entity);
 
     void destroy(utils::Entity e) noexcept;
@@ -60,9 +67,15 @@ public:
     void prepare(driver::DriverApi& driver) const noexcept;
 
     void gc(utils::EntityManager& em) noexcept {
-        mManager.gc(em);
+        mManager.gc(em, 4, [this](utils::Entity e) {
+            mChangeLog.record(e);
+            mManager.removeComponent(e);
+        });
     }
 
+    // entities that gained or lost their light component
+    ChangeLog const& getChangeLog() const noexcept { return mChangeLog; }
+
     struct LightType {
         Type type : 3;
         uint8_t shadowMapBits : 4;
@@ -84,6 +97,9 @@ public:
         float shadowFar;
         float shadowNearHint;
         float shadowFarHint;
+        float cascadeSplitLambda;
+        float cascadeSplitPositions[CONFIG_MAX_SHADOW_CASCADES - 1]; // valid if non zero
+        uint8_t cascadeCount;
     };
 
     UTILS_NOINLINE void setLocalPosition(Instance i, const filament::math::float3& position) noexcept;
@@ -268,6 +284,7 @@ private:
     };
 
     Sim mManager;
+    ChangeLog mChangeLog;
     FEngine& mEngine;
 };
 
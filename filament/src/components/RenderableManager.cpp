@@ -41,17 +41,27 @@ struct RenderableManager::BuilderDetails {
     Entry* mEntries = nullptr;
     size_t mEntriesCount = 0;
     Box mAABB;
+    Box mOccluder;
     uint8_t mLayerMask = 0x1;
     uint8_t mPriority = 0x4;
     bool mCulling : 1;
     bool mCastShadows : 1;
     bool mReceiveShadows : 1;
+    bool mStaticShadowCaster : 1;
     size_t mSkinningBoneCount = 0;
     Bone const* mUserBones = nullptr;
     filament::math::mat4f const* mUserBoneMatrices = nullptr;
+    struct Lod {
+        size_t first = 0;
+        size_t count = 0;
+        float minScreenSize = 0;
+    };
+    Lod mLods[CONFIG_MAX_LOD_COUNT];
+    size_t mLodCount = 0;
 
     explicit BuilderDetails(size_t count)
-            : mEntriesCount(count), mCulling(true), mCastShadows(false), mReceiveShadows(true) {
+            : mEntriesCount(count), mCulling(true), mCastShadows(false), mReceiveShadows(true),
+              mStaticShadowCaster(false) {
     }
     // this is only needed for the explicit instantiation below
     BuilderDetails() = default;
@@ -135,6 +145,16 @@ RenderableManager::Builder& RenderableManager::Builder::receiveShadows(bool enab
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::staticShadowCaster(bool enable) noexcept {
+    mImpl->mStaticShadowCaster = enable;
+    return *this;
+}
+
+RenderableManager::Builder& RenderableManager::Builder::occluder(const Box& occluderBox) noexcept {
+    mImpl->mOccluder = occluderBox;
+    return *this;
+}
+
 RenderableManager::Builder& RenderableManager::Builder::skinning(size_t boneCount) noexcept {
     mImpl->mSkinningBoneCount = boneCount;
     return *this;
@@ -161,7 +181,28 @@ RenderableManager::Builder& RenderableManager::Builder::blendOrder(size_t index,
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::levelOfDetail(uint8_t level,
+        size_t first, size_t count, float minScreenSize) noexcept {
+    if (level < CONFIG_MAX_LOD_COUNT) {
+        mImpl->mLods[level] = { first, count, minScreenSize };
+        mImpl->mLodCount = std::max(mImpl->mLodCount, size_t(level) + 1);
+    }
+    return *this;
+}
+
 RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& engine, Entity entity) {
+    return build(engine, &entity, 1);
+}
+
+RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& engine,
+        Entity const* entities, size_t count) {
+    if (UTILS_UNLIKELY(!count)) {
+        return Success;
+    }
+
+    // the builder is the same for all the entities, so it's validated only once and the errors
+    // are reported for the first entity
+    const Entity entity = entities[0];
     bool isEmpty = true;
 
     if (!ASSERT_PRECONDITION_NON_FATAL(mImpl->mSkinningBoneCount <= CONFIG_MAX_BONE_COUNT,
@@ -169,6 +210,31 @@ RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& eng
         return Error;
     }
 
+    if (mImpl->mLodCount) {
+        // levels must be consecutive ranges of primitives, covering all of them
+        size_t end = 0;
+        for (size_t level = 0, c = mImpl->mLodCount; level < c; level++) {
+            auto const& lod = mImpl->mLods[level];
+            if (!ASSERT_PRECONDITION_NON_FATAL(lod.first == end && lod.count > 0,
+                    "[entity=%u] level of detail %u is empty or doesn't start at primitive %u",
+                    entity.getId(), level, end)) {
+                return Error;
+            }
+            if (!ASSERT_PRECONDITION_NON_FATAL(level == 0 || level + 1 == c ||
+                    lod.minScreenSize < mImpl->mLods[level - 1].minScreenSize,
+                    "[entity=%u] minScreenSize of level of detail %u must be smaller than the "
+                    "previous level's", entity.getId(), level)) {
+                return Error;
+            }
+            end += lod.count;
+        }
+        if (!ASSERT_PRECONDITION_NON_FATAL(end == mImpl->mEntriesCount,
+                "[entity=%u] levels of detail cover %u primitives out of %u",
+                entity.getId(), end, mImpl->mEntriesCount)) {
+            return Error;
+        }
+    }
+
     for (size_t i = 0, c = mImpl->mEntriesCount; i < c; i++) {
         auto& entry = mImpl->mEntries[i];
 
@@ -230,7 +296,7 @@ RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& eng
     }
 
     // we get here only if there was no POSTCONDITION errors.
-    upcast(engine).createRenderable(*this, entity);
+    upcast(engine).createRenderables(*this, entities, count);
     return Success;
 }
 
@@ -267,7 +333,7 @@ void FRenderableManager::create(
         Builder::Entry const * const entries = builder->mEntries;
         FRenderPrimitive* rp = new FRenderPrimitive[builder->mEntriesCount];
         for (size_t i = 0, c = builder->mEntriesCount; i < c; ++i) {
-            rp[i].init(driver, entries[i]);
+            rp[i].init(engine, entries[i]);
         }
         setPrimitives(ci, { rp, size_type(builder->mEntriesCount) });
 
@@ -276,8 +342,23 @@ void FRenderableManager::create(
         setPriority(ci, builder->mPriority);
         setCastShadows(ci, builder->mCastShadows);
         setReceiveShadows(ci, builder->mReceiveShadows);
+        setStaticShadowCaster(ci, builder->mStaticShadowCaster);
         setCulling(ci, builder->mCulling);
         setSkinning(ci, false);
+        setOccluder(ci, builder->mOccluder);
+
+        // a single level of detail is the same as none
+        const size_t lodCount = builder->mLodCount;
+        if (UTILS_UNLIKELY(lodCount > 1)) {
+            std::unique_ptr<LevelsOfDetail>& lods = manager[ci].lods;
+            lods = std::unique_ptr<LevelsOfDetail>(new LevelsOfDetail{});
+            lods->count = uint8_t(lodCount);
+            for (size_t level = 0; level < lodCount; level++) {
+                lods->offsets[level] = uint32_t(builder->mLods[level].first);
+                lods->minScreenSizes[level] = builder->mLods[level].minScreenSize;
+            }
+            lods->offsets[lodCount] = uint32_t(builder->mEntriesCount);
+        }
 
         const size_t count = builder->mSkinningBoneCount;
         if (UTILS_UNLIKELY(count)) {
@@ -322,10 +403,33 @@ void FRenderableManager::destroy(utils::Entity e) noexcept {
     Instance ci = getInstance(e);
     if (ci) {
         destroyComponent(ci);
-        mManager.removeComponent(e);
+        removeComponent(e);
     }
 }
 
+void FRenderableManager::create(const RenderableManager::Builder& UTILS_RESTRICT builder,
+        Entity const* entities, size_t count) {
+    // adding the components doesn't reallocate
+    mManager.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        create(builder, entities[i]);
+    }
+}
+
+void FRenderableManager::destroy(Entity const* entities, size_t count) noexcept {
+    for (size_t i = 0; i < count; i++) {
+        destroy(entities[i]);
+    }
+}
+
+void FRenderableManager::removeComponent(utils::Entity e) noexcept {
+    auto& manager = mManager;
+    // the last component is moved in place of the removed one, so its instance changes
+    mChangeLog.record(e);
+    mChangeLog.record(manager.getEntity(manager.end() - 1));
+    manager.removeComponent(e);
+}
+
 // this destroys all components in this manager
 void FRenderableManager::terminate() noexcept {
     auto& manager = mManager;
@@ -387,11 +491,24 @@ void FRenderableManager::prepare(
     }
 }
 
-void FRenderableManager::setMaterialInstanceAt(Instance instance, uint8_t level,
+Slice<FRenderPrimitive> FRenderableManager::getRenderPrimitives(
+        Instance instance, uint8_t level) const noexcept {
+    Slice<FRenderPrimitive> primitives = mManager[instance].primitives;
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    if (lods) {
+        assert(level < lods->count);
+        primitives.set(primitives.begin() + lods->offsets[level],
+                lods->offsets[level + 1] - lods->offsets[level]);
+    }
+    return primitives;
+}
+
+void FRenderableManager::setMaterialInstanceAt(Instance instance,
         size_t primitiveIndex, FMaterialInstance const* mi) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance);
         if (primitiveIndex < primitives.size()) {
+            recordStaticShadowCasterChange(instance);
             primitives[primitiveIndex].setMaterialInstance(upcast(mi));
 #ifndef NDEBUG
             AttributeBitset required = mi->getMaterial()->getRequiredAttributes();
@@ -407,9 +524,9 @@ void FRenderableManager::setMaterialInstanceAt(Instance instance, uint8_t level,
 }
 
 MaterialInstance* FRenderableManager::getMaterialInstanceAt(
-        Instance instance, uint8_t level, size_t primitiveIndex) const noexcept {
+        Instance instance, size_t primitiveIndex) const noexcept {
     if (instance) {
-        const Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        const Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance);
         if (primitiveIndex < primitives.size()) {
             // We store the material instance as const because we don't want to change it internally
             // but when the user queries it, we want to allow them to call setParameter()
@@ -419,10 +536,10 @@ MaterialInstance* FRenderableManager::getMaterialInstanceAt(
     return nullptr;
 }
 
-void FRenderableManager::setBlendOrderAt(Instance instance, uint8_t level,
+void FRenderableManager::setBlendOrderAt(Instance instance,
         size_t primitiveIndex, uint16_t order) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setBlendOrder(order);
         }
@@ -430,9 +547,9 @@ void FRenderableManager::setBlendOrderAt(Instance instance, uint8_t level,
 }
 
 AttributeBitset FRenderableManager::getEnabledAttributesAt(
-        Instance instance, uint8_t level, size_t primitiveIndex) const noexcept {
+        Instance instance, size_t primitiveIndex) const noexcept {
     if (instance) {
-        Slice<FRenderPrimitive> const& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive> const& primitives = getRenderPrimitives(instance);
         if (primitiveIndex < primitives.size()) {
             return primitives[primitiveIndex].getEnabledAttributes();
         }
@@ -440,23 +557,25 @@ AttributeBitset FRenderableManager::getEnabledAttributesAt(
     return AttributeBitset{};
 }
 
-void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+void FRenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, FVertexBuffer* vertices, FIndexBuffer* indices,
         size_t offset, size_t count) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance);
         if (primitiveIndex < primitives.size()) {
+            recordStaticShadowCasterChange(instance);
             primitives[primitiveIndex].set(mEngine, type, vertices, indices, offset,
                     0, vertices->getVertexCount() - 1, count);
         }
     }
 }
 
-void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+void FRenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, size_t offset, size_t count) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance);
         if (primitiveIndex < primitives.size()) {
+            recordStaticShadowCasterChange(instance);
             primitives[primitiveIndex].set(mEngine, type, offset, 0, 0, count);
         }
     }
@@ -468,6 +587,7 @@ void FRenderableManager::setBones(Instance ci,
         std::unique_ptr<Bones> const& bones = mManager[ci].bones;
         assert(bones && offset + boneCount <= bones->count);
         if (bones) {
+            recordStaticShadowCasterChange(ci);
             boneCount = std::min(boneCount, bones->count - offset);
             PerRenderableUibBone* UTILS_RESTRICT out = (PerRenderableUibBone*)bones->bones.invalidateUniforms(
                     offset * sizeof(PerRenderableUibBone),
@@ -487,6 +607,7 @@ void FRenderableManager::setBones(Instance ci,
         std::unique_ptr<Bones> const& bones = mManager[ci].bones;
         assert(bones && offset + boneCount <= bones->count);
         if (bones) {
+            recordStaticShadowCasterChange(ci);
             boneCount = std::min(boneCount, bones->count - offset);
             PerRenderableUibBone* UTILS_RESTRICT out = (PerRenderableUibBone*)bones->bones.invalidateUniforms(
                     offset * sizeof(PerRenderableUibBone),
@@ -543,6 +664,10 @@ void RenderableManager::destroy(utils::Entity e) noexcept {
     return upcast(this)->destroy(e);
 }
 
+void RenderableManager::destroy(utils::Entity const* entities, size_t count) noexcept {
+    upcast(this)->destroy(entities, count);
+}
+
 void RenderableManager::setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept {
     upcast(this)->setAxisAlignedBoundingBox(instance, aabb);
 }
@@ -563,6 +688,14 @@ void RenderableManager::setReceiveShadows(Instance instance, bool enable) noexce
     upcast(this)->setReceiveShadows(instance, enable);
 }
 
+void RenderableManager::setStaticShadowCaster(Instance instance, bool enable) noexcept {
+    upcast(this)->setStaticShadowCaster(instance, enable);
+}
+
+void RenderableManager::setOccluder(Instance instance, const Box& occluderBox) noexcept {
+    upcast(this)->setOccluder(instance, occluderBox);
+}
+
 bool RenderableManager::isShadowCaster(Instance instance) const noexcept {
     return upcast(this)->isShadowCaster(instance);
 }
@@ -571,42 +704,55 @@ bool RenderableManager::isShadowReceiver(Instance instance) const noexcept {
     return upcast(this)->isShadowReceiver(instance);
 }
 
+bool RenderableManager::isStaticShadowCaster(Instance instance) const noexcept {
+    return upcast(this)->isStaticShadowCaster(instance);
+}
+
 const Box& RenderableManager::getAxisAlignedBoundingBox(Instance instance) const noexcept {
     return upcast(this)->getAxisAlignedBoundingBox(instance);
 }
 
 size_t RenderableManager::getPrimitiveCount(Instance instance) const noexcept {
-    return upcast(this)->getPrimitiveCount(instance, 0);
+    return upcast(this)->getPrimitiveCount(instance);
 }
 
 void RenderableManager::setMaterialInstanceAt(Instance instance,
         size_t primitiveIndex, MaterialInstance const* materialInstance) noexcept {
-    upcast(this)->setMaterialInstanceAt(instance, 0, primitiveIndex, upcast(materialInstance));
+    upcast(this)->setMaterialInstanceAt(instance, primitiveIndex, upcast(materialInstance));
 }
 
 MaterialInstance* RenderableManager::getMaterialInstanceAt(
         Instance instance, size_t primitiveIndex) const noexcept {
-    return upcast(this)->getMaterialInstanceAt(instance, 0, primitiveIndex);
+    return upcast(this)->getMaterialInstanceAt(instance, primitiveIndex);
 }
 
 void RenderableManager::setBlendOrderAt(Instance instance, size_t primitiveIndex, uint16_t order) noexcept {
-    upcast(this)->setBlendOrderAt(instance, 0, primitiveIndex, order);
+    upcast(this)->setBlendOrderAt(instance, primitiveIndex, order);
 }
 
 AttributeBitset RenderableManager::getEnabledAttributesAt(Instance instance, size_t primitiveIndex) const noexcept {
-    return upcast(this)->getEnabledAttributesAt(instance, 0, primitiveIndex);
+    return upcast(this)->getEnabledAttributesAt(instance, primitiveIndex);
 }
 
 void RenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, VertexBuffer* vertices, IndexBuffer* indices,
         size_t offset, size_t count) noexcept {
-    upcast(this)->setGeometryAt(instance, 0, primitiveIndex,
+    upcast(this)->setGeometryAt(instance, primitiveIndex,
             type, upcast(vertices), upcast(indices), offset, count);
 }
 
 void RenderableManager::setGeometryAt(RenderableManager::Instance instance, size_t primitiveIndex,
         RenderableManager::PrimitiveType type, size_t offset, size_t count) noexcept {
-    upcast(this)->setGeometryAt(instance, 0, primitiveIndex, type, offset, count);
+    upcast(this)->setGeometryAt(instance, primitiveIndex, type, offset, count);
+}
+
+size_t RenderableManager::getLevelOfDetailCount(Instance instance) const noexcept {
+    return upcast(this)->getLevelCount(instance);
+}
+
+void RenderableManager::setLevelOfDetailScreenSize(Instance instance,
+        uint8_t level, float minScreenSize) noexcept {
+    upcast(this)->setMinScreenSize(instance, level, minScreenSize);
 }
 
 void RenderableManager::setBones(Instance instance,
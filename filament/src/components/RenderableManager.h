@@ -21,10 +21,15 @@
 
 #include "UniformBuffer.h"
 
+#include "components/ChangeLog.h"
+
+#include "details/RenderPrimitiveCache.h"
+
 #include "driver/DriverApiForward.h"
 #include "driver/Handle.h"
 
 #include <filament/Box.h>
+#include <filament/EngineEnums.h>
 #include <filament/RenderableManager.h>
 
 #include <private/filament/UibGenerator.h>
@@ -53,8 +58,25 @@ public:
         bool receiveShadows : 1;
         bool culling        : 1;
         bool skinning       : 1;
+        bool occluder       : 1;
+        bool staticShadowCaster : 1;
+    };
+
+    // Levels of detail of a renderable that has more than one
+    struct LevelsOfDetail {
+        // primitives of level i are [offsets[i], offsets[i + 1])
+        uint32_t offsets[CONFIG_MAX_LOD_COUNT + 1];
+        // level i is used while the screen size is at least minScreenSizes[i], except for the
+        // last level which is used below all of them.
+        float minScreenSizes[CONFIG_MAX_LOD_COUNT];
+        uint8_t count;
     };
 
+    // A renderable only goes back to a finer level of detail once its screen size is this much
+    // (relatively) above the level's threshold, so it doesn't pop back and forth when its screen
+    // size hovers around a threshold.
+    static constexpr float LOD_HYSTERESIS = 0.1f;
+
     explicit FRenderableManager(FEngine& engine) noexcept;
     ~FRenderableManager();
 
@@ -75,8 +97,13 @@ public:
 
     void create(const RenderableManager::Builder& builder, utils::Entity entity);
 
+    void create(const RenderableManager::Builder& builder,
+            utils::Entity const* entities, size_t count);
+
     void destroy(utils::Entity e) noexcept;
 
+    void destroy(utils::Entity const* entities, size_t count) noexcept;
+
     // - instances is a list of Instance (typically the list from a given scene)
     // - list is a list of index in 'instances' (typically the visible ones)
     void prepare(driver::DriverApi& driver,
@@ -84,9 +111,18 @@ public:
             utils::Range<uint32_t> list) const noexcept;
 
     void gc(utils::EntityManager& em) noexcept {
-        mManager.gc(em);
+        mManager.gc(em, 4, [this](utils::Entity e) {
+            removeComponent(e);
+        });
     }
 
+    // entities whose instance or scene-visible state (AABB, layers, visibility) changed, as well
+    // as static shadow casters whose primitives or bones changed
+    ChangeLog const& getChangeLog() const noexcept { return mChangeLog; }
+
+    // HwRenderPrimitives shared by all FRenderPrimitive with the same geometry
+    RenderPrimitiveCache& getRenderPrimitiveCache() noexcept { return mRenderPrimitiveCache; }
+
     inline void setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept;
 
     inline void setLayerMask(Instance instance, uint8_t select, uint8_t values) noexcept;
@@ -98,19 +134,24 @@ public:
 
     inline void setLayerMask(Instance instance, uint8_t layerMask) noexcept;
     inline void setReceiveShadows(Instance instance, bool enable) noexcept;
+    inline void setStaticShadowCaster(Instance instance, bool enable) noexcept;
     inline void setCulling(Instance instance, bool enable) noexcept;
     inline void setSkinning(Instance instance, bool enable) noexcept;
+    inline void setOccluder(Instance instance, const Box& occluderBox) noexcept;
     inline void setPrimitives(Instance instance, utils::Slice<FRenderPrimitive> const& primitives) noexcept;
     inline void setBones(Instance instance, Bone const* transforms, size_t boneCount, size_t offset = 0) noexcept;
     inline void setBones(Instance instance, filament::math::mat4f const* transforms, size_t boneCount, size_t offset = 0) noexcept;
+    inline void setMinScreenSize(Instance instance, uint8_t level, float minScreenSize) noexcept;
 
 
     inline bool isShadowCaster(Instance instance) const noexcept;
     inline bool isShadowReceiver(Instance instance) const noexcept;
+    inline bool isStaticShadowCaster(Instance instance) const noexcept;
     inline bool isCullingEnabled(Instance instance) const noexcept;
 
     inline Box const& getAABB(Instance instance) const noexcept;
     inline Box const& getAxisAlignedBoundingBox(Instance instance) const noexcept { return getAABB(instance); }
+    inline Box const& getOccluder(Instance instance) const noexcept;
     inline Visibility getVisibility(Instance instance) const noexcept;
     inline uint8_t getLayerMask(Instance instance) const noexcept;
     inline uint8_t getPriority(Instance instance) const noexcept;
@@ -118,23 +159,44 @@ public:
     inline Handle<HwUniformBuffer> getBonesUbh(Instance instance) const noexcept;
 
 
-    inline size_t getLevelCount(Instance instance) const noexcept { return 1; }
-    inline size_t getPrimitiveCount(Instance instance, uint8_t level) const noexcept;
-    void setMaterialInstanceAt(Instance instance, uint8_t level,
+    inline size_t getLevelCount(Instance instance) const noexcept;
+    // null if the renderable has a single level of detail
+    inline LevelsOfDetail const* getLevelsOfDetail(Instance instance) const noexcept;
+    inline size_t getPrimitiveCount(Instance instance) const noexcept;
+    void setMaterialInstanceAt(Instance instance,
             size_t primitiveIndex, FMaterialInstance const* materialInstance) noexcept;
-    MaterialInstance* getMaterialInstanceAt(Instance instance, uint8_t level, size_t primitiveIndex) const noexcept;
-    void setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+    MaterialInstance* getMaterialInstanceAt(Instance instance, size_t primitiveIndex) const noexcept;
+    void setGeometryAt(Instance instance, size_t primitiveIndex,
             PrimitiveType type, FVertexBuffer* vertices, FIndexBuffer* indices,
             size_t offset, size_t count) noexcept;
-    void setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+    void setGeometryAt(Instance instance, size_t primitiveIndex,
             PrimitiveType type, size_t offset, size_t count) noexcept;
-    void setBlendOrderAt(Instance instance, uint8_t level, size_t primitiveIndex, uint16_t blendOrder) noexcept;
-    AttributeBitset getEnabledAttributesAt(Instance instance, uint8_t level, size_t primitiveIndex) const noexcept;
-    inline utils::Slice<FRenderPrimitive> const& getRenderPrimitives(Instance instance, uint8_t level) const noexcept;
-    inline utils::Slice<FRenderPrimitive>& getRenderPrimitives(Instance instance, uint8_t level) noexcept;
+    void setBlendOrderAt(Instance instance, size_t primitiveIndex, uint16_t blendOrder) noexcept;
+    AttributeBitset getEnabledAttributesAt(Instance instance, size_t primitiveIndex) const noexcept;
+
+    // all the primitives of the renderable, across all levels of detail
+    inline utils::Slice<FRenderPrimitive> const& getRenderPrimitives(Instance instance) const noexcept;
+    inline utils::Slice<FRenderPrimitive>& getRenderPrimitives(Instance instance) noexcept;
+
+    // the primitives of the given level of detail
+    utils::Slice<FRenderPrimitive> getRenderPrimitives(Instance instance, uint8_t level) const noexcept;
+
+    // Returns the level of detail to use for a renderable whose screen size (its projected
+    // bounding sphere diameter divided by the viewport height) is 'screenSize', and which
+    // currently uses level 'current'.
+    static inline uint8_t selectLevelOfDetail(LevelsOfDetail const& lods,
+            float screenSize, uint8_t current) noexcept;
 
 private:
+    // the cached shadow maps must be re-rendered when a static shadow caster changes
+    void recordStaticShadowCasterChange(Instance instance) noexcept {
+        if (getVisibility(instance).staticShadowCaster) {
+            mChangeLog.record(mManager.getEntity(instance));
+        }
+    }
+
     void destroyComponent(Instance ci) noexcept;
+    void removeComponent(utils::Entity e) noexcept;
     static void destroyComponentPrimitives(FEngine& engine,
             utils::Slice<FRenderPrimitive>& primitives) noexcept;
 
@@ -154,6 +216,8 @@ private:
         VISIBILITY,         // user data
         PRIMITIVES,         // user data
         BONES,              // filament data, UBO storing a pointer to the bones information
+        OCCLUDER,           // user data
+        LODS,               // user data
     };
 
     using Base = utils::SingleInstanceComponentManager<
@@ -161,7 +225,9 @@ private:
             uint8_t,
             Visibility,
             utils::Slice<FRenderPrimitive>,
-            std::unique_ptr<Bones>
+            std::unique_ptr<Bones>,
+            Box,
+            std::unique_ptr<LevelsOfDetail>
     >;
 
     struct Sim : public Base {
@@ -181,6 +247,8 @@ private:
                 Field<VISIBILITY>   visibility;
                 Field<PRIMITIVES>   primitives;
                 Field<BONES>        bones;
+                Field<OCCLUDER>     occluder;
+                Field<LODS>         lods;
             };
         };
 
@@ -193,6 +261,8 @@ private:
     };
 
     Sim mManager;
+    ChangeLog mChangeLog;
+    RenderPrimitiveCache mRenderPrimitiveCache;
     FEngine& mEngine;
 };
 
@@ -200,6 +270,7 @@ FILAMENT_UPCAST(RenderableManager)
 
 void FRenderableManager::setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         mManager[instance].aabb = aabb;
     }
 }
@@ -207,6 +278,7 @@ void FRenderableManager::setAxisAlignedBoundingBox(Instance instance, const Box&
 void FRenderableManager::setLayerMask(Instance instance,
         uint8_t select, uint8_t values) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         uint8_t& layers = mManager[instance].layers;
         layers = (layers & ~select) | (values & select);
     }
@@ -214,12 +286,14 @@ void FRenderableManager::setLayerMask(Instance instance,
 
 void FRenderableManager::setLayerMask(Instance instance, uint8_t layerMask) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         mManager[instance].layers = layerMask;
     }
 }
 
 void FRenderableManager::setPriority(Instance instance, uint8_t priority) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         Visibility& visibility = mManager[instance].visibility;
         visibility.priority = priority;
     }
@@ -227,6 +301,7 @@ void FRenderableManager::setPriority(Instance instance, uint8_t priority) noexce
 
 void FRenderableManager::setCastShadows(Instance instance, bool enable) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         Visibility& visibility = mManager[instance].visibility;
         visibility.castShadows = enable;
     }
@@ -234,13 +309,23 @@ void FRenderableManager::setCastShadows(Instance instance, bool enable) noexcept
 
 void FRenderableManager::setReceiveShadows(Instance instance, bool enable) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         Visibility& visibility = mManager[instance].visibility;
         visibility.receiveShadows = enable;
     }
 }
 
+void FRenderableManager::setStaticShadowCaster(Instance instance, bool enable) noexcept {
+    if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.staticShadowCaster = enable;
+    }
+}
+
 void FRenderableManager::setCulling(Instance instance, bool enable) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         Visibility& visibility = mManager[instance].visibility;
         visibility.culling = enable;
     }
@@ -248,11 +333,21 @@ void FRenderableManager::setCulling(Instance instance, bool enable) noexcept {
 
 void FRenderableManager::setSkinning(Instance instance, bool enable) noexcept {
     if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
         Visibility& visibility = mManager[instance].visibility;
         visibility.skinning = enable;
     }
 }
 
+void FRenderableManager::setOccluder(Instance instance, const Box& occluderBox) noexcept {
+    if (instance) {
+        mChangeLog.record(mManager.getEntity(instance));
+        mManager[instance].occluder = occluderBox;
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.occluder = !occluderBox.isEmpty();
+    }
+}
+
 void FRenderableManager::setPrimitives(Instance instance,
         utils::Slice<FRenderPrimitive> const& primitives) noexcept {
     if (instance) {
@@ -273,6 +368,10 @@ bool FRenderableManager::isShadowReceiver(Instance instance) const noexcept {
     return getVisibility(instance).receiveShadows;
 }
 
+bool FRenderableManager::isStaticShadowCaster(Instance instance) const noexcept {
+    return getVisibility(instance).staticShadowCaster;
+}
+
 bool FRenderableManager::isCullingEnabled(Instance instance) const noexcept {
     return getVisibility(instance).culling;
 }
@@ -289,23 +388,61 @@ Box const& FRenderableManager::getAABB(Instance instance) const noexcept {
     return mManager[instance].aabb;
 }
 
+Box const& FRenderableManager::getOccluder(Instance instance) const noexcept {
+    return mManager[instance].occluder;
+}
+
 Handle<HwUniformBuffer> FRenderableManager::getBonesUbh(Instance instance) const noexcept {
     std::unique_ptr<Bones> const& bones = mManager[instance].bones;
     return bones ? bones->handle : Handle<HwUniformBuffer>{};
 }
 
+void FRenderableManager::setMinScreenSize(Instance instance,
+        uint8_t level, float minScreenSize) noexcept {
+    if (instance) {
+        std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+        if (lods && level < lods->count) {
+            lods->minScreenSizes[level] = minScreenSize;
+        }
+    }
+}
+
+size_t FRenderableManager::getLevelCount(Instance instance) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    return lods ? lods->count : 1;
+}
+
+FRenderableManager::LevelsOfDetail const* FRenderableManager::getLevelsOfDetail(
+        Instance instance) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    return lods.get();
+}
+
 utils::Slice<FRenderPrimitive> const& FRenderableManager::getRenderPrimitives(
-        Instance instance, uint8_t level) const noexcept {
+        Instance instance) const noexcept {
     return mManager[instance].primitives;
 }
 
 utils::Slice<FRenderPrimitive>& FRenderableManager::getRenderPrimitives(
-        Instance instance, uint8_t level) noexcept {
+        Instance instance) noexcept {
     return mManager[instance].primitives;
 }
 
-size_t FRenderableManager::getPrimitiveCount(Instance instance, uint8_t level) const noexcept {
-    return getRenderPrimitives(instance, level).size();
+size_t FRenderableManager::getPrimitiveCount(Instance instance) const noexcept {
+    return getRenderPrimitives(instance).size();
+}
+
+uint8_t FRenderableManager::selectLevelOfDetail(LevelsOfDetail const& lods,
+        float screenSize, uint8_t current) noexcept {
+    // count the thresholds we're below, the ones of the levels finer than the current one are
+    // raised by the hysteresis.
+    uint8_t level = 0;
+    for (size_t i = 0, c = lods.count - 1u; i < c; i++) {
+        const float threshold = lods.minScreenSizes[i] *
+                (i < current ? 1.0f + LOD_HYSTERESIS : 1.0f);
+        level += screenSize < threshold ? 1 : 0;
+    }
+    return level;
 }
 
 } // namespace details
@@ -16,14 +16,29 @@
 
 #include "components/TransformManager.h"
 
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
+#include <numeric>
+
 using namespace utils;
 using namespace filament::math;
 
 namespace filament {
 namespace details {
 
+// levels of the hierarchy smaller than this are transformed on the calling thread
+static constexpr size_t PARALLEL_LEVEL_SIZE_MIN = 1024;
+
+// setTransforms() recomputes all the world transforms at once when it updates at least
+// 1/BATCH_RESOLVE_RATIO of the nodes, it updates the nodes one by one otherwise
+static constexpr size_t BATCH_RESOLVE_RATIO = 4;
+
 FTransformManager::FTransformManager() noexcept = default;
 
+FTransformManager::FTransformManager(JobSystem& js) noexcept : mJobSystem(&js) {
+}
+
 FTransformManager::~FTransformManager() noexcept = default;
 
 void FTransformManager::terminate() noexcept {
@@ -35,9 +50,9 @@ void FTransformManager::create(Entity entity) {
 
 void FTransformManager::create(Entity entity, Instance parent, const mat4f& localTransform) {
     // this always adds at the end, so all existing instances stay valid
+    // (the entries are sorted with their siblings and parents in commitLocalTransformTransaction())
     auto& manager = mManager;
 
-    // TODO: try to keep entries sorted with their siblings/parents to improve cache access
     if (UTILS_UNLIKELY(manager.hasComponent(entity))) {
         destroy(entity);
     }
@@ -75,6 +90,8 @@ void FTransformManager::destroy(Entity e) noexcept {
     Instance i = manager.getInstance(e);
     validateNode(i);
     if (i) {
+        mChangeLog.record(e);
+
         // 1) remove the entry from the linked lists
         removeNode(i);
 
@@ -105,6 +122,52 @@ void FTransformManager::setTransform(Instance ci, const mat4f& model) noexcept {
     }
 }
 
+void FTransformManager::setTransforms(Instance const* instances, mat4f const* localTransforms,
+        size_t count, size_t stride) noexcept {
+    SYSTRACE_CALL();
+
+    auto& soa = mManager.getSoA();
+    mat4f* const UTILS_RESTRICT local = soa.data<LOCAL>();
+    char const* UTILS_RESTRICT p = reinterpret_cast<char const*>(localTransforms);
+    for (size_t i = 0; i < count; i++, p += stride) {
+        const Instance ci = instances[i];
+        validateNode(ci);
+        if (ci) {
+            local[ci] = *reinterpret_cast<mat4f const*>(p);
+        }
+    }
+
+    if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
+        // the world transforms are computed by commitLocalTransformTransaction()
+        return;
+    }
+
+    if (count * BATCH_RESOLVE_RATIO >= mManager.getComponentCount()) {
+        // a single pass over the hierarchy, instead of one per node and its descendants.
+        // Unlike commitLocalTransformTransaction(), this never sorts the nodes, so that the
+        // caller's instances stay valid.
+        if (UTILS_LIKELY(!mHierarchyChanged)) {
+            // the levels are up-to-date
+            transformAllNodes();
+            mChangeLog.invalidate();
+        } else {
+            // depth-first from each root
+            auto& manager = mManager;
+            for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
+                if (!Instance(manager[i].parent)) {
+                    transformChildren(manager, mChangeLog, i);
+                }
+            }
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            if (instances[i]) {
+                updateNodeTransform(instances[i]);
+            }
+        }
+    }
+}
+
 void FTransformManager::updateNodeTransform(Instance i) noexcept {
     validateNode(i);
     auto& manager = mManager;
@@ -112,14 +175,6 @@ void FTransformManager::updateNodeTransform(Instance i) noexcept {
 
     if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
         // don't update the world transform until commitLocalTransformTransaction() is called
-        Instance ci = manager[i].firstChild;
-        while (ci) {
-            Instance child = manager[ci].firstChild;
-            ci = manager[ci].next;
-            if (child) {
-                updateNodeTransform(child);
-            }
-        }
         return;
     }
 
@@ -130,11 +185,12 @@ void FTransformManager::updateNodeTransform(Instance i) noexcept {
 
     // compute our world transform
     manager[i].world = pt * static_cast<mat4f const&>(manager[i].local);
+    mChangeLog.record(manager.getEntity(i));
 
     // update our children's world transforms
     Instance child = manager[i].firstChild;
     if (UTILS_UNLIKELY(child)) { // assume we don't have a hierarchy in the common case
-        transformChildren(manager, child);
+        transformChildren(manager, mChangeLog, child);
     }
 }
 
@@ -145,30 +201,111 @@ void FTransformManager::openLocalTransformTransaction() noexcept {
 void FTransformManager::commitLocalTransformTransaction() noexcept {
     if (mLocalTransformTransactionOpen) {
         mLocalTransformTransactionOpen = false;
-        auto& manager = mManager;
 
-        // swapNode() below needs some temporary storage which we provide here
-        auto& soa = manager.getSoA();
-        soa.ensureCapacity(soa.size() + 1);
+        // the nodes are sorted breadth-first, so that each level of the hierarchy only
+        // depends on the previous ones
+        if (UTILS_UNLIKELY(mHierarchyChanged)) {
+            sortNodes();
+            mHierarchyChanged = false;
+        }
+
+        transformAllNodes();
+
+        // potentially all world transforms changed
+        mChangeLog.invalidate();
+    }
+}
+
+void FTransformManager::sortNodes() noexcept {
+    SYSTRACE_CALL();
 
-        mat4f const* const UTILS_RESTRICT world = manager.raw_array<WORLD>();
-        for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
-            // Ensure that children are always sorted after their parent.
-            if (UTILS_UNLIKELY(Instance(manager[i].parent) > i)) {
-                swapNode(i, manager[i].parent);
+    auto& manager = mManager;
+    const size_t count = manager.getComponentCount();
+
+    // breadth-first order of the nodes: the roots first (in their current order), then the
+    // children of each node of the previous level, following their sibling list.
+    std::vector<Instance> order;
+    order.reserve(count);
+    for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
+        if (!Instance(manager[i].parent)) {
+            order.push_back(i);
+        }
+    }
+    mLevels.clear();
+    for (size_t b = 0; b < order.size();) {
+        const size_t e = order.size();
+        mLevels.push_back(Instance(manager.begin() + e));
+        for (size_t k = b; k < e; k++) {
+            for (Instance child = manager[order[k]].firstChild; child; child = manager[child].next) {
+                order.push_back(child);
             }
-            Instance parent = manager[i].parent;
-            assert(parent < i);
-            manager[i].world = world[parent] * static_cast<mat4f const&>(manager[i].local);
+        }
+        b = e;
+    }
+    assert(order.size() == count);
+
+    // swapNode() below needs some temporary storage which we provide here
+    auto& soa = manager.getSoA();
+    soa.ensureCapacity(soa.size() + 1);
+
+    // move each node to its position, keeping track of where the nodes are as they get swapped:
+    // where[] is the current instance of a node, by its instance before sorting, and at[]
+    // the node currently at a given instance.
+    std::vector<Instance> where(count + 1);
+    std::vector<Instance> at(count + 1);
+    std::iota(where.begin(), where.end(), Instance(0));
+    std::iota(at.begin(), at.end(), Instance(0));
+    for (size_t k = 0; k < count; k++) {
+        const Instance dst = Instance(manager.begin() + k);
+        const Instance src = where[order[k]];
+        if (src != dst) {
+            swapNode(dst, src);
+            const Instance moved = at[dst];
+            at[src] = moved;
+            where[moved] = src;
+            at[dst] = order[k];
+            where[order[k]] = dst;
         }
     }
 }
 
+void FTransformManager::transformAllNodes() noexcept {
+    SYSTRACE_CALL();
+
+    auto& soa = mManager.getSoA();
+    mat4f* const UTILS_RESTRICT world = soa.data<WORLD>();
+    mat4f const* const UTILS_RESTRICT local = soa.data<LOCAL>();
+    Instance const* const UTILS_RESTRICT parent = soa.data<PARENT>();
+
+    // note: the parents are transformed already, and world[0] is the identity
+    auto transform = [world, local, parent](uint32_t start, uint32_t count) {
+        for (size_t i = start, e = start + count; i < e; i++) {
+            world[i] = world[parent[i]] * local[i];
+        }
+    };
+
+    // levels are transformed one after the other, each of them in parallel if it's large enough
+    uint32_t begin = mManager.begin();
+    for (Instance end : mLevels) {
+        const uint32_t count = end - begin;
+        if (mJobSystem && count >= PARALLEL_LEVEL_SIZE_MIN) {
+            JobSystem& js = *mJobSystem;
+            auto job = jobs::parallel_for(js, nullptr, begin, count,
+                    std::cref(transform), jobs::CountSplitter<PARALLEL_LEVEL_SIZE_MIN / 2, 8>());
+            js.runAndWait(job);
+        } else {
+            transform(begin, count);
+        }
+        begin = end;
+    }
+}
+
 // Inserts a parentless node in the hierarchy
 void FTransformManager::insertNode(Instance i, Instance parent) noexcept {
     auto& manager = mManager;
 
     assert(manager[i].parent == Instance{});
+    mHierarchyChanged = true;
 
     manager[i].parent = parent;
     manager[i].prev = 0;
@@ -230,6 +367,7 @@ void FTransformManager::swapNode(Instance i, Instance j) noexcept {
 // (making everybody orphaned).
 void FTransformManager::removeNode(Instance i) noexcept {
     auto& manager = mManager;
+    mHierarchyChanged = true;
     Instance parent = manager[i].parent;
     Instance prev = manager[i].prev;
     Instance next = manager[i].next;
@@ -283,22 +421,30 @@ void FTransformManager::updateNode(Instance i) noexcept {
     validateNode(next);
 }
 
-void FTransformManager::transformChildren(Sim& manager, Instance ci) noexcept {
+void FTransformManager::transformChildren(Sim& manager, ChangeLog& changeLog,
+        Instance ci) noexcept {
+    // depth-first traversal, without recursion so that deep hierarchies don't overflow the stack
+    const Instance root = manager[ci].parent;
     while (ci) {
         // update child's world transform
         Instance parent = manager[ci].parent;
         mat4f const& pt = manager[parent].world;
         mat4f const& local = manager[ci].local;
         manager[ci].world = pt * local;
+        changeLog.record(manager.getEntity(ci));
 
         // assume we don't have a deep hierarchy
         Instance child = manager[ci].firstChild;
         if (UTILS_UNLIKELY(child)) {
-            transformChildren(manager, child);
+            ci = child;
+            continue;
         }
 
-        // process our next child
-        ci = manager[ci].next;
+        // process our next sibling, or the next sibling of our closest ancestor that has one
+        while (ci != root && !Instance(manager[ci].next)) {
+            ci = manager[ci].parent;
+        }
+        ci = (ci != root) ? Instance(manager[ci].next) : Instance(0);
     }
 }
 
@@ -380,6 +526,11 @@ void TransformManager::setTransform(Instance ci, const mat4f& model) noexcept {
     upcast(this)->setTransform(ci, model);
 }
 
+void TransformManager::setTransforms(Instance const* instances, const mat4f* localTransforms,
+        size_t count, size_t stride) noexcept {
+    upcast(this)->setTransforms(instances, localTransforms, count, stride);
+}
+
 const mat4f& TransformManager::getTransform(Instance ci) const noexcept {
     return upcast(this)->getTransform(ci);
 }
@@ -19,6 +19,8 @@
 
 #include "upcast.h"
 
+#include "components/ChangeLog.h"
+
 #include <filament/TransformManager.h>
 
 #include <utils/compiler.h>
@@ -28,6 +30,12 @@
 
 #include <math/mat4.h>
 
+#include <vector>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
 namespace filament {
 namespace details {
 
@@ -36,6 +44,8 @@ public:
     using Instance = TransformManager::Instance;
 
     FTransformManager() noexcept;
+    // with a JobSystem, commitLocalTransformTransaction() computes the world transforms in parallel
+    explicit FTransformManager(utils::JobSystem& js) noexcept;
     ~FTransformManager() noexcept;
 
     // free-up all resources
@@ -74,6 +84,9 @@ public:
 
     void setTransform(Instance ci, const filament::math::mat4f& model) noexcept;
 
+    void setTransforms(Instance const* instances, const filament::math::mat4f* localTransforms,
+            size_t count, size_t stride = sizeof(filament::math::mat4f)) noexcept;
+
     const filament::math::mat4f& getTransform(Instance ci) const noexcept {
         return mManager[ci].local;
     }
@@ -82,6 +95,9 @@ public:
         return mManager[ci].world;
     }
 
+    // entities whose world transform changed, or that lost their transform component
+    ChangeLog const& getChangeLog() const noexcept { return mChangeLog; }
+
 private:
     struct Sim;
 
@@ -91,7 +107,9 @@ private:
     void updateNodeTransform(Instance i) noexcept;
     void insertNode(Instance i, Instance p) noexcept;
     void swapNode(Instance i, Instance j) noexcept;
-    static void transformChildren(Sim& manager, Instance firstChild) noexcept;
+    void sortNodes() noexcept;
+    void transformAllNodes() noexcept;
+    static void transformChildren(Sim& manager, ChangeLog& changeLog, Instance firstChild) noexcept;
 
 
     enum {
@@ -144,6 +162,14 @@ private:
     };
 
     Sim mManager;
+    ChangeLog mChangeLog;
+    utils::JobSystem* mJobSystem = nullptr;
+
+    // After commitLocalTransformTransaction(), the nodes are sorted breadth-first: the roots,
+    // then their children, and so on, with the children of a node next to each other. These
+    // are the end instances of each level of the hierarchy, valid until the hierarchy changes.
+    std::vector<Instance> mLevels;
+    bool mHierarchyChanged = true;
     bool mLocalTransformTransactionOpen = false;
 };
 
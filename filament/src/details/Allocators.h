@@ -23,10 +23,10 @@ namespace filament {
 namespace details {
 
 // per render pass allocations
-// Froxelization needs about 1 MiB. Command buffer needs about 1 MiB.
+// Froxelization needs about 1 MiB.
 static constexpr size_t CONFIG_PER_RENDER_PASS_ARENA_SIZE    = 2 * 1024 * 1024;
 
-// size of the high-level draw commands buffer (comes from the per-render pass allocator)
+// initial size of the high-level draw commands buffer (comes from the heap and grows on demand)
 static constexpr size_t CONFIG_PER_FRAME_COMMANDS_SIZE = 1 * 1024 * 1024;
 
 // size of a command-stream buffer (comes from mmap -- not the per-engine arena)
@@ -33,6 +33,8 @@ namespace details {
  *
  * The implementation assumes 'count' below is multiple of 8
  *
+ * On x86, hand-written SSE2, AVX2 or AVX-512 kernels are selected at runtime based on the
+ * CPU capabilities. Other platforms rely on the compiler to auto-vectorize the generic code.
  */
 
 class Culler {
@@ -48,6 +50,17 @@ public:
 
     using result_type = uint8_t;
 
+    // Instruction sets the culling kernels are specialized for
+    enum class Isa : uint8_t {
+        GENERIC,    // auto-vectorized C++
+        SSE2,
+        AVX2,
+        AVX512,
+    };
+
+    // returns the instruction set used by intersects(), this is the best one the CPU supports
+    static Isa getIsa() noexcept;
+
     /*
      * returns whether each AABB in an array intersects with the frustum
      */
@@ -92,6 +105,21 @@ public:
                 Frustum const& frustum,
                 filament::math::float4 const* b,
                 size_t count) noexcept;
+
+        // same as above, using the kernels for the given instruction set
+        static void intersects(Isa isa, result_type* results,
+                Frustum const& frustum,
+                filament::math::float3 const* c,
+                filament::math::float3 const* e,
+                size_t count) noexcept;
+
+        static void intersects(Isa isa, result_type* results,
+                Frustum const& frustum,
+                filament::math::float4 const* b,
+                size_t count) noexcept;
+
+        static bool isSupported(Isa isa) noexcept;
+        static const char* getName(Isa isa) noexcept;
     };
 };
 
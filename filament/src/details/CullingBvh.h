@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_CULLINGBVH_H
+#define TNT_FILAMENT_DETAILS_CULLINGBVH_H
+
+#include "details/Culler.h"
+
+#include <filament/Frustum.h>
+
+#include <math/vec3.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
+namespace filament {
+namespace details {
+
+/*
+ * A bounding volume hierarchy over an array of world-space AABBs, used to accept or reject
+ * whole groups of boxes against a frustum at once.
+ *
+ * The hierarchy only stores indices into the caller's AABB arrays, so it can be refit in place
+ * every frame as long as the number of boxes doesn't change. Only the leaves containing boxes
+ * that changed since the last update, and their ancestors, are refit. When the boxes move too
+ * much relative to when the hierarchy was built, it is rebuilt from scratch.
+ *
+ * The culling results are exactly the ones Culler::intersects() would produce for the same
+ * boxes, except for boxes straddling a frustum plane within floating-point precision.
+ */
+class CullingBvh {
+public:
+    // Below this many boxes, a linear Culler::intersects() pass is faster
+    static constexpr size_t MIN_BOX_COUNT = 4096;
+
+    // Maximum number of boxes per leaf
+    static constexpr size_t LEAF_SIZE = Culler::MODULO;
+
+    CullingBvh() noexcept;
+    ~CullingBvh() noexcept;
+
+    CullingBvh(CullingBvh const&) = delete;
+    CullingBvh& operator=(CullingBvh const&) = delete;
+
+    // Builds the hierarchy from scratch
+    void build(filament::math::float3 const* center, filament::math::float3 const* extent,
+            size_t count);
+
+    // Refits the hierarchy to the new bounds of the boxes, rebuilds it if the number of boxes
+    // changed or if the refit hierarchy became too loose.
+    void update(filament::math::float3 const* center, filament::math::float3 const* extent,
+            size_t count);
+
+    // Releases all the memory used by the hierarchy
+    void clear() noexcept;
+
+    // Sets bit 'bit' of results[i] for each box i that intersects the frustum. Other bits are
+    // left untouched. The boxes must be the ones passed to the last build() or update().
+    void intersects(utils::JobSystem& js, Culler::result_type* results,
+            Frustum const& frustum,
+            filament::math::float3 const* center, filament::math::float3 const* extent,
+            size_t bit) const;
+
+    bool empty() const noexcept { return mNodes.empty(); }
+    size_t size() const noexcept { return mCount; }
+    size_t getNodeCount() const noexcept { return mNodes.size(); }
+
+private:
+    // Nodes are stored in depth-first order. The first child of an internal node immediately
+    // follows it, 'skip' is the index of the first node past its subtree; so for a leaf
+    // skip == index + 1.
+    struct Node {
+        filament::math::float3 min;
+        uint32_t skip;
+        filament::math::float3 max;
+        uint32_t leaf;              // leaves only: (first entry << 3) | (count - 1)
+    };
+
+    // refit bounds that grew by this ratio (in summed surface area) trigger a rebuild
+    static constexpr float REBUILD_RATIO = 2.0f;
+
+    uint32_t buildRecursive(uint32_t first, uint32_t count,
+            filament::math::float3 const* center, filament::math::float3 const* extent);
+
+    // recomputes the bounds of a leaf, returns true if they changed
+    bool refitLeaf(Node& node, filament::math::float3 const* center,
+            filament::math::float3 const* extent) noexcept;
+
+    static float area(Node const& node) noexcept;
+
+    std::vector<Node> mNodes;
+    std::vector<uint32_t> mIndices;                     // box indices, grouped by leaf
+    std::vector<uint32_t> mLeaves;                      // leaf node of each box
+    std::vector<filament::math::float3> mCenters;       // boxes as of the last update
+    std::vector<filament::math::float3> mExtents;
+    std::vector<uint8_t> mDirty;                        // refit scratch, one per node
+    size_t mCount = 0;
+    float mBuildArea = 0;
+    float mArea = 0;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_CULLINGBVH_H
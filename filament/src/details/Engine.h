@@ -109,7 +109,8 @@ public:
 
 public:
     static FEngine* create(Backend backend = Backend::DEFAULT,
-            Platform* platform = nullptr, void* sharedGLContext = nullptr);
+            Platform* platform = nullptr, void* sharedGLContext = nullptr,
+            utils::JobSystem* jobSystem = nullptr);
 
     ~FEngine() noexcept;
 
@@ -226,7 +227,8 @@ public:
     FSkybox* createSkybox(const Skybox::Builder& builder) noexcept;
     FStream* createStream(const Stream::Builder& builder) noexcept;
 
-    void createRenderable(const RenderableManager::Builder& builder, utils::Entity entity);
+    void createRenderables(const RenderableManager::Builder& builder,
+            utils::Entity const* entities, size_t count);
     void createLight(const LightManager::Builder& builder, utils::Entity entity);
 
     FRenderer* createRenderer() noexcept;
@@ -274,7 +276,8 @@ public:
     bool execute();
 
 private:
-    FEngine(Backend backend, Platform* platform, void* sharedGLContext);
+    FEngine(Backend backend, Platform* platform, void* sharedGLContext,
+            utils::JobSystem* jobSystem);
     void init();
 
     int loop();
@@ -302,6 +305,10 @@ private:
     PostProcessManager mPostProcessManager;
     RenderTargetPool mRenderTargetPool;
 
+    // must be initialized before the components
+    std::unique_ptr<utils::JobSystem> mOwnJobSystem;    // null when the JobSystem is shared
+    utils::JobSystem& mJobSystem;
+
     utils::EntityManager& mEntityManager;
     FRenderableManager mRenderableManager;
     FTransformManager mTransformManager;
@@ -345,8 +352,6 @@ private:
     LinearAllocatorArena mPerRenderPassAllocator;
     HeapAllocatorArena mHeapAllocator;
 
-    utils::JobSystem mJobSystem;
-
     Epoch mEngineEpoch;
 
     mutable FMaterial const* mDefaultMaterial = nullptr;
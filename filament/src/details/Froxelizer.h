@@ -31,7 +31,6 @@
 #include <private/filament/UibGenerator.h>
 
 #include <utils/compiler.h>
-#include <utils/bitset.h>
 #include <utils/Slice.h>
 
 #include <math/mat4.h>
@@ -55,8 +54,8 @@ public:
 };
 
 //
-// Light UBO           Froxel Record Buffer     per-froxel light list texture
-// {4 x float4}         R_U8  {index into        RG_U16 {offset, point-count, spot-sount}
+// Light texture       Froxel Record Buffer     per-froxel light list texture
+// {4 x float4}         R_U16 {index into       RG_U32 {offset, point-count | spot-count << 16}
 // (spot/point            light texture}
 //
 //  +----+                     +-+                     +----+
@@ -69,11 +68,11 @@ public:
 //  :    :                     | |                     |    |
 //  :    :                     | |                     |    |
 //  :    :                     +-+                     |    |
-//  :    :                  65536 max                  +----+
+//  :    :                 16K to 256K                 +----+
 //  |....|                                          h = num froxels
 //  |....|
 //  +----+
-// 256 lights max
+// 4096 lights max
 //
 
 // Max number of froxels limited by:
@@ -81,10 +80,13 @@ public:
 // - chosen texture width [64]
 // - size of CPU-side indices [16 bits]
 // Also, increasing the number of froxels adds more pressure on the "record buffer" which stores
-// the light indices per froxel. The record buffer is limited to 65536 entries, so with
-// 8192 froxels, we can store 8 lights per froxels assuming they're all used. In practice, some
-// froxels are not used, so we can store more.
+// the light indices per froxel, and on the CPU time spent froxelizing. Mobile and web backends
+// keep a smaller grid.
+#if defined(ANDROID) || defined(IOS) || defined(__EMSCRIPTEN__)
 static constexpr size_t FROXEL_BUFFER_ENTRY_COUNT_MAX = 8192;
+#else
+static constexpr size_t FROXEL_BUFFER_ENTRY_COUNT_MAX = 16384;
+#endif
 
 class Froxelizer {
 public:
@@ -101,6 +103,10 @@ public:
 
     void setOptions(float zLightNear, float zLightFar) noexcept;
 
+    // Number of point and spot lights to froxelize, used to pick the froxel grid's layout.
+    // Takes effect at the next prepare().
+    void setLightCount(size_t lightCount) noexcept;
+
     /*
      * Allocate per-frame data structures for froxelization.
      *
@@ -123,9 +129,14 @@ public:
     size_t getFroxelCount() const noexcept { return mFroxelCount; }
 
     // update Records and Froxels texture with lights data. this is thread-safe.
+    // This does nothing if the camera, the froxels and the lights didn't change since the last
+    // call, and the following commit() doesn't upload anything either.
     void froxelizeLights(FEngine& engine, CameraInfo const& camera,
             const FScene::LightSoa& lightData) noexcept;
 
+    // true if the last froxelizeLights() did nothing, the froxel and record buffers are invalid
+    bool isFroxelizationSkipped() const noexcept { return mFroxelsUnchanged; }
+
     void updateUniforms(UniformBuffer& u) {
         u.setUniform(offsetof(PerViewUib, zParams), mParamsZ);
         u.setUniform(offsetof(PerViewUib, fParams), mParamsF.yz);
@@ -135,7 +146,8 @@ public:
     }
 
     // send froxel data to GPU
-    void commit(driver::DriverApi& driverApi);
+    // returns true if the record buffer was reallocated, i.e. getRecordBuffer() changed
+    bool commit(driver::DriverApi& driverApi);
 
 
     /*
@@ -143,35 +155,25 @@ public:
      */
 
     struct FroxelEntry {
-        union {
-            uint32_t u32;
-            struct {
-                uint16_t offset = 0;
-                union {
-                    uint8_t count[2] = { 0, 0 };
-                    struct {
-                        uint8_t pointLightCount;
-                        uint8_t spotLightCount;
-                    };
-                };
-            };
-        };
+        uint32_t offset = 0;
+        uint16_t pointLightCount = 0;
+        uint16_t spotLightCount = 0;
     };
-    // This depends on the maximum number of lights (currently 255),and can't be more than 16 bits.
-    static_assert(CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<uint16_t>::max(), "can't have more than 65536 lights");
+    // This depends on the maximum number of lights (currently 4096), and can't be more than
+    // 15 bits because the light index is packed with the froxel index and light type (see LightHit).
+    static_assert(CONFIG_MAX_LIGHT_INDEX < 0x8000, "can't have more than 32768 lights");
     using RecordBufferType = std::conditional_t<CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<uint8_t>::max(), uint8_t, uint16_t>;
     const utils::Slice<FroxelEntry>& getFroxelBufferUser() const { return mFroxelBufferUser; }
     const utils::Slice<RecordBufferType>& getRecordBufferUser() const { return mRecordBufferUser; }
 
-    // this is chosen so froxelizePointAndSpotLight() vectorizes 4 froxel tests / spotlight
-    // with 256 lights this implies 8 jobs (256 / 32) for froxelization.
-    using LightGroupType = uint32_t;
-
 private:
-    struct LightRecord {
-        using bitset = utils::bitset<uint64_t, (CONFIG_MAX_LIGHT_COUNT + 63) / 64>;
-        bitset lights;
-    };
+    // number of jobs used for froxelization, job j processes the lights j, j + count, etc...
+    static constexpr size_t FROXELIZE_JOB_COUNT = 8;
+
+    // A froxel a light intersects: the froxel index in the low 16 bits, the light index above
+    // it, and the top bit set for spot lights.
+    using LightHit = uint32_t;
+    static constexpr LightHit LIGHT_HIT_SPOT_BIT = 0x80000000u;
 
     struct LightParams {
         filament::math::float3 position;
@@ -195,20 +197,23 @@ private:
         uint16_t reserved;
     };
 
-    // The first entry always encodes the type of light, i.e. point/spot
-    using FroxelThreadData = std::array<LightGroupType, FROXEL_BUFFER_ENTRY_COUNT_MAX + 1>;
-
     void setViewport(Viewport const& viewport) noexcept;
     void setProjection(const filament::math::mat4f& projection, float near, float far) noexcept;
     bool update() noexcept;
 
-    void froxelizeLoop(FEngine& engine,
+    // gathers the lights' inputs of the froxelization, returns false if they didn't change
+    bool updateLightInputs(FEngine& engine,
             const CameraInfo& camera, const FScene::LightSoa& lightData) noexcept;
 
-    void froxelizeAssignRecordsCompress() noexcept;
+    void froxelizeLoop(utils::JobSystem& js, const CameraInfo& camera) noexcept;
+
+    void froxelizeAssignRecordsCompress(utils::JobSystem& js) noexcept;
 
-    void froxelizePointAndSpotLight(FroxelThreadData& froxelThread, size_t bit,
-            filament::math::mat4f const& projection, const LightParams& light) const noexcept;
+    // appends the froxels intersected by the light to hits, starting at hitCount, and returns
+    // the new hit count. hits grows as needed.
+    size_t froxelizePointAndSpotLight(std::vector<LightHit>& hits, size_t hitCount,
+            LightHit lightBits, filament::math::mat4f const& projection,
+            const LightParams& light) const noexcept;
 
     static void computeLightTree(LightTreeNode* lightTree,
             utils::Slice<RecordBufferType> const& lightList,
@@ -224,7 +229,7 @@ private:
 
     static void computeFroxelLayout(
             filament::math::uint2* dim, uint16_t* countX, uint16_t* countY, uint16_t* countZ,
-            Viewport const& viewport) noexcept;
+            Viewport const& viewport, bool fewLights) noexcept;
 
     // internal state dependant on the viewport and needed for froxelizing
     LinearAllocatorArena mArena;                    // ~256 KiB
@@ -232,14 +237,45 @@ private:
     float* mDistancesZ = nullptr;                   // max 2.1 MiB (actual: resolution dependant)
     filament::math::float4* mPlanesX = nullptr;
     filament::math::float4* mPlanesY = nullptr;
-    filament::math::float4* mBoundingSpheres = nullptr;
-
-    utils::Slice<FroxelThreadData> mFroxelShardedData;  // 256 KiB w/  256 lights
-    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  32 KiB w/ 8192 froxels
 
-    // max 32 KiB  (actual: resolution dependant)
-    utils::Slice<RecordBufferType> mRecordBufferUser;   //  64 KiB
-    utils::Slice<LightRecord> mLightRecords;            // 256 KiB w/ 256 lights
+    // froxels' bounding spheres, stored as SoA so that the spot light test vectorizes
+    struct BoundingSpheres {
+        float* x = nullptr;
+        float* y = nullptr;
+        float* z = nullptr;
+        float* r = nullptr;
+    };
+    BoundingSpheres mBoundingSpheres;
+
+    utils::Slice<FroxelEntry> mFroxelBufferUser;        // 128 KiB w/ 16384 froxels
+    utils::Slice<RecordBufferType> mRecordBufferUser;   // view of mRecords, valid after froxelization
+
+    // per-frame, the light list of each froxel in mFroxelLightLists
+    utils::Slice<FroxelEntry> mFroxelLists;             // 128 KiB w/ 16384 froxels
+    utils::Slice<uint32_t> mFroxelLightCounts;          //  64 KiB w/ 16384 froxels
+
+    // these grow as needed and are kept across frames
+    std::vector<LightHit> mLightHits[FROXELIZE_JOB_COUNT];  // max 512 KiB per job
+    size_t mLightHitCounts[FROXELIZE_JOB_COUNT] = {};
+    // point | spot << 16 light count of each froxel, per job
+    std::vector<uint32_t> mJobLightCounts[FROXELIZE_JOB_COUNT]; // 64 KiB per job w/ 16384 froxels
+    std::vector<RecordBufferType> mFroxelLightLists;    // max 2 MiB
+    std::vector<RecordBufferType> mRecords;             // max 512 KiB
+    size_t mRecordCount = 0;
+
+    // the lights as seen by the froxelization, which is skipped when these, the camera and the
+    // froxels are unchanged
+    struct LightInputs {
+        filament::math::float4 positionRadius;
+        filament::math::float3 direction;   // spot only
+        float cosSqr;                       // spot only
+        float invSin;                       // spot only
+    };
+    std::vector<LightInputs> mLightInputs;              // max 144 KiB
+    std::vector<LightInputs> mLastLightInputs;          // max 144 KiB
+    filament::math::mat4f mLastView;
+    bool mLastFroxelizationValid = false;   // mLastLightInputs and mLastView are valid
+    bool mFroxelsUnchanged = false;         // froxelizeLights() was skipped
 
     uint16_t mFroxelCountX = 0;
     uint16_t mFroxelCountY = 0;
@@ -263,6 +299,7 @@ private:
     float mNear = 0.0f;        // camera near
     float mZLightFar = FEngine::CONFIG_Z_LIGHT_FAR;
     float mZLightNear = FEngine::CONFIG_Z_LIGHT_NEAR;  // light near (first slice)
+    bool mFewLights = false;   // the grid trades z-slices for x-y resolution
 
     // track if we need to update our internal state before froxelizing
     uint8_t mDirtyFlags = 0;
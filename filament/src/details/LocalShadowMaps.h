@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_LOCALSHADOWMAPS_H
+#define TNT_FILAMENT_DETAILS_LOCALSHADOWMAPS_H
+
+#include "components/LightManager.h"
+
+#include "details/Camera.h"
+#include "details/Scene.h"
+#include "details/ShadowAtlasAllocator.h"
+#include "details/ShadowMapAtlas.h"
+
+#include "driver/DriverApiForward.h"
+
+#include <filament/EngineEnums.h>
+#include <filament/Frustum.h>
+#include <filament/Viewport.h>
+
+#include <utils/compiler.h>
+#include <utils/Entity.h>
+
+#include <math/mat4.h>
+
+#include <tsl/robin_map.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+class FEngine;
+
+/*
+ * The shadow maps of the point and spot lights of a view.
+ *
+ * All the shadow maps share an atlas of a fixed size: the most important lights, i.e. the
+ * biggest on screen, get a shadow map sized after their size on screen, the others don't cast
+ * shadows. A spot light has a single shadow map, a point light has one per face of a cube.
+ *
+ * The shadow maps stay in the atlas across frames, and only a few of them are rendered each
+ * frame: the new ones first, then the ones whose light moved, then the oldest ones. A light is
+ * shadowed once all its shadow maps are rendered, each shadow map is then sampled with the
+ * light camera it was rendered with.
+ */
+class UTILS_PRIVATE LocalShadowMaps {
+public:
+    // A shadow map to render this frame
+    struct Update {
+        CameraInfo camera;
+        Frustum frustum;
+        Viewport tile;      // area of the atlas to clear
+        Viewport viewport;  // area of the atlas to render, the tile minus its 1-texel border
+    };
+
+    explicit LocalShadowMaps(FEngine& engine) noexcept;
+    ~LocalShadowMaps() noexcept;
+
+    LocalShadowMaps(LocalShadowMaps const&) = delete;
+    LocalShadowMaps& operator=(LocalShadowMaps const&) = delete;
+
+    void terminate(driver::DriverApi& driver) noexcept;
+
+    // Call once per frame, after the lights are culled. Picks the shadow maps of the visible
+    // shadow-casting point and spot lights, and the ones to render this frame. The
+    // SHADOW_PARAMS of each shadowed light are set to { index of its first shadow map in
+    // getShadowMatrices(), normal bias scale }.
+    // Returns true if any light has shadow maps, even if they're not rendered yet.
+    bool prepare(driver::DriverApi& driver, FLightManager const& lcm,
+            FScene::LightSoa& lightData, CameraInfo const& camera,
+            Viewport const& viewport) noexcept;
+
+    // The shadow maps to render this frame. Valid after prepare().
+    std::vector<Update> const& getUpdates() const noexcept { return mUpdates; }
+
+    // CONFIG_MAX_LOCAL_SHADOW_MAPS transforms from world space to the shadow maps' texture
+    // coordinates. Valid after prepare().
+    filament::math::mat4f const* getShadowMatrices() const noexcept { return mShadowMatrices; }
+
+    ShadowMapAtlas const& getAtlas() const noexcept { return mAtlas; }
+
+private:
+    struct Face {
+        CameraInfo camera;
+        filament::math::mat4f lightFromWorld;
+        filament::math::mat4f renderedLightFromWorld;   // the one the shadow map was rendered with
+        Viewport tile;
+        uint32_t renderedFrame = 0;
+        bool rendered = false;
+    };
+
+    struct Record {
+        Face faces[6];
+        float normalBiasScale = 0.0f;
+        uint32_t frame = 0;             // last frame the light cast shadows
+        uint32_t requestedDimension = 0;
+        uint32_t dimension = 0;         // dimension of the allocated tiles, 0 if none
+        uint8_t faceCount = 0;
+    };
+
+    struct Candidate {
+        utils::Entity entity;
+        uint32_t index;                 // in the LightSoa
+        float importance;
+    };
+
+    void release(Record& record) noexcept;
+    void updateFaces(Record& record, FLightManager const& lcm,
+            FScene::LightSoa const& lightData, size_t index) noexcept;
+
+    ShadowMapAtlas mAtlas;
+    ShadowAtlasAllocator mAllocator;
+    tsl::robin_map<utils::Entity, Record> mRecords;
+    std::vector<Candidate> mCandidates;
+    std::vector<Update> mUpdates;
+    std::vector<std::pair<uint64_t, Face*>> mStaleFaces;
+    filament::math::mat4f mShadowMatrices[CONFIG_MAX_LOCAL_SHADOW_MAPS];
+    uint32_t mFrame = 0;
+    const bool mClipSpaceFlipped;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_LOCALSHADOWMAPS_H
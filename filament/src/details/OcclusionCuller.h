@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_OCCLUSIONCULLER_H
+#define TNT_FILAMENT_DETAILS_OCCLUSIONCULLER_H
+
+#include "details/Culler.h"
+
+#include <filament/Box.h>
+
+#include <math/mat4.h>
+#include <math/vec3.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
+namespace filament {
+namespace details {
+
+/*
+ * A software occlusion culler.
+ *
+ * Occluders are boxes entirely enclosed by the geometry of a renderable (e.g. the inside of a
+ * wall). Their silhouettes are rasterized on the CPU into a small depth buffer, which is then
+ * reduced into a hierarchical depth buffer of TILE_SIZE x TILE_SIZE tiles storing the farthest
+ * depth of each tile. A box is occluded if it's behind the farthest depth of all the tiles
+ * (or pixels, for small boxes) it covers.
+ *
+ * Rasterization is conservative: a pixel is only covered if the occluder covers it entirely,
+ * and its depth is the farthest depth of the occluder within the pixel. So a box is never
+ * reported as occluded if any part of it could be visible.
+ *
+ * Depths are NDC z values (smaller is closer), which interpolate linearly in screen space for
+ * both perspective and orthographic projections.
+ */
+class OcclusionCuller {
+public:
+    // dimensions of the depth buffer in pixels
+    static constexpr size_t WIDTH = 256;
+    static constexpr size_t HEIGHT = 128;
+
+    // dimension of the hierarchical depth buffer tiles in pixels
+    static constexpr size_t TILE_SIZE = 8;
+
+    OcclusionCuller() noexcept;
+    ~OcclusionCuller() noexcept;
+
+    OcclusionCuller(OcclusionCuller const&) = delete;
+    OcclusionCuller& operator=(OcclusionCuller const&) = delete;
+
+    // Removes all occluders and sets the projection used for the following operations
+    void begin(filament::math::mat4f const& clipFromWorld) noexcept;
+
+    // Adds an occluder, 'box' is in the space defined by 'worldTransform'. Occluders crossing
+    // the near plane are ignored.
+    void addOccluder(filament::math::mat4f const& worldTransform, Box const& box);
+
+    // Rasterizes all occluders added since begin()
+    void rasterize(utils::JobSystem& js) noexcept;
+
+    // Clears bit 'bit' of results[i] for each box i that has bit 'testBit' set and is occluded.
+    void cull(utils::JobSystem& js, Culler::result_type* results,
+            filament::math::float3 const* center, filament::math::float3 const* extent,
+            size_t count, size_t testBit, size_t bit) const noexcept;
+
+    // Returns whether a world-space box is occluded
+    bool isOccluded(filament::math::float3 const& center,
+            filament::math::float3 const& extent) const noexcept;
+
+    // Depth at pixel (x, y), +infinity if no occluder entirely covers this pixel
+    float getDepthAt(size_t x, size_t y) const noexcept { return mDepth[y * WIDTH + x]; }
+
+    bool empty() const noexcept { return mPolygons.empty(); }
+
+private:
+    // a box's silhouette is a convex polygon with at most 6 edges
+    static constexpr size_t MAX_EDGES = 8;
+
+    // at most 3 faces of a box are facing the camera
+    static constexpr size_t MAX_PLANES = 3;
+
+    // boxes covering up to this many pixels are tested against the full resolution depth
+    static constexpr size_t MAX_PIXEL_TEST_COUNT = 256;
+
+    // rows rasterized by a single job, a multiple of TILE_SIZE
+    static constexpr size_t BAND_HEIGHT = 16;
+
+    static constexpr size_t TILE_COUNT_X = WIDTH / TILE_SIZE;
+    static constexpr size_t TILE_COUNT_Y = HEIGHT / TILE_SIZE;
+
+    struct Polygon {
+        float xmin, xmax, ymin, ymax;           // pixel bounds
+        uint32_t edgeCount;
+        // edges are inside when a * x + b * y + c >= 0, 'c' is moved inward by half a pixel
+        filament::math::float3 edges[MAX_EDGES];
+        // depth of the front faces' planes is a * x + b * y + c, 'c' is moved backward by
+        // half a pixel. The front surface of a convex shape is the farthest of these.
+        filament::math::float3 planes[MAX_PLANES];
+    };
+
+    void rasterizeBand(size_t first, size_t last) noexcept;
+
+    filament::math::mat4f mClipFromWorld;
+    std::vector<Polygon> mPolygons;
+    std::vector<float> mDepth;                  // WIDTH x HEIGHT
+    std::vector<float> mTiles;                  // TILE_COUNT_X x TILE_COUNT_Y
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_OCCLUSIONCULLER_H
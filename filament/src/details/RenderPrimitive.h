@@ -20,6 +20,7 @@
 #include "components/RenderableManager.h"
 
 #include "details/MaterialInstance.h"
+#include "details/RenderPrimitiveCache.h"
 
 #include "driver/Handle.h"
 
@@ -37,7 +38,7 @@ class FRenderPrimitive {
 public:
     FRenderPrimitive() noexcept = default;
 
-    void init(driver::DriverApi& driver, const RenderableManager::Builder::Entry& entry) noexcept;
+    void init(FEngine& engine, const RenderableManager::Builder::Entry& entry) noexcept;
 
     void set(FEngine& engine, RenderableManager::PrimitiveType type,
             FVertexBuffer* vertices, FIndexBuffer* indices, size_t offset,
@@ -50,9 +51,16 @@ public:
     void terminate(FEngine& engine);
 
     const FMaterialInstance* getMaterialInstance() const noexcept { return mMaterialInstance; }
+    // render primitives with the same geometry share the same handle
     Handle<HwRenderPrimitive> getHwHandle() const noexcept { return mHandle; }
-    driver::PrimitiveType getPrimitiveType() const noexcept { return mPrimitiveType; }
-    AttributeBitset getEnabledAttributes() const noexcept { return mEnabledAttributes; }
+    driver::PrimitiveType getPrimitiveType() const noexcept {
+        return driver::PrimitiveType(mGeometry.type);
+    }
+    AttributeBitset getEnabledAttributes() const noexcept {
+        AttributeBitset enabledAttributes;
+        enabledAttributes.setValue(mGeometry.enabledAttributes);
+        return enabledAttributes;
+    }
     uint16_t getBlendOrder() const noexcept { return mBlendOrder; }
 
     void setMaterialInstance(FMaterialInstance const* mi) noexcept { mMaterialInstance = mi; }
@@ -61,10 +69,11 @@ public:
     }
 
 private:
+    void setGeometry(FEngine& engine, RenderPrimitiveCache::Key const& geometry) noexcept;
+
     FMaterialInstance const* mMaterialInstance = nullptr;
     Handle<HwRenderPrimitive> mHandle;
-    driver::PrimitiveType mPrimitiveType = driver::PrimitiveType::NONE;
-    AttributeBitset mEnabledAttributes;
+    RenderPrimitiveCache::Key mGeometry;
     uint16_t mBlendOrder = 0;
 };
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_RENDERPRIMITIVECACHE_H
+#define TNT_FILAMENT_DETAILS_RENDERPRIMITIVECACHE_H
+
+#include "driver/DriverApiForward.h"
+#include "driver/Handle.h"
+
+#include <filament/driver/DriverEnums.h>
+
+#include <utils/compiler.h>
+#include <utils/Hash.h>
+
+#include <tsl/robin_map.h>
+
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+/*
+ * Render primitives drawing the same geometry (same buffers, attributes and range) share the
+ * same HwRenderPrimitive, this is what allows RenderPass to batch them into instanced draw calls.
+ *
+ * Handles are reference counted, the HwRenderPrimitive is destroyed when the last user releases
+ * it. A shared HwRenderPrimitive must never be modified, instead users acquire the handle
+ * matching their new geometry and release the old one.
+ */
+class UTILS_PRIVATE RenderPrimitiveCache {
+public:
+    struct Key {
+        Handle<HwVertexBuffer> vertexBuffer;    // null if there is no geometry
+        Handle<HwIndexBuffer> indexBuffer;
+        uint32_t enabledAttributes = 0;
+        uint32_t type = uint32_t(driver::PrimitiveType::NONE);
+        uint32_t offset = 0;
+        uint32_t minIndex = 0;
+        uint32_t maxIndex = 0;
+        uint32_t count = 0;
+    };
+
+    RenderPrimitiveCache() noexcept;
+    ~RenderPrimitiveCache() noexcept;
+
+    RenderPrimitiveCache(RenderPrimitiveCache const&) = delete;
+    RenderPrimitiveCache& operator=(RenderPrimitiveCache const&) = delete;
+
+    // Returns the HwRenderPrimitive for this geometry, creating it if needed. Each call must be
+    // balanced by a call to release().
+    Handle<HwRenderPrimitive> acquire(driver::DriverApi& driver, Key const& key);
+
+    void release(driver::DriverApi& driver, Key const& key) noexcept;
+
+    bool empty() const noexcept { return mEntries.empty(); }
+
+private:
+    struct KeyEqualFn {
+        bool operator()(Key const& lhs, Key const& rhs) const noexcept;
+    };
+
+    struct Entry {
+        Handle<HwRenderPrimitive> handle;
+        uint32_t refs;
+    };
+
+    tsl::robin_map<Key, Entry, utils::hash::MurmurHashFn<Key>, KeyEqualFn> mEntries;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_RENDERPRIMITIVECACHE_H
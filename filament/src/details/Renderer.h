@@ -46,7 +46,7 @@ namespace details {
 
 class FEngine;
 class FView;
-class ShadowMap;
+class ShadowMapAtlas;
 
 /*
  * A concrete implementation of the Renderer Interface.
@@ -80,9 +80,15 @@ public:
     // Clean-up everything, this is typically called when the client calls Engine::destroyRenderer()
     void terminate(FEngine& engine);
 
+    // largest number of commands needed by a single render pass so far
+    size_t getCommandsHighWatermark() const noexcept {
+        return mCommands.getHighWatermark();
+    }
+
 private:
     friend class Renderer;
     using Command = RenderPass::Command;
+    using CommandArena = RenderPass::CommandArena;
 
     // this class is defined in RenderPass.cpp
     class ColorPass final : public RenderPass {
@@ -100,33 +106,34 @@ private:
                 utils::JobSystem& js, utils::JobSystem::Job* sync,
                 Handle<HwRenderTarget> rth,
                 FView& view, Viewport const& scaledViewport,
-                utils::GrowingSlice<Command>& commands) noexcept;
+                CommandArena& commands) noexcept;
     };
 
     // this class is defined in RenderPass.cpp
     class ShadowPass final : public RenderPass {
         using DriverApi = driver::DriverApi;
-        ShadowMap const& shadowMap;
+        ShadowMapAtlas const& atlas;
+        bool const clear;   // only the first shadow map rendered in the atlas clears it
+        Viewport const tile;    // if not empty, only this tile of the atlas is cleared
         void beginRenderPass(driver::DriverApi& driver, Viewport const& viewport, const CameraInfo& camera) noexcept override;
         void endRenderPass(DriverApi& driver, Viewport const& viewport) noexcept override;
     public:
-        ShadowPass(const char* name, ShadowMap const& shadowMap) noexcept;
+        ShadowPass(const char* name, ShadowMapAtlas const& atlas, bool clear) noexcept;
+        ShadowPass(const char* name, ShadowMapAtlas const& atlas, Viewport const& tile) noexcept;
         static void renderShadowMap(FEngine& engine, utils::JobSystem& js,
-                FView& view, utils::GrowingSlice<Command>& commands) noexcept;
+                FView& view, CommandArena& commands) noexcept;
+    private:
+        // renders the shadow casters of each cascade in the atlas
+        static void renderCascades(FEngine& engine, utils::JobSystem& js,
+                FView& view, CommandArena& commands, ShadowMapAtlas const& atlas,
+                RenderFlags flags) noexcept;
+        // renders the shadow maps of the point and spot lights that are out of date
+        static void renderLocalShadowMaps(FEngine& engine, utils::JobSystem& js,
+                FView& view, CommandArena& commands, RenderFlags flags) noexcept;
     };
 
     Handle<HwRenderTarget> getRenderTarget() const noexcept { return mRenderTarget; }
 
-    void recordHighWatermark(utils::Slice<Command> const& commands) noexcept {
-#ifndef NDEBUG
-        mCommandsHighWatermark = std::max(mCommandsHighWatermark, size_t(commands.size()));
-#endif
-    }
-
-    size_t getCommandsHighWatermark() const noexcept {
-        return mCommandsHighWatermark * sizeof(RenderPass::Command);
-    }
-
     driver::TextureFormat getHdrFormat(const View& view) const noexcept;
     driver::TextureFormat getLdrFormat() const noexcept;
 
@@ -144,7 +151,6 @@ private:
     FrameSkipper mFrameSkipper;
     Handle<HwRenderTarget> mRenderTarget;
     FSwapChain* mSwapChain = nullptr;
-    size_t mCommandsHighWatermark = 0;
     uint32_t mFrameId = 0;
     FrameInfoManager mFrameInfoManager;
     bool mIsRGB16FSupported : 1;
@@ -155,6 +161,9 @@ private:
     // per-frame arena for this Renderer
     LinearAllocatorArena& mPerRenderPassArena;
 
+    // high-level draw commands, reused by all passes and across frames
+    CommandArena mCommands;
+
 #if EXTRA_TIMING_INFO
     Series<float> mRendering;
     Series<float> mPostProcess;
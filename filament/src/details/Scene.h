@@ -18,27 +18,40 @@
 #define TNT_FILAMENT_DETAILS_SCENE_H
 
 #include "upcast.h"
+#include "AffineTransform.h"
+#include "components/ChangeLog.h"
 #include "components/LightManager.h"
 #include "components/RenderableManager.h"
 #include "components/TransformManager.h"
 
 #include "details/Culler.h"
+#include "details/CullingBvh.h"
 
 #include "Allocators.h"
 
 #include <filament/Box.h>
+#include <filament/EngineEnums.h>
 #include <filament/Scene.h>
 
 #include <utils/compiler.h>
 #include <utils/Entity.h>
+#include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
+#include <utils/Mutex.h>
 #include <utils/Slice.h>
 #include <utils/StructureOfArrays.h>
 #include <utils/Range.h>
 
 #include <cstddef>
+#include <tsl/robin_map.h>
 #include <tsl/robin_set.h>
 
+#include <vector>
+
 namespace filament {
+
+class GPUBuffer;
+
 namespace details {
 
 struct CameraInfo;
@@ -80,8 +93,14 @@ public:
     ~FScene() noexcept;
     void terminate(FEngine& engine);
 
-    void prepare(const filament::math::mat4f& worldOriginTransform);
-    void prepareDynamicLights(const CameraInfo& camera, ArenaScope& arena, Handle<HwUniformBuffer> lightUbh) noexcept;
+    // Gathers this frame's renderables and lights, returns once their data is ready.
+    // 'renderablesReady' and 'lightsReady', if not null, are jobs created but not run yet: they
+    // are run as soon as the renderables (and their culling hierarchy) or the lights are ready,
+    // possibly before prepare() returns. They must be retained to be waited on.
+    void prepare(const filament::math::mat4f& worldOriginTransform,
+            utils::JobSystem::Job* renderablesReady = nullptr,
+            utils::JobSystem::Job* lightsReady = nullptr);
+    void prepareDynamicLights(const CameraInfo& camera, ArenaScope& arena, GPUBuffer& lightBuffer) noexcept;
     void computeBounds(Aabb& castersBox, Aabb& receiversBox, uint32_t visibleLayers) const noexcept;
 
 
@@ -95,9 +114,10 @@ public:
 
     enum {
         RENDERABLE_INSTANCE,    //  4 instance of the Renderable component
-        WORLD_TRANSFORM,        // 16 instance of the Transform component
+        WORLD_TRANSFORM,        // 48 affine world transform of the renderable
         VISIBILITY_STATE,       //  1 visibility data of the component
         BONES_UBH,              //  4 bones uniform buffer handle
+        UBO_SLOT,               //  4 index of the renderable's uniforms in the renderable UBO
         WORLD_AABB_CENTER,      // 12 world-space bounding box center of the renderable
         VISIBLE_MASK,           //  1 each bit represents a visibility in a pass
 
@@ -112,9 +132,10 @@ public:
 
     using RenderableSoa = utils::StructureOfArrays<
             utils::EntityInstance<RenderableManager>,
-            filament::math::mat4f,
+            AffineTransform,
             FRenderableManager::Visibility,
             Handle<HwUniformBuffer>,
+            uint32_t,
             filament::math::float3,
             Culler::result_type,
             uint8_t,
@@ -126,6 +147,10 @@ public:
     RenderableSoa const& getRenderableData() const noexcept { return mRenderableData; }
     RenderableSoa& getRenderableData() noexcept { return mRenderableData; }
 
+    // Hierarchy over the renderables' world AABB, empty when the scene is too small to need it.
+    // Indices match mRenderableData until it's partitioned by the View.
+    CullingBvh const& getCullingBvh() const noexcept { return mCullingBvh; }
+
     static inline uint32_t getPrimitiveCount(RenderableSoa const& soa,
             uint32_t first, uint32_t last) noexcept {
         // the caller must guarantee that last is dereferenceable
@@ -147,7 +172,8 @@ public:
         DIRECTION,
         LIGHT_INSTANCE,
         VISIBILITY,
-        SCREEN_SPACE_Z_RANGE
+        SCREEN_SPACE_Z_RANGE,
+        SHADOW_PARAMS
     };
 
     using LightSoa = utils::StructureOfArrays<
@@ -155,21 +181,83 @@ public:
             filament::math::float3,
             FLightManager::Instance,
             Culler::result_type,
-            filament::math::float2
+            filament::math::float2,
+            filament::math::float2  // { shadow map index or -1, normal bias scale }
     >;
 
     LightSoa const& getLightData() const noexcept { return mLightData; }
     LightSoa& getLightData() noexcept { return mLightData; }
 
-    void updateUBOs(utils::Range<uint32_t> visibleRenderables, Handle<HwUniformBuffer> renderableUbh) noexcept;
+    /*
+     * The per-renderable uniforms of each renderable are stored at index UBO_SLOT of the
+     * renderable UBO, which doesn't change as long as the renderable stays in the scene.
+     */
+
+    // Number of PerRenderableUib the renderable UBO must hold. Bound ranges always cover a
+    // whole ObjectUniforms block (CONFIG_MAX_INSTANCES PerRenderableUib), even for a single
+    // renderable, so there must be room for that many past the last slot.
+    size_t getRenderableUboCount() const noexcept {
+        return mRenderableCache.size() + CONFIG_MAX_INSTANCES - 1;
+    }
+
+    // Uploads the per-renderable uniforms that changed since 'version' into renderableUbh,
+    // which must have been created with BufferUsage::DYNAMIC. A version of 0 uploads all of
+    // them. Returns the version to pass next time.
+    uint64_t updateUBOs(Handle<HwUniformBuffer> renderableUbh, uint64_t version) noexcept;
+
+    // The PerRenderableUib of each slot, i.e. what updateUBOs() uploads. These are up-to-date
+    // as soon as prepare() returns.
+    void const* getRenderableUniforms() const noexcept { return mRenderableUniforms.data(); }
+
+    // Changes each time a static shadow caster is added, removed or modified, the shadow maps
+    // cached from the static shadow casters are only valid as long as it doesn't.
+    uint64_t getStaticShadowCastersVersion() const noexcept { return mStaticShadowCastersVersion; }
 
 private:
+    // Writes the PerRenderableUib of a renderable with the world transform 'model' at byte
+    // 'offset' of 'buffer'
+    static void writeRenderableUniforms(void* buffer, size_t offset,
+            AffineTransform const& model) noexcept;
+
     static inline void computeLightRanges(filament::math::float2* zrange,
             CameraInfo const& camera, const filament::math::float4* spheres, size_t count) noexcept;
 
     static inline void computeLightCameraPlaneDistances(float* distances,
             const CameraInfo& camera, const filament::math::float4* spheres, size_t count) noexcept;
 
+    // adds or removes an entity from the scene's renderables and lights, as needed
+    void updateEntity(utils::Entity e) noexcept;
+
+    // recomputes the scene's renderables and lights from scratch
+    void updateAllEntities(utils::JobSystem& js);
+
+    // computes the cached data of the renderables in the given slots, all of them if null
+    void updateRenderables(utils::JobSystem& js, uint32_t const* slots, size_t count);
+
+    // copies the cached renderables into the per-frame renderable data
+    void prepareRenderables(utils::JobSystem& js);
+
+    void prepareLights(utils::JobSystem& js);
+
+    // refits or rebuilds the culling hierarchy over the per-frame renderable data
+    void updateCullingBvh();
+
+    void rebuildSlots() noexcept;
+
+    // Records the destroyed entities, these can be destroyed from any thread.
+    class DestroyedEntities : public utils::EntityManager::Listener {
+    public:
+        void onEntitiesDestroyed(size_t n, utils::Entity const* entities) noexcept override;
+        void onAllEntitiesDestroyed() noexcept override;
+        // moves the entities destroyed since last time into 'entities', returns false if
+        // all entities were destroyed.
+        bool retrieve(std::vector<utils::Entity>& entities) noexcept;
+    private:
+        utils::Mutex mLock;
+        std::vector<utils::Entity> mEntities;
+        bool mAllDestroyed = false;
+    };
+
     FEngine& mEngine;
     FSkybox const* mSkybox = nullptr;
     FIndirectLight const* mIndirectLight = nullptr;
@@ -181,6 +269,42 @@ private:
      */
     tsl::robin_set<utils::Entity> mEntities;
 
+    /*
+     * Renderables and lights of the scene, updated incrementally by prepare() from the
+     * managers' ChangeLogs. Renderables keep the same slot in mRenderableCache until they're
+     * removed (the last one then takes its place), so that they're gathered in the same order
+     * every frame. The slot maps are only rebuilt when an incremental update needs them.
+     */
+    RenderableSoa mRenderableCache;                                 // per-frame columns unused
+    std::vector<utils::Entity> mRenderableEntities;                 // entity of each slot
+    std::vector<utils::Entity> mLightEntities;
+    tsl::robin_map<utils::Entity, uint32_t> mRenderableSlots;       // slot of each entity
+    tsl::robin_map<utils::Entity, uint32_t> mLightSlots;
+    bool mSlotsValid = false;
+    std::vector<utils::Entity> mDirtyEntities;                      // to update in prepare()
+    std::vector<uint64_t> mSlotVersions;            // version when a slot's uniforms changed
+    std::vector<uint8_t> mRenderableUniforms;       // PerRenderableUib of each slot
+    uint64_t mVersion = 0;                          // incremented by each prepare()
+    uint64_t mLastChangeVersion = 0;                // last version any slot's uniforms changed
+    uint64_t mStaticShadowCastersVersion = 0;       // last version a static shadow caster changed
+    DestroyedEntities mDestroyedEntities;
+    ChangeLog::Cursor mTransformCursor = 0;
+    ChangeLog::Cursor mRenderableCursor = 0;
+    ChangeLog::Cursor mLightCursor = 0;
+    filament::math::mat4f mWorldOriginTransform;
+
+    // scratch storage for prepare(), kept around to avoid allocations
+    std::vector<utils::Entity> mEntityList;
+    std::vector<uint8_t> mEntityFlags;
+    std::vector<uint32_t> mDirtySlots;
+    std::vector<FLightManager::Instance> mLightInstances;
+    struct LightChunk {
+        uint32_t offset;            // count of positional lights, then their offset
+        uint32_t directional;       // index of the brightest directional light, or ~0u
+        float intensity;            // intensity of that light
+    };
+    std::vector<LightChunk> mLightChunks;
+
 
     /*
      * The data below is valid only during a view pass. i.e. if a scene is used in multiple
@@ -190,6 +314,7 @@ private:
      */
     RenderableSoa mRenderableData;
     LightSoa mLightData;
+    CullingBvh mCullingBvh;
     Handle<HwUniformBuffer> mRenderableViewUbh; // This is actually owned by the view.
 };
 
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_SHADOWATLASALLOCATOR_H
+#define TNT_FILAMENT_DETAILS_SHADOWATLASALLOCATOR_H
+
+#include <filament/Viewport.h>
+
+#include <utils/compiler.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+/*
+ * Allocates square tiles of power-of-two dimensions in a square shadow atlas, whose area is the
+ * budget shared by all the shadow maps.
+ *
+ * This is a buddy allocator over a quadtree: a tile is either free, allocated, or split in four
+ * tiles of half its dimension. Allocations prefer the tiles that are already split, so that
+ * the large free tiles stay available. Tiles stay where they are until they're freed, which lets
+ * the shadow maps they hold be reused across frames.
+ */
+class UTILS_PRIVATE ShadowAtlasAllocator {
+public:
+    ShadowAtlasAllocator() noexcept;
+    ~ShadowAtlasAllocator() noexcept;
+
+    ShadowAtlasAllocator(ShadowAtlasAllocator const&) = delete;
+    ShadowAtlasAllocator& operator=(ShadowAtlasAllocator const&) = delete;
+
+    // Frees all the tiles and sets the dimension of the atlas and of its smallest tiles, both
+    // must be powers of two.
+    void init(uint32_t dimension, uint32_t minTileDimension) noexcept;
+
+    uint32_t getDimension() const noexcept { return mDimension; }
+    uint32_t getMinTileDimension() const noexcept { return mDimension >> mMaxLevel; }
+
+    // Allocates a tile of the given dimension, which must be a power of two between the
+    // smallest tile dimension and the atlas dimension. Returns an empty viewport if there is no
+    // room left.
+    Viewport allocate(uint32_t tileDimension) noexcept;
+
+    // Frees a tile returned by allocate()
+    void free(Viewport const& tile) noexcept;
+
+private:
+    enum class State : uint8_t { FREE, SPLIT, ALLOCATED };
+
+    // the nodes of a level are stored after the ones of the level above it, in Morton order
+    static constexpr size_t getLevelOffset(size_t level) noexcept {
+        return ((size_t(1) << (2 * level)) - 1) / 3;
+    }
+
+    size_t allocate(size_t node, size_t level, size_t targetLevel) noexcept;
+    Viewport getTile(size_t node, size_t level) const noexcept;
+
+    std::vector<State> mNodes;
+    uint32_t mDimension = 0;
+    uint8_t mMaxLevel = 0;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_SHADOWATLASALLOCATOR_H
@@ -22,9 +22,6 @@
 #include "details/Camera.h"
 #include "details/Scene.h"
 
-#include "driver/DriverApiForward.h"
-#include "driver/SamplerBuffer.h"
-
 #include <filament/Viewport.h>
 
 #include <math/mat4.h>
@@ -38,21 +35,24 @@ public:
     explicit ShadowMap(FEngine& engine) noexcept;
     ~ShadowMap();
 
-    void terminate(driver::DriverApi& driverApi) noexcept;
+    // Computes the distances from the camera of the boundaries of the directional light's
+    // shadow cascades, from zn to zf. Cascade i covers [splits[i], splits[i + 1]].
+    static void computeCascadeSplits(float* splits, size_t cascadeCount, float zn, float zf,
+            FLightManager::ShadowParams const& params) noexcept;
 
     // Call once per frame if the light, scene (or visible layers) or camera changes.
-    // This computes the light's camera.
+    // This computes the light's camera for the part of the camera's frustum between the
+    // distances zRange, rendered in the given tile of a shadow map atlas.
     void update(
-            const FScene::LightSoa& lightData, size_t index, FScene const* scene,
-            details::CameraInfo const& camera, uint8_t visibleLayers) noexcept;
+            const FScene::LightSoa& lightData, size_t index,
+            Aabb const& wsShadowCastersVolume, Aabb const& wsShadowReceiversVolume,
+            details::CameraInfo const& camera, filament::math::float2 zRange,
+            Viewport const& tile, uint32_t atlasDimension) noexcept;
 
     // Do we have visible shadows. Valid after calling update().
     bool hasVisibleShadows() const noexcept { return mHasVisibleShadows; }
 
-    // Allocates shadow texture based on user parameters (e.g. dimensions)
-    void prepare(driver::DriverApi& driver, SamplerBuffer& buffer) noexcept;
-
-    // Returns the shadow map's viewport. Valid after prepare().
+    // Returns the shadow map's viewport in the atlas. Valid after update().
     Viewport const& getViewport() const noexcept { return mViewport; }
 
     // Computes the transform to use in the shader to access the shadow map.
@@ -68,12 +68,14 @@ public:
     // Returns the light's projection. Valid after calling update().
     FCamera const& getCamera() const noexcept { return *mCamera; }
 
-    // Set-up the render target, call before rendering the shadow map.
-    void beginRenderPass(driver::DriverApi& driverApi) const noexcept;
-
     // use only for debugging
     FCamera const& getDebugCamera() const noexcept { return *mDebugCamera; }
 
+    // Returns the transform from clip-space to the texture coordinates of a shadow map rendered
+    // in the given tile of an atlas, minus its 1-texel border.
+    static filament::math::mat4f getTextureCoordsMapping(Viewport const& tile,
+            uint32_t atlasDimension, bool clipSpaceFlipped) noexcept;
+
 private:
     struct CameraInfo {
         filament::math::mat4f projection;
@@ -105,8 +107,9 @@ private:
     using FrustumBoxIntersection = std::array<filament::math::float3, 64>;
 
     void computeShadowCameraDirectional(
-            filament::math::float3 const& direction, FScene const* scene, CameraInfo const& camera,
-            uint8_t visibleLayers) noexcept;
+            filament::math::float3 const& direction,
+            Aabb const& wsShadowCastersVolume, Aabb const& wsShadowReceiversVolume,
+            CameraInfo const& camera) noexcept;
 
     static filament::math::mat4f applyLISPSM(
             CameraInfo const& camera, float dzn, float dzf, const filament::math::mat4f& LMpMv,
@@ -173,13 +176,11 @@ private:
     float mSceneRange = 0.0f;
     float mTexelSizeWs = 0.0f;
 
-    // set-up in prepare()
-    Viewport mViewport;
-    Handle<HwTexture> mShadowMapHandle;
-    Handle<HwRenderTarget> mShadowMapRenderTarget;
-
     // set-up in update()
+    Viewport mTile;
+    Viewport mViewport;
     uint32_t mShadowMapDimension = 0;
+    uint32_t mAtlasDimension = 0;
     bool mHasVisibleShadows = false;
 
     // use a member here (instead of stack) because we don't want to pay the
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_SHADOWMAPATLAS_H
+#define TNT_FILAMENT_DETAILS_SHADOWMAPATLAS_H
+
+#include "driver/DriverApiForward.h"
+#include "driver/Handle.h"
+
+#include <filament/Viewport.h>
+#include <filament/driver/DriverEnums.h>
+
+#include <utils/compiler.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+/*
+ * The depth texture all the shadow maps of a view are rendered into.
+ *
+ * The texture is a square grid of square tiles, one per shadow map. Each shadow map renders in
+ * its own tile, inset by a 1-texel border (see ShadowMap::getViewport()), so that sampling
+ * outside of a shadow map never reads its neighbours.
+ */
+class UTILS_PRIVATE ShadowMapAtlas {
+public:
+    ShadowMapAtlas() noexcept;
+    ~ShadowMapAtlas() noexcept;
+
+    ShadowMapAtlas(ShadowMapAtlas const&) = delete;
+    ShadowMapAtlas& operator=(ShadowMapAtlas const&) = delete;
+
+    void terminate(driver::DriverApi& driver) noexcept;
+
+    // Allocates the texture for 'tileCount' tiles of tileDimension x tileDimension texels,
+    // if needed. Returns true if a new texture was allocated, its content is undefined.
+    bool prepare(driver::DriverApi& driver, uint32_t tileDimension, size_t tileCount) noexcept;
+
+    // Returns the texture, to be sampled with getSamplerParams(). Valid after prepare().
+    Handle<HwTexture> getTexture() const noexcept { return mTexture; }
+
+    static driver::SamplerParams getSamplerParams() noexcept;
+
+    // Returns the dimension of the texture. Valid after prepare().
+    uint32_t getDimension() const noexcept { return mDimension; }
+
+    // Returns the area of the texture used by the given tile. Valid after prepare().
+    Viewport getTile(size_t index) const noexcept;
+
+    // Set-up the render target, call before rendering a shadow map. Only the first shadow map
+    // rendered in a frame should clear the texture, the others must keep its content.
+    void beginRenderPass(driver::DriverApi& driver, bool clear) const noexcept;
+
+    // Set-up the render target to render a shadow map in the given area of the texture, which
+    // is cleared while the rest of the texture keeps its content.
+    void beginTileRenderPass(driver::DriverApi& driver, Viewport const& tile) const noexcept;
+
+private:
+    Handle<HwTexture> mTexture;
+    Handle<HwRenderTarget> mRenderTarget;
+    uint32_t mDimension = 0;
+    uint32_t mTileDimension = 0;
+    uint32_t mColumns = 0;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_SHADOWMAPATLAS_H
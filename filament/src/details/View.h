@@ -26,7 +26,10 @@
 #include "details/Allocators.h"
 #include "details/Camera.h"
 #include "details/Froxelizer.h"
+#include "details/LocalShadowMaps.h"
+#include "details/OcclusionCuller.h"
 #include "details/ShadowMap.h"
+#include "details/ShadowMapAtlas.h"
 #include "details/Scene.h"
 
 #include "driver/DriverApi.h"
@@ -39,6 +42,8 @@
 #include <utils/Range.h>
 
 #include <array>
+#include <memory>
+#include <vector>
 
 namespace utils {
 class JobSystem;
@@ -64,7 +69,11 @@ public:
     void prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& arena,
             Viewport const& viewport, filament::math::float4 const& userTime) noexcept;
 
-    void setScene(FScene* scene) { mScene = scene; }
+    void setScene(FScene* scene) {
+        mScene = scene;
+        // the renderable UBO's content belongs to the previous scene
+        mRenderableUboVersion = 0;
+    }
     FScene const* getScene() const noexcept { return mScene; }
     FScene* getScene() noexcept { return mScene; }
 
@@ -99,6 +108,9 @@ public:
     void setFrustumCullingEnabled(bool culling) noexcept { mCulling = culling; }
     bool isFrustumCullingEnabled() const noexcept { return mCulling; }
 
+    void setOcclusionCullingEnabled(bool enabled) noexcept { mOcclusionCulling = enabled; }
+    bool isOcclusionCullingEnabled() const noexcept { return mOcclusionCulling; }
+
     void setFrontFaceWindingInverted(bool inverted) noexcept { mFrontFaceWindingInverted = inverted; }
     bool isFrontFaceWindingInverted() const noexcept { return mFrontFaceWindingInverted; }
 
@@ -128,18 +140,59 @@ public:
 
     bool hasDirectionalLight() const noexcept { return mHasDirectionalLight; }
     bool hasDynamicLighting() const noexcept { return mHasDynamicLighting; }
-    bool hasShadowing() const noexcept { return mHasShadowing & mDirectionalShadowMap.hasVisibleShadows(); }
-
+    bool hasShadowing() const noexcept { return mHasShadowing; }
+    bool hasDirectionalShadowing() const noexcept { return mHasDirectionalShadowing; }
+
+    // passes selecting levels of detail, each keeps its own state for the hysteresis
+    enum LodPass : uint8_t {
+        LOD_COLOR_PASS,
+        LOD_SHADOW_PASS,    // one per shadow cascade
+        LOD_LOCAL_SHADOW_PASS = LOD_SHADOW_PASS + CONFIG_MAX_SHADOW_CASCADES,
+        LOD_PASS_COUNT
+    };
+
+    // Sets the PRIMITIVES of the renderables in 'visible' to the level of detail matching their
+    // size on screen, as seen by 'camera'.
     void updatePrimitivesLod(
             FEngine& engine, const CameraInfo& camera,
-            FScene::RenderableSoa& renderableData, Range visible) noexcept;
+            FScene::RenderableSoa& renderableData, Range visible, LodPass pass) noexcept;
 
     void setShadowsEnabled(bool enabled) noexcept { mShadowingEnabled = enabled; }
 
-    ShadowMap const& getShadowMap() const { return mDirectionalShadowMap; }
+    // number of cascades of the directional light's shadow map, valid after prepare()
+    size_t getShadowCascadeCount() const noexcept { return mShadowCascadeCount; }
+
+    ShadowMap const& getShadowMap(size_t cascade) const {
+        assert(cascade < mShadowCascadeCount);
+        return *mShadowMaps[cascade];
+    }
+
+    ShadowMapAtlas const& getShadowMapAtlas() const noexcept { return mShadowMapAtlas; }
+
+    // The static shadow casters are rendered in their own atlas, cached across frames. When it's
+    // in use, getShadowMapAtlas() only holds the dynamic shadow casters. Valid after prepare().
+    bool hasStaticShadowMap() const noexcept { return mStaticShadowMap.enabled; }
+    bool isStaticShadowMapDirty() const noexcept { return mStaticShadowMap.dirty; }
+    ShadowMapAtlas const& getStaticShadowMapAtlas() const noexcept {
+        return mStaticShadowMap.atlas;
+    }
+
+    // The shadow maps of the point and spot lights, rendered in their own atlas. Valid after
+    // prepare().
+    LocalShadowMaps const& getLocalShadowMaps() const noexcept { return mLocalShadowMaps; }
+
+    // Culls the visible shadow casters with the light camera of a shadow map of a point or spot
+    // light, returns the VISIBLE_MASK bit of the shadow casters it sees.
+    Culler::result_type cullLocalShadowCasters(LocalShadowMaps::Update const& update) noexcept;
+
+    // VISIBLE_MASK bit of the visible renderables
+    static Culler::result_type getRenderableVisibilityMask() noexcept;
+
+    // VISIBLE_MASK bit of the shadow casters of the given cascade
+    static Culler::result_type getShadowCascadeVisibilityMask(size_t cascade) noexcept;
 
     FCamera const* getDirectionalLightCamera() const noexcept {
-        return &mDirectionalShadowMap.getDebugCamera();
+        return &mShadowMaps[0]->getDebugCamera();
     }
 
     void setRenderTarget(TargetBufferFlags discard) noexcept {
@@ -221,17 +274,30 @@ private:
     static constexpr size_t MAX_FRAMETIME_HISTORY = 32u;
 
     void prepareVisibleRenderables(utils::JobSystem& js,
-            Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept;
+            Frustum const& frustum, FScene::RenderableSoa& renderableData,
+            CullingBvh const& bvh) const noexcept;
 
-    static void prepareVisibleShadowCasters(utils::JobSystem& js,
-            Frustum const& lightFrustum, FScene::RenderableSoa& renderableData) noexcept;
+    void prepareOcclusionCulling(FEngine& engine, utils::JobSystem& js,
+            filament::math::mat4f const& clipFromWorld,
+            FScene::RenderableSoa& renderableData) noexcept;
+
+    void prepareVisibleShadowCasters(utils::JobSystem& js,
+            FScene::RenderableSoa& renderableData, CullingBvh const& bvh) noexcept;
+
+    void prepareStaticShadowMap(driver::DriverApi& driver,
+            FScene::RenderableSoa const& renderableData, uint32_t tileDimension) noexcept;
+
+    void prepareLocalShadowing(FEngine& engine, driver::DriverApi& driver,
+            FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData,
+            Viewport const& viewport) noexcept;
 
     static void prepareVisibleLights(
             FLightManager const& lcm, utils::JobSystem& js, Frustum const& frustum,
             FScene::LightSoa& lightData) noexcept;
 
     static void cullRenderables(utils::JobSystem& js,
-            FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit) noexcept;
+            FScene::RenderableSoa const& renderableData, CullingBvh const& bvh,
+            Frustum const& frustum, Culler::result_type* results, size_t bit) noexcept;
 
     void computeVisibilityMasks(
             uint8_t visibleLayers, uint8_t const* layers,
@@ -240,7 +306,6 @@ private:
 
     void bindPerViewUniformsAndSamplers(FEngine::DriverApi& driver) const noexcept {
         driver.bindUniformBuffer(BindingPoints::PER_VIEW, mPerViewUbh);
-        driver.bindUniformBuffer(BindingPoints::LIGHTS, mLightUbh);
         driver.bindSamplers(BindingPoints::PER_VIEW, mPerViewSbh);
     }
 
@@ -252,12 +317,10 @@ private:
     // these are accessed in the render loop, keep together
     Handle<HwSamplerBuffer> mPerViewSbh;
     Handle<HwUniformBuffer> mPerViewUbh;
-    Handle<HwUniformBuffer> mLightUbh;
     Handle<HwUniformBuffer> mRenderableUbh;
 
     Handle<HwSamplerBuffer> getUsh() const noexcept { return mPerViewSbh; }
     Handle<HwUniformBuffer> getUbh() const noexcept { return mPerViewUbh; }
-    Handle<HwUniformBuffer> getLightUbh() const noexcept { return mLightUbh; }
 
     FScene* mScene = nullptr;
     FCamera* mCullingCamera = nullptr;
@@ -267,10 +330,17 @@ private:
     Frustum mCullingFrustum;
 
     mutable Froxelizer mFroxelizer;
+    GPUBuffer mLightBuffer;
+    OcclusionCuller mOcclusionCuller;
+
+    // Level of detail each renderable used last time, indexed by UBO_SLOT. Slots are reused
+    // and the scene can change, this only matters within the hysteresis range.
+    std::vector<uint8_t> mPrimitivesLod[LOD_PASS_COUNT];
 
     Viewport mViewport;
     LinearColorA mClearColor;
     bool mCulling = true;
+    bool mOcclusionCulling = false;
     bool mFrontFaceWindingInverted = false;
     bool mClearTargetColor = true;
     bool mClearTargetDepth = true;
@@ -306,10 +376,34 @@ private:
     Range mVisibleRenderables;
     Range mVisibleShadowCasters;
     uint32_t mRenderableUBOSize = 0;
+    uint64_t mRenderableUboVersion = 0;     // see FScene::updateUBOs()
     mutable bool mHasDirectionalLight = false;
     mutable bool mHasDynamicLighting = false;
     mutable bool mHasShadowing = false;
-    mutable ShadowMap mDirectionalShadowMap;
+    bool mHasDirectionalShadowing = false;
+    uint8_t mShadowCascadeCount = 0;
+    // cascades are allocated on demand, except the first one
+    std::array<std::unique_ptr<ShadowMap>, CONFIG_MAX_SHADOW_CASCADES> mShadowMaps;
+    ShadowMapAtlas mShadowMapAtlas;
+    // shadow casters visible in each cascade, see prepareVisibleShadowCasters()
+    std::vector<Culler::result_type> mShadowCascadeCasters[CONFIG_MAX_SHADOW_CASCADES];
+
+    // shadow maps of the static shadow casters, see prepareStaticShadowMap()
+    struct StaticShadowMap {
+        ShadowMapAtlas atlas;
+        // what the cached shadow maps were rendered with
+        filament::math::mat4f lightFromWorld[CONFIG_MAX_SHADOW_CASCADES];
+        FScene const* scene = nullptr;
+        uint64_t version = 0;       // see FScene::getStaticShadowCastersVersion()
+        uint8_t visibleLayers = 0;
+        uint8_t cascadeCount = 0;
+        bool enabled = false;       // the cached shadow maps are used this frame
+        bool dirty = false;         // the cached shadow maps must be rendered this frame
+    } mStaticShadowMap;
+
+    // shadow maps of the point and spot lights, see prepareLocalShadowing()
+    LocalShadowMaps mLocalShadowMaps;
+    std::vector<Culler::result_type> mLocalShadowCasters;
 };
 
 FILAMENT_UPCAST(View)
@@ -119,11 +119,14 @@ void GPUBuffer::terminate(driver::DriverApi& driverApi) noexcept {
     driverApi.destroyTexture(mTexture);
 }
 
-void GPUBuffer::commitSlow(driver::DriverApi& driverApi, void const* begin, void const* end) noexcept {
+void GPUBuffer::commitSlow(driver::DriverApi& driverApi, void const* begin, void const* end,
+        driver::BufferDescriptor::Callback callback, void* user) noexcept {
     const uintptr_t sizeInBytes = uintptr_t(end) - uintptr_t(begin);
     assert(sizeInBytes <= mRowSizeInBytes * mHeight);
-    driverApi.update2DImage(mTexture, 0, 0, 0, mWidth, mHeight,
-            { begin, sizeInBytes, mFormat, mType });
+    assert(sizeInBytes % mRowSizeInBytes == 0);
+    const uint32_t rowCount = uint32_t(sizeInBytes / mRowSizeInBytes);
+    driverApi.update2DImage(mTexture, 0, 0, 0, mWidth, rowCount,
+            { begin, sizeInBytes, mFormat, mType, callback, user });
 }
 
 } // namespace filament
@@ -22,6 +22,8 @@
 #include "driver/DriverApiForward.h"
 #include "driver/Handle.h"
 
+#include <filament/driver/BufferDescriptor.h>
+
 #include <utils/Slice.h>
 
 namespace filament {
@@ -59,10 +61,18 @@ public:
     void terminate(driver::DriverApi& driverApi) noexcept;
 
     size_t getSize() const noexcept { return mSize; }
+    size_t getHeight() const noexcept { return mHeight; }
 
+    // Only the rows covered by [begin, end) are updated, which must be whole rows.
     // source data isn't copied and must stay valid until the command-buffer is executed
     void commit(driver::DriverApi& driverApi, void const* begin, void const* end) noexcept {
-        commitSlow(driverApi, begin, end);
+        commitSlow(driverApi, begin, end, nullptr, nullptr);
+    }
+
+    // same as above, but the data is released by the callback once it's been consumed
+    void commit(driver::DriverApi& driverApi, void const* begin, void const* end,
+            driver::BufferDescriptor::Callback callback, void* user = nullptr) noexcept {
+        commitSlow(driverApi, begin, end, callback, user);
     }
 
     template<typename T>
@@ -80,7 +90,8 @@ private:
     driver::SamplerParams getSamplerParams() const noexcept { return driver::SamplerParams{}; }
 
 private:
-    void commitSlow(driver::DriverApi& driverApi, void const* begin, void const* end) noexcept;
+    void commitSlow(driver::DriverApi& driverApi, void const* begin, void const* end,
+            driver::BufferDescriptor::Callback callback, void* user) noexcept;
 
     Handle<HwTexture> mTexture;
     uint32_t mSize = 0;
@@ -298,6 +298,11 @@ void MetalDriver::updateUniformBuffer(Driver::UniformBufferHandle ubh,
 
 }
 
+void MetalDriver::updateUniformBufferRange(Driver::UniformBufferHandle ubh,
+        Driver::BufferDescriptor&& data, uint32_t byteOffset) {
+
+}
+
 void MetalDriver::updateSamplerBuffer(Driver::SamplerBufferHandle sbh,
         SamplerBuffer&& samplerBuffer) {
 
@@ -396,6 +401,11 @@ void MetalDriver::draw(Driver::PipelineState ps, Driver::RenderPrimitiveHandle r
 
 }
 
+void MetalDriver::drawInstanced(Driver::PipelineState ps, Driver::RenderPrimitiveHandle rph,
+        uint32_t instanceCount) {
+
+}
+
 } // namespace metal
 } // namespace driver
 
@@ -1654,6 +1654,26 @@ void OpenGLDriver::updateUniformBuffer(Driver::UniformBufferHandle ubh, BufferDe
     scheduleDestroy(std::move(p));
 }
 
+void OpenGLDriver::updateUniformBufferRange(Driver::UniformBufferHandle ubh,
+        BufferDescriptor&& p, uint32_t byteOffset) {
+    DEBUG_MARKER()
+
+    GLUniformBuffer* ub = handle_cast<GLUniformBuffer *>(ubh);
+    assert(ub);
+    // STREAM buffers are reallocated by updateBuffer(), they can't be partially updated
+    assert(ub->gl.ubo.usage != driver::BufferUsage::STREAM);
+    assert(byteOffset + p.size <= ub->gl.ubo.capacity);
+
+    if (p.size > 0) {
+        GLBuffer& buffer = ub->gl.ubo;
+        bindBuffer(GL_UNIFORM_BUFFER, buffer.id);
+        glBufferSubData(GL_UNIFORM_BUFFER, byteOffset, p.size, p.buffer);
+        buffer.size = std::max(buffer.size, uint32_t(byteOffset + p.size));
+        CHECK_GL_ERROR(utils::slog.e)
+    }
+    scheduleDestroy(std::move(p));
+}
+
 void OpenGLDriver::updateBuffer(GLenum target,
         GLBuffer* buffer, BufferDescriptor const& p, uint32_t alignment) noexcept {
     assert(buffer->capacity >= p.size);
@@ -2014,6 +2034,11 @@ void OpenGLDriver::beginRenderPass(Driver::RenderTargetHandle rth,
         viewport(params.left, params.bottom, params.width, params.height);
     }
 
+    if (clearFlags & RenderPassParams::CLEAR_RENDER_AREA) {
+        // the scissor is intersected with the viewport set above
+        setViewportScissor(params.left, params.bottom, params.width, params.height);
+    }
+
     const bool respectScissor = !(clearFlags & RenderPassParams::IGNORE_SCISSOR);
     const bool clearColor = clearFlags & TargetBufferFlags::COLOR;
     const bool clearDepth = clearFlags & TargetBufferFlags::DEPTH;
@@ -2752,6 +2777,13 @@ void OpenGLDriver::blit(TargetBufferFlags buffers,
 void OpenGLDriver::draw(
         Driver::PipelineState state,
         Driver::RenderPrimitiveHandle rph) {
+    drawInstanced(state, rph, 1);
+}
+
+void OpenGLDriver::drawInstanced(
+        Driver::PipelineState state,
+        Driver::RenderPrimitiveHandle rph,
+        uint32_t instanceCount) {
     DEBUG_MARKER()
 
     OpenGLProgram* p = handle_cast<OpenGLProgram*>(state.program);
@@ -2764,8 +2796,15 @@ void OpenGLDriver::draw(
 
     polygonOffset(state.polygonOffset.slope, state.polygonOffset.constant);
 
-    glDrawRangeElements(GLenum(rp->type), rp->minIndex, rp->maxIndex, rp->count,
-            rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset));
+    if (UTILS_LIKELY(instanceCount == 1)) {
+        glDrawRangeElements(GLenum(rp->type), rp->minIndex, rp->maxIndex, rp->count,
+                rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset));
+    } else {
+        // there is no instanced version of glDrawRangeElements
+        glDrawElementsInstanced(GLenum(rp->type), rp->count,
+                rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset),
+                GLsizei(instanceCount));
+    }
 
     CHECK_GL_ERROR(utils::slog.e)
 }
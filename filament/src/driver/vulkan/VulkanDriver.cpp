@@ -559,7 +559,16 @@ void VulkanDriver::setExternalStream(Driver::TextureHandle th, Driver::StreamHan
 void VulkanDriver::updateUniformBuffer(Driver::UniformBufferHandle ubh, BufferDescriptor&& data) {
     if (data.size > 0) {
         auto* buffer = handle_cast<VulkanUniformBuffer>(mHandleMap, ubh);
-        buffer->loadFromCpu(data.buffer, (uint32_t) data.size);
+        buffer->loadFromCpu(data.buffer, 0, (uint32_t) data.size);
+        scheduleDestroy(std::move(data));
+    }
+}
+
+void VulkanDriver::updateUniformBufferRange(Driver::UniformBufferHandle ubh,
+        BufferDescriptor&& data, uint32_t byteOffset) {
+    if (data.size > 0) {
+        auto* buffer = handle_cast<VulkanUniformBuffer>(mHandleMap, ubh);
+        buffer->loadFromCpu(data.buffer, byteOffset, (uint32_t) data.size);
         scheduleDestroy(std::move(data));
     }
 }
@@ -875,6 +884,11 @@ void VulkanDriver::blit(TargetBufferFlags buffers,
 }
 
 void VulkanDriver::draw(Driver::PipelineState pipelineState, Driver::RenderPrimitiveHandle rph) {
+    drawInstanced(pipelineState, rph, 1);
+}
+
+void VulkanDriver::drawInstanced(Driver::PipelineState pipelineState,
+        Driver::RenderPrimitiveHandle rph, uint32_t instanceCount) {
     VkCommandBuffer cmdbuffer = mContext.cmdbuffer;
     ASSERT_POSTCONDITION(cmdbuffer, "Draw calls can occur only within a beginFrame / endFrame.");
     const VulkanRenderPrimitive& prim = *handle_cast<VulkanRenderPrimitive>(mHandleMap, rph);
@@ -996,11 +1010,12 @@ void VulkanDriver::draw(Driver::PipelineState pipelineState, Driver::RenderPrimi
             prim.indexBuffer->indexType);
 
     // Finally, make the actual draw call. TODO: support subranges
+    // The shaders index the per-renderable uniforms with gl_InstanceIndex, which includes the
+    // first instance, so it must be 0.
     const uint32_t indexCount = prim.count;
-    const uint32_t instanceCount = 1;
     const uint32_t firstIndex = prim.offset / prim.indexBuffer->elementSize;
     const int32_t vertexOffset = 0;
-    const uint32_t firstInstId = 1;
+    const uint32_t firstInstId = 0;
     vkCmdDrawIndexed(cmdbuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstId);
 }
 
@@ -1008,6 +1023,7 @@ void VulkanDriver::draw(Driver::PipelineState pipelineState, Driver::RenderPrimi
 void VulkanDriver::debugCommand(const char* methodName) {
     static const std::set<utils::StaticString> OUTSIDE_COMMANDS = {
         "updateUniformBuffer",
+        "updateUniformBufferRange",
         "updateVertexBuffer",
         "updateIndexBuffer",
         "update2DImage",
@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <random>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -28,6 +31,13 @@
 #include <filament/Frustum.h>
 #include <filament/Material.h>
 #include <filament/Engine.h>
+#include <filament/LightManager.h>
+#include <filament/RenderableManager.h>
+#include <filament/Renderer.h>
+#include <filament/Scene.h>
+#include <filament/View.h>
+
+#include <utils/JobSystem.h>
 
 #include <private/filament/UniformInterfaceBlock.h>
 #include <private/filament/UibGenerator.h>
@@ -35,10 +45,19 @@
 #include "details/Allocators.h"
 #include "details/Material.h"
 #include "details/Camera.h"
+#include "details/Culler.h"
+#include "details/CullingBvh.h"
 #include "details/Froxelizer.h"
+#include "details/OcclusionCuller.h"
+#include "details/ShadowMap.h"
 #include "details/Engine.h"
+#include "details/Scene.h"
+#include "details/ShadowAtlasAllocator.h"
+#include "components/ChangeLog.h"
 #include "components/RenderableManager.h"
 #include "components/TransformManager.h"
+#include "AffineTransform.h"
+#include "RenderPass.h"
 #include "UniformBuffer.h"
 
 using namespace filament;
@@ -146,6 +165,241 @@ TEST(FilamentTest, TransformManager) {
     EXPECT_EQ(tcm.getWorldTransform(child), mat4f{ float4{ 8 }});
 }
 
+TEST(FilamentTest, TransformManagerHierarchy) {
+    using filament::details::FEngine;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    auto& tcm = engine->getTransformManager();
+    EntityManager& em = engine->getEntityManager();
+
+    // a wide level, large enough to be transformed in parallel, and a deep chain
+    constexpr size_t WIDE_COUNT = 4096;
+    constexpr size_t DEEP_COUNT = 4096;
+    std::vector<Entity> entities(1 + WIDE_COUNT + DEEP_COUNT);
+    em.create(entities.size(), entities.data());
+
+    // the nodes are created children first, so that the hierarchy needs sorting
+    tcm.create(entities[0]);
+    for (size_t i = 0; i < WIDE_COUNT; i++) {
+        tcm.create(entities[1 + i]);
+    }
+    for (size_t i = 0; i < DEEP_COUNT; i++) {
+        tcm.create(entities[1 + WIDE_COUNT + i]);
+    }
+    auto instance = [&](size_t i) { return tcm.getInstance(entities[i]); };
+    for (size_t i = 0; i < WIDE_COUNT; i++) {
+        tcm.setParent(instance(1 + i), instance(0));
+    }
+    tcm.setParent(instance(1 + WIDE_COUNT), instance(0));
+    for (size_t i = 1; i < DEEP_COUNT; i++) {
+        tcm.setParent(instance(1 + WIDE_COUNT + i), instance(WIDE_COUNT + i));
+    }
+
+    auto check = [&](float rootX) {
+        EXPECT_EQ(mat4f::translate(float3{ rootX, 0, 0 }), tcm.getWorldTransform(instance(0)));
+        for (size_t i = 0; i < WIDE_COUNT; i++) {
+            EXPECT_EQ(mat4f::translate(float3{ rootX, 1, 0 }),
+                    tcm.getWorldTransform(instance(1 + i)));
+        }
+        for (size_t i = 0; i < DEEP_COUNT; i++) {
+            EXPECT_EQ(mat4f::translate(float3{ rootX, 0, float(i + 1) }),
+                    tcm.getWorldTransform(instance(1 + WIDE_COUNT + i)));
+        }
+    };
+
+    // world transforms computed by a transaction, level by level
+    tcm.openLocalTransformTransaction();
+    tcm.setTransform(instance(0), mat4f::translate(float3{ 1, 0, 0 }));
+    for (size_t i = 0; i < WIDE_COUNT; i++) {
+        tcm.setTransform(instance(1 + i), mat4f::translate(float3{ 0, 1, 0 }));
+    }
+    for (size_t i = 0; i < DEEP_COUNT; i++) {
+        tcm.setTransform(instance(1 + WIDE_COUNT + i), mat4f::translate(float3{ 0, 0, 1 }));
+    }
+    tcm.commitLocalTransformTransaction();
+    check(1);
+
+    // the parents come before their children
+    for (size_t i = 1; i < entities.size(); i++) {
+        auto parent = tcm.getInstance(entities[i == 1 + WIDE_COUNT || i <= WIDE_COUNT ? 0 : i - 1]);
+        EXPECT_LT(parent, instance(i));
+    }
+
+    // world transforms computed through the hierarchy, outside of a transaction
+    tcm.setTransform(instance(0), mat4f::translate(float3{ 2, 0, 0 }));
+    check(2);
+
+    // world transforms computed in a single pass for a large batch, read from strided data
+    struct Node {
+        uint32_t id;
+        mat4f transform;
+    };
+    std::vector<TransformManager::Instance> instances(entities.size());
+    std::vector<Node> nodes(entities.size());
+    for (size_t i = 0; i < entities.size(); i++) {
+        instances[i] = instance(i);
+        nodes[i] = { uint32_t(i), tcm.getTransform(instance(i)) };
+    }
+    nodes[0].transform = mat4f::translate(float3{ 3, 0, 0 });
+    tcm.setTransforms(instances.data(), &nodes[0].transform, nodes.size(), sizeof(Node));
+    check(3);
+
+    // and through the hierarchy for a small one
+    const mat4f root = mat4f::translate(float3{ 4, 0, 0 });
+    tcm.setTransforms(instances.data(), &root, 1);
+    check(4);
+
+    // after a hierarchy change, a large batch doesn't reorder the nodes
+    Entity leaf = em.create();
+    tcm.create(leaf, instance(0), mat4f::translate(float3{ 0, 0, -1 }));
+    nodes[0].transform = mat4f::translate(float3{ 5, 0, 0 });
+    tcm.setTransforms(instances.data(), &nodes[0].transform, nodes.size(), sizeof(Node));
+    for (size_t i = 0; i < entities.size(); i++) {
+        EXPECT_EQ(instances[i], instance(i));
+    }
+    check(5);
+    EXPECT_EQ(mat4f::translate(float3{ 5, 0, -1 }),
+            tcm.getWorldTransform(tcm.getInstance(leaf)));
+
+    tcm.destroy(leaf);
+    em.destroy(leaf);
+    for (Entity e : entities) {
+        tcm.destroy(e);
+    }
+    em.destroy(entities.size(), entities.data());
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, RenderableManagerBatch) {
+    using filament::details::FEngine;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    auto& rcm = engine->getRenderableManager();
+    auto& tcm = engine->getTransformManager();
+    EntityManager& em = engine->getEntityManager();
+
+    constexpr size_t COUNT = 1000;
+    std::vector<Entity> entities(COUNT);
+    em.create(COUNT, entities.data());
+
+    // identical renderables, with a transform component
+    const Box box = { { 1, 2, 3 }, { 1, 1, 1 } };
+    EXPECT_EQ(RenderableManager::Builder::Success,
+            RenderableManager::Builder(0)
+                    .boundingBox(box)
+                    .castShadows(true)
+                    .build(*engine, entities.data(), COUNT));
+    for (Entity e : entities) {
+        auto ri = rcm.getInstance(e);
+        ASSERT_TRUE(ri);
+        EXPECT_EQ(box.center, rcm.getAABB(ri).center);
+        EXPECT_TRUE(rcm.isShadowCaster(ri));
+        EXPECT_TRUE(tcm.hasComponent(e));
+    }
+
+    rcm.destroy(entities.data(), COUNT);
+    for (Entity e : entities) {
+        EXPECT_FALSE(rcm.hasComponent(e));
+    }
+
+    em.destroy(COUNT, entities.data());
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, SharedJobSystem) {
+    constexpr size_t ENGINE_COUNT = 16;
+
+    // one thread pool for all the engines, each engine is created on its own thread
+    JobSystem::Config config;
+    config.adoptableThreadsCount = ENGINE_COUNT;
+    JobSystem js(config);
+
+    auto renderFrames = [&js](size_t seed) {
+        Engine* engine = Engine::create(Engine::Backend::NOOP, nullptr, nullptr, &js);
+        ASSERT_NE(nullptr, engine);
+        SwapChain* swapChain = engine->createSwapChain(nullptr);
+        Renderer* renderer = engine->createRenderer();
+        Scene* scene = engine->createScene();
+        Camera* camera = engine->createCamera();
+        View* view = engine->createView();
+        view->setScene(scene);
+        view->setCamera(camera);
+        view->setViewport({ 0, 0, 640, 480 });
+        camera->setProjection(45.0, 640.0 / 480.0, 0.1, 100.0);
+
+        EntityManager& em = EntityManager::get();
+        std::default_random_engine gen(uint32_t(seed + 1));
+        std::uniform_real_distribution<float> rand(-20.0f, 20.0f);
+
+        constexpr size_t COUNT = 500;
+        std::vector<Entity> renderables(COUNT);
+        em.create(COUNT, renderables.data());
+        RenderableManager::Builder(0)
+                .boundingBox({{ 0, 0, 0 }, { 0.5f, 0.5f, 0.5f }})
+                .castShadows(true)
+                .build(*engine, renderables.data(), COUNT);
+
+        TransformManager& tcm = engine->getTransformManager();
+        std::vector<TransformManager::Instance> instances(COUNT);
+        std::vector<mat4f> transforms(COUNT);
+        for (size_t i = 0; i < COUNT; i++) {
+            instances[i] = tcm.getInstance(renderables[i]);
+            scene->addEntity(renderables[i]);
+        }
+
+        std::vector<Entity> lights(8);
+        em.create(lights.size(), lights.data());
+        for (Entity light : lights) {
+            LightManager::Builder(LightManager::Type::POINT)
+                    .position({ rand(gen), rand(gen), -std::abs(rand(gen)) - 1.0f })
+                    .falloff(5.0f)
+                    .build(*engine, light);
+            scene->addEntity(light);
+        }
+
+        for (size_t frame = 0; frame < 10; frame++) {
+            for (size_t i = 0; i < COUNT; i++) {
+                transforms[i] = mat4f::translate(
+                        float3{ rand(gen), rand(gen), -std::abs(rand(gen)) - 1.0f });
+            }
+            tcm.setTransforms(instances.data(), transforms.data(), COUNT);
+            if (renderer->beginFrame(swapChain)) {
+                renderer->render(view);
+                renderer->endFrame();
+            }
+        }
+
+        for (Entity e : lights) {
+            engine->destroy(e);
+        }
+        for (Entity e : renderables) {
+            engine->destroy(e);
+        }
+        em.destroy(lights.size(), lights.data());
+        em.destroy(COUNT, renderables.data());
+        engine->destroy(view);
+        engine->destroy(camera);
+        engine->destroy(scene);
+        engine->destroy(renderer);
+        engine->destroy(swapChain);
+        Engine::destroy(&engine);
+        EXPECT_EQ(nullptr, engine);
+    };
+
+    // the second round checks that the adoptable threads are reused
+    for (size_t round = 0; round < 2; round++) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < ENGINE_COUNT; i++) {
+            threads.emplace_back(renderFrames, round * ENGINE_COUNT + i);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
 TEST(FilamentTest, UniformInterfaceBlock) {
 
     UniformInterfaceBlock::Builder b;
@@ -373,6 +627,35 @@ TEST(FilamentTest, BoxCulling) {
     EXPECT_TRUE( frustum.intersects( { 0, 200 }) );
 }
 
+TEST(FilamentTest, AffineTransform) {
+    const mat4f a = mat4f::translate(float3{ 1, 2, 3 }) *
+            mat4f::rotate(0.5f, float3{ 0, 1, 0 }) * mat4f::scale(float3{ 2, 1, 0.5f });
+    const mat4f b = mat4f::rotate(-1.2f, float3{ 1, 1, 0 }) *
+            mat4f::translate(float3{ -4, 0, 7 });
+
+    // the round trip is exact for affine transforms
+    EXPECT_EQ(a, AffineTransform{ a }.toMat4());
+    EXPECT_EQ(mat4f{}, AffineTransform{}.toMat4());
+
+    // products match mat4f's
+    const mat4f ab = (AffineTransform{ a } * AffineTransform{ b }).toMat4();
+    const mat4f expected = a * b;
+    for (size_t i = 0; i < 4; i++) {
+        for (size_t j = 0; j < 4; j++) {
+            EXPECT_NEAR(expected[i][j], ab[i][j], 1e-5f);
+        }
+    }
+
+    // as well as transformed bounding boxes
+    const Box box = { { 1, -2, 3 }, { 0.5f, 2, 1 } };
+    const Box expectedBox = rigidTransform(box, a);
+    const Box affineBox = rigidTransform(box, AffineTransform{ a });
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_NEAR(expectedBox.center[i], affineBox.center[i], 1e-5f);
+        EXPECT_NEAR(expectedBox.halfExtent[i], affineBox.halfExtent[i], 1e-5f);
+    }
+}
+
 TEST(FilamentTest, SphereCulling) {
     Frustum frustum(mat4f::frustum(-1, 1, -1, 1, 1, 100));
 
@@ -410,6 +693,613 @@ TEST(FilamentTest, SphereCulling) {
     EXPECT_TRUE(frustum.intersects({ 0, 200 }));
 }
 
+TEST(FilamentTest, CullingIsa) {
+    using namespace filament::details;
+    using Isa = Culler::Isa;
+
+    Frustum frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f));
+
+    const size_t count = 1000;
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 10.0f);
+    std::vector<float3> centers(count);
+    std::vector<float3> extents(count);
+    std::vector<float4> spheres(count);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+        spheres[i] = { position(gen), position(gen), position(gen), size(gen) };
+    }
+
+    std::vector<Culler::result_type> expectedBoxes(count);
+    std::vector<Culler::result_type> expectedSpheres(count);
+    Culler::Test::intersects(Isa::GENERIC, expectedBoxes.data(), frustum,
+            centers.data(), extents.data(), count);
+    Culler::Test::intersects(Isa::GENERIC, expectedSpheres.data(), frustum,
+            spheres.data(), count);
+    EXPECT_NE(0, std::count(expectedBoxes.begin(), expectedBoxes.end(), 1));
+    EXPECT_NE(0, std::count(expectedSpheres.begin(), expectedSpheres.end(), 1));
+
+    for (Isa isa : { Isa::SSE2, Isa::AVX2, Isa::AVX512 }) {
+        if (!Culler::Test::isSupported(isa)) {
+            continue;
+        }
+        // a count that's a multiple of 8, but not of 16
+        const size_t c = count - 8;
+        std::vector<Culler::result_type> results(count);
+        Culler::Test::intersects(isa, results.data(), frustum, centers.data(), extents.data(), c);
+        EXPECT_TRUE(std::equal(results.begin(), results.begin() + c, expectedBoxes.begin()))
+                << Culler::Test::getName(isa);
+
+        std::fill(results.begin(), results.end(), 0xFF);
+        Culler::Test::intersects(isa, results.data(), frustum, spheres.data(), c);
+        EXPECT_TRUE(std::equal(results.begin(), results.begin() + c, expectedSpheres.begin()))
+                << Culler::Test::getName(isa);
+    }
+}
+
+TEST(FilamentTest, BvhCulling) {
+    using namespace filament::details;
+
+    JobSystem js;
+    js.adopt();
+
+    Frustum frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f));
+
+    // not a multiple of the leaf size on purpose
+    const size_t count = 20003;
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    std::vector<float3> centers(Culler::round(count));
+    std::vector<float3> extents(Culler::round(count));
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+    }
+
+    std::vector<Culler::result_type> expected(Culler::round(count));
+    std::vector<Culler::result_type> results(Culler::round(count));
+    CullingBvh bvh;
+    auto check = [&]() {
+        std::fill(expected.begin(), expected.end(), Culler::result_type(0));
+        Culler::Test::intersects(expected.data(), frustum, centers.data(), extents.data(), count);
+        // other bits must be preserved
+        std::fill(results.begin(), results.end(), Culler::result_type(0x4));
+        bvh.intersects(js, results.data(), frustum, centers.data(), extents.data(), 1);
+        size_t visibleCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(Culler::result_type(0x4 | (expected[i] ? 0x2 : 0)), results[i]) << i;
+            visibleCount += expected[i] ? 1 : 0;
+        }
+        EXPECT_GT(visibleCount, 0u);
+        EXPECT_LT(visibleCount, count);
+    };
+
+    bvh.build(centers.data(), extents.data(), count);
+    EXPECT_EQ(count, bvh.size());
+    check();
+
+    // move a few boxes by a small amount, this only refits the hierarchy
+    std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+    for (size_t i = 0; i < count; i += 7) {
+        centers[i] += float3{ offset(gen), offset(gen), offset(gen) };
+    }
+    bvh.update(centers.data(), extents.data(), count);
+    check();
+
+    // move them anywhere, this rebuilds the hierarchy
+    for (size_t i = 0; i < count; i += 7) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+    }
+    bvh.update(centers.data(), extents.data(), count);
+    check();
+
+    // a different number of boxes forces a rebuild
+    bvh.update(centers.data(), extents.data(), count - 3);
+    EXPECT_EQ(count - 3, bvh.size());
+
+    bvh.clear();
+    EXPECT_TRUE(bvh.empty());
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, OcclusionCulling) {
+    using namespace filament::details;
+
+    JobSystem js;
+    js.adopt();
+
+    // camera at the origin looking down -z, a wall 10 units away
+    OcclusionCuller culler;
+    culler.begin(mat4f::perspective(90.0f, 1.0f, 0.1f, 100.0f));
+
+    // occluders crossing the near plane are ignored
+    culler.addOccluder(mat4f{}, Box{ { 0, 0, 0 }, { 1, 1, 1 } });
+    EXPECT_TRUE(culler.empty());
+
+    culler.addOccluder(mat4f{}, Box{ { 0, 0, -10 }, { 5, 5, 0.5f } });
+    EXPECT_FALSE(culler.empty());
+    culler.rasterize(js);
+
+    const size_t cx = OcclusionCuller::WIDTH / 2;
+    const size_t cy = OcclusionCuller::HEIGHT / 2;
+    EXPECT_LT(culler.getDepthAt(cx, cy), 1.0f);
+    EXPECT_EQ(std::numeric_limits<float>::infinity(), culler.getDepthAt(0, 0));
+
+    std::vector<float3> centers = {
+            { 0, 0, -20 },      // behind the wall
+            { 0, 0, -5 },       // in front of the wall
+            { 15, 0, -20 },     // behind, but beside the wall
+            { 0, 0, -30 },      // behind, but larger than the wall
+            { 0, 0, -10 },      // the wall itself
+            { 0, 0, 0 },        // crossing the near plane
+            { 0, 0, -20 },      // behind the wall, but not tested
+    };
+    std::vector<float3> extents = {
+            { 1, 1, 1 },
+            { 1, 1, 1 },
+            { 1, 1, 1 },
+            { 20, 20, 1 },
+            { 5, 5, 0.5f },
+            { 1, 1, 1 },
+            { 1, 1, 1 },
+    };
+    std::vector<Culler::result_type> results = { 0x5, 0x5, 0x5, 0x5, 0x5, 0x5, 0x4 };
+    culler.cull(js, results.data(), centers.data(), extents.data(), centers.size(), 0, 2);
+    EXPECT_EQ(0x1, results[0]);
+    EXPECT_EQ(0x5, results[1]);
+    EXPECT_EQ(0x5, results[2]);
+    EXPECT_EQ(0x5, results[3]);
+    EXPECT_EQ(0x5, results[4]);
+    EXPECT_EQ(0x5, results[5]);
+    EXPECT_EQ(0x4, results[6]);
+
+    // a mirroring transform produces the same wall
+    culler.begin(mat4f::perspective(90.0f, 1.0f, 0.1f, 100.0f));
+    culler.addOccluder(mat4f::scale(float3{ -1, 1, 1 }), Box{ { 0, 0, -10 }, { 5, 5, 0.5f } });
+    culler.rasterize(js);
+    for (size_t i = 0; i < centers.size(); i++) {
+        EXPECT_EQ(i == 0 || i == 6, culler.isOccluded(centers[i], extents[i])) << i;
+    }
+
+    // culling must be conservative: occluded boxes are entirely hidden by the wall's front face
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-30.0f, 30.0f);
+    std::uniform_real_distribution<float> depth(-60.0f, -1.0f);
+    std::uniform_real_distribution<float> size(0.1f, 3.0f);
+    size_t occludedCount = 0;
+    for (size_t i = 0; i < 10000; i++) {
+        const float3 center = { position(gen), position(gen), depth(gen) };
+        const float3 extent = { size(gen), size(gen), size(gen) };
+        if (!culler.isOccluded(center, extent)) {
+            continue;
+        }
+        occludedCount++;
+        for (size_t j = 0; j < 8; j++) {
+            const float3 p = center + float3{
+                    (j & 1u) ? extent.x : -extent.x,
+                    (j & 2u) ? extent.y : -extent.y,
+                    (j & 4u) ? extent.z : -extent.z };
+            EXPECT_LT(p.z, -9.5f);
+            EXPECT_LE(std::abs(p.x * 9.5f / p.z), 5.0f);
+            EXPECT_LE(std::abs(p.y * 9.5f / p.z), 5.0f);
+        }
+    }
+    EXPECT_GT(occludedCount, 0u);
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, ChangeLog) {
+    std::vector<Entity> entities;
+    auto gather = [&entities](Entity e) { entities.push_back(e); };
+    using filament::details::ChangeLog;
+    EntityManager& em = EntityManager::get();
+    const Entity a = em.create();
+    const Entity b = em.create();
+
+    ChangeLog log;
+    ChangeLog::Cursor cursor = 0;
+
+    // a new reader always starts over
+    EXPECT_FALSE(log.read(cursor, gather));
+    EXPECT_TRUE(entities.empty());
+    EXPECT_TRUE(log.read(cursor, gather));
+    EXPECT_TRUE(entities.empty());
+
+    log.record(a);
+    log.record(b);
+    log.record(a);
+    EXPECT_TRUE(log.read(cursor, gather));
+    EXPECT_EQ(std::vector<Entity>({ a, b, a }), entities);
+
+    // only the new entries are read
+    entities.clear();
+    log.record(b);
+    EXPECT_TRUE(log.read(cursor, gather));
+    EXPECT_EQ(std::vector<Entity>({ b }), entities);
+
+    // readers start over after an invalidation
+    entities.clear();
+    log.record(a);
+    log.invalidate();
+    EXPECT_FALSE(log.read(cursor, gather));
+    EXPECT_TRUE(entities.empty());
+    log.record(b);
+    EXPECT_TRUE(log.read(cursor, gather));
+    EXPECT_EQ(std::vector<Entity>({ b }), entities);
+
+    // a reader that falls behind starts over, a reader that keeps up doesn't
+    entities.clear();
+    ChangeLog::Cursor lagging = cursor;
+    for (size_t i = 0; i < ChangeLog::CAPACITY; i++) {
+        log.record(a);
+        EXPECT_TRUE(log.read(cursor, gather));
+    }
+    EXPECT_EQ(size_t(ChangeLog::CAPACITY), entities.size());
+    EXPECT_FALSE(log.read(lagging, gather));
+    EXPECT_TRUE(log.read(lagging, gather));
+
+    em.destroy(a);
+    em.destroy(b);
+}
+
+TEST(FilamentTest, RadixSortCommands) {
+    using filament::details::RenderPass;
+    using Command = RenderPass::Command;
+
+    JobSystem js;
+    js.adopt();
+
+    // keys use bits all over the 64-bit range, a few commands are discarded (SENTINEL)
+    constexpr size_t COUNT = 100000;
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<uint64_t> rand;
+    std::vector<uint64_t> keys(COUNT);
+    RenderPass::CommandArena commands(COUNT);
+    for (size_t i = 0; i < COUNT; i++) {
+        uint64_t key = std::min(rand(gen), uint64_t(RenderPass::Pass::SENTINEL) - 1);
+        if (i % 97 == 0) {
+            key = uint64_t(RenderPass::Pass::SENTINEL);
+        }
+        keys[i] = key;
+        Command* c = commands.grow(1);
+        *c = Command{};
+        c->key = key;
+    }
+    commands.grow(1)->key = uint64_t(RenderPass::Pass::SENTINEL);
+
+    RenderPass::radixSortCommands(js, commands);
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::find(keys.begin(), keys.end(), uint64_t(RenderPass::Pass::SENTINEL)),
+            keys.end());
+    ASSERT_LE(keys.size() + 1, commands.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(keys[i], commands.begin()[i].key);
+    }
+    EXPECT_EQ(uint64_t(RenderPass::Pass::SENTINEL), commands.begin()[keys.size()].key);
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, InstanceCommands) {
+    using filament::details::FMaterialInstance;
+    using filament::details::RenderPass;
+    using Command = RenderPass::Command;
+
+    // commands are never dereferenced, any pointer will do
+    auto const* mi = reinterpret_cast<FMaterialInstance const*>(uintptr_t(64));
+    Handle<HwUniformBuffer> bones(1);
+
+    RenderPass::CommandArena commands(256);
+    uint32_t index = 0;
+    auto add = [&](uint32_t primitive, size_t count, bool skinned) {
+        for (size_t i = 0; i < count; i++) {
+            Command* c = commands.grow(1);
+            *c = Command{};
+            c->key = uint64_t(RenderPass::Pass::COLOR);
+            c->primitive.mi = mi;
+            c->primitive.primitiveHandle = Handle<HwRenderPrimitive>(primitive);
+            c->primitive.perRenderableBones = skinned ? bones : Handle<HwUniformBuffer>{};
+            c->primitive.index = index++;
+        }
+    };
+    add(1, 3, false);
+    add(2, 1, false);
+    add(1, CONFIG_MAX_INSTANCES + 36, false);
+    add(1, 2, true);
+    commands.grow(1)->key = uint64_t(RenderPass::Pass::SENTINEL);
+
+    std::vector<uint32_t> instances;
+    RenderPass::instanceCommands(commands, instances);
+
+    // runs longer than CONFIG_MAX_INSTANCES are split, commands with bones are never merged
+    struct Expected { uint32_t primitive; uint32_t index; uint8_t instanceCount; };
+    std::vector<Expected> expected = {
+            { 1,  0, 3 },
+            { 2,  3, 1 },
+            { 1,  3, CONFIG_MAX_INSTANCES },
+            { 1,  3 + CONFIG_MAX_INSTANCES, 36 },
+            { 1,  CONFIG_MAX_INSTANCES + 40, 1 },
+            { 1,  CONFIG_MAX_INSTANCES + 41, 1 },
+    };
+    ASSERT_EQ(expected.size() + 1, commands.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        Command const& c = commands.begin()[i];
+        EXPECT_EQ(expected[i].primitive, c.primitive.primitiveHandle.getId());
+        EXPECT_EQ(expected[i].index, c.primitive.index);
+        EXPECT_EQ(expected[i].instanceCount, c.primitive.instanceCount);
+    }
+    EXPECT_EQ(uint64_t(RenderPass::Pass::SENTINEL), commands.begin()[expected.size()].key);
+
+    // the instances of a draw are the renderables of the merged commands, in order
+    ASSERT_EQ(3 + CONFIG_MAX_INSTANCES + 36, instances.size());
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(i, instances[i]);
+    }
+    for (size_t i = 3; i < instances.size(); i++) {
+        EXPECT_EQ(i + 1, instances[i]);
+    }
+}
+
+TEST(FilamentTest, LargeCommandBuffer) {
+    using filament::details::FMaterialInstance;
+    using filament::details::RenderPass;
+    using Command = RenderPass::Command;
+
+    JobSystem js;
+    js.adopt();
+
+    // more renderables than a 16-bit index can address, drawn back to front
+    constexpr uint32_t COUNT = 70000;
+    auto const* mi = reinterpret_cast<FMaterialInstance const*>(uintptr_t(64));
+    RenderPass::CommandArena commands(COUNT);
+    for (uint32_t i = 0; i < COUNT; i++) {
+        Command* c = commands.grow(1);
+        *c = Command{};
+        c->key = uint64_t(RenderPass::Pass::COLOR) | (COUNT - i);
+        c->primitive.mi = mi;
+        c->primitive.primitiveHandle = Handle<HwRenderPrimitive>(i + 1);
+        c->primitive.index = i;
+    }
+    commands.grow(1)->key = uint64_t(RenderPass::Pass::SENTINEL);
+
+    RenderPass::radixSortCommands(js, commands);
+
+    std::vector<uint32_t> instances;
+    RenderPass::instanceCommands(commands, instances);
+
+    // no two commands draw the same primitive, so none are merged
+    EXPECT_TRUE(instances.empty());
+    ASSERT_EQ(COUNT + 1, commands.size());
+    for (uint32_t i = 0; i < COUNT; i++) {
+        EXPECT_EQ(COUNT - 1 - i, commands.begin()[i].primitive.index);
+    }
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, LevelOfDetailSelection) {
+    using filament::details::FRenderableManager;
+
+    FRenderableManager::LevelsOfDetail lods{};
+    lods.count = 3;
+    lods.minScreenSizes[0] = 0.5f;
+    lods.minScreenSizes[1] = 0.1f;
+    lods.minScreenSizes[2] = 1.0f;  // ignored, the last level has no threshold
+
+    const float h = 1.0f + FRenderableManager::LOD_HYSTERESIS;
+    auto select = FRenderableManager::selectLevelOfDetail;
+
+    // going to coarser levels happens right at the thresholds
+    EXPECT_EQ(0, select(lods, 2.0f, 0));
+    EXPECT_EQ(0, select(lods, 0.5f, 0));
+    EXPECT_EQ(1, select(lods, 0.49f, 0));
+    EXPECT_EQ(2, select(lods, 0.09f, 0));
+    EXPECT_EQ(2, select(lods, 0.0f, 1));
+
+    // going back to finer levels needs to go past the hysteresis
+    EXPECT_EQ(1, select(lods, 0.5f, 1));
+    EXPECT_EQ(1, select(lods, 0.5f * h - 0.001f, 1));
+    EXPECT_EQ(0, select(lods, 0.5f * h + 0.001f, 1));
+    EXPECT_EQ(2, select(lods, 0.1f * h - 0.001f, 2));
+    EXPECT_EQ(1, select(lods, 0.1f * h + 0.001f, 2));
+    EXPECT_EQ(0, select(lods, 1.0f, 2));
+
+    // a level that isn't there anymore is handled like the last one
+    EXPECT_EQ(1, select(lods, 0.5f, 7));
+}
+
+TEST(FilamentTest, ShadowCascadeSplits) {
+    using filament::details::ShadowMap;
+
+    filament::details::FLightManager::ShadowParams params{};
+    float splits[CONFIG_MAX_SHADOW_CASCADES + 1];
+
+    // a single cascade covers everything
+    ShadowMap::computeCascadeSplits(splits, 1, 0.1f, 100.0f, params);
+    EXPECT_FLOAT_EQ(0.1f, splits[0]);
+    EXPECT_FLOAT_EQ(100.0f, splits[1]);
+
+    // uniform
+    params.cascadeSplitLambda = 0.0f;
+    ShadowMap::computeCascadeSplits(splits, 4, 1.0f, 81.0f, params);
+    EXPECT_FLOAT_EQ(1.0f, splits[0]);
+    EXPECT_FLOAT_EQ(21.0f, splits[1]);
+    EXPECT_FLOAT_EQ(41.0f, splits[2]);
+    EXPECT_FLOAT_EQ(61.0f, splits[3]);
+    EXPECT_FLOAT_EQ(81.0f, splits[4]);
+
+    // logarithmic
+    params.cascadeSplitLambda = 1.0f;
+    ShadowMap::computeCascadeSplits(splits, 4, 1.0f, 81.0f, params);
+    EXPECT_FLOAT_EQ(3.0f, splits[1]);
+    EXPECT_FLOAT_EQ(9.0f, splits[2]);
+    EXPECT_FLOAT_EQ(27.0f, splits[3]);
+
+    // blend of both
+    params.cascadeSplitLambda = 0.5f;
+    ShadowMap::computeCascadeSplits(splits, 2, 1.0f, 81.0f, params);
+    EXPECT_FLOAT_EQ(25.0f, splits[1]);
+
+    // the logarithmic split needs a positive near plane
+    params.cascadeSplitLambda = 1.0f;
+    ShadowMap::computeCascadeSplits(splits, 2, 0.0f, 10.0f, params);
+    EXPECT_FLOAT_EQ(5.0f, splits[1]);
+
+    // explicit positions win
+    params.cascadeSplitPositions[0] = 0.25f;
+    params.cascadeSplitPositions[1] = 0.5f;
+    ShadowMap::computeCascadeSplits(splits, 3, 0.0f, 100.0f, params);
+    EXPECT_FLOAT_EQ(25.0f, splits[1]);
+    EXPECT_FLOAT_EQ(50.0f, splits[2]);
+    EXPECT_FLOAT_EQ(100.0f, splits[3]);
+}
+
+TEST(FilamentTest, StaticShadowCastersVersion) {
+    using filament::details::FEngine;
+    using filament::details::FScene;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FScene* scene = engine->createScene();
+    auto& rcm = engine->getRenderableManager();
+    auto& tcm = engine->getTransformManager();
+    EntityManager& em = engine->getEntityManager();
+
+    Entity staticCaster = em.create();
+    Entity dynamicCaster = em.create();
+    RenderableManager::Builder(0)
+            .boundingBox({{ 0, 0, 0 }, { 1, 1, 1 }})
+            .castShadows(true)
+            .staticShadowCaster(true)
+            .build(*engine, staticCaster);
+    RenderableManager::Builder(0)
+            .boundingBox({{ 0, 0, 0 }, { 1, 1, 1 }})
+            .castShadows(true)
+            .build(*engine, dynamicCaster);
+    EXPECT_TRUE(rcm.isStaticShadowCaster(rcm.getInstance(staticCaster)));
+    EXPECT_FALSE(rcm.isStaticShadowCaster(rcm.getInstance(dynamicCaster)));
+
+    // adding a static shadow caster changes the version
+    scene->addEntity(staticCaster);
+    scene->addEntity(dynamicCaster);
+    scene->prepare({});
+    uint64_t version = scene->getStaticShadowCastersVersion();
+    EXPECT_NE(0, version);
+
+    // nothing changed
+    scene->prepare({});
+    EXPECT_EQ(version, scene->getStaticShadowCastersVersion());
+
+    // the dynamic shadow casters don't matter
+    tcm.setTransform(tcm.getInstance(dynamicCaster), mat4f::translate(float3{ 1, 0, 0 }));
+    scene->prepare({});
+    EXPECT_EQ(version, scene->getStaticShadowCastersVersion());
+
+    // moving a static shadow caster does
+    tcm.setTransform(tcm.getInstance(staticCaster), mat4f::translate(float3{ 1, 0, 0 }));
+    scene->prepare({});
+    EXPECT_LT(version, scene->getStaticShadowCastersVersion());
+    version = scene->getStaticShadowCastersVersion();
+
+    // so does making a shadow caster static, or dynamic
+    rcm.setStaticShadowCaster(rcm.getInstance(dynamicCaster), true);
+    scene->prepare({});
+    EXPECT_LT(version, scene->getStaticShadowCastersVersion());
+    version = scene->getStaticShadowCastersVersion();
+
+    rcm.setStaticShadowCaster(rcm.getInstance(dynamicCaster), false);
+    scene->prepare({});
+    EXPECT_LT(version, scene->getStaticShadowCastersVersion());
+    version = scene->getStaticShadowCastersVersion();
+
+    // and removing a static shadow caster
+    scene->remove(staticCaster);
+    scene->prepare({});
+    EXPECT_LT(version, scene->getStaticShadowCastersVersion());
+
+    rcm.destroy(staticCaster);
+    rcm.destroy(dynamicCaster);
+    em.destroy(staticCaster);
+    em.destroy(dynamicCaster);
+    static_cast<Engine*>(engine)->destroy(scene);
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, ShadowAtlasAllocator) {
+    filament::details::ShadowAtlasAllocator allocator;
+    allocator.init(256, 32);
+    EXPECT_EQ(256, allocator.getDimension());
+    EXPECT_EQ(32, allocator.getMinTileDimension());
+
+    auto overlap = [](Viewport const& a, Viewport const& b) {
+        return a.left < b.left + int32_t(b.width) && b.left < a.left + int32_t(a.width) &&
+               a.bottom < b.bottom + int32_t(b.height) && b.bottom < a.bottom + int32_t(a.height);
+    };
+
+    // the tiles are allocated in the partially used tiles first
+    Viewport big = allocator.allocate(128);
+    EXPECT_EQ(0, big.left);
+    EXPECT_EQ(0, big.bottom);
+    EXPECT_EQ(128, big.width);
+    EXPECT_EQ(128, big.height);
+
+    Viewport small = allocator.allocate(64);
+    EXPECT_EQ(128, small.left);
+    EXPECT_EQ(0, small.bottom);
+    EXPECT_EQ(64, small.width);
+
+    std::vector<Viewport> tiles = { big, small };
+    tiles.push_back(allocator.allocate(64));
+    EXPECT_EQ(192, tiles.back().left);
+    EXPECT_EQ(0, tiles.back().bottom);
+
+    // sizes out of range
+    EXPECT_TRUE(allocator.allocate(512).empty());
+    EXPECT_TRUE(allocator.allocate(16).empty());
+    EXPECT_TRUE(allocator.allocate(256).empty());
+
+    // fill the atlas, the tiles never overlap
+    for (size_t i = 0; i < 10; i++) {
+        Viewport tile = allocator.allocate(64);
+        ASSERT_FALSE(tile.empty());
+        EXPECT_LE(tile.left + 64, 256);
+        EXPECT_LE(tile.bottom + 64, 256);
+        for (Viewport const& other : tiles) {
+            EXPECT_FALSE(overlap(tile, other));
+        }
+        tiles.push_back(tile);
+    }
+    EXPECT_TRUE(allocator.allocate(64).empty());
+    EXPECT_TRUE(allocator.allocate(32).empty());
+
+    // a freed tile can be allocated again, whole or split
+    allocator.free(big);
+    Viewport tile = allocator.allocate(32);
+    EXPECT_EQ(0, tile.left);
+    EXPECT_EQ(0, tile.bottom);
+    allocator.free(tile);
+    tile = allocator.allocate(128);
+    EXPECT_EQ(0, tile.left);
+    EXPECT_EQ(0, tile.bottom);
+    EXPECT_EQ(128, tile.width);
+    tiles[0] = tile;
+
+    // freeing all the tiles merges them back into the whole atlas
+    for (Viewport const& t : tiles) {
+        allocator.free(t);
+    }
+    tile = allocator.allocate(256);
+    EXPECT_EQ(0, tile.left);
+    EXPECT_EQ(0, tile.bottom);
+    EXPECT_EQ(256, tile.width);
+}
+
 TEST(FilamentTest, ColorConversion) {
     // Linear to Gamma
     // 0.0 stays 0.0
@@ -467,7 +1357,8 @@ TEST(FilamentTest, FroxelData) {
     // (unfortunately there is no way to guarantee it as it depends on the max # of froxel
     // used by the engine). We do this to infer the value of the left and right most planes
     // to check if they're computed correctly.
-    Viewport vp(0, 0, 1280, 640);
+    // 1408x704 works with both 8192 and 16384 froxels.
+    Viewport vp(0, 0, 1408, 704);
     mat4f p = mat4f::perspective(90, 1.0f, 0.1, 100, mat4f::Fov::HORIZONTAL);
 
     Froxelizer froxelData(*engine);
@@ -519,8 +1410,8 @@ TEST(FilamentTest, FroxelData) {
     LightManager::Instance instance = engine->getLightManager().getInstance(e);
 
     FScene::LightSoa lights;
-    lights.push_back({}, {}, {}, {}, {});   // first one is always skipped
-    lights.push_back(float4{ 0, 0, -5, 1 }, {}, instance, 1, {});
+    lights.push_back({}, {}, {}, {}, {}, {});   // first one is always skipped
+    lights.push_back(float4{ 0, 0, -5, 1 }, {}, instance, 1, {}, {});
 
     {
         froxelData.froxelizeLights(*engine, {}, lights);
@@ -555,6 +1446,249 @@ TEST(FilamentTest, FroxelData) {
         EXPECT_GT(pointCount, 0);
     }
 
+    {
+        // more lights per froxel than a byte can count, all lighting the same froxels
+        FScene::LightSoa manyLights;
+        manyLights.push_back({}, {}, {}, {}, {}, {});   // first one is always skipped
+        for (size_t i = 0; i < 300; i++) {
+            manyLights.push_back(float4{ 0, 0, -3, 1 }, {}, instance, 1, {}, {});
+        }
+
+        froxelData.froxelizeLights(*engine, {}, manyLights);
+        auto const& froxelBuffer = froxelData.getFroxelBufferUser();
+        auto const& recordBuffer = froxelData.getRecordBufferUser();
+        size_t litCount = 0;
+        for (const auto& entry : froxelBuffer) {
+            EXPECT_TRUE(entry.pointLightCount == 0 || entry.pointLightCount == 300);
+            EXPECT_EQ(entry.spotLightCount, 0);
+            if (entry.pointLightCount) {
+                EXPECT_LE(entry.offset + entry.pointLightCount, recordBuffer.size());
+                litCount++;
+            }
+        }
+        EXPECT_GT(litCount, 1);
+        // identical light lists of neighboring froxels share their records
+        EXPECT_LT(recordBuffer.size(), litCount * 300);
+    }
+
+    froxelData.terminate(engine->getDriverApi());
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, FroxelDataInvalidation) {
+    using namespace filament;
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    LinearAllocatorArena arena("FRenderer: per-frame allocator", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+
+    Entity e = engine->getEntityManager().create();
+    LightManager::Builder(LightManager::Type::POINT).build(*engine, e);
+    LightManager::Instance instance = engine->getLightManager().getInstance(e);
+
+    Viewport vp(0, 0, 1408, 704);
+    const mat4f p = mat4f::perspective(90, 1.0f, 0.1, 100, mat4f::Fov::HORIZONTAL);
+    CameraInfo camera{};
+    FScene::LightSoa lights;
+    lights.push_back({}, {}, {}, {}, {}, {});   // first one is always skipped
+    lights.push_back(float4{ 0, 0, -3, 1 }, {}, instance, 1, {}, {});
+
+    // each step prepares and froxelizes like a frame would
+    auto froxelize = [&](Froxelizer& froxelizer) {
+        utils::ArenaScope<LinearAllocatorArena> scope(arena);
+        froxelizer.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100);
+        froxelizer.froxelizeLights(*engine, camera, lights);
+        engine->flush();
+    };
+
+    // the froxels and records must be the ones of a froxelizer that never saw the previous steps
+    Froxelizer froxelData(*engine);
+    froxelData.setOptions(5, 100);
+    auto expectRecomputed = [&]() {
+        froxelize(froxelData);
+        EXPECT_FALSE(froxelData.isFroxelizationSkipped());
+
+        Froxelizer reference(*engine);
+        reference.setOptions(5, 100);
+        froxelize(reference);
+        auto const& froxels = froxelData.getFroxelBufferUser();
+        auto const& expectedFroxels = reference.getFroxelBufferUser();
+        ASSERT_EQ(expectedFroxels.size(), froxels.size());
+        size_t lit = 0;
+        for (size_t i = 0; i < froxels.size(); i++) {
+            EXPECT_EQ(expectedFroxels[i].offset, froxels[i].offset);
+            EXPECT_EQ(expectedFroxels[i].pointLightCount, froxels[i].pointLightCount);
+            EXPECT_EQ(expectedFroxels[i].spotLightCount, froxels[i].spotLightCount);
+            lit += froxels[i].pointLightCount;
+        }
+        EXPECT_GT(lit, 0);
+        auto const& records = froxelData.getRecordBufferUser();
+        auto const& expectedRecords = reference.getRecordBufferUser();
+        ASSERT_EQ(expectedRecords.size(), records.size());
+        EXPECT_TRUE(std::equal(records.begin(), records.end(), expectedRecords.begin()));
+        reference.terminate(engine->getDriverApi());
+    };
+
+    expectRecomputed();
+
+    // nothing changed
+    froxelize(froxelData);
+    EXPECT_TRUE(froxelData.isFroxelizationSkipped());
+
+    // the camera moves
+    camera.view = mat4f::translate(float3{ 1, 0, 0 });
+    expectRecomputed();
+    froxelize(froxelData);
+    EXPECT_TRUE(froxelData.isFroxelizationSkipped());
+
+    // the viewport changes, which changes the froxels
+    vp = Viewport(0, 0, 704, 704);
+    expectRecomputed();
+    froxelize(froxelData);
+    EXPECT_TRUE(froxelData.isFroxelizationSkipped());
+
+    // the light moves
+    lights.elementAt<FScene::POSITION_RADIUS>(1) = float4{ 0, 0, -8, 1 };
+    expectRecomputed();
+    froxelize(froxelData);
+    EXPECT_TRUE(froxelData.isFroxelizationSkipped());
+
+    // the light's radius changes
+    lights.elementAt<FScene::POSITION_RADIUS>(1) = float4{ 0, 0, -8, 2 };
+    expectRecomputed();
+
+    froxelData.terminate(engine->getDriverApi());
+    engine->getEntityManager().destroy(e);
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, FroxelLayout) {
+    using namespace filament;
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+
+    LinearAllocatorArena arena("FRenderer: per-frame allocator", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+    utils::ArenaScope<LinearAllocatorArena> scope(arena);
+
+    // landscape, ultrawide and portrait viewports
+    const Viewport viewports[] = {
+            { 0, 0, 1920, 1080 },
+            { 0, 0, 3440, 1440 },
+            { 0, 0, 1080, 2340 },
+    };
+
+    for (Viewport const& vp : viewports) {
+        const float aspect = float(vp.width) / vp.height;
+        mat4f p = mat4f::perspective(60, aspect, 0.1, 100);
+
+        for (size_t lightCount : { 1000, 1 }) {
+            Froxelizer froxelData(*engine);
+            froxelData.setOptions(5, 100);
+            froxelData.setLightCount(lightCount);
+            froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100);
+            engine->flush();
+
+            const size_t countX = froxelData.getFroxelCountX();
+            const size_t countY = froxelData.getFroxelCountY();
+            const size_t countZ = froxelData.getFroxelCountZ();
+
+            // with few lights, the z-slices are traded for x-y resolution
+            EXPECT_EQ(lightCount == 1 ?
+                    FEngine::CONFIG_FROXEL_SLICE_COUNT / 2 : FEngine::CONFIG_FROXEL_SLICE_COUNT,
+                    countZ);
+
+            // the grid fills most of the froxel buffer, whatever the aspect ratio
+            EXPECT_LE(countX * countY * countZ, FROXEL_BUFFER_ENTRY_COUNT_MAX);
+            EXPECT_GE(countX * countY * countZ, FROXEL_BUFFER_ENTRY_COUNT_MAX * 3 / 4);
+
+            // and the froxels are close to square
+            const float froxelAspect = (float(vp.width) / countX) / (float(vp.height) / countY);
+            EXPECT_GT(froxelAspect, 0.75f);
+            EXPECT_LT(froxelAspect, 1.33f);
+
+            // neighboring froxels share their planes
+            for (size_t z = 0; z < countZ; z++) {
+                for (size_t y = 0; y < countY; y++) {
+                    for (size_t x = 0; x < countX; x++) {
+                        Froxel f = froxelData.getFroxelAt(x, y, z);
+                        if (x + 1 < countX) {
+                            Froxel r = froxelData.getFroxelAt(x + 1, y, z);
+                            EXPECT_TRUE(f.planes[Froxel::RIGHT] == -r.planes[Froxel::LEFT]);
+                        }
+                        if (y + 1 < countY) {
+                            Froxel t = froxelData.getFroxelAt(x, y + 1, z);
+                            EXPECT_TRUE(f.planes[Froxel::TOP] == -t.planes[Froxel::BOTTOM]);
+                        }
+                        if (z + 1 < countZ) {
+                            Froxel n = froxelData.getFroxelAt(x, y, z + 1);
+                            EXPECT_TRUE(f.planes[Froxel::FAR] == -n.planes[Froxel::NEAR]);
+                        }
+                    }
+                }
+            }
+
+            // the first and last z-slices span the light near and far planes
+            EXPECT_FLOAT_EQ(  5, -froxelData.getFroxelAt(0, 0, 0).planes[Froxel::FAR].w);
+            EXPECT_FLOAT_EQ(100, -froxelData.getFroxelAt(0, 0, countZ - 1).planes[Froxel::FAR].w);
+
+            froxelData.terminate(engine->getDriverApi());
+        }
+    }
+
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, FroxelIndexBeyondLightFar) {
+    using namespace filament;
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+
+    LinearAllocatorArena arena("FRenderer: per-frame allocator", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+    utils::ArenaScope<LinearAllocatorArena> scope(arena);
+
+    // the camera sees past the light far plane
+    const Viewport vp = { 0, 0, 1920, 1080 };
+    const mat4f p = mat4f::perspective(60, float(vp.width) / vp.height, 0.1, 1000);
+
+    Froxelizer froxelData(*engine);
+    froxelData.setOptions(5, 100);
+    froxelData.setLightCount(1000);
+    froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 1000);
+    engine->flush();
+
+    UniformBuffer u(sizeof(PerViewUib));
+    froxelData.updateUniforms(u);
+    const float4 zParams = u.getUniform<float4>(offsetof(PerViewUib, zParams));
+    const uint2 fParams = u.getUniform<uint2>(offsetof(PerViewUib, fParams));
+    const uint32_t fParamsX = u.getUniform<uint32_t>(offsetof(PerViewUib, fParamsX));
+
+    // same as getFroxelCoords() and getFroxelIndex() in light_punctual.fs
+    auto getFroxelIndex = [&](uint32_t x, uint32_t y, float vz) {
+        const float4 clip = p * float4{ 0, 0, vz, 1 };
+        const float fz = (clip.z / clip.w) * 0.5f + 0.5f;
+        const float z = std::log2(zParams.x * fz + zParams.y) * zParams.z + zParams.w;
+        const uint32_t iz = uint32_t(std::min(std::max(z, 0.0f), zParams.w - 1.0f));
+        return x * fParamsX + y * fParams.x + iz * fParams.y;
+    };
+
+    const uint32_t countX = uint32_t(froxelData.getFroxelCountX());
+    const uint32_t countZ = uint32_t(froxelData.getFroxelCountZ());
+    const uint32_t lastSlice = countZ - 1;
+    for (uint32_t x : { 0u, countX / 2, countX - 1 }) {
+        const uint32_t expected = x * fParamsX + lastSlice * fParams.y;
+        // fragments beyond the light far plane use the last slice of their own column,
+        // not the froxels of the next column
+        EXPECT_EQ(expected, getFroxelIndex(x, 0, -150.0f));
+        EXPECT_EQ(expected, getFroxelIndex(x, 0, -900.0f));
+        // just before the light far plane is the last slice too
+        EXPECT_EQ(expected, getFroxelIndex(x, 0, -99.0f));
+    }
+
     froxelData.terminate(engine->getDriverApi());
     engine->shutdown();
     delete engine;
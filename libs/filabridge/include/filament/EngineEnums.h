@@ -40,7 +40,7 @@ namespace BindingPoints {
     constexpr uint8_t PER_VIEW                = 0;    // uniforms/samplers updated per view
     constexpr uint8_t PER_RENDERABLE          = 1;    // uniforms/samplers updated per renderable
     constexpr uint8_t PER_RENDERABLE_BONES    = 2;    // bones data, per renderable
-    constexpr uint8_t LIGHTS                  = 3;    // lights data array
+    constexpr uint8_t LIGHTS                  = 3;    // unused, lights are in a per-view sampler
     constexpr uint8_t POST_PROCESS            = 4;    // samplers for the post process pass
     constexpr uint8_t PER_MATERIAL_INSTANCE   = 5;    // uniforms/samplers updates per material
     constexpr uint8_t COUNT                   = 6;
@@ -53,15 +53,29 @@ constexpr uint32_t ATTRIBUTE_INDEX_COUNT = 7;
 constexpr size_t MAX_ATTRIBUTE_BUFFERS_COUNT = 8; // FIXME: should match Driver::MAX_ATTRIBUTE_BUFFER_COUNT
 constexpr size_t MAX_SAMPLER_COUNT = 16; // Matches the Adreno Vulkan driver.
 
-// This value is limited by UBO size, ES3.0 only guarantees 16 KiB.
-// Values <= 256, use less CPU and GPU resources.
-constexpr size_t CONFIG_MAX_LIGHT_COUNT = 256;
+// The lights are stored in a texture, this value is limited by the size of the froxel records
+// (16 bits per light index) and by the CPU and GPU resources used by the froxelization.
+constexpr size_t CONFIG_MAX_LIGHT_COUNT = 4096;
 constexpr size_t CONFIG_MAX_LIGHT_INDEX = CONFIG_MAX_LIGHT_COUNT - 1;
 
 // This value is also limited by UBO size, ES3.0 only guarantees 16 KiB.
 // We store 64 bytes per bone.
 constexpr size_t CONFIG_MAX_BONE_COUNT = 256;
 
+// Maximum number of instances drawn by a single instanced draw call. This is also limited by
+// UBO size, ES3.0 only guarantees 16 KiB; we store 256 bytes per instance (PerRenderableUib).
+constexpr size_t CONFIG_MAX_INSTANCES = 64;
+
+// Maximum number of levels of detail of a renderable.
+constexpr size_t CONFIG_MAX_LOD_COUNT = 4;
+
+// Maximum number of cascades of a directional light's shadow map.
+constexpr size_t CONFIG_MAX_SHADOW_CASCADES = 4;
+
+// Maximum number of shadow maps of the point and spot lights, a spot light uses one, a point
+// light six (one per cube face). This is also limited by UBO size, we store 64 bytes per map.
+constexpr size_t CONFIG_MAX_LOCAL_SHADOW_MAPS = 24;
+
 // can't really use std::underlying_type<AttributeIndex>::type because the driver takes a uint32_t
 using AttributeBitset = utils::bitset32;
 
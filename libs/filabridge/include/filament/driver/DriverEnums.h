@@ -103,6 +103,8 @@ struct RenderPassParams {
     // Extra RenderPass-only flags stashed in the "clear" field.
     static const uint8_t IGNORE_SCISSOR = 0x10;
     static const uint8_t IGNORE_VIEWPORT = 0x20;
+    // Only clear the render area (left, bottom, width, height), not the whole render target.
+    static const uint8_t CLEAR_RENDER_AREA = 0x40;
 };
 
 /**
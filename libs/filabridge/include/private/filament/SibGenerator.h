@@ -36,12 +36,15 @@ struct PerViewSib {
         return SibGenerator::getPerViewSib();
     }
     // indices of each samplers in this SamplerInterfaceBlock (see: getSib())
-    static constexpr size_t SHADOW_MAP     = 0;
-    static constexpr size_t RECORDS        = 1;
-    static constexpr size_t FROXELS        = 2;
-    static constexpr size_t IBL_DFG_LUT    = 3;
-    static constexpr size_t IBL_SPECULAR   = 4;
-    static constexpr size_t IBL_IRRADIANCE = 5;
+    static constexpr size_t SHADOW_MAP        = 0;
+    static constexpr size_t STATIC_SHADOW_MAP = 1;
+    static constexpr size_t LOCAL_SHADOW_MAP  = 2;
+    static constexpr size_t RECORDS           = 3;
+    static constexpr size_t FROXELS           = 4;
+    static constexpr size_t LIGHTS            = 5;
+    static constexpr size_t IBL_DFG_LUT       = 6;
+    static constexpr size_t IBL_SPECULAR      = 7;
+    static constexpr size_t IBL_IRRADIANCE    = 8;
 };
 
 struct PostProcessSib {
@@ -18,6 +18,8 @@
 #define TNT_FILABRIDGE_UIBGENERATOR_H
 
 
+#include <filament/EngineEnums.h>
+
 #include <math/mat4.h>
 #include <math/vec4.h>
 
@@ -29,7 +31,6 @@ class UibGenerator {
 public:
     static UniformInterfaceBlock const& getPerViewUib() noexcept;
     static UniformInterfaceBlock const& getPerRenderableUib() noexcept;
-    static UniformInterfaceBlock const& getLightsUib() noexcept;
     static UniformInterfaceBlock const& getPostProcessingUib() noexcept;
     static UniformInterfaceBlock const& getPerRenderableBonesUib() noexcept;
 };
@@ -50,7 +51,7 @@ struct PerViewUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     filament::math::mat4f viewFromClipMatrix;
     filament::math::mat4f clipFromWorldMatrix;
     filament::math::mat4f worldFromClipMatrix;
-    filament::math::mat4f lightFromWorldMatrix;
+    filament::math::mat4f lightFromWorldMatrix[CONFIG_MAX_SHADOW_CASCADES]; // one per cascade
 
     filament::math::float4 resolution; // viewport width, height, 1/width, 1/height
 
@@ -64,7 +65,7 @@ struct PerViewUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     filament::math::float3 lightDirection;
     uint32_t fParamsX; // stride-x
 
-    filament::math::float3 shadowBias; // constant bias, normal bias, unused
+    filament::math::float3 shadowBias; // static shadow map (0 or 1), normal bias, directional shadows (0 or 1)
     float oneOverFroxelDimensionY;
 
     filament::math::float4 zParams; // froxel Z parameters
@@ -80,25 +81,41 @@ struct PerViewUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     alignas(16) filament::math::float4 iblSH[9]; // actually float3 entries (std140 requires float4 alignment)
 
     filament::math::float4 userTime;  // time(s), (double)time - (float)time, 0, 0
+
+    filament::math::float4 cascadeSplits;     // view-space far distance of each shadow cascade
+    filament::math::float4 cascadeTexelSizes; // world-space texel size of each shadow cascade
+
+    // one per shadow map of the point and spot lights, see LightsUib::spotScaleOffset
+    filament::math::mat4f localShadowMatrices[CONFIG_MAX_LOCAL_SHADOW_MAPS];
 };
 
 
 // PerRenderableUib must have an alignment of 256 to be compatible with all versions of GLES.
+// The shaders see the ObjectUniforms block as an array of mat4, PER_RENDERABLE_UIB_MAT4_COUNT per
+// instance, indexed by gl_InstanceID: the normal matrix is the upper-left 3x3 of the second one.
 struct alignas(256) PerRenderableUib {
     filament::math::mat4f worldFromModelMatrix;
     filament::math::mat3f worldFromModelNormalMatrix;
 };
 
+static constexpr size_t PER_RENDERABLE_UIB_MAT4_COUNT =
+        sizeof(PerRenderableUib) / sizeof(filament::math::mat4f);
+
+// The punctual lights are stored in a float4 texture rather than a UBO, whose size is limited to
+// 16 KiB on ES3.0. LightsUib is the layout of one light, i.e. LIGHT_TEXELS_PER_LIGHT texels.
 struct LightsUib {
-    static const UniformInterfaceBlock& getUib() noexcept {
-        return UibGenerator::getLightsUib();
-    }
     filament::math::float4 positionFalloff;   // { float3(pos), 1/falloff^2 }
     filament::math::float4 colorIntensity;    // { float3(col), intensity }
     filament::math::float4 directionIES;      // { float3(dir), IES index }
-    filament::math::float4 spotScaleOffset;   // { scale, offset, unused, unused }
+    filament::math::float4 spotScaleOffset;   // { scale, offset, shadow index, normal bias }
 };
 
+// Make sure this matches the same constants in light_punctual.fs
+static constexpr size_t LIGHT_TEXELS_PER_LIGHT = sizeof(LightsUib) / sizeof(filament::math::float4);
+static constexpr size_t LIGHT_BUFFER_WIDTH_SHIFT = 6u;
+static constexpr size_t LIGHT_BUFFER_WIDTH = 1u << LIGHT_BUFFER_WIDTH_SHIFT;
+static constexpr size_t LIGHT_PER_ROW = LIGHT_BUFFER_WIDTH / LIGHT_TEXELS_PER_LIGHT;
+
 struct PostProcessingUib {
     static const UniformInterfaceBlock& getUib() noexcept {
         return UibGenerator::getPostProcessingUib();
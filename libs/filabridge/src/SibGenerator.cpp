@@ -30,8 +30,11 @@ SamplerInterfaceBlock const& SibGenerator::getPerViewSib() noexcept {
     static SamplerInterfaceBlock sib = SamplerInterfaceBlock::Builder()
             .name("Light")
             .add("shadowMap",     Type::SAMPLER_2D,      Format::SHADOW,Precision::LOW)
+            .add("staticShadowMap", Type::SAMPLER_2D,    Format::SHADOW,Precision::LOW)
+            .add("localShadowMap", Type::SAMPLER_2D,     Format::SHADOW,Precision::LOW)
             .add("records",       Type::SAMPLER_2D,      Format::UINT,  Precision::MEDIUM)
-            .add("froxels",       Type::SAMPLER_2D,      Format::UINT,  Precision::MEDIUM)
+            .add("froxels",       Type::SAMPLER_2D,      Format::UINT,  Precision::HIGH)
+            .add("punctualLights", Type::SAMPLER_2D,     Format::FLOAT, Precision::HIGH)
             .add("iblDFG",        Type::SAMPLER_2D,      Format::FLOAT, Precision::MEDIUM)
             .add("iblSpecular",   Type::SAMPLER_CUBEMAP, Format::FLOAT, Precision::MEDIUM)
             .build();
@@ -31,6 +31,9 @@ static_assert(sizeof(PerRenderableUib) % 256 == 0,
 static_assert(CONFIG_MAX_BONE_COUNT * sizeof(PerRenderableUibBone) <= 16384,
         "Bones exceed max UBO size");
 
+static_assert(CONFIG_MAX_INSTANCES * sizeof(PerRenderableUib) <= 16384,
+        "Instances exceed max UBO size");
+
 
 UniformInterfaceBlock const& UibGenerator::getPerViewUib() noexcept  {
     // IMPORTANT NOTE: Respect std140 layout, don't update without updating Engine::PerViewUib
@@ -43,7 +46,7 @@ UniformInterfaceBlock const& UibGenerator::getPerViewUib() noexcept  {
             .add("viewFromClipMatrix",      1, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             .add("clipFromWorldMatrix",     1, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             .add("worldFromClipMatrix",     1, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
-            .add("lightFromWorldMatrix",    1, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
+            .add("lightFromWorldMatrix",    CONFIG_MAX_SHADOW_CASCADES, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             // view
             .add("resolution",              1, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
             // camera
@@ -73,6 +76,11 @@ UniformInterfaceBlock const& UibGenerator::getPerViewUib() noexcept  {
             .add("iblSH",                   9, UniformInterfaceBlock::Type::FLOAT3)
             // user time
             .add("userTime",                1, UniformInterfaceBlock::Type::FLOAT4)
+            // shadow cascades
+            .add("cascadeSplits",           1, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
+            .add("cascadeTexelSizes",       1, UniformInterfaceBlock::Type::FLOAT4)
+            // point and spot lights shadows
+            .add("localShadowMatrices",     CONFIG_MAX_LOCAL_SHADOW_MAPS, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             .build();
     return uib;
 }
@@ -80,16 +88,9 @@ UniformInterfaceBlock const& UibGenerator::getPerViewUib() noexcept  {
 UniformInterfaceBlock const& UibGenerator::getPerRenderableUib() noexcept {
     static UniformInterfaceBlock uib =  UniformInterfaceBlock::Builder()
             .name("ObjectUniforms")
-            .add("worldFromModelMatrix",       1, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
-            .add("worldFromModelNormalMatrix", 1, UniformInterfaceBlock::Type::MAT3, Precision::HIGH)
-            .build();
-    return uib;
-}
-
-UniformInterfaceBlock const& UibGenerator::getLightsUib() noexcept {
-    static UniformInterfaceBlock uib = UniformInterfaceBlock::Builder()
-            .name("LightsUniforms")
-            .add("lights", CONFIG_MAX_LIGHT_COUNT, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
+            // see PerRenderableUib for the layout of each instance's data
+            .add("data", CONFIG_MAX_INSTANCES * PER_RENDERABLE_UIB_MAT4_COUNT,
+                    UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             .build();
     return uib;
 }
@@ -311,6 +311,8 @@ void GLSLPostProcessor::fullOptimization(const TShader& tShader,
                 CompilerGLSL::Options::Precision::Mediump : CompilerGLSL::Options::Precision::Highp;
         glslOptions.fragment.default_int_precision = glslOptions.es ?
                 CompilerGLSL::Options::Precision::Mediump : CompilerGLSL::Options::Precision::Highp;
+        // we never draw with a base instance, gl_InstanceIndex can become gl_InstanceID
+        glslOptions.vertex.support_nonzero_base_instance = false;
 
         CompilerGLSL glslCompiler(move(spirv));
         glslCompiler.set_common_options(glslOptions);
@@ -274,7 +274,8 @@ std::ostream& CodeGenerator::generateUniforms(std::ostream& out, ShaderType shad
 }
 
 std::ostream& CodeGenerator::generateSamplers(
-        std::ostream& out, uint8_t firstBinding, const SamplerInterfaceBlock& sib) const {
+        std::ostream& out, uint8_t firstBinding, const SamplerInterfaceBlock& sib,
+        uint32_t samplerMask) const {
     auto const& infos = sib.getSamplerInfoList();
     if (infos.empty()) {
         return out;
@@ -285,6 +286,10 @@ std::ostream& CodeGenerator::generateSamplers(
     instanceName.front() = char(std::tolower((unsigned char) instanceName.front()));
 
     for (auto const& info : infos) {
+        if (!(samplerMask & (1u << info.offset))) {
+            // skipped samplers keep their binding, so the others don't move
+            continue;
+        }
         auto type = info.type;
         if (type == SamplerType::SAMPLER_EXTERNAL && mShaderModel != ShaderModel::GL_ES_30) {
             // we're generating the shader for the desktop, where we assume external textures
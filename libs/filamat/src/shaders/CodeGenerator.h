@@ -90,9 +90,10 @@ public:
     std::ostream& generateUniforms(std::ostream& out, ShaderType type, uint8_t binding,
             const filament::UniformInterfaceBlock& uib) const;
 
-    // generate samplers
+    // generate samplers, only the ones whose bit (by offset in the block) is set in samplerMask
     std::ostream& generateSamplers(
-        std::ostream& out, uint8_t firstBinding, const filament::SamplerInterfaceBlock& sib) const;
+        std::ostream& out, uint8_t firstBinding, const filament::SamplerInterfaceBlock& sib,
+        uint32_t samplerMask = ~0u) const;
 
     // generate material properties getters
     std::ostream& generateMaterialProperty(std::ostream& out,
@@ -83,6 +83,25 @@ static void generateVertexDomain(const CodeGenerator& cg, std::stringstream& vs,
     }
 }
 
+// The shadow maps and the light buffers are only declared in the variants that sample them,
+// so that the other variants don't use up texture units for them.
+static uint32_t getPerViewSamplerMask(filament::Variant variant, bool litVariants,
+        bool lit) noexcept {
+    using filament::PerViewSib;
+    uint32_t mask = (1u << PerViewSib::IBL_DFG_LUT) | (1u << PerViewSib::IBL_SPECULAR);
+    if (litVariants && variant.hasShadowReceiver()) {
+        mask |= (1u << PerViewSib::SHADOW_MAP) | (1u << PerViewSib::STATIC_SHADOW_MAP);
+    }
+    if (lit && variant.hasDynamicLighting()) {
+        mask |= (1u << PerViewSib::RECORDS) | (1u << PerViewSib::FROXELS) |
+                (1u << PerViewSib::LIGHTS);
+        if (variant.hasShadowReceiver()) {
+            mask |= 1u << PerViewSib::LOCAL_SHADOW_MAP;
+        }
+    }
+    return mask;
+}
+
 static size_t countLines(const std::stringstream& ss) noexcept {
     std::string s = ss.str();
     size_t lines = 0;
@@ -160,6 +179,8 @@ const std::string ShaderGenerator::createVertexProgram(filament::driver::ShaderM
     cg.generateDefine(vs, "HAS_SHADOWING", litVariants && variant.hasShadowReceiver());
     cg.generateDefine(vs, "HAS_SHADOW_MULTIPLIER", material.hasShadowMultiplier);
     cg.generateDefine(vs, "HAS_SKINNING", variant.hasSkinning());
+    cg.generateDefine(vs, "PER_RENDERABLE_UIB_MAT4_COUNT",
+            uint32_t(filament::PER_RENDERABLE_UIB_MAT4_COUNT));
     cg.generateDefine(vs, getShadingDefine(material.shading), true);
     generateMaterialDefines(vs, cg, mProperties);
 
@@ -291,14 +312,12 @@ const std::string ShaderGenerator::createFragmentProgram(filament::driver::Shade
     // uniforms and samplers
     cg.generateUniforms(fs, ShaderType::FRAGMENT,
             BindingPoints::PER_VIEW, UibGenerator::getPerViewUib());
-    cg.generateUniforms(fs, ShaderType::FRAGMENT,
-            BindingPoints::LIGHTS, UibGenerator::getLightsUib());
     cg.generateUniforms(fs, ShaderType::FRAGMENT,
             BindingPoints::PER_MATERIAL_INSTANCE, material.uib);
     cg.generateSeparator(fs);
     cg.generateSamplers(fs,
             material.samplerBindings.getBlockOffset(BindingPoints::PER_VIEW),
-            SibGenerator::getPerViewSib());
+            SibGenerator::getPerViewSib(), getPerViewSamplerMask(variant, litVariants, lit));
     cg.generateSamplers(fs,
             material.samplerBindings.getBlockOffset(BindingPoints::PER_MATERIAL_INSTANCE),
             material.sib);
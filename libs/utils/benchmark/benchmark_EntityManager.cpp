@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <utils/EntityManager.h>
+#include <utils/compiler.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+using namespace utils;
+
+static constexpr size_t ENTITY_COUNT = 1024 * 1024;
+
+static void BM_EntityManager_createDestroy(benchmark::State& state) {
+    EntityManager& em = EntityManager::get();
+    const size_t n = size_t(state.range(0));
+    std::unique_ptr<Entity[]> entities(new Entity[n]);
+
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            em.create(n, entities.get());
+            em.destroy(n, entities.get());
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * n);
+}
+
+static void BM_EntityManager_isAlive(benchmark::State& state) {
+    EntityManager& em = EntityManager::get();
+    const size_t n = size_t(state.range(0));
+    std::unique_ptr<Entity[]> entities(new Entity[n]);
+    em.create(n, entities.get());
+
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            size_t alive = 0;
+            for (size_t i = 0; i < n; i++) {
+                alive += em.isAlive(entities[i]) ? 1 : 0;
+            }
+            benchmark::DoNotOptimize(alive);
+        }
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * n);
+
+    em.destroy(n, entities.get());
+}
+
+BENCHMARK(BM_EntityManager_createDestroy)->Arg(1024)->Arg(ENTITY_COUNT);
+BENCHMARK(BM_EntityManager_isAlive)->Arg(1024)->Arg(ENTITY_COUNT);
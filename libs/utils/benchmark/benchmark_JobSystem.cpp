@@ -21,6 +21,10 @@
 
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 using namespace utils;
 
 
@@ -72,7 +76,123 @@ static void BM_JobSystemParallelFor(benchmark::State& state) {
     state.SetItemsProcessed((int64_t)state.iterations() * 4096);
 }
 
+// stages of MAX_SUCCESSOR_COUNT jobs, each waiting for the whole previous stage
+static constexpr size_t STAGE_COUNT = 16;
+
+static void BM_JobSystemStagesWithBarriers(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            for (size_t s = 0; s < STAGE_COUNT; s++) {
+                auto stage = js.create(nullptr, &emptyJob);
+                for (size_t i = 0; i < JobSystem::MAX_SUCCESSOR_COUNT; i++) {
+                    js.run(js.create(stage, &emptyJob));
+                }
+                js.runAndWait(stage);
+            }
+        }
+    }
+    state.SetItemsProcessed(
+            (int64_t)state.iterations() * STAGE_COUNT * JobSystem::MAX_SUCCESSOR_COUNT);
+}
+
+static void BM_JobSystemStagesWithDependencies(benchmark::State& state) {
+    JobSystem js;
+    js.adopt();
+
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            // each stage's jobs are the successors of the previous stage's fence job
+            auto fence = js.create(nullptr, &emptyJob);
+            for (size_t s = 0; s < STAGE_COUNT; s++) {
+                auto next = js.create(nullptr, &emptyJob);
+                for (size_t i = 0; i < JobSystem::MAX_SUCCESSOR_COUNT; i++) {
+                    auto job = js.create(nullptr, &emptyJob);
+                    js.addDependency(fence, job);
+                    js.addDependency(job, next);
+                    js.run(job);
+                }
+                js.run(fence);
+                fence = next;
+            }
+            js.runAndWait(fence);
+        }
+    }
+    state.SetItemsProcessed(
+            (int64_t)state.iterations() * STAGE_COUNT * JobSystem::MAX_SUCCESSOR_COUNT);
+}
+
+// busy-waits, so that the jobs take the same time whether the machine is loaded or not
+static void spin(std::chrono::microseconds duration) {
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+// BACKGROUND jobs of 100us, replacing themselves as they complete, to keep all threads busy
+struct BackgroundLoad {
+    JobSystem::Job* root = nullptr;
+    std::atomic<bool> stop = { false };
+
+    void work(JobSystem& js, JobSystem::Job*) {
+        spin(std::chrono::microseconds(100));
+        if (!stop.load(std::memory_order_relaxed)) {
+            js.run(js.createJob<BackgroundLoad, &BackgroundLoad::work>(root, this));
+        }
+    }
+};
+
+/*
+ * Latency of a parallel_for() of 256us worth of work, run in the lane range(0), while all
+ * threads are saturated with background jobs. With range(1), only half of the worker threads
+ * run background jobs. BACKGROUND for range(0) is equivalent to not having lanes.
+ */
+static void BM_JobSystemCriticalLatency(benchmark::State& state) {
+    const auto lane = JobSystem::Lane(state.range(0));
+    JobSystem::Config config;
+    config.threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    config.backgroundThreadCount = state.range(1) ? std::max(size_t(1), config.threadCount / 2) : 0;
+    JobSystem js(config);
+    js.adopt();
+
+    BackgroundLoad load;
+    load.root = js.createJob();
+    js.setLane(load.root, JobSystem::Lane::BACKGROUND);
+    for (size_t i = 0, c = (config.threadCount + 1) * 2; i < c; i++) {
+        js.run(js.createJob<BackgroundLoad, &BackgroundLoad::work>(load.root, &load));
+    }
+    JobSystem::Job* root = js.runAndRetain(load.root);
+
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            auto job = jobs::parallel_for(js, nullptr, 0, 256, [](uint32_t start, uint32_t count) {
+                spin(std::chrono::microseconds(count));
+            }, jobs::CountSplitter<16>());
+            js.setLane(job, lane);
+            js.runAndWait(job);
+        }
+    }
+
+    load.stop = true;
+    js.waitAndRelease(root);
+    js.emancipate();
+}
+
 
 BENCHMARK(BM_JobSystem);
 BENCHMARK(BM_JobSystemAsChildren4k);
 BENCHMARK(BM_JobSystemParallelFor);
+BENCHMARK(BM_JobSystemStagesWithBarriers);
+BENCHMARK(BM_JobSystemStagesWithDependencies);
+BENCHMARK(BM_JobSystemCriticalLatency)
+        ->ArgNames({ "lane", "reserved" })
+        ->Args({ int(JobSystem::Lane::BACKGROUND), 0 })
+        ->Args({ int(JobSystem::Lane::CRITICAL), 0 })
+        ->Args({ int(JobSystem::Lane::CRITICAL), 1 })
+        ->UseRealTime()
+        ->Unit(benchmark::kMicrosecond);
@@ -45,6 +45,16 @@ public:
         return RAW_INDEX_COUNT - 1;
     }
 
+    // number of bytes currently used to store the generations, this grows with the number
+    // of entities created.
+    size_t getGenerationStorageSize() const noexcept {
+        size_t pageCount = 0;
+        for (uint8_t const* page : mGens) {
+            pageCount += page ? 1 : 0;
+        }
+        return pageCount * GENERATION_PAGE_SIZE;
+    }
+
     // create n entities. Thread safe.
     void create(size_t n, Entity* entities);
 
@@ -68,14 +78,21 @@ public:
     // Thread safe.
     bool isAlive(Entity e) const noexcept {
         assert(getIndex(e) < RAW_INDEX_COUNT);
-        return (!e.isNull()) && (getGeneration(e) == mGens[getIndex(e)]);
+        if (e.isNull()) {
+            return false;
+        }
+        // a stale or foreign Entity can have an index in a page that was never allocated
+        uint8_t const* const page = mGens[getIndex(e) >> GENERATION_PAGE_SHIFT];
+        return page && (getGeneration(e) == page[getIndex(e) & GENERATION_PAGE_MASK]);
     }
 
     // registers a listener to be called when an entity is destroyed. thread safe.
     // if the listener is already register, this method has no effect.
     void registerListener(Listener* l) noexcept;
 
-    // unregisters a listener.
+    // unregisters a listener. thread safe.
+    // the listener is never called after this returns, which makes it safe to destroy it.
+    // listeners must not register or unregister listeners from their callbacks.
     void unregisterListener(Listener* l) noexcept;
 
 
@@ -83,7 +100,7 @@ public:
 
     // current generation of the given index. Use for debugging and testing.
     uint8_t getGenerationForIndex(size_t index) const noexcept {
-        return mGens[index];
+        return mGens[index >> GENERATION_PAGE_SHIFT][index & GENERATION_PAGE_MASK];
     }
     // singleton, can't be copied
     EntityManager(const EntityManager& rhs) = delete;
@@ -94,12 +111,19 @@ private:
     EntityManager();
     ~EntityManager();
 
-    // GENERATION_SHIFT determines how many simultaneous Entities are available, the
-    // minimum memory requirement is 2^GENERATION_SHIFT bytes.
-    static constexpr const int GENERATION_SHIFT = 17;
+    // GENERATION_SHIFT determines how many simultaneous Entities are available. Generations are
+    // stored on 8 bits, so we use all the remaining bits of the identity for the index.
+    static constexpr const int GENERATION_SHIFT = 24;
     static constexpr const size_t RAW_INDEX_COUNT = (1 << GENERATION_SHIFT);
     static constexpr const Entity::Type INDEX_MASK = (1 << GENERATION_SHIFT) - 1u;
 
+    // Generations are stored in pages of 2^GENERATION_PAGE_SHIFT bytes, which are allocated
+    // on demand, the minimum memory requirement is a single page.
+    static constexpr const int GENERATION_PAGE_SHIFT = 16;
+    static constexpr const size_t GENERATION_PAGE_SIZE = (1 << GENERATION_PAGE_SHIFT);
+    static constexpr const size_t GENERATION_PAGE_MASK = GENERATION_PAGE_SIZE - 1u;
+    static constexpr const size_t GENERATION_PAGE_COUNT = RAW_INDEX_COUNT / GENERATION_PAGE_SIZE;
+
     static inline Entity::Type getGeneration(Entity e) noexcept {
         return e.getId() >> GENERATION_SHIFT;
     }
@@ -110,8 +134,9 @@ private:
         return (g << GENERATION_SHIFT) | (i & INDEX_MASK);
     }
 
-    // stores the generation of each index.
-    uint8_t * const mGens;
+    // stores the generation of each index. Pages are never freed or moved once allocated, which
+    // allows isAlive() to be called without holding a lock.
+    uint8_t* mGens[GENERATION_PAGE_COUNT] = {};
 };
 
 } // namespace utils
@@ -37,9 +37,16 @@
 namespace utils {
 
 class JobSystem {
-    static constexpr size_t MAX_JOB_COUNT = 4096;
-    static_assert(MAX_JOB_COUNT <= 0x7FFE, "MAX_JOB_COUNT must be <= 0x7FFE");
-    using WorkQueue = WorkStealingDequeue<uint16_t, MAX_JOB_COUNT>;
+    // Jobs are stored in blocks of JOB_BLOCK_SIZE. The first block is allocated upfront, the
+    // others only when all the existing ones are full, so that the common case doesn't allocate.
+    static constexpr size_t JOB_BLOCK_SIZE = 4096;
+    static constexpr size_t MAX_JOB_BLOCK_COUNT = 256;
+    static constexpr size_t MAX_JOB_COUNT = JOB_BLOCK_SIZE * MAX_JOB_BLOCK_COUNT;
+    static_assert(MAX_JOB_COUNT < 0xFFFFFFFF, "MAX_JOB_COUNT must be < 0xFFFFFFFF");
+    static_assert(!(JOB_BLOCK_SIZE & (JOB_BLOCK_SIZE - 1)), "JOB_BLOCK_SIZE must be a power of two");
+    static constexpr uint32_t NO_PARENT = 0xFFFFFFFF;
+    // work queues grow past JOB_BLOCK_SIZE entries as needed
+    using WorkQueue = WorkStealingDequeue<uint32_t, JOB_BLOCK_SIZE>;
 
 public:
     class Job;
@@ -64,26 +71,67 @@ public:
 
         // keep it first, so it's correctly aligned with all architectures
         // this is were we store the job's data, typically a std::function<>
+        // the job's function is stored with its JobInfo.
                                                                 // v7 | v8
         void* storage[JOB_STORAGE_SIZE_WORDS];                  // 48 | 48
-        JobFunc function;                                       //  4 |  8
-        uint16_t parent;                                        //  2 |  2
-        std::atomic<uint16_t> runningJobCount = { 1 };          //  2 |  2
+        uint32_t index;                                         //  4 |  4
+        uint32_t parent;                                        //  4 |  4
+        std::atomic<uint32_t> runningJobCount = { 1 };          //  4 |  4
         mutable std::atomic<uint16_t> refCount = { 1 };         //  2 |  2
-                                                                //  6 |  2 (padding)
+        // # of predecessors still running, +1 until run() is called
+        std::atomic<uint16_t> pendingCount = { 1 };             //  2 |  2
                                                                 // 64 | 64
     };
 
+    // maximum number of successors of a job, see addDependency()
+    static constexpr size_t MAX_SUCCESSOR_COUNT = 7;
+
+    /*
+     * Jobs are queued in one of these lanes. Each thread services its lanes in this order, and
+     * prefers stealing a job from a higher priority lane over running one of a lower priority
+     * lane from its own queue. Jobs are not preempted, a critical job can still wait for the
+     * jobs that are running when it's queued, see Config::backgroundThreadCount.
+     */
+    enum class Lane : uint8_t {
+        CRITICAL,       // e.g.: work the current frame is waiting on
+        NORMAL,         // the default
+        BACKGROUND      // e.g.: asset loading, anything that can be late
+    };
+    static constexpr size_t LANE_COUNT = 3;
+
+    enum class Affinity : uint8_t {
+        NONE,           // the worker threads can run on any core
+        GROUP,          // the worker threads can run on any core of Config::cpus
+        PINNED          // each worker thread runs on a single core of Config::cpus
+    };
+
+    struct Config {
+        // # of worker threads, 0 picks a value based on the number of cores (or of Config::cpus)
+        size_t threadCount = 0;
+        // # of threads that can be adopted, see adopt()
+        size_t adoptableThreadsCount = 1;
+        // # of worker threads that run BACKGROUND jobs, 0 for all. The others are kept available
+        // for the higher priority lanes. Adopted threads run all lanes.
+        size_t backgroundThreadCount = 0;
+        Affinity affinity = Affinity::PINNED;
+        // the cores the worker threads are placed on (e.g.: the cores of a NUMA node),
+        // all cores if empty. In PINNED mode, the worker threads are assigned these cores in
+        // turn.
+        std::vector<uint16_t> cpus;
+    };
+
     explicit JobSystem(size_t threadCount = 0, size_t adoptableThreadsCount = 1) noexcept;
 
+    explicit JobSystem(Config const& config) noexcept;
+
     ~JobSystem();
 
-    // Make the current thread part of the thread pool.
+    // Make the current thread part of the thread pool. Calls can be nested, e.g. when several
+    // users of a JobSystem run on the same thread, each must be matched by emancipate().
     void adopt();
 
-    // Remove this adopted thread from the parent. This is intended to be used for
-    // shutting down a JobSystem. In particular, this doesn't allow the parent to
-    // adopt more thread.
+    // Remove this adopted thread from the parent. Once all calls to adopt() are matched, the
+    // thread leaves the thread pool and its slot can be used by another thread.
     void emancipate();
 
 
@@ -92,9 +140,12 @@ public:
     static JobSystem* getJobSystem() noexcept;
 
     // If a parent is not specified when creating a job, that job will automatically take the
-    // master job as a parent.
+    // master job as a parent. Each thread has its own master job, and the jobs descending from
+    // a master job use it as well, whichever thread runs them. So no job created while
+    // the master job runs can escape it, yet the threads sharing a JobSystem don't see each
+    // other's master job.
     // The master job is reset when waited on.
-    Job* setMasterJob(Job* job) noexcept { return mMasterJob = job; }
+    Job* setMasterJob(Job* job) noexcept;
 
 
     Job* create(Job* parent, JobFunc func) noexcept;
@@ -216,6 +267,35 @@ public:
     }
 
 
+    /*
+     * Makes 'successor' wait for 'predecessor' to complete (that is, the predecessor and all its
+     * children) before it runs. A job is queued once run() has been called on it and all its
+     * predecessors completed, by whichever happens last and on that thread, so that a graph of
+     * jobs can be run without any thread waiting between its stages.
+     *
+     * Both jobs must have been created but not run yet, and the successor must not be canceled.
+     * A job can have up to MAX_SUCCESSOR_COUNT successors (an empty job can be used to fan-out
+     * more), returns false if there is no room left, in which case the dependency isn't added.
+     *
+     *  e.g.:
+     *   Job* a = js.createJob(...);
+     *   Job* b = js.createJob(...);
+     *   Job* c = js.createJob(...);
+     *   js.addDependency(a, c);
+     *   js.addDependency(b, c);
+     *   js.run(c);              // c will run after a and b complete
+     *   js.run(a);
+     *   js.run(b);
+     */
+    bool addDependency(Job* predecessor, Job* successor) noexcept;
+
+    /*
+     * Sets the lane a job is queued in, this must be done before it's run. By default, jobs are
+     * in their parent's lane (so that e.g. all the jobs of a parallel_for() are), and jobs
+     * without a parent are in the NORMAL lane.
+     */
+    void setLane(Job* job, Lane lane) noexcept;
+
     /*
      * Jobs are normally finished automatically, this can be used to cancel a job before it is run.
      *
@@ -324,16 +404,21 @@ private:
         }
     };
 
-    struct alignas(CACHELINE_SIZE) ThreadState {    // this causes 40-bytes padding
-        // make sure storage is cache-line aligned
-        WorkQueue workQueue;
+    struct alignas(CACHELINE_SIZE) ThreadState {    // this causes 8-bytes padding
+        // make sure storage is cache-line aligned, one queue per Lane
+        WorkQueue workQueues[LANE_COUNT];
 
         // these are not accessed by the worker threads
-        alignas(CACHELINE_SIZE)     // this causes 56-bytes padding
+        alignas(CACHELINE_SIZE)     // this causes 24-bytes padding
         JobSystem* js;
         std::thread thread;
+        Job* masterJob = nullptr;
         default_random_engine rndGen;
         uint32_t id;
+        uint32_t jobCount = 0;      // # of jobs executed, see execute()
+        uint8_t laneCount;          // # of lanes this thread runs jobs from
+        uint8_t adoptCount = 0;     // # of unmatched calls to adopt()
+        std::atomic<bool> adopted = { false };  // this adoptable slot is used
     };
 
     static_assert(sizeof(ThreadState) % CACHELINE_SIZE == 0,
@@ -345,32 +430,51 @@ private:
     void decRef(Job const* job) noexcept;
 
     Job* allocateJob() noexcept;
+    Job* allocateJobSlow() noexcept;
+    void destroyJob(Job const* job) noexcept;
     JobSystem::ThreadState* getStateToStealFrom(JobSystem::ThreadState& state) noexcept;
+    Job* stealFromOtherThread(JobSystem::ThreadState& state, size_t lane) noexcept;
     bool hasJobCompleted(Job const* job) noexcept;
+    bool hasActiveJobs(ThreadState const& state) const noexcept;
+    void setAffinity(ThreadState const& state) const noexcept;
 
     void requestExit() noexcept;
     bool exitRequested() const noexcept;
 
     void loop(ThreadState* state) noexcept;
     bool execute(JobSystem::ThreadState& state) noexcept;
+    void schedule(Job* job, uint32_t flags) noexcept;
+    void runSuccessors(Job const* job) noexcept;
     void finish(Job* job) noexcept;
 
+    struct JobInfo;
+
+    // the first block is always there, the others are only used when it's full
+    Job* getJob(uint32_t index) const noexcept {
+        assert(index < MAX_JOB_COUNT);
+        return UTILS_LIKELY(index < JOB_BLOCK_SIZE) ? mJobStorageBase + index : getJobSlow(index);
+    }
+
+    JobInfo& getInfo(uint32_t index) const noexcept {
+        assert(index < MAX_JOB_COUNT);
+        return UTILS_LIKELY(index < JOB_BLOCK_SIZE) ? mJobInfoBase[index] : getInfoSlow(index);
+    }
+
+    Job* getJobSlow(uint32_t index) const noexcept;
+    JobInfo& getInfoSlow(uint32_t index) const noexcept;
+
     void put(WorkQueue& workQueue, Job* job) noexcept {
-        size_t index = job - mJobStorageBase;
-        assert(index >= 0 && index < MAX_JOB_COUNT);
-        workQueue.push(uint16_t(index + 1));
+        workQueue.push(job->index + 1);
     }
 
     Job* pop(WorkQueue& workQueue) noexcept {
-        size_t index = workQueue.pop();
-        assert(index <= MAX_JOB_COUNT);
-        return !index ? nullptr : &mJobStorageBase[index - 1];
+        uint32_t index = workQueue.pop();
+        return !index ? nullptr : getJob(index - 1);
     }
 
     Job* steal(WorkQueue& workQueue) noexcept {
-        size_t index = workQueue.steal();
-        assert(index <= MAX_JOB_COUNT);
-        return !index ? nullptr : &mJobStorageBase[index - 1];
+        uint32_t index = workQueue.steal();
+        return !index ? nullptr : getJob(index - 1);
     }
 
     // these have thread contention, keep them together
@@ -380,12 +484,25 @@ private:
     utils::Mutex mWaiterLock;
     utils::Condition mWaiterCondition;
 
-    std::atomic<uint32_t> mActiveJobs = { 0 };
-    utils::Arena<utils::ThreadSafeObjectPoolAllocator<Job>, LockingPolicy::NoLock> mJobPool;
+    std::atomic<uint32_t> mActiveJobs[LANE_COUNT] = {}; // queued jobs, per lane
+
+    utils::Mutex mJobBlockLock;                         // only taken to add a block
+    std::atomic<uint32_t> mJobBlockCount = { 0 };
 
     template <typename T>
     using aligned_vector = std::vector<T, utils::STLAlignedAllocator<T>>;
 
+    // what we need to know about each job besides the Job itself, indexed like the job storage
+    struct JobInfo {
+        JobFunc function;
+        Lane lane;
+        uint8_t successorCount;
+        uint32_t master;                                // the master job we descend from
+        uint32_t successors[MAX_SUCCESSOR_COUNT];
+    };
+
+    struct JobBlock;                                    // Jobs and their JobInfo
+
     // these are essentially const, make sure they're on a different cache-lines than the
     // read-write atomics.
     // We can't use "alignas(CACHELINE_SIZE)" because the standard allocator can't make this
@@ -395,11 +512,15 @@ private:
     alignas(16) // at least we align to half (or quarter) cache-line
     aligned_vector<ThreadState> mThreadStates;          // actual data is stored offline
     std::atomic<bool> mExitRequested = { false };       // this one is almost never written
-    std::atomic<uint16_t> mAdoptedThreads = { 0 };      // this one is almost never written
-    Job* const mJobStorageBase;                         // Base for conversion to indices
+    std::atomic<uint16_t> mAdoptedThreads = { 0 };      // # of adoptable slots ever used
+    Job* mJobStorageBase = nullptr;                     // the first block's jobs
+    JobInfo* mJobInfoBase = nullptr;                    // the first block's JobInfo
+    JobBlock* mJobBlocks[MAX_JOB_BLOCK_COUNT] = {};     // mJobBlockCount are valid
+    std::vector<uint16_t> mCpus;                        // cores the worker threads are placed on
     uint16_t mThreadCount = 0;                          // total # of threads in the pool
     uint8_t mParallelSplitCount = 0;                    // # of split allowable in parallel_for
-    Job* mMasterJob = nullptr;
+    Affinity mAffinity = Affinity::PINNED;
+    bool mBackgroundLaneRestricted = false;             // not all threads run BACKGROUND jobs
 
     static UTILS_DECLARE_TLS(ThreadState *) sThreadState;
 };
@@ -115,6 +115,13 @@ public:
         return elementAt<ENTITY_INDEX>(i);
     }
 
+    // Makes room for 'count' more components, so that adding them doesn't reallocate.
+    // The capacity grows geometrically, so calling this before adding each component is cheap.
+    void reserve(size_t count) {
+        mData.ensureCapacity(mData.size() + count);
+        mInstanceMap.reserve(getComponentCount() + count);
+    }
+
     // Add a component to the given Entity. If the entity already has a component from this
     // manager, this function is a no-op.
     // This invalidates all pointers components.
@@ -17,30 +17,65 @@
 #ifndef TNT_UTILS_WORKSTEALINGDEQUEUE_H
 #define TNT_UTILS_WORKSTEALINGDEQUEUE_H
 
+#include <utils/compiler.h>
+
 #include <atomic>
 #include <cstddef>
 
 namespace utils {
 
+/*
+ * A Chase-Lev work-stealing dequeue. COUNT items are stored inline, when more are needed the
+ * items are moved to a heap-allocated buffer twice as large. Buffers are only freed when the
+ * dequeue is destroyed, because concurrent steal() could still be reading from them.
+ */
 template <typename TYPE, size_t COUNT>
 class WorkStealingDequeue {
     static_assert(!(COUNT & (COUNT - 1)), "COUNT must be a power of two");
-    static constexpr size_t MASK = COUNT - 1;
+
+    struct Buffer {
+        size_t mask;
+        TYPE* items;
+        Buffer* previous;   // the buffer this one replaced
+        TYPE get(int32_t index) const noexcept { return items[index & mask]; }
+        void set(int32_t index, TYPE item) noexcept { items[index & mask] = item; }
+    };
+
     std::atomic<int32_t> mTop = { 0 };      // written/read in pop()/steal()
     std::atomic<int32_t> mBottom = { 0 };   // written only in pop(), read in push(), steal()
+    std::atomic<Buffer*> mBuffer;           // written only in push(), read in pop(), steal()
+    Buffer mInlineBuffer;
     TYPE mItems[COUNT];
 
-    TYPE getItemAt(int32_t index) noexcept { return mItems[index & MASK]; }
-    void setItemAt(int32_t index, TYPE item) noexcept { mItems[index & MASK] = item; }
+    UTILS_NOINLINE Buffer* grow(Buffer* buffer, int32_t top, int32_t bottom) noexcept;
 
 public:
     using value_type = TYPE;
 
+    WorkStealingDequeue() noexcept
+            : mBuffer(&mInlineBuffer), mInlineBuffer{ COUNT - 1, mItems, nullptr } {
+    }
+
+    ~WorkStealingDequeue() noexcept {
+        Buffer* buffer = mBuffer.load(std::memory_order_relaxed);
+        while (buffer != &mInlineBuffer) {
+            Buffer* const previous = buffer->previous;
+            delete [] buffer->items;
+            delete buffer;
+            buffer = previous;
+        }
+    }
+
+    // the inline buffer can't be moved
+    WorkStealingDequeue(WorkStealingDequeue const&) = delete;
+    WorkStealingDequeue& operator=(WorkStealingDequeue const&) = delete;
+
     inline void push(TYPE item) noexcept;
     inline TYPE pop() noexcept;
     inline TYPE steal() noexcept;
 
-    size_t getSize() const noexcept { return COUNT; }
+    // current capacity, must be called from the thread calling push()
+    size_t getSize() const noexcept { return mBuffer.load(std::memory_order_relaxed)->mask + 1; }
 
     bool isEmpty() const noexcept {
         uint32_t bottom = (uint32_t)mBottom.load(std::memory_order_relaxed);
@@ -63,7 +98,18 @@ void WorkStealingDequeue<TYPE, COUNT>::push(TYPE item) noexcept {
     // mBottom is only written in pop() which cannot be concurrent with push(),
     // however, it is read in steal() so we need basic atomicity.
     int32_t bottom = mBottom.load(std::memory_order_relaxed);
-    setItemAt(bottom, item);
+
+    // mBuffer is only written here
+    Buffer* buffer = mBuffer.load(std::memory_order_relaxed);
+
+    // mTop can only have moved forward since, so we can't underestimate the free space. The
+    // slot we're writing was read by the steal() that moved mTop past it, memory_order_acquire
+    // makes sure that read happened before our write.
+    int32_t top = mTop.load(std::memory_order_acquire);
+    if (UTILS_UNLIKELY(size_t(bottom - top) > buffer->mask)) {
+        buffer = grow(buffer, top, bottom);
+    }
+    buffer->set(bottom, item);
 
     // memory accesses cannot be reordered after mBottom write, which notifies the
     // availability of an extra item.
@@ -81,15 +127,18 @@ TYPE WorkStealingDequeue<TYPE, COUNT>::pop() noexcept {
     // other threads before we read mTop.
     int32_t top = mTop.load(std::memory_order_seq_cst);
 
+    // mBuffer is only written in push(), which cannot be concurrent with pop()
+    Buffer const* const buffer = mBuffer.load(std::memory_order_relaxed);
+
     if (top < bottom) {
         // Queue isn't empty and it's not the last item, just return it.
-        return getItemAt(bottom);
+        return buffer->get(bottom);
     }
 
     TYPE item{};
     if (top == bottom) {
         // We took the last item in the queue
-        item = getItemAt(bottom);
+        item = buffer->get(bottom);
 
         // Items can be added only in push() which isn't concurrent to us, however we could
         // be racing with a steal() -- pretend to steal from ourselves to resolve this
@@ -129,8 +178,11 @@ TYPE WorkStealingDequeue<TYPE, COUNT>::steal() noexcept {
             return TYPE();
         }
 
-        // The queue isn't empty
-        TYPE item(getItemAt(top));
+        // The queue isn't empty. The buffer must be read after mBottom, so it's at least as recent
+        // as the push() of the item we're stealing. If push() replaced it since, the item is
+        // still in the previous buffer, which is not written to anymore.
+        Buffer const* const buffer = mBuffer.load(std::memory_order_acquire);
+        TYPE item(buffer->get(top));
         if (mTop.compare_exchange_strong(top, top + 1,
                 std::memory_order_seq_cst,
                 std::memory_order_relaxed)) {
@@ -142,6 +194,19 @@ TYPE WorkStealingDequeue<TYPE, COUNT>::steal() noexcept {
     } while (true);
 }
 
+template <typename TYPE, size_t COUNT>
+typename WorkStealingDequeue<TYPE, COUNT>::Buffer* WorkStealingDequeue<TYPE, COUNT>::grow(
+        Buffer* buffer, int32_t top, int32_t bottom) noexcept {
+    const size_t size = (buffer->mask + 1) * 2;
+    Buffer* const newBuffer = new Buffer{ size - 1, new TYPE[size], buffer };
+    for (int32_t i = top; i < bottom; i++) {
+        newBuffer->set(i, buffer->get(i));
+    }
+    // the items must be visible to steal() once it sees the new buffer
+    mBuffer.store(newBuffer, std::memory_order_release);
+    return newBuffer;
+}
+
 
 } // namespace utils
 
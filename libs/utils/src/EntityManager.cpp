@@ -18,14 +18,17 @@
 
 namespace utils {
 
-EntityManager::EntityManager()
-        : mGens(new uint8_t[RAW_INDEX_COUNT]) {
+EntityManager::EntityManager() {
+    // the first page is always needed, since index 0 is reserved
+    mGens[0] = new uint8_t[GENERATION_PAGE_SIZE];
     // initialize all the generations to 0
-    std::fill_n(mGens, RAW_INDEX_COUNT, 0);
+    std::fill_n(mGens[0], GENERATION_PAGE_SIZE, 0);
 }
 
 EntityManager::~EntityManager() {
-    delete [] mGens;
+    for (uint8_t* page : mGens) {
+        delete [] page;
+    }
 }
 
 EntityManager& EntityManager::get() noexcept {
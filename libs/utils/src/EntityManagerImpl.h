@@ -25,6 +25,7 @@
 
 #include <tsl/robin_set.h>
 
+#include <algorithm>
 #include <deque>
 #include <mutex> // for std::lock_guard
 #include <vector>
@@ -45,7 +46,6 @@ public:
     void create(size_t n, Entity* entities) {
         Entity::Type index;
         auto& freeList = mFreeList;
-        uint8_t* const gens = mGens;
 
         // this must be thread-safe, acquire the free-list mutex
         std::lock_guard<Mutex> lock(mFreeListLock);
@@ -71,15 +71,19 @@ public:
                 // we're always in the slower case above. The idea is that we have enough indices
                 // that it doesn't happen in practice.
                 index = currentIndex++;
+                if (UTILS_UNLIKELY((index & GENERATION_PAGE_MASK) == 0)) {
+                    // we're entering a page we never used, allocate it now. Indices from the
+                    // free list always belong to a page that already exists.
+                    allocatePage(index >> GENERATION_PAGE_SHIFT);
+                }
             }
-            entities[i] = Entity{ makeIdentity(gens[index], index) };
+            entities[i] = Entity{ makeIdentity(generation(index), index) };
         }
         mCurrentIndex = currentIndex;
     }
 
     void destroy(size_t n, Entity* entities) noexcept {
         auto& freeList = mFreeList;
-        uint8_t* const gens = mGens;
 
         std::unique_lock<Mutex> lock(mFreeListLock);
         for (size_t i = 0; i < n; i++) {
@@ -102,14 +106,15 @@ public:
                 // and entities work as weak references -- it just means that isAlive() could return
                 // true a little longer than expected in some other threads.
                 // We do need a memory fence though, it is provided by the mFreeListLock.unlock() below.
-                gens[index]++;
+                generation(index)++;
             }
         }
         lock.unlock();
 
-        // notify our listeners that some entities are being destroyed
-        auto listeners = getListeners();
-        for (auto const& l : listeners) {
+        // notify our listeners that some entities are being destroyed, the listener lock is
+        // held so that a listener can't be unregistered (and destroyed) while we're calling it.
+        std::lock_guard<Mutex> listenerLock(mListenerLock);
+        for (Listener* l : mListeners) {
             l->onEntitiesDestroyed(n, entities);
         }
     }
@@ -124,18 +129,21 @@ public:
         mListeners.erase(l);
     }
 
-    std::vector<EntityManager::Listener*> getListeners() const noexcept {
-        std::unique_lock<Mutex> lock(mListenerLock);
-        tsl::robin_set<Listener*> const& listeners = mListeners;
-        std::vector<EntityManager::Listener*> result(listeners.size()); // unfortunately this memset()
-        auto d = result.begin();
-        for (Listener* listener : listeners) {
-            *d++ = listener;
+private:
+    uint8_t& generation(Entity::Type index) noexcept {
+        return mGens[index >> GENERATION_PAGE_SHIFT][index & GENERATION_PAGE_MASK];
+    }
+
+    // must be called with mFreeListLock held
+    void allocatePage(size_t page) {
+        assert(page < GENERATION_PAGE_COUNT);
+        if (!mGens[page]) {
+            uint8_t* gens = new uint8_t[GENERATION_PAGE_SIZE];
+            std::fill_n(gens, GENERATION_PAGE_SIZE, 0);
+            mGens[page] = gens;
         }
-        return result; // the c++ standard guarantees a move
     }
 
-private:
     uint32_t mCurrentIndex = 1;
 
     // stores indices that got freed
@@ -59,6 +59,19 @@ namespace utils {
 
 UTILS_DEFINE_TLS(JobSystem::ThreadState *) JobSystem::sThreadState(nullptr);
 
+struct JobSystem::JobBlock {
+    using JobPool = Arena<ThreadSafeObjectPoolAllocator<Job>, LockingPolicy::NoLock>;
+
+    JobBlock() noexcept
+            : pool("JobSystem Job pool", JOB_BLOCK_SIZE * sizeof(Job)),
+              base(static_cast<Job*>(pool.getAllocator().getCurrent())) {
+    }
+
+    JobPool pool;
+    Job* const base;
+    JobInfo info[JOB_BLOCK_SIZE];
+};
+
 void JobSystem::setThreadName(const char* name) noexcept {
 #if defined(__linux__)
     pthread_setname_np(pthread_self(), name);
@@ -112,13 +125,39 @@ void JobSystem::setThreadAffinityById(size_t id) noexcept {
 #endif
 }
 
+static void setThreadAffinityToCpus(std::vector<uint16_t> const& cpus) noexcept {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint16_t cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(gettid(), sizeof(set), &set);
+#endif
+}
+
 JobSystem::JobSystem(size_t threadCount, size_t adoptableThreadsCount) noexcept
-    : mJobPool("JobSystem Job pool", MAX_JOB_COUNT * sizeof(Job)),
-      mJobStorageBase(static_cast<Job *>(mJobPool.getAllocator().getCurrent()))
+    : JobSystem(Config{ threadCount, adoptableThreadsCount }) {
+}
+
+JobSystem::JobSystem(Config const& config) noexcept
+    : mCpus(config.cpus),
+      mAffinity(config.affinity)
 {
     SYSTRACE_ENABLE();
 
-    if (threadCount == 0) {
+    JobBlock* const block = new JobBlock();
+    mJobBlocks[0] = block;
+    mJobBlockCount.store(1, std::memory_order_relaxed);
+    mJobStorageBase = block->base;
+    mJobInfoBase = block->info;
+
+    size_t threadCount = config.threadCount;
+    const size_t adoptableThreadsCount = config.adoptableThreadsCount;
+    if (threadCount == 0 && !mCpus.empty()) {
+        // one thread per core of the group
+        threadCount = mCpus.size();
+    } else if (threadCount == 0) {
         // default value, system dependant
         size_t hwThreads = std::thread::hardware_concurrency();
         if (UTILS_HAS_HYPER_THREADING) {
@@ -135,9 +174,14 @@ JobSystem::JobSystem(size_t threadCount, size_t adoptableThreadsCount) noexcept
     mThreadCount = uint16_t(threadCount);
     mParallelSplitCount = (uint8_t)std::ceil((std::log2f(threadCount + adoptableThreadsCount)));
 
+    // the worker threads past backgroundThreadCount don't run BACKGROUND jobs
+    const size_t backgroundThreadCount = config.backgroundThreadCount;
+    mBackgroundLaneRestricted = backgroundThreadCount && backgroundThreadCount < threadCount;
+
     // this is pitty these are not compile-time checks (C++17 supports it apparently)
     assert(mExitRequested.is_lock_free());
     assert(Job().runningJobCount.is_lock_free());
+    assert(mActiveJobs[0].is_lock_free());
 
     std::random_device rd;
     const size_t hardwareThreadCount = mThreadCount;
@@ -149,6 +193,8 @@ JobSystem::JobSystem(size_t threadCount, size_t adoptableThreadsCount) noexcept
         state.rndGen = default_random_engine(rd());
         state.id = (uint32_t)i;
         state.js = this;
+        state.laneCount = uint8_t(mBackgroundLaneRestricted &&
+                i >= backgroundThreadCount && i < hardwareThreadCount ? LANE_COUNT - 1 : LANE_COUNT);
         if (i < hardwareThreadCount) {
             // don't start a thread of adoptable thread slots
             state.thread = std::thread(&JobSystem::loop, this, &state);
@@ -166,6 +212,10 @@ JobSystem::~JobSystem() {
             state.thread.join();
         }
     }
+
+    for (size_t i = 0, c = mJobBlockCount.load(std::memory_order_relaxed); i < c; i++) {
+        delete mJobBlocks[i];
+    }
 }
 
 inline void JobSystem::incRef(Job const* job) noexcept {
@@ -195,7 +245,7 @@ void JobSystem::decRef(Job const* job) noexcept {
         // TSAN doesn't handle standalone fences, we use memory_order_acq_rel instead
         std::atomic_thread_fence(std::memory_order_acquire);
 #endif
-        mJobPool.destroy(job);
+        destroyJob(job);
     }
 }
 
@@ -223,14 +273,80 @@ inline bool JobSystem::hasJobCompleted(JobSystem::Job const* job) noexcept {
     return job->runningJobCount.load(std::memory_order_relaxed) <= 0;
 }
 
+inline bool JobSystem::hasActiveJobs(ThreadState const& state) const noexcept {
+    for (size_t lane = 0, c = state.laneCount; lane < c; lane++) {
+        if (mActiveJobs[lane].load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 inline JobSystem::ThreadState& JobSystem::getState() noexcept {
     // check we're not using a thread not owned by the thread pool
     assert(sThreadState);
     return *sThreadState;
 }
 
+JobSystem::Job* JobSystem::setMasterJob(Job* job) noexcept {
+    if (job) {
+        // the master job is its own master, its descendants inherit it (see create())
+        getInfo(job->index).master = job->index;
+    }
+    return getState().masterJob = job;
+}
+
 JobSystem::Job* JobSystem::allocateJob() noexcept {
-    return mJobPool.make<Job>();
+    // fast path, there is room in the first block
+    Job* const job = mJobBlocks[0]->pool.make<Job>();
+    if (UTILS_LIKELY(job)) {
+        job->index = uint32_t(job - mJobStorageBase);
+        return job;
+    }
+    return allocateJobSlow();
+}
+
+UTILS_NOINLINE
+JobSystem::Job* JobSystem::allocateJobSlow() noexcept {
+    SYSTRACE_CALL();
+
+    // Blocks are never removed, so the ones we see here stay valid. The jobs' indices are
+    // published with the jobs (see put()), so other threads see the blocks they need.
+    uint32_t count = mJobBlockCount.load(std::memory_order_acquire);
+    while (true) {
+        // the most recent blocks are the most likely to have room
+        for (uint32_t i = count; i-- > 0;) {
+            JobBlock* const block = mJobBlocks[i];
+            Job* const job = block->pool.make<Job>();
+            if (job) {
+                job->index = uint32_t(i * JOB_BLOCK_SIZE + (job - block->base));
+                return job;
+            }
+        }
+
+        // all the blocks are full, add one unless another thread just did
+        std::lock_guard<Mutex> lock(mJobBlockLock);
+        if (count == mJobBlockCount.load(std::memory_order_relaxed)) {
+            if (UTILS_UNLIKELY(count == MAX_JOB_BLOCK_COUNT)) {
+                return nullptr;
+            }
+            mJobBlocks[count] = new JobBlock();
+            mJobBlockCount.store(count + 1, std::memory_order_release);
+        }
+        count = mJobBlockCount.load(std::memory_order_relaxed);
+    }
+}
+
+void JobSystem::destroyJob(Job const* job) noexcept {
+    mJobBlocks[job->index / JOB_BLOCK_SIZE]->pool.destroy(job);
+}
+
+JobSystem::Job* JobSystem::getJobSlow(uint32_t index) const noexcept {
+    return mJobBlocks[index / JOB_BLOCK_SIZE]->base + (index % JOB_BLOCK_SIZE);
+}
+
+JobSystem::JobInfo& JobSystem::getInfoSlow(uint32_t index) const noexcept {
+    return mJobBlocks[index / JOB_BLOCK_SIZE]->info[index % JOB_BLOCK_SIZE];
 }
 
 inline JobSystem::ThreadState* JobSystem::getStateToStealFrom(JobSystem::ThreadState& state) noexcept {
@@ -243,34 +359,82 @@ inline JobSystem::ThreadState* JobSystem::getStateToStealFrom(JobSystem::ThreadS
     return &mThreadStates[index];
 }
 
+inline JobSystem::Job* JobSystem::stealFromOtherThread(
+        JobSystem::ThreadState& state, size_t lane) noexcept {
+    ThreadState* stateToStealFrom = nullptr;
+    do {
+        stateToStealFrom = getStateToStealFrom(state);
+        // don't steal from our own queue
+    } while (stateToStealFrom == &state);
+    return steal(stateToStealFrom->workQueues[lane]);
+}
+
 bool JobSystem::execute(JobSystem::ThreadState& state) noexcept {
 
-    Job* job = pop(state.workQueue);
-    if (job == nullptr) {
-        // our queue is empty, try to steal a job
-        do {
-            ThreadState* stateToStealFrom = nullptr;
-            do {
-                stateToStealFrom = getStateToStealFrom(state);
-                // don't steal from our own queue
-            } while (stateToStealFrom == &state);
-            job = steal(stateToStealFrom->workQueue);
-            // nullptr -> nothing to steal in that queue either, if there are active jobs,
-            // continue to try stealing one.
-        } while (!job && mActiveJobs.load(std::memory_order_relaxed) && !exitRequested());
-    }
+    // Every FAIRNESS_INTERVAL jobs, we try to steal a job before looking at our own queue.
+    // Otherwise a thread working through a large tree of jobs (e.g. a parallel_for()) keeps
+    // finding work in its own queue, and the jobs queued by other threads -- e.g. other engines
+    // sharing this JobSystem -- only get the threads that are idle.
+    constexpr uint32_t FAIRNESS_INTERVAL = 16;
+    const bool stealFirst = (state.jobCount % FAIRNESS_INTERVAL) == FAIRNESS_INTERVAL - 1;
+
+    Job* job = nullptr;
+    size_t lane = 0;
+    bool active;
+    do {
+        // The lanes are visited in priority order, in each we try our own queue first and then
+        // to steal a job, so a higher priority job is stolen before a lower priority one is
+        // taken from our queue. Lanes without any queued jobs are skipped, which is all of
+        // them but NORMAL in the common case. Our own jobs are always visible to us here.
+        active = false;
+        for (lane = 0; lane < state.laneCount; lane++) {
+            if (!mActiveJobs[lane].load(std::memory_order_relaxed)) {
+                continue;
+            }
+            active = true;
+            if (UTILS_UNLIKELY(stealFirst)) {
+                job = stealFromOtherThread(state, lane);
+                if (job) {
+                    break;
+                }
+            }
+            job = pop(state.workQueues[lane]);
+            if (job) {
+                break;
+            }
+            // our queue is empty, try to steal a job
+            job = stealFromOtherThread(state, lane);
+            if (job) {
+                break;
+            }
+        }
+        // nullptr -> nothing to steal in those queues either, if there are active jobs,
+        // continue to try stealing one.
+    } while (!job && active && !exitRequested());
 
     if (job) {
         SYSTRACE_CALL();
 
-        UTILS_UNUSED_IN_RELEASE uint32_t activeJobs = mActiveJobs.fetch_sub(1, std::memory_order_relaxed);
+        UTILS_UNUSED_IN_RELEASE uint32_t activeJobs =
+                mActiveJobs[lane].fetch_sub(1, std::memory_order_relaxed);
         assert(activeJobs); // whoops, we were already at 0
         SYSTRACE_VALUE32("JobSystem::activeJobs", activeJobs - 1);
 
-        if (UTILS_LIKELY(job->function)) {
+        state.jobCount++;
+
+        // while this job runs, the jobs it creates without a parent take its master job, which
+        // can't complete before this job does.
+        JobInfo const& info = getInfo(job->index);
+        Job* const masterJob = state.masterJob;
+        state.masterJob = (info.master != NO_PARENT) ? getJob(info.master) : nullptr;
+
+        JobFunc const function = info.function;
+        if (UTILS_LIKELY(function)) {
             SYSTRACE_NAME("job->function");
-            job->function(job->storage, *this, job);
+            function(job->storage, *this, job);
         }
+
+        state.masterJob = masterJob;
         finish(job);
     }
     return job != nullptr;
@@ -282,7 +446,7 @@ void JobSystem::loop(ThreadState* state) noexcept {
 
     // set a CPU affinity on each of our JobSystem thread to prevent them from jumping from core
     // to core. On Android, it looks like the affinity needs to be reset from time to time.
-    setThreadAffinityById(state->id);
+    setAffinity(*state);
 
     // record our work queue to thread-local storage
     sThreadState = state;
@@ -291,14 +455,44 @@ void JobSystem::loop(ThreadState* state) noexcept {
     do {
         if (!execute(*state)) {
             std::unique_lock<Mutex> lock(mLooperLock);
-            while (!exitRequested() && !(mActiveJobs.load(std::memory_order_relaxed))) {
+            while (!exitRequested() && !hasActiveJobs(*state)) {
                 mLooperCondition.wait(lock);
-                setThreadAffinityById(state->id);
+                setAffinity(*state);
             }
         }
     } while (!exitRequested());
 }
 
+void JobSystem::setAffinity(ThreadState const& state) const noexcept {
+    switch (mAffinity) {
+        case Affinity::NONE:
+            break;
+        case Affinity::GROUP:
+            if (!mCpus.empty()) {
+                setThreadAffinityToCpus(mCpus);
+            }
+            break;
+        case Affinity::PINNED:
+            setThreadAffinityById(mCpus.empty() ? state.id : mCpus[state.id % mCpus.size()]);
+            break;
+    }
+}
+
+void JobSystem::runSuccessors(Job const* job) noexcept {
+    JobInfo const& info = getInfo(job->index);
+    for (size_t i = 0, c = info.successorCount; i < c; i++) {
+        Job* const successor = getJob(info.successors[i]);
+        // the last predecessor to complete queues the successor, unless run() wasn't called yet.
+        // memory_order_acq_rel makes what all predecessors did visible to the successor.
+        auto pendingCount = successor->pendingCount.fetch_sub(1, std::memory_order_acq_rel);
+        assert(pendingCount > 0);
+        if (pendingCount == 1) {
+            // don't signal the first one, it's likely to be executed next on this thread
+            schedule(successor, i ? 0 : DONT_SIGNAL);
+        }
+    }
+}
+
 UTILS_NOINLINE
 void JobSystem::finish(Job* job) noexcept {
     SYSTRACE_CALL();
@@ -306,8 +500,6 @@ void JobSystem::finish(Job* job) noexcept {
     bool notify = false;
 
     // terminate this job and notify its parent
-    auto& jobPool = mJobPool;
-    Job* const storage = mJobStorageBase;
     do {
         // std::memory_order_release here is needed to synchronize with JobSystem::wait()
         // which needs to "see" all changes that happened before the job terminated.
@@ -320,9 +512,10 @@ void JobSystem::finish(Job* job) noexcept {
 #if !__has_feature(thread_sanitizer)
             std::atomic_thread_fence(std::memory_order_acquire);
 #endif
-            // no more work, destroy this job and notify its the parent
+            // no more work, start its successors, destroy this job and notify its the parent
             notify = true;
-            Job* const parent = job->parent == 0x7FFF ? nullptr : &storage[job->parent];
+            runSuccessors(job);
+            Job* const parent = job->parent == NO_PARENT ? nullptr : getJob(job->parent);
             decRef(job);
             job = parent;
         } else {
@@ -343,10 +536,16 @@ void JobSystem::finish(Job* job) noexcept {
 
 
 JobSystem::Job* JobSystem::create(JobSystem::Job* parent, JobFunc func) noexcept {
-    parent = (parent == nullptr) ? mMasterJob : parent;
+    if (parent == nullptr) {
+        // this can be called from a thread that's not in the thread pool
+        ThreadState* const state = sThreadState;
+        parent = state ? state->masterJob : nullptr;
+    }
     Job* const job = allocateJob();
     if (UTILS_LIKELY(job)) {
-        size_t index = 0x7FFF;
+        uint32_t index = NO_PARENT;
+        uint32_t master = NO_PARENT;
+        Lane lane = Lane::NORMAL;
         if (parent) {
             // add a reference to the parent to make sure it can't be terminated.
             // memory_order_relaxed is safe because no action is taken at this point
@@ -356,15 +555,41 @@ JobSystem::Job* JobSystem::create(JobSystem::Job* parent, JobFunc func) noexcept
             // can't create a child job of a terminated parent
             assert(parentJobCount > 0);
 
-            index = parent - mJobStorageBase;
-            assert(index < MAX_JOB_COUNT);
+            index = parent->index;
+            JobInfo const& parentInfo = getInfo(index);
+            lane = parentInfo.lane;
+            master = parentInfo.master;
         }
-        job->function = func;
-        job->parent = uint16_t(index);
+        job->parent = index;
+        JobInfo& info = getInfo(job->index);
+        info.function = func;
+        info.lane = lane;
+        info.successorCount = 0;
+        info.master = master;
     }
     return job;
 }
 
+bool JobSystem::addDependency(Job* predecessor, Job* successor) noexcept {
+    assert(predecessor && successor && predecessor != successor);
+    JobInfo& info = getInfo(predecessor->index);
+    if (UTILS_UNLIKELY(info.successorCount >= MAX_SUCCESSOR_COUNT)) {
+        return false;
+    }
+    info.successors[info.successorCount++] = successor->index;
+
+    // memory_order_relaxed is safe because neither job has been run yet
+    UTILS_UNUSED_IN_RELEASE auto pendingCount =
+            successor->pendingCount.fetch_add(1, std::memory_order_relaxed);
+    assert(pendingCount > 0 && pendingCount < 0xFFFF);
+    return true;
+}
+
+void JobSystem::setLane(Job* job, Lane lane) noexcept {
+    assert(job);
+    getInfo(job->index).lane = lane;
+}
+
 void JobSystem::cancel(Job*& job) noexcept {
     finish(job);
     job = nullptr;
@@ -386,27 +611,48 @@ void JobSystem::run(JobSystem::Job*& job, uint32_t flags) noexcept {
     SYSTRACE_CALL();
 #endif
 
+    // A job that still waits on predecessors is queued by the last of them to complete. In the
+    // common case it has none and we can skip the read-modify-write, the count can't change
+    // anymore at that point.
+    if (UTILS_LIKELY(job->pendingCount.load(std::memory_order_acquire) == 1) ||
+            job->pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        schedule(job, flags);
+    }
+
+    // after run() returns, the job is virtually invalid (it'll die on its own)
+    job = nullptr;
+}
+
+void JobSystem::schedule(JobSystem::Job* job, uint32_t flags) noexcept {
     ThreadState& state(getState());
+    const size_t lane = size_t(getInfo(job->index).lane);
 
     // increase the active job count before we add the job to the queue, because otherwise
     // the job could run and finish before the counter is incremented, which would trigger
     // an assert() in execute(). Either way, it's not "wrong", but the assert() is useful.
-    uint32_t activeJobs = mActiveJobs.fetch_add(1, std::memory_order_relaxed);
+    uint32_t activeJobs = mActiveJobs[lane].fetch_add(1, std::memory_order_relaxed);
 
-    put(state.workQueue, job);
+    put(state.workQueues[lane], job);
 
     SYSTRACE_CONTEXT();
     SYSTRACE_VALUE32("JobSystem::activeJobs", activeJobs + 1);
 
+    // if this thread doesn't run this lane, another one must be woken-up
+    if (lane >= state.laneCount) {
+        flags &= ~DONT_SIGNAL;
+    }
+
     // wake-up a thread if needed...
     if (!(flags & DONT_SIGNAL)) {
         // wake-up a queue
         { std::lock_guard<Mutex> lock(mLooperLock); }
-        mLooperCondition.notify_one();
+        if (lane == size_t(Lane::BACKGROUND) && mBackgroundLaneRestricted) {
+            // the thread woken-up by notify_one() might not run BACKGROUND jobs
+            mLooperCondition.notify_all();
+        } else {
+            mLooperCondition.notify_one();
+        }
     }
-
-    // after run() returns, the job is virtually invalid (it'll die on its own)
-    job = nullptr;
 }
 
 JobSystem::Job* JobSystem::runAndRetain(JobSystem::Job* job, uint32_t flags) noexcept {
@@ -434,8 +680,8 @@ void JobSystem::waitAndRelease(Job*& job) noexcept {
         }
     } while (!hasJobCompleted(job) && !exitRequested());
 
-    if (job == mMasterJob) {
-        mMasterJob = nullptr;
+    if (job == state.masterJob) {
+        state.masterJob = nullptr;
     }
 
     release(job);
@@ -449,20 +695,37 @@ void JobSystem::runAndWait(JobSystem::Job*& job) noexcept {
 void JobSystem::adopt() {
     ThreadState* const state = sThreadState;
     if (state) {
-        // we're already part of a JobSystem, do nothing.
+        // we're already part of a JobSystem, do nothing but count the nested adopt().
         ASSERT_PRECONDITION(this == state->js,
                 "Called adopt on a thread owned by another JobSystem (%p), this=%p!",
                 state->js, this);
+        if (state->id >= mThreadCount) {
+            state->adoptCount++;
+        }
         return;
     }
 
-    // memory_order_relaxed is safe because we don't take action on this value.
-    uint16_t adopted = mAdoptedThreads.fetch_add(1, std::memory_order_relaxed);
-    size_t index = mThreadCount + adopted;
+    // use the first free adoptable slot, the slots of emancipated threads are reused
+    size_t index = mThreadCount;
+    for (size_t n = mThreadStates.size(); index < n; index++) {
+        bool adopted = false;
+        if (mThreadStates[index].adopted.compare_exchange_strong(adopted, true,
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+            break;
+        }
+    }
 
     ASSERT_POSTCONDITION(index < mThreadStates.size(),
             "Too many calls to adopt(). No more adoptable threads!");
 
+    // the slots that have been used at least once are the ones we steal from.
+    // memory_order_relaxed is safe because we don't take action on this value.
+    const uint16_t used = uint16_t(index - mThreadCount + 1);
+    uint16_t adopted = mAdoptedThreads.load(std::memory_order_relaxed);
+    while (adopted < used && !mAdoptedThreads.compare_exchange_weak(adopted, used,
+            std::memory_order_relaxed)) {
+    }
+
     // all threads adopted by the JobSystem need to run at the same priority
     JobSystem::setThreadPriority(JobSystem::Priority::DISPLAY);
 
@@ -470,19 +733,28 @@ void JobSystem::adopt() {
     // however, it's not a problem since mThreadState is pre-initialized and valid
     // (e.g.: the queue is empty).
 
+    mThreadStates[index].adoptCount = 1;
     sThreadState = &mThreadStates[index];
 }
 
 void JobSystem::emancipate() {
     ThreadState* const state = sThreadState;
-    ASSERT_PRECONDITION(state, "this thread is not an adopted thread");
+    ASSERT_PRECONDITION(state && state->adoptCount, "this thread is not an adopted thread");
     ASSERT_PRECONDITION(state->js == this, "this thread is not adopted by us");
-    sThreadState = nullptr;
+    if (--state->adoptCount == 0) {
+        state->masterJob = nullptr;
+        sThreadState = nullptr;
+        // memory_order_release so that the next thread using this slot sees our writes to it
+        state->adopted.store(false, std::memory_order_release);
+    }
 }
 
 io::ostream& operator<<(io::ostream& out, JobSystem const& js) {
     for (auto const& item : js.mThreadStates) {
-        out << size_t(item.id) << ": " << item.workQueue.getCount() << io::endl;
+        out << size_t(item.id) << ": "
+            << item.workQueues[0].getCount() << ", "
+            << item.workQueues[1].getCount() << ", "
+            << item.workQueues[2].getCount() << io::endl;
     }
     return out;
 }
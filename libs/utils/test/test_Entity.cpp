@@ -128,6 +128,43 @@ TEST(EntityTest, Lots) {
     // at this point, we should be getting indices from the free-list exclusively
 }
 
+TEST(EntityTest, Pages) {
+    EntityManagerImpl em;
+
+    // a new EntityManager only needs a single page of generations
+    size_t pageSize = em.getGenerationStorageSize();
+    EXPECT_GT(pageSize, 0u);
+
+    // entities of another EntityManager can have an index in a page we never allocated
+    {
+        EntityManagerImpl other;
+        const size_t count = 2 * pageSize;
+        std::unique_ptr<Entity[]> foreign(new Entity[count]);
+        other.create(count, foreign.get());
+        EXPECT_FALSE(em.isAlive(foreign[count - 1]));
+        other.destroy(count, foreign.get());
+    }
+    EXPECT_EQ(pageSize, em.getGenerationStorageSize());
+
+    // allocate more entities than fit in a page, as well as more than the old 2^17 limit
+    const size_t n = 4 * pageSize;
+    std::unique_ptr<Entity[]> entities(new Entity[n]);
+    em.create(n, entities.get());
+    EXPECT_EQ(pageSize * 5, em.getGenerationStorageSize());
+
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_FALSE(entities[i].isNull());
+        EXPECT_TRUE(em.isAlive(entities[i]));
+    }
+
+    em.destroy(n, entities.get());
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_FALSE(em.isAlive(entities[i]));
+    }
+
+    // pages are kept around
+    EXPECT_EQ(pageSize * 5, em.getGenerationStorageSize());
+}
 
 TEST(EntityTest, NameComponent) {
 
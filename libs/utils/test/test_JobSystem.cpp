@@ -22,7 +22,9 @@
 #include <math/vec3.h>
 #include <math/mat3.h>
 
+#include <algorithm>
 #include <array>
+#include <string>
 #include <thread>
 #include <utils/Allocator.h>
 
@@ -188,6 +190,68 @@ TEST(JobSystem, WorkStealingDequeue_PushPopSteal) {
     EXPECT_TRUE(queue.isEmpty());
 }
 
+TEST(JobSystem, WorkStealingDequeue_Grow) {
+    WorkStealingDequeue<uint32_t, 64> queue;
+    EXPECT_EQ(64, queue.getSize());
+
+    // the queue grows as needed, and keeps its order
+    for (uint32_t i = 1; i <= 1000; i++) {
+        queue.push(i);
+    }
+    EXPECT_EQ(1024, queue.getSize());
+    for (uint32_t i = 1; i <= 500; i++) {
+        EXPECT_EQ(i, queue.steal());
+    }
+    for (uint32_t i = 1000; i > 500; i--) {
+        EXPECT_EQ(i, queue.pop());
+    }
+    EXPECT_TRUE(queue.isEmpty());
+
+    // it doesn't grow when there is room left
+    for (uint32_t i = 1; i <= 1000; i++) {
+        queue.push(i);
+        EXPECT_EQ(i, queue.steal());
+    }
+    EXPECT_EQ(1024, queue.getSize());
+}
+
+TEST(JobSystem, WorkStealingDequeue_PushStealGrow) {
+    WorkStealingDequeue<uint32_t, 64> queue;
+    const uint32_t size = 65536;
+
+    // all items pushed are stolen once, while the queue grows
+    std::vector<std::atomic<uint32_t>> stolen(size + 1);
+    std::atomic<bool> done = { false };
+    auto thief = [&]() {
+        bool last = false;
+        do {
+            last = done;
+            while (uint32_t item = queue.steal()) {
+                stolen[item]++;
+            }
+        } while (!last);
+    };
+    std::thread steal_thread0(thief);
+    std::thread steal_thread1(thief);
+    std::thread steal_thread2(thief);
+    std::thread steal_thread3(thief);
+
+    for (uint32_t i = 1; i <= size; i++) {
+        queue.push(i);
+    }
+    done = true;
+
+    steal_thread0.join();
+    steal_thread1.join();
+    steal_thread2.join();
+    steal_thread3.join();
+
+    EXPECT_TRUE(queue.isEmpty());
+    for (uint32_t i = 1; i <= size; i++) {
+        EXPECT_EQ(1, stolen[i].load());
+    }
+}
+
 
 
 static std::atomic_int v = {0};
@@ -342,5 +406,277 @@ TEST(JobSystem, JobSystemDelegates) {
     EXPECT_EQ(4, functor.result);
 
 
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemDependencies) {
+    JobSystem js;
+    js.adopt();
+
+    // diamonds: a -> (b, c) -> d, each job records when it ran
+    std::atomic<uint32_t> clock = { 0 };
+    for (size_t i = 0; i < 1000; i++) {
+        uint32_t order[4] = {};
+        JobSystem::Job* jobs[4];
+        for (size_t j = 0; j < 4; j++) {
+            jobs[j] = js.createJob(nullptr,
+                    [&clock, o = &order[j]](JobSystem&, JobSystem::Job*) { *o = ++clock; });
+        }
+        EXPECT_TRUE(js.addDependency(jobs[0], jobs[1]));
+        EXPECT_TRUE(js.addDependency(jobs[0], jobs[2]));
+        EXPECT_TRUE(js.addDependency(jobs[1], jobs[3]));
+        EXPECT_TRUE(js.addDependency(jobs[2], jobs[3]));
+
+        // successors can be run before or after their predecessors
+        JobSystem::Job* d = js.retain(jobs[3]);
+        if (i & 1) {
+            js.run(jobs[3]);
+            js.run(jobs[2]);
+            js.run(jobs[1]);
+            js.run(jobs[0]);
+        } else {
+            js.run(jobs[0]);
+            js.run(jobs[1]);
+            js.run(jobs[2]);
+            js.run(jobs[3]);
+        }
+        js.waitAndRelease(d);
+
+        EXPECT_LT(order[0], order[1]);
+        EXPECT_LT(order[0], order[2]);
+        EXPECT_LT(order[1], order[3]);
+        EXPECT_LT(order[2], order[3]);
+    }
+
+    // a chain, the jobs run one after the other
+    std::vector<size_t> sequence;
+    JobSystem::Job* previous = nullptr;
+    JobSystem::Job* first = nullptr;
+    for (size_t i = 0; i < 256; i++) {
+        JobSystem::Job* job = js.createJob(nullptr,
+                [&sequence, i](JobSystem&, JobSystem::Job*) { sequence.push_back(i); });
+        if (previous) {
+            js.addDependency(previous, job);
+            js.run(previous);
+        } else {
+            first = js.retain(job);
+        }
+        previous = job;
+    }
+    js.runAndWait(previous);
+    js.release(first);
+    ASSERT_EQ(256, sequence.size());
+    for (size_t i = 0; i < sequence.size(); i++) {
+        EXPECT_EQ(i, sequence[i]);
+    }
+
+    // a job's successors are limited
+    JobSystem::Job* root = js.createJob();
+    JobSystem::Job* parent = js.createJob();
+    for (size_t i = 0; i < JobSystem::MAX_SUCCESSOR_COUNT; i++) {
+        JobSystem::Job* job = js.createJob(parent);
+        EXPECT_TRUE(js.addDependency(root, job));
+        js.run(job);
+    }
+    JobSystem::Job* extra = js.createJob(parent);
+    EXPECT_FALSE(js.addDependency(root, extra));
+    js.run(extra);
+    js.run(root);
+    js.runAndWait(parent);
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemLanes) {
+    JobSystem::Config config;
+    config.threadCount = 1;
+    JobSystem js(config);
+    js.adopt();
+
+    // keep the worker thread busy, so that all the jobs below run on this thread, in order
+    std::atomic<bool> blocked = { false };
+    std::atomic<bool> unblock = { false };
+    JobSystem::Job* blocker = js.runAndRetain(js.createJob(nullptr,
+            [&blocked, &unblock](JobSystem&, JobSystem::Job*) {
+                blocked = true;
+                while (!unblock) {
+                    std::this_thread::yield();
+                }
+            }));
+    while (!blocked) {
+        std::this_thread::yield();
+    }
+
+    // critical jobs run first, then normal ones, then background ones, and children are in
+    // their parent's lane.
+    std::vector<char> sequence;
+    JobSystem::Job* root = js.createJob();
+    for (size_t i = 0; i < 4; i++) {
+        JobSystem::Job* job = js.createJob(root,
+                [&sequence](JobSystem&, JobSystem::Job*) { sequence.push_back('b'); });
+        js.setLane(job, JobSystem::Lane::BACKGROUND);
+        js.run(job);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        JobSystem::Job* job = js.createJob(root,
+                [&sequence](JobSystem& js, JobSystem::Job* parent) {
+                    sequence.push_back('c');
+                    js.run(js.createJob(parent,
+                            [&sequence](JobSystem&, JobSystem::Job*) { sequence.push_back('c'); }));
+                });
+        js.setLane(job, JobSystem::Lane::CRITICAL);
+        js.run(job);
+    }
+    js.runAndWait(root);
+    EXPECT_EQ(std::string("ccccbbbb"), std::string(sequence.begin(), sequence.end()));
+
+    unblock = true;
+    js.waitAndRelease(blocker);
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemConfig) {
+    JobSystem::Config config;
+    config.threadCount = 4;
+    config.backgroundThreadCount = 1;
+    config.affinity = JobSystem::Affinity::GROUP;
+    config.cpus = { 0 };
+    JobSystem js(config);
+    js.adopt();
+
+    // only one worker thread runs background jobs, they must all run nonetheless
+    std::atomic<uint32_t> count = { 0 };
+    JobSystem::Job* root = js.createJob();
+    js.setLane(root, JobSystem::Lane::BACKGROUND);
+    auto job = parallel_for(js, root, 0, 4096, [&count](uint32_t start, uint32_t c) {
+        count += c;
+    }, CountSplitter<16>());
+    js.run(job);
+    for (size_t i = 0; i < 256; i++) {
+        js.run(js.createJob(root, [&count](JobSystem&, JobSystem::Job*) { count++; }));
+    }
+    js.runAndWait(root);
+    EXPECT_EQ(4096 + 256, count.load());
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemManyJobs) {
+    JobSystem js;
+    js.adopt();
+
+    // more jobs than fit in the first block are in flight at the same time
+    std::atomic<uint32_t> count = { 0 };
+    JobSystem::Job* root = js.createJob();
+    for (size_t i = 0; i < 100000; i++) {
+        JobSystem::Job* job = js.createJob(root,
+                [&count](JobSystem&, JobSystem::Job*) { count++; });
+        ASSERT_NE(nullptr, job);
+        js.run(job);
+    }
+    js.runAndWait(root);
+    EXPECT_EQ(100000, count.load());
+
+    // and again, from many threads, with the storage that was added above
+    count = 0;
+    root = js.createJob();
+    JobSystem::Job* spawner = parallel_for(js, root, 0, 100, [&js, &count](uint32_t, uint32_t c) {
+        JobSystem::Job* parent = js.createJob();
+        for (size_t i = 0; i < c * 1000; i++) {
+            js.run(js.createJob(parent, [&count](JobSystem&, JobSystem::Job*) { count++; }));
+        }
+        js.runAndWait(parent);
+    }, CountSplitter<1>());
+    js.run(spawner);
+    js.runAndWait(root);
+    EXPECT_EQ(100000, count.load());
+
+    // a parallel_for() that creates many more jobs than fit in the first block
+    std::vector<uint8_t> visits(1000000);
+    auto job = parallel_for(js, nullptr, visits.data(), uint32_t(visits.size()),
+            [](uint8_t* data, uint32_t c) {
+                for (uint32_t i = 0; i < c; i++) {
+                    data[i]++;
+                }
+            }, CountSplitter<8, 20>());
+    js.runAndWait(job);
+    EXPECT_EQ(visits.size(), std::count(visits.begin(), visits.end(), 1));
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemSharedAdopt) {
+    JobSystem::Config config;
+    config.threadCount = 2;
+    config.adoptableThreadsCount = 4;
+    JobSystem js(config);
+
+    // adopt() nests, only the last emancipate() releases the slot
+    js.adopt();
+    js.adopt();
+    js.emancipate();
+    std::atomic_int count = { 0 };
+    JobSystem::Job* root = js.createJob(nullptr, [&count](JobSystem&, JobSystem::Job*) {
+        count++;
+    });
+    js.runAndWait(root);
+    EXPECT_EQ(1, count.load());
+    js.emancipate();
+
+    // many short-lived client threads, each with its own master job, reusing the 4 slots
+    for (size_t round = 0; round < 4; round++) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; t++) {
+            threads.emplace_back([&js, &count]() {
+                js.adopt();
+                JobSystem::Job* master = js.setMasterJob(js.createJob());
+                for (size_t i = 0; i < 64; i++) {
+                    js.run(js.createJob(nullptr, [&count](JobSystem&, JobSystem::Job*) {
+                        count++;
+                    }));
+                }
+                js.runAndWait(master);
+                js.emancipate();
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    EXPECT_EQ(1 + 4 * 4 * 64, count.load());
+}
+
+TEST(JobSystem, JobSystemMasterJob) {
+    JobSystem js;
+    js.adopt();
+
+    // jobs created without a parent by the master job's descendants, on any thread, are
+    // children of the master job, so waiting on it waits for them too.
+    std::atomic_int count = { 0 };
+    JobSystem::Job* master = js.setMasterJob(js.createJob());
+    for (size_t i = 0; i < 16; i++) {
+        js.run(js.createJob(nullptr, [&count](JobSystem& js, JobSystem::Job*) {
+            for (size_t j = 0; j < 16; j++) {
+                js.run(js.createJob(nullptr, [&count](JobSystem&, JobSystem::Job*) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    count++;
+                }));
+            }
+        }));
+    }
+    js.runAndWait(master);
+    EXPECT_EQ(16 * 16, count.load());
+
+    // the master job is reset once waited on, and jobs outside of it don't take it as parent
+    count = 0;
+    JobSystem::Job* root = js.createJob(nullptr, [&count](JobSystem& js, JobSystem::Job*) {
+        JobSystem::Job* child = js.createJob(nullptr, [&count](JobSystem&, JobSystem::Job*) {
+            count++;
+        });
+        js.runAndWait(child);
+    });
+    js.runAndWait(root);
+    EXPECT_EQ(1, count.load());
+
     js.emancipate();
 }
@@ -24,7 +24,17 @@ vec2 getUV1() {
 #endif
 
 #if defined(HAS_SHADOWING) && defined(HAS_DIRECTIONAL_LIGHTING)
+/**
+ * Returns the position of the fragment in the shadow map, in the cascade covering its
+ * distance from the camera. The position is offset along the normal to limit acne.
+ */
 HIGHP vec3 getLightSpacePosition() {
-    return vertex_lightSpacePosition.xyz * (1.0 / vertex_lightSpacePosition.w);
+    HIGHP float z = -(frameUniforms.viewFromWorldMatrix * vec4(vertex_worldPosition, 1.0)).z;
+    // the unused cascades have a split at infinity
+    int cascade = int(dot(vec4(greaterThan(vec4(z), frameUniforms.cascadeSplits)), vec4(1.0)));
+    HIGHP vec3 p = vertex_worldPosition +
+            vertex_shadowNormalOffset * frameUniforms.cascadeTexelSizes[cascade];
+    HIGHP vec4 lightSpacePosition = frameUniforms.lightFromWorldMatrix[cascade] * vec4(p, 1.0);
+    return lightSpacePosition.xyz * (1.0 / lightSpacePosition.w);
 }
 #endif
@@ -2,18 +2,26 @@
 // Uniforms access
 //------------------------------------------------------------------------------
 
-mat4 getLightFromWorldMatrix() {
-    return frameUniforms.lightFromWorldMatrix;
+// The per-renderable uniforms of all the instances of an instanced draw call are stored
+// contiguously, PER_RENDERABLE_UIB_MAT4_COUNT mat4 per instance (see PerRenderableUib)
+// VULKAN is defined by glslang only when the shader is compiled with Vulkan semantics, which
+// is not the case of the static code analysis, even for the Vulkan code generation target
+int getInstanceIndex() {
+#if defined(VULKAN)
+    return gl_InstanceIndex;
+#else
+    return gl_InstanceID;
+#endif
 }
 
 /** @public-api */
 mat4 getWorldFromModelMatrix() {
-    return objectUniforms.worldFromModelMatrix;
+    return objectUniforms.data[getInstanceIndex() * PER_RENDERABLE_UIB_MAT4_COUNT];
 }
 
 /** @public-api */
 mat3 getWorldFromModelNormalMatrix() {
-    return objectUniforms.worldFromModelNormalMatrix;
+    return mat3(objectUniforms.data[getInstanceIndex() * PER_RENDERABLE_UIB_MAT4_COUNT + 1]);
 }
 
 //------------------------------------------------------------------------------
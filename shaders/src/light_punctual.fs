@@ -7,14 +7,19 @@
 #define FROXEL_BUFFER_WIDTH         (1u << FROXEL_BUFFER_WIDTH_SHIFT)
 #define FROXEL_BUFFER_WIDTH_MASK    (FROXEL_BUFFER_WIDTH - 1u)
 
-#define RECORD_BUFFER_WIDTH_SHIFT   5u
+#define RECORD_BUFFER_WIDTH_SHIFT   8u
 #define RECORD_BUFFER_WIDTH         (1u << RECORD_BUFFER_WIDTH_SHIFT)
 #define RECORD_BUFFER_WIDTH_MASK    (RECORD_BUFFER_WIDTH - 1u)
 
+// Make sure this matches the same constants in UibGenerator.h
+#define LIGHT_TEXELS_PER_LIGHT      4u
+#define LIGHT_BUFFER_WIDTH_SHIFT    6u
+#define LIGHT_BUFFER_WIDTH_MASK     ((1u << LIGHT_BUFFER_WIDTH_SHIFT) - 1u)
+
 struct FroxelParams {
-    uint recordOffset; // offset at which the list of lights for this froxel starts
-    uint pointCount;   // number of point lights in this froxel
-    uint spotCount;    // number of spot lights in this froxel
+    HIGHP uint recordOffset; // offset at which the list of lights for this froxel starts
+    uint pointCount;         // number of point lights in this froxel
+    uint spotCount;          // number of spot lights in this froxel
 };
 
 /**
@@ -27,9 +32,12 @@ uvec3 getFroxelCoords(const vec3 fragCoords) {
     froxelCoord.xy = uvec2((fragCoords.xy - frameUniforms.origin.xy) *
             vec2(frameUniforms.oneOverFroxelDimension, frameUniforms.oneOverFroxelDimensionY));
 
-    froxelCoord.z = uint(max(0.0,
+    // zParams.w is the number of z-slices, fragments farther than the light far plane use the
+    // last slice, like on the CPU. Otherwise, their index would overflow into the next froxels.
+    froxelCoord.z = uint(clamp(
             log2(frameUniforms.zParams.x * fragCoords.z + frameUniforms.zParams.y) *
-                    frameUniforms.zParams.z + frameUniforms.zParams.w));
+                    frameUniforms.zParams.z + frameUniforms.zParams.w,
+            0.0, frameUniforms.zParams.w - 1.0));
 
     return froxelCoord;
 }
@@ -60,24 +68,34 @@ ivec2 getFroxelTexCoord(uint froxelIndex) {
  */
 FroxelParams getFroxelParams(uint froxelIndex) {
     ivec2 texCoord = getFroxelTexCoord(froxelIndex);
-    uvec2 entry = texelFetch(light_froxels, texCoord, 0).rg;
+    HIGHP uvec2 entry = texelFetch(light_froxels, texCoord, 0).rg;
 
     FroxelParams froxel;
     froxel.recordOffset = entry.r;
-    froxel.pointCount = entry.g & 0xFFu;
-    froxel.spotCount = entry.g >> 8u;
+    froxel.pointCount = entry.g & 0xFFFFu;
+    froxel.spotCount = entry.g >> 16u;
     return froxel;
 }
 
 /**
  * Returns the coordinates of the light record in the light_records texture
  * given the specified index. A light record is a single uint index into the
- * lights data buffer (lightsUniforms UBO).
+ * lights data texture (light_punctualLights).
  */
-ivec2 getRecordTexCoord(uint index) {
+ivec2 getRecordTexCoord(HIGHP uint index) {
     return ivec2(index & RECORD_BUFFER_WIDTH_MASK, index >> RECORD_BUFFER_WIDTH_SHIFT);
 }
 
+/**
+ * Returns the specified texel of the light at the given index in the light_punctualLights
+ * texture. Each light is stored as LIGHT_TEXELS_PER_LIGHT consecutive texels, see LightsUib.
+ */
+HIGHP vec4 getLightTexel(uint lightIndex, uint texel) {
+    uint index = lightIndex * LIGHT_TEXELS_PER_LIGHT + texel;
+    ivec2 texCoord = ivec2(index & LIGHT_BUFFER_WIDTH_MASK, index >> LIGHT_BUFFER_WIDTH_SHIFT);
+    return texelFetch(light_punctualLights, texCoord, 0);
+}
+
 float getSquareFalloffAttenuation(float distanceSquare, float falloff) {
     float factor = distanceSquare * falloff;
     float smoothFactor = saturate(1.0 - factor * factor);
@@ -99,6 +117,35 @@ float getAngleAttenuation(const vec3 lightDir, const vec3 l, const vec2 scaleOff
     return attenuation * attenuation;
 }
 
+#if defined(HAS_SHADOWING)
+/**
+ * Returns the face of a point light's shadow map that covers the specified light-to-fragment
+ * vector. The faces of a cube are in the order +x, -x, +y, -y, +z, -z.
+ */
+uint getPointLightShadowFace(const vec3 lightToPosition) {
+    vec3 a = abs(lightToPosition);
+    if (a.x >= a.y && a.x >= a.z) {
+        return lightToPosition.x > 0.0 ? 0u : 1u;
+    }
+    if (a.y >= a.z) {
+        return lightToPosition.y > 0.0 ? 2u : 3u;
+    }
+    return lightToPosition.z > 0.0 ? 4u : 5u;
+}
+
+/**
+ * Returns the visibility of a point or spot light, using the shadow map at the specified index
+ * of the local shadow atlas. The normal bias is the size of a shadow map texel at a distance
+ * of 1 from the light, scaled by the light's normal bias.
+ */
+float localShadow(const Light light, uint shadowIndex, float normalBias, const HIGHP vec3 posToLight) {
+    float offset = normalBias * length(posToLight) * sqrt(1.0 - light.NoL * light.NoL);
+    HIGHP vec3 position = vertex_worldPosition + shading_normal * offset;
+    HIGHP vec4 shadowPosition = frameUniforms.localShadowMatrices[shadowIndex] * vec4(position, 1.0);
+    return shadow(light_localShadowMap, shadowPosition.xyz * (1.0 / shadowPosition.w));
+}
+#endif
+
 /**
  * Light setup common to point and spot light. This function sets the light vector
  * "l" and the attenuation factor in the Light structure. The attenuation factor
@@ -119,24 +166,32 @@ void setupPunctualLight(inout Light light, const HIGHP vec4 positionFalloff) {
  * in the w component.
  *
  * The light parameters used to compute the Light structure are fetched from the
- * lightsUniforms uniform buffer.
+ * light_punctualLights texture.
  */
-Light getSpotLight(uint index) {
+Light getSpotLight(HIGHP uint index) {
     Light light;
     ivec2 texCoord = getRecordTexCoord(index);
     uint lightIndex = texelFetch(light_records, texCoord, 0).r;
 
-    HIGHP vec4 positionFalloff = lightsUniforms.lights[lightIndex][0];
-    HIGHP vec4 colorIntensity  = lightsUniforms.lights[lightIndex][1];
-          vec4 directionIES    = lightsUniforms.lights[lightIndex][2];
-          vec2 scaleOffset     = lightsUniforms.lights[lightIndex][3].xy;
+    HIGHP vec4 positionFalloff = getLightTexel(lightIndex, 0u);
+    HIGHP vec4 colorIntensity  = getLightTexel(lightIndex, 1u);
+          vec4 directionIES    = getLightTexel(lightIndex, 2u);
+          vec4 scaleOffset     = getLightTexel(lightIndex, 3u);
 
     light.colorIntensity.rgb = colorIntensity.rgb;
     light.colorIntensity.w = computePreExposedIntensity(colorIntensity.w, frameUniforms.exposure);
 
     setupPunctualLight(light, positionFalloff);
 
-    light.attenuation *= getAngleAttenuation(-directionIES.xyz, light.l, scaleOffset);
+    light.attenuation *= getAngleAttenuation(-directionIES.xyz, light.l, scaleOffset.xy);
+
+#if defined(HAS_SHADOWING)
+    // the shadow index is negative when the light doesn't cast shadows
+    if (scaleOffset.z >= 0.0 && light.NoL > 0.0) {
+        HIGHP vec3 posToLight = positionFalloff.xyz - vertex_worldPosition;
+        light.attenuation *= localShadow(light, uint(scaleOffset.z), scaleOffset.w, posToLight);
+    }
+#endif
 
     return light;
 }
@@ -147,21 +202,31 @@ Light getSpotLight(uint index) {
  * in the w component.
  *
  * The light parameters used to compute the Light structure are fetched from the
- * lightsUniforms uniform buffer.
+ * light_punctualLights texture.
  */
-Light getPointLight(uint index) {
+Light getPointLight(HIGHP uint index) {
     Light light;
     ivec2 texCoord = getRecordTexCoord(index);
     uint lightIndex = texelFetch(light_records, texCoord, 0).r;
 
-    HIGHP vec4 positionFalloff = lightsUniforms.lights[lightIndex][0];
-    HIGHP vec4 colorIntensity  = lightsUniforms.lights[lightIndex][1];
+    HIGHP vec4 positionFalloff = getLightTexel(lightIndex, 0u);
+    HIGHP vec4 colorIntensity  = getLightTexel(lightIndex, 1u);
+          vec2 shadowParams    = getLightTexel(lightIndex, 3u).zw;
 
     light.colorIntensity.rgb = colorIntensity.rgb;
     light.colorIntensity.w = computePreExposedIntensity(colorIntensity.w, frameUniforms.exposure);
 
     setupPunctualLight(light, positionFalloff);
 
+#if defined(HAS_SHADOWING)
+    // the shadow index is negative when the light doesn't cast shadows
+    if (shadowParams.x >= 0.0 && light.NoL > 0.0) {
+        HIGHP vec3 posToLight = positionFalloff.xyz - vertex_worldPosition;
+        uint shadowIndex = uint(shadowParams.x) + getPointLightShadowFace(-posToLight);
+        light.attenuation *= localShadow(light, shadowIndex, shadowParams.y, posToLight);
+    }
+#endif
+
     return light;
 }
 
@@ -179,10 +244,10 @@ void evaluatePunctualLights(const PixelParams pixel, inout vec3 color) {
     // the current fragment. A froxel also contains a record offset that
     // tells us where the indices of those lights are in the records
     // texture. The records texture contains the indices of the actual
-    // light data in the lightsUniforms uniform buffer
+    // light data in the light_punctualLights texture
 
-    uint index = froxel.recordOffset;
-    uint end = index + froxel.pointCount;
+    HIGHP uint index = froxel.recordOffset;
+    HIGHP uint end = index + froxel.pointCount;
 
     // Iterate point lights
     for ( ; index < end; index++) {
@@ -20,8 +20,8 @@ void main() {
         // because we ensure the worldFromModelNormalMatrix pre-scales the normal such that
         // all its components are < 1.0. This precents the bitangent to exceed the range of fp16
         // in the fragment shader, where we renormalize after interpolation
-        vertex_worldTangent = objectUniforms.worldFromModelNormalMatrix * vertex_worldTangent;
-        material.worldNormal = objectUniforms.worldFromModelNormalMatrix * material.worldNormal;
+        vertex_worldTangent = getWorldFromModelNormalMatrix() * vertex_worldTangent;
+        material.worldNormal = getWorldFromModelNormalMatrix() * material.worldNormal;
 
         // Reconstruct the bitangent from the normal and tangent. We don't bother with
         // normalization here since we'll do it after interpolation in the fragment stage
@@ -30,7 +30,7 @@ void main() {
     #else // MATERIAL_HAS_ANISOTROPY || MATERIAL_HAS_NORMAL
         // Without anisotropy or normal mapping we only need the normal vector
         toTangentFrame(mesh_tangents, material.worldNormal);
-        material.worldNormal = objectUniforms.worldFromModelNormalMatrix * material.worldNormal;
+        material.worldNormal = getWorldFromModelNormalMatrix() * material.worldNormal;
         #if defined(HAS_SKINNING)
             skinNormal(material.worldNormal, mesh_bone_indices, mesh_bone_weights);
         #endif
@@ -77,7 +77,7 @@ void main() {
 #endif
 
 #if defined(HAS_SHADOWING) && defined(HAS_DIRECTIONAL_LIGHTING)
-    vertex_lightSpacePosition = getLightSpacePosition(vertex_worldPosition, vertex_worldNormal);
+    vertex_shadowNormalOffset = getShadowNormalOffset(vertex_worldNormal);
 #endif
 
 #if defined(VERTEX_DOMAIN_DEVICE)
@@ -244,3 +244,20 @@ float shadow(const lowp sampler2DShadow shadowMap, const vec3 shadowPosition) {
     return ShadowSample_PCF_High(shadowMap, size, shadowPosition);
 #endif
 }
+
+/**
+ * Samples the directional light visibility at the specified position in light
+ * (shadow) space. When the static shadow casters are cached in their own shadow
+ * map, the visibility is the lowest of both shadow maps. When only the point and
+ * spot lights cast shadows, the directional light is always visible.
+ */
+float directionalShadow(const vec3 shadowPosition) {
+    if (frameUniforms.shadowBias.z <= 0.0) {
+        return 1.0;
+    }
+    float visibility = shadow(light_shadowMap, shadowPosition);
+    if (frameUniforms.shadowBias.x > 0.0) {
+        visibility = min(visibility, shadow(light_staticShadowMap, shadowPosition));
+    }
+    return visibility;
+}